@@ -43,6 +43,7 @@ typedef enum
     ERR_UNKNOWN,
     ERR_COMMS_TIMEOUT,
     ERR_CTRL_C_PRESSED,
+    ERR_SOCK_RECONNECT,
 
 } err_t;
 
@@ -63,7 +64,10 @@ typedef enum
                         {ERR_FIRMWARE_FAILED_VERIFY,        "FAILED FIRMWARE VERIFY"},      \
                         {ERR_FIRMWARE_ADDRESS_OUT_OF_RANGE, "ADDRESS OUT OF RANGE"},        \
                         {ERR_INV_ADDR,                      "INVALID ADDR"},                \
-                        {ERR_COMMS_TIMEOUT,                 "COMMS TIMEOUT"},
+                        {ERR_BUSY,                          "BUSY"},                        \
+                        {ERR_IN_PROGRESS,                   "IN PROGRESS"},                 \
+                        {ERR_COMMS_TIMEOUT,                 "COMMS TIMEOUT"},               \
+                        {ERR_SOCK_RECONNECT,                "SOCKET RECONNECTING"},
 
 
 
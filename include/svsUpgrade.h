@@ -35,6 +35,7 @@ extern int svsUpgradeInit(void);
 extern int svsUpgradeUninit(void);
 
 extern int svsSWUServerInit(void);
+extern int svsSWUStationUp(void);
 extern int svsSWUServerUninit(void);
 
 extern int svsGetSWVersion(char *currentSWVersion);
@@ -143,9 +143,20 @@ typedef enum
     UPGRADE_MANAGER_CANCEL_CMD = 0,
     UPGRADE_MANAGER_OTA_UPGRADE_CMD,
     UPGRADE_MANAGER_CONN_TYPE,
-    UPGRADE_MANAGER_EXIT
+    UPGRADE_MANAGER_EXIT,
+    UPGRADE_MANAGER_USB_PROGRESS,       // notification sent on the swu_Async connections
+    UPGRADE_MANAGER_STATION_UP          // sent by svsd once all its servers are up
 } swu_card_manager_cmds;
 
+typedef enum
+{
+    swu_usbMount,           // USB drive attached, mounting it
+    swu_usbCopy,            // package copied to local flash, CRC computed on the fly
+    swu_usbVerify,          // CRC checked, USB drive unmounted
+    swu_usbInstall,         // package decrypted and upgrade started
+    swu_usbDone             // finished, status holds the result
+} swu_usb_stage_t;
+
 
 typedef enum
 {
@@ -192,4 +203,21 @@ typedef struct _upgradeMgrResult
     int status;                     // Status/error code
 } swu_upgradeMgrResult_t;
 
+/*********************************************************
+ * NAME:   upgradeUsbProgress
+ * DESCRIPTION: Data Structure typedef used by the Upgrade
+ *              Manager application to report the progress
+ *              of a USB drive upgrade to the Async
+ *              connections.
+ *
+ *********************************************************/
+
+typedef struct _upgradeUsbProgress
+{
+    swu_upgradeMgrResult_t swuResult;   // command is UPGRADE_MANAGER_USB_PROGRESS
+    swu_usb_stage_t stage;
+    unsigned int bytesDone;             // package bytes copied to local flash
+    unsigned int bytesTotal;            // package size
+} swu_upgradeUsbProgress_t;
+
 #endif // __UPDATE_DATADEF_H__
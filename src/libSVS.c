@@ -246,6 +246,13 @@ int svsServerInit(const char *appName, const char *logfile)
     }
      
     */
+
+    // All servers are up, lets the upgrade manager end the trial of a new release
+    rc = svsSWUStationUp();
+    if(rc != ERR_PASS)
+    {
+        return(rc);
+    }
 	
     //logDebug("Done");
 
@@ -321,6 +328,7 @@ static int svsSocketClientSvsHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint
     bdp_power_get_msg_rsp_t         bdp_power_get_msg_rsp;
     bdp_address_get_msg_req_t       *bdp_address_get_msg_req;
     bdp_address_get_msg_rsp_t       bdp_address_get_msg_rsp;
+    callback_stats_t                callback_stats;
 
     hdr->u.svshdr.status = ERR_PASS;
 
@@ -385,6 +393,57 @@ static int svsSocketClientSvsHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint
             hdr->u.svshdr.status = rc;
             break;
 
+        case SVS_MSG_ID_BDP_SWEEP:
+            // the responses are sent by the sweep thread as they are received
+            rc = ERR_FAIL;
+            if(hdr->len == sizeof(bdp_sweep_msg_req_t))
+            {
+                rc = svsBdpSweepStart(sockFd, hdr->seq, hdr->dev_num, (bdp_sweep_msg_req_t *)payload);
+            }
+            if(rc == ERR_PASS)
+            {
+                return(rc);
+            }
+            hdr->len = 0;
+            hdr->u.svshdr.status = rc;
+            break;
+
+        case SVS_MSG_ID_CALLBACK_STATS_GET:
+            rsp = &callback_stats;
+            hdr->len = sizeof(callback_stats_t);
+            hdr->u.svshdr.status = svsCallbackServerStatsGet(&callback_stats);
+            break;
+
+        case SVS_MSG_ID_BDP_SCAN:
+            // the result is sent by the scan thread
+            rc = ERR_FAIL;
+            if(hdr->len == sizeof(bdp_scan_msg_req_t))
+            {
+                rc = svsBdpScanStart(sockFd, hdr->seq, hdr->dev_num, (bdp_scan_msg_req_t *)payload);
+            }
+            if(rc == ERR_PASS)
+            {
+                return(rc);
+            }
+            hdr->len = 0;
+            hdr->u.svshdr.status = rc;
+            break;
+
+        case SVS_MSG_ID_BDP_UPGRADE:
+            // the progress reports are sent by the upgrade thread
+            rc = ERR_FAIL;
+            if(hdr->len == sizeof(bdp_upgrade_msg_req_t))
+            {
+                rc = svsBdpUpgradeStart(sockFd, hdr->seq, hdr->dev_num, (bdp_upgrade_msg_req_t *)payload);
+            }
+            if(rc == ERR_PASS)
+            {
+                return(rc);
+            }
+            hdr->len = 0;
+            hdr->u.svshdr.status = rc;
+            break;
+
         default:
             hdr->len = 0;
             hdr->u.svshdr.status = ERR_INV_MSG_ID;
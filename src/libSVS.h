@@ -25,6 +25,11 @@ typedef enum
 
     SVS_MSG_ID_BDP_MSN_GET,
     SVS_MSG_ID_BDP_MSN_FLUSH,
+    SVS_MSG_ID_BDP_SWEEP,
+
+    SVS_MSG_ID_CALLBACK_STATS_GET,
+    SVS_MSG_ID_BDP_UPGRADE,
+    SVS_MSG_ID_BDP_SCAN,
 
 } svs_msg_id_t;
 
@@ -3,10 +3,13 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <svsErr.h>
 #include <svsLog.h>
@@ -17,6 +20,7 @@
 #include <svsBdp.h>
 #include <svsKr.h>
 #include <svsSocket.h>
+#include <svsImage.h>
 
 // ------------------------------------------------------------------
 //  UTILITIES
@@ -88,6 +92,25 @@ int svsLogVerbositySet(log_verbosity_t verbosity)
     return(rc);
 }
 
+//
+// Description:
+// Gets the event queue depth and the overflow counters of the applications registered with the callback server.
+//
+svs_err_t *svsCallbackStatsGet(callback_stats_t *data, int timeout_ms)
+{
+    int rc;
+
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+
+    rc = svsSocketServerSvsTransferSafe(0, SVS_MSG_ID_CALLBACK_STATS_GET, timeout_ms, 0, 0, (uint8_t *)data, sizeof(callback_stats_t));
+
+    return(errUpdate(rc));
+}
+
 svs_err_t *svsModulePowerSet(module_power_t *data, blocking_t blocking, int timeout_ms, callback_fn_t callback)
 {
     int rc = ERR_FAIL;
@@ -241,77 +264,62 @@ svs_err_t *svsBdpScan(void)
 // Perform BDP scan to retreive BDP ID and assign them to the
 svs_err_t *svsBdpScanForce(void)
 {
-    int rc = ERR_PASS;
-    svs_err_t *svs_err;
-    uint16_t bdp_max = 0;
-    uint16_t bdp_max_old;
-    bdp_address_t bdp_address;
+    bdp_scan_t scan;
 
-    svsBdpMsnFlush();
+    memset(&scan, 0, sizeof(scan));
 
-    // send broadcast command to ask ALL BDPs to send their IDs
-    bdp_address.bdp_num = BDP_NUM_ALL;
-    int retry = 0;
-    // perform several iterations to make sure all BDPs respond to the ARP request
-    do
-    {   // perform the ARP request
-        svs_err = svsBdpMsnForceGet(&bdp_address, BLOCKING_OFF, 0, 0);
-        if((svs_err->code != ERR_PASS))
-        {
-            rc = svs_err->code;
-            break;
-        }
+    return(svsBdpScanRun(&scan));
+}
 
-        int64_t tstart;
-        tstart = svsTimeGet_ms();
-        do
-        {   // check to see how many BDPs responded
-            bdp_max_old = bdp_max;
+//
+// Scan the buses for BDPs, the scan is run by the server which broadcasts the ARP request in rounds.
+// The scan stops after two rounds without a new BDP, or as soon as data->expected BDPs answered.
+// The number of BDPs detected, the scan duration and the responses received in each round are returned in data.
+//
+svs_err_t *svsBdpScanRun(bdp_scan_t *data)
+{
+    int rc;
+    int i;
+    int deadline_ms;
+    bdp_scan_msg_req_t req;
+    bdp_scan_msg_rsp_t rsp;
 
-            rc = svsBdpAvailableGet(&bdp_max);
-            if(rc != ERR_PASS)
-            {
-                return(errUpdate(ERR_FAIL));
-            }
-            // tell the BDPs who responded to go quiet,
-            // we need to let the BDP timeout so they don't get stuck in the quiet mode forever
-            // XXX
-
-            // at this point more BDPs should have responded, if so we keep on getting bdp_max
-            // until bdp_max stays constant for at least the time chosen in usleep() below
-            // it is expected for the BDPs to respond within a few 100ms
-
-            if(bdp_max_old != bdp_max)
-            {   // update time as we detected a change
-                tstart = svsTimeGet_ms();
-                logInfo("BDPs detected so far: %d", bdp_max);
-            }
-            if(svsTimeGet_ms() - tstart >= 1000)
-            {   // keep on retrying until this time has been reached
-                // we expect to have responses between 0 and 700ms
-                break;
-            }
-            // allow some time before the next request, most messages will be sent within a few 100ms
-            // so we wait a little longer before checking again
-            usleep(10000);
-        } while(1);
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    deadline_ms = (data->deadline_ms > 0) ? data->deadline_ms : BDP_SCAN_DEADLINE_MS;
 
-        // retry this process several times, this will guarantee that all BDPs were able to send their data
-        retry++;
-        logDebug("retrying...");
-    } while(retry < 10); // loop for as long as there are new BDPs responding
+    memset(&req, 0, sizeof(req));
+    memset(&rsp, 0, sizeof(rsp));
+    req.expected    = data->expected;
+    req.deadline_ms = deadline_ms;
 
-    // tell the BDPs who went quiet to start talking again
-    // XXX
+    rc = svsSocketServerSvsTransferSafe(0, SVS_MSG_ID_BDP_SCAN, deadline_ms + BDP_SWEEP_MARGIN_MS,
+                                        (uint8_t *)&req, sizeof(req), (uint8_t *)&rsp, sizeof(rsp));
+    if(rc != ERR_PASS)
+    {
+        return(errUpdate(rc));
+    }
 
-    if(bdp_max == 0)
+    data->bdp_max     = rsp.bdp_max;
+    data->rounds      = rsp.rounds;
+    data->duration_ms = rsp.duration_ms;
+    for(i=0; i<BDP_SCAN_ROUND_MAX; i++)
+    {
+        data->round_rsp[i] = rsp.round_rsp[i];
+        data->round_new[i] = rsp.round_new[i];
+    }
+
+    if(data->bdp_max == 0)
     {
         logWarning("No BDPs detected");
     }
 
-    logInfo("Total BDPs detected: %d", bdp_max);
+    logInfo("Total BDPs detected: %d in %d ms", data->bdp_max, data->duration_ms);
 
-    return(errUpdate(rc));
+    return(errUpdate(rsp.status));
 }
 
 svs_err_t *svsBdpLedSet(bdp_led_t *data, blocking_t blocking, int timeout_ms, callback_fn_t callback)
@@ -916,7 +924,7 @@ svs_err_t *svsBdpGetBootblockRev(bdp_get_rev_t *data, int timeout_ms)
 svs_err_t *svsBdpFirmwareUpgrade(bdp_firmware_upgrade_t *data, int timeout_ms)
 {
     int      rc;
-    uint16_t bdp_max, len,last_len=0;
+    uint16_t bdp_max, last_len=0;
     uint8_t  tries;
     int      timeout;
 
@@ -946,13 +954,12 @@ svs_err_t *svsBdpFirmwareUpgrade(bdp_firmware_upgrade_t *data, int timeout_ms)
     bdp_firmware_upgrade_msg_req_t req;
     bdp_firmware_upgrade_msg_rsp_t rsp;
 
-    // Open the file
-    FILE *imgFd;
-    imgFd = fopen(data->filename, "r");
-    if(imgFd == 0)
+    // the image is read once and shared with the other upgrades using the same file
+    svs_image_t *image;
+    rc = svsImageOpen(data->filename, &image);
+    if(rc != ERR_PASS)
     {
-        logError("failed to open file: %s", strerror(errno));
-        return(errUpdate(ERR_FAIL));
+        return(errUpdate(rc));
     }
 
     req.offset = 0; // assume we're starting at the  start of the file
@@ -969,26 +976,12 @@ svs_err_t *svsBdpFirmwareUpgrade(bdp_firmware_upgrade_t *data, int timeout_ms)
 
     do
     {
-        memset(req.data, 0, FIRMWARE_IMAGE_BLOCK_MAX);
-        // Read file in blocks
-        len = fread(req.data, sizeof(uint8_t), FIRMWARE_IMAGE_BLOCK_MAX, imgFd);
-        //logDebug("fread returned len: %d", len);
-        if(feof(imgFd) != 0)
+        if((req.offset >= image->len) && (last_len != FIRMWARE_IMAGE_BLOCK_MAX))
         {   // are we done?  Only if the last block wasn't full
             // else we have to send a zero length block
-            if(last_len != FIRMWARE_IMAGE_BLOCK_MAX)
-                break;
-        }
-        else
-        {
-            if(ferror(imgFd))
-            {
-                logError("failed to read file: %s", strerror(errno));
-                rc = ERR_FAIL;
-                break;
-            }
+            break;
         }
-        req.len = len;
+        req.len = svsImageBlockCopy(image, req.offset, req.data);
         //logDebug("BDP%d sending %d bytes @ %08X", data->bdp_num, req.len, req.offset);
         printf(".");fflush(stdout);
 
@@ -1026,7 +1019,109 @@ svs_err_t *svsBdpFirmwareUpgrade(bdp_firmware_upgrade_t *data, int timeout_ms)
 
     printf("%08X\n", req.offset);fflush(stdout);
 
-    fclose(imgFd);
+    svsImageClose(image);
+
+    return(errUpdate(rc));
+}
+
+//
+// Called for each progress report received during an upgrade, returns 1 on the last message
+//
+static int svsBdpUpgradeRsp(uint8_t *payload, uint16_t len, void *arg)
+{
+    int i;
+    bdp_upgrade_t *data = (bdp_upgrade_t *)arg;
+    bdp_upgrade_msg_rsp_t *rsp = (bdp_upgrade_msg_rsp_t *)payload;
+
+    if((len < offsetof(bdp_upgrade_msg_rsp_t, result)) ||
+       (len < offsetof(bdp_upgrade_msg_rsp_t, result) + rsp->result_cnt * sizeof(bdp_upgrade_result_t)))
+    {
+        logError("upgrade response length invalid %d", len);
+        return(1);
+    }
+
+    memcpy(&data->progress, &rsp->progress, sizeof(bdp_upgrade_progress_t));
+    for(i=0; i<rsp->result_cnt; i++)
+    {
+        if(data->result && (data->result_cnt < data->result_max))
+        {
+            memcpy(&data->result[data->result_cnt], &rsp->result[i], sizeof(bdp_upgrade_result_t));
+        }
+        data->result_cnt++;
+    }
+    if(data->fn)
+    {
+        data->fn(&rsp->progress, rsp->result, rsp->result_cnt, data->arg);
+    }
+
+    return(rsp->last);
+}
+
+//
+// Upgrade the firmware of several BDPs at once, all the available BDPs when data->bdp_cnt is 0.
+// The server streams the image to the BDPs in parallel, the result of each BDP is returned in data->result
+// and the progress is passed to data->fn about once per second. BDPs that did not complete within
+// data->deadline_ms are reported with ERR_TIMEOUT. Returns ERR_FIRMWARE_FAILED_PROGRAM when a BDP failed.
+// With data->broadcast set the image is sent once to all the BDPs, then each BDP only receives the blocks it missed.
+// With data->delta set each BDP only receives the blocks that differ from its flash. In both cases the CRC of the
+// whole image is checked on each BDP at the end.
+//
+svs_err_t *svsBdpFirmwareUpgradeMany(bdp_upgrade_t *data)
+{
+    int rc;
+    bdp_upgrade_msg_req_t req;
+    bdp_upgrade_msg_rsp_t rsp;
+    char *path;
+
+    if((data == 0) || (data->filename == 0))
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    if((data->bdp_cnt > BDP_UPGRADE_LIST_MAX) || (data->deadline_ms <= 0) ||
+       (data->timeout_erase < 0) || (data->timeout_normal < 0))
+    {
+        logError("invalid parameters");
+        return(errUpdate(ERR_FAIL));
+    }
+
+    // the file is read by the server, which does not run in the same directory
+    memset(&req, 0, sizeof(req));
+    path = realpath(data->filename, 0);
+    if(path == 0)
+    {
+        logError("%s: %s", data->filename, strerror(errno));
+        return(errUpdate(ERR_FAIL));
+    }
+    if(strlen(path) >= BDP_UPGRADE_FILENAME_MAX)
+    {
+        logError("%s: path too long", path);
+        free(path);
+        return(errUpdate(ERR_LEN_TOO_LONG));
+    }
+    strcpy(req.filename, path);
+    free(path);
+    req.window          = data->window;
+    req.retries         = data->retries;
+    req.broadcast       = data->broadcast;
+    req.delta           = data->delta;
+    req.timeout_erase   = data->timeout_erase;
+    req.timeout_normal  = data->timeout_normal;
+    req.deadline_ms     = data->deadline_ms;
+    req.bdp_cnt         = data->bdp_cnt;
+    memcpy(req.bdp_num, data->bdp_num, data->bdp_cnt);
+
+    data->result_cnt = 0;
+    memset(&data->progress, 0, sizeof(bdp_upgrade_progress_t));
+
+    // the last results are sent by the server once the deadline expired, allow some time to receive them
+    rc = svsSocketServerSvsStreamTransferSafe(0, SVS_MSG_ID_BDP_UPGRADE, data->deadline_ms + BDP_UPGRADE_MARGIN_MS,
+                                              (uint8_t *)&req, sizeof(req), (uint8_t *)&rsp, sizeof(rsp),
+                                              svsBdpUpgradeRsp, data);
+    if((rc == ERR_PASS) && (data->progress.bdp_done != data->progress.bdp_total))
+    {
+        rc = ERR_FIRMWARE_FAILED_PROGRAM;
+    }
 
     return(errUpdate(rc));
 }
@@ -1038,7 +1133,7 @@ svs_err_t *svsBdpFirmwareUpgrade(bdp_firmware_upgrade_t *data, int timeout_ms)
 svs_err_t *svsBdpBootblockUpload(bdp_firmware_upgrade_t *data, int timeout_ms)
 {
     int      rc;
-    uint16_t bdp_max, len,last_len=0;
+    uint16_t bdp_max, last_len=0;
     uint8_t  tries;
     int      timeout;
 
@@ -1073,13 +1168,12 @@ svs_err_t *svsBdpBootblockUpload(bdp_firmware_upgrade_t *data, int timeout_ms)
     bdp_firmware_upgrade_msg_req_t req;
     bdp_firmware_upgrade_msg_rsp_t rsp;
 
-    // Open the file
-    FILE *imgFd;
-    imgFd = fopen(data->filename, "r");
-    if(imgFd == 0)
+    // the image is read once and shared with the other upgrades using the same file
+    svs_image_t *image;
+    rc = svsImageOpen(data->filename, &image);
+    if(rc != ERR_PASS)
     {
-        logError("failed to open file: %s", strerror(errno));
-        return(errUpdate(ERR_FAIL));
+        return(errUpdate(rc));
     }
 
     req.offset = 0; // assume we're starting at the  start of the file
@@ -1096,26 +1190,12 @@ svs_err_t *svsBdpBootblockUpload(bdp_firmware_upgrade_t *data, int timeout_ms)
 
     do
     {
-        memset(req.data, 0, FIRMWARE_IMAGE_BLOCK_MAX);
-        // Read file in blocks
-        len = fread(req.data, sizeof(uint8_t), FIRMWARE_IMAGE_BLOCK_MAX, imgFd);
-        //logDebug("fread returned len: %d", len);
-        if(feof(imgFd) != 0)
+        if((req.offset >= image->len) && (last_len != FIRMWARE_IMAGE_BLOCK_MAX))
         {   // are we done?  Only if the last block wasn't full
             // else we have to send a zero length block
-            if(last_len != FIRMWARE_IMAGE_BLOCK_MAX)
-                break;
-        }
-        else
-        {
-            if(ferror(imgFd))
-            {
-                logError("failed to read file: %s", strerror(errno));
-                rc = ERR_FAIL;
-                break;
-            }
+            break;
         }
-        req.len = len;
+        req.len = svsImageBlockCopy(image, req.offset, req.data);
         //logDebug("BDP%d sending %d bytes @ %08X", data->bdp_num, req.len, req.offset);
         printf(".");fflush(stdout);
 
@@ -1153,7 +1233,7 @@ svs_err_t *svsBdpBootblockUpload(bdp_firmware_upgrade_t *data, int timeout_ms)
 
     printf("%08X\n", req.offset);fflush(stdout);
 
-    fclose(imgFd);
+    svsImageClose(image);
 
     return(errUpdate(rc));
 }
@@ -1437,6 +1517,87 @@ svs_err_t *svsBdpSwitchGet(bdp_switch_t *data, blocking_t blocking, int timeout_
     return(errUpdate(rc));
 }
 
+//
+// Called for each message of results received during a sweep, returns 1 on the last message
+//
+static int svsBdpSweepRsp(uint8_t *payload, uint16_t len, void *arg)
+{
+    int i;
+    bdp_sweep_t *data = (bdp_sweep_t *)arg;
+    bdp_sweep_msg_rsp_t *rsp = (bdp_sweep_msg_rsp_t *)payload;
+
+    if((len < offsetof(bdp_sweep_msg_rsp_t, result)) ||
+       (len < offsetof(bdp_sweep_msg_rsp_t, result) + rsp->result_cnt * sizeof(bdp_sweep_result_t)))
+    {
+        logError("sweep response length invalid %d", len);
+        return(1);
+    }
+
+    for(i=0; i<rsp->result_cnt; i++)
+    {
+        if(data->fn)
+        {
+            data->fn(&rsp->result[i], data->arg);
+        }
+        if(data->result && (data->result_cnt < data->result_max))
+        {
+            memcpy(&data->result[data->result_cnt], &rsp->result[i], sizeof(bdp_sweep_result_t));
+        }
+        data->result_cnt++;
+    }
+
+    return(rsp->last);
+}
+
+//
+// Send the same request to all available BDPs and gather the responses in one call.
+// The server sends the requests and collects the responses, the results are returned in data->result
+// and/or passed to data->fn as they are received. BDPs that did not respond within data->deadline_ms
+// are reported with ERR_TIMEOUT.
+//
+svs_err_t *svsBdpSweep(bdp_sweep_t *data)
+{
+    int rc;
+    bdp_sweep_msg_req_t req;
+    bdp_sweep_msg_rsp_t rsp;
+
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    switch(data->msg_id)
+    {
+        case MSG_ID_BDP_SWITCH_GET:
+        case MSG_ID_BDP_RFID_GET:
+        case MSG_ID_BDP_RFID_ALL_GET:
+            break;
+        default:
+            logError("sweep not supported for msg ID %d", data->msg_id);
+            return(errUpdate(ERR_INV_MSG_ID));
+    }
+    if((data->req_len > BDP_SWEEP_REQ_MAX) || (data->deadline_ms <= 0))
+    {
+        logError("invalid parameters");
+        return(errUpdate(ERR_FAIL));
+    }
+
+    memset(&req, 0, sizeof(req));
+    req.msg_id      = data->msg_id;
+    req.deadline_ms = data->deadline_ms;
+    req.req_len     = data->req_len;
+    memcpy(req.req, data->req, data->req_len);
+
+    data->result_cnt = 0;
+
+    // the last results are sent by the server once the deadline expired, allow some time to receive them
+    rc = svsSocketServerSvsStreamTransferSafe(0, SVS_MSG_ID_BDP_SWEEP, data->deadline_ms + BDP_SWEEP_MARGIN_MS,
+                                              (uint8_t *)&req, sizeof(req), (uint8_t *)&rsp, sizeof(rsp),
+                                              svsBdpSweepRsp, data);
+
+    return(errUpdate(rc));
+}
+
 svs_err_t *svsBdpJtagDebugSet(bdp_jtag_debug_t *data, int timeout_ms)
 {
     int rc;
@@ -1895,119 +2056,821 @@ svs_err_t *svsBdpCommsSet(bdp_comms_t *data, int timeout_ms)
 }
 
 // ------------------------------------------------------------------
-//  KR
+//  ASYNCHRONOUS REQUESTS
 // ------------------------------------------------------------------
 
-svs_err_t *svsKrAddressGet(kr_address_t *data, int timeout_ms)
+// copies the response into the API structure, returns the status reported by the BDP
+typedef int (* svs_future_rsp_fn_t)(svs_future_t *future);
+
+struct svs_future_s
 {
-    int rc;
+    uint8_t             done;       // 1 once the request completed
+    uint8_t             refs;       // references held by the application and by the request in flight
+    err_t               status;     // status of the request once done
+    uint16_t            bdp_num;    // BDP the request was sent to
+    bdp_msg_id_t        msg_id;     // message ID of the request
+    uint16_t            rsp_len;    // expected response length
+    uint8_t             rsp[SVS_SOCKET_MSG_PAYLOAD_MAX];
+    void                *data;      // API structure updated with the response
+    svs_future_rsp_fn_t fnRsp;      // copies the response into data
+    svs_future_fn_t     fn;         // called once done, see svsFutureThen()
+    void                *arg;       // argument passed to fn
+    svs_future_t        *next;      // in the list of the callbacks to call
+};
 
-    // check pointer
-    if(data == 0)
-    {
-        logError("null pointer");
-        return(errUpdate(ERR_FAIL));
-    }
-    if(data->kr_addr.octet == 0)
-    {
-        logError("data->kr_addr.octet null pointer");
-        return(errUpdate(ERR_FAIL));
-    }
-    // validate structure fields
-    // this is a special case where we only check for the possible maximum BDPs
-    // in the system rather than the ones available
-    if(data->kr_num != KR_NUM_ALL)
+// all the futures share one lock and one condition, so a thread can wait on several of them at once
+static pthread_mutex_t  mutexFuture = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   condFuture;
+static pthread_once_t   onceFuture  = PTHREAD_ONCE_INIT;
+
+// the callbacks are called from their own thread, the receiver thread must keep reading while they call the API
+static pthread_cond_t   condFutureCb = PTHREAD_COND_INITIALIZER;
+static svs_future_t     *futureCbHead = 0;
+static svs_future_t     *futureCbTail = 0;
+
+static uint16_t         futureBdpMax = 0;   // BDP count cached for the requests validation, svsd rejects the unknown BDPs
+
+static void svsFutureUnref(svs_future_t *future);
+
+static void *svsFutureCbThread(void *arg)
+{
+    svs_future_t    *future;
+    svs_future_fn_t fn;
+    void            *fn_arg;
+
+    for(;;)
     {
-        if(data->kr_num >= KR_MAX)
+        pthread_mutex_lock(&mutexFuture);
+        while(futureCbHead == 0)
         {
-            logError("kr number out of range %d %d", data->kr_num, KR_MAX);
-            return(errUpdate(ERR_FAIL));
+            pthread_cond_wait(&condFutureCb, &mutexFuture);
         }
-    }
-
-    // prepare the message structure
-    kr_address_get_msg_req_t req;
-    kr_address_get_msg_rsp_t rsp;
-    // Send message
-    rc = svsSocketServerKrTransferSafe(data->kr_num, MSG_ID_KR_ADDR_GET, timeout_ms, 0, (uint8_t *)&req, sizeof(req), (uint8_t *)&rsp, sizeof(rsp));
-    if(rc != ERR_PASS)
-    {
-        return(errUpdate(rc));
-    }
+        future = futureCbHead;
+        futureCbHead = future->next;
+        if(futureCbHead == 0)
+        {
+            futureCbTail = 0;
+        }
+        // the callback is dropped when the application released the future meanwhile
+        fn     = future->fn;
+        fn_arg = future->arg;
+        pthread_mutex_unlock(&mutexFuture);
 
-    rc = rsp.status;
+        if(fn != 0)
+        {
+            fn(future, future->status, fn_arg);
+        }
 
-    if(rc == ERR_PASS)
-    {
-        memcpy(data->kr_addr.octet, rsp.kr_addr.octet, KR_MSG_ADDR_LENGTH);
+        // drop the reference held by the request
+        svsFutureUnref(future);
     }
 
-    return(errUpdate(rc));
+    return(arg);
 }
 
-svs_err_t *svsKrAddressSet(kr_address_t *data, int timeout_ms)
+static void svsFutureInit(void)
 {
-    if(data == 0)
+    pthread_condattr_t condAttr;
+    pthread_attr_t     threadAttr;
+    pthread_t          threadId;
+
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&condFuture, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    pthread_attr_init(&threadAttr);
+    pthread_attr_setdetachstate(&threadAttr, PTHREAD_CREATE_DETACHED);
+    if(pthread_create(&threadId, &threadAttr, svsFutureCbThread, 0) != 0)
     {
-        logError("null pointer");
-        return(errUpdate(ERR_FAIL));
+        logError("cannot create the future callback thread");
     }
-    return(errUpdate(ERR_NOT_IMPLEMENTED));
+    pthread_attr_destroy(&threadAttr);
 }
 
-svs_err_t *svsKrPowerSet(kr_power_t *data, int timeout_ms)
+//
+// Checks the BDP number against the BDP count, which is only requested again from svsd for a BDP beyond it
+//
+static int svsFutureBdpCheck(uint16_t bdp_num)
 {
     int rc;
+    uint16_t bdp_max;
 
-    // check pointer
-    if(data == 0)
-    {
-        logError("null pointer");
-        return(errUpdate(ERR_FAIL));
-    }
+    pthread_mutex_lock(&mutexFuture);
+    bdp_max = futureBdpMax;
+    pthread_mutex_unlock(&mutexFuture);
 
-    switch(data->kr_power_state)
+    if(bdp_num < bdp_max)
     {
-        case MODULE_POWER_STATE_ON:
-        case MODULE_POWER_STATE_OFF:
-        case MODULE_POWER_STATE_STANDBY:
-            break;
-
-        default:
-            logError("invalid state");
-            return(errUpdate(ERR_FAIL));
+        return(ERR_PASS);
     }
 
-    // prepare the message structure
-    kr_power_set_msg_req_t req;
-    kr_power_set_msg_rsp_t rsp;
-    req.kr_power_state = data->kr_power_state;
-    // Send message
-    rc = svsSocketServerKrTransferSafe(0, MSG_ID_KR_POWER_SET, timeout_ms, 0, (uint8_t *)&req, sizeof(req), (uint8_t *)&rsp, sizeof(rsp));
+    rc = svsBdpAvailableGet(&bdp_max);
     if(rc != ERR_PASS)
     {
-        return(errUpdate(rc));
+        return(ERR_FAIL);
     }
+    pthread_mutex_lock(&mutexFuture);
+    futureBdpMax = bdp_max;
+    pthread_mutex_unlock(&mutexFuture);
 
-    rc = rsp.status;
+    if(bdp_num >= bdp_max)
+    {
+        logError("bdp number out of range %d %d", bdp_num, bdp_max);
+        return(ERR_FAIL);
+    }
 
-    return(errUpdate(rc));
+    return(ERR_PASS);
 }
 
-svs_err_t *svsKrPowerGet(kr_power_t *data, int timeout_ms)
+static void svsFutureUnref(svs_future_t *future)
 {
-    int rc;
+    uint8_t refs;
 
-    // check pointer
-    if(data == 0)
+    pthread_mutex_lock(&mutexFuture);
+    refs = --future->refs;
+    pthread_mutex_unlock(&mutexFuture);
+
+    if(refs == 0)
     {
-        logError("null pointer");
-        return(errUpdate(ERR_FAIL));
+        free(future);
     }
-    switch(data->kr_power_state)
-    {
-        case MODULE_POWER_STATE_ON:
-        case MODULE_POWER_STATE_OFF:
+}
+
+//
+// Called from the client receiver thread when the request is done: response received, timeout or disconnect
+//
+static void svsFutureDone(void *arg, int rc, svsSocketMsgHeader_t *hdr)
+{
+    svs_future_t    *future = (svs_future_t *)arg;
+
+    pthread_mutex_lock(&mutexFuture);
+    if(rc == ERR_PASS)
+    {
+        if(hdr->u.bdphdr.msg_id == MSG_ID_BDP_ACK)
+        {   // get ack status and use it as an error code
+            rc = ((bdp_ack_msg_rsp_t *)future->rsp)->status;
+            logError("ACK message ID received with status %d", rc);
+        }
+        else if((hdr->u.bdphdr.msg_id != future->msg_id) || (hdr->dev_num != future->bdp_num))
+        {
+            logError("response mismatch BDP %d msg ID %d, expected BDP %d msg ID %d",
+                     hdr->dev_num, hdr->u.bdphdr.msg_id, future->bdp_num, future->msg_id);
+            rc = ERR_FAIL;
+        }
+        else if(future->fnRsp != 0)
+        {   // data is cleared when the application released the future before the request was done
+            rc = future->fnRsp(future);
+        }
+    }
+    future->status = rc;
+    future->done   = 1;
+    pthread_cond_broadcast(&condFuture);
+    if(future->fn != 0)
+    {   // the callback thread drops the reference held by the request
+        future->next = 0;
+        if(futureCbTail != 0)
+        {
+            futureCbTail->next = future;
+        }
+        else
+        {
+            futureCbHead = future;
+        }
+        futureCbTail = future;
+        pthread_cond_signal(&condFutureCb);
+        pthread_mutex_unlock(&mutexFuture);
+        return;
+    }
+    pthread_mutex_unlock(&mutexFuture);
+
+    // drop the reference held by the request
+    svsFutureUnref(future);
+}
+
+static int svsFutureCreate(uint16_t bdp_num, bdp_msg_id_t msg_id, void *req, uint16_t req_len, uint16_t rsp_len, int timeout_ms,
+                           void *data, svs_future_rsp_fn_t fnRsp, svs_future_t **future)
+{
+    int rc;
+    svs_future_t *f;
+
+    if(future == 0)
+    {
+        logError("null pointer");
+        return(ERR_FAIL);
+    }
+    *future = 0;
+    if(rsp_len > SVS_SOCKET_MSG_PAYLOAD_MAX)
+    {
+        logError("rsp length out of range %d", rsp_len);
+        return(ERR_INV_PARAM);
+    }
+
+    pthread_once(&onceFuture, svsFutureInit);
+
+    f = (svs_future_t *)calloc(1, sizeof(svs_future_t));
+    if(f == 0)
+    {
+        logError("calloc: %s", strerror(errno));
+        return(ERR_FAIL);
+    }
+    f->refs    = 2;   // one for the application, one for the request in flight
+    f->status  = ERR_IN_PROGRESS;
+    f->bdp_num = bdp_num;
+    f->msg_id  = msg_id;
+    f->rsp_len = rsp_len;
+    f->data    = data;
+    f->fnRsp   = fnRsp;
+
+    rc = svsSocketServerBdpTransferAsync(bdp_num, msg_id, timeout_ms, 0, (uint8_t *)req, req_len, f->rsp, sizeof(f->rsp), svsFutureDone, f);
+    if(rc != ERR_PASS)
+    {
+        free(f);
+        return(rc);
+    }
+
+    *future = f;
+
+    return(ERR_PASS);
+}
+
+//
+// Wait on the shared condition until the deadline, returns ETIMEDOUT once it expired.
+// A negative timeout waits forever. Called with mutexFuture held.
+//
+static int svsFutureCondWait(int64_t tend_ms, int timeout_ms)
+{
+    struct timespec ts;
+
+    if(timeout_ms < 0)
+    {
+        return(pthread_cond_wait(&condFuture, &mutexFuture));
+    }
+    ts.tv_sec  = tend_ms / 1000;
+    ts.tv_nsec = (tend_ms % 1000) * 1000000;
+
+    return(pthread_cond_timedwait(&condFuture, &mutexFuture, &ts));
+}
+
+//
+// Send any BDP request without waiting for the response.
+// The raw response is retrieved with svsFutureRspGet() once the request is done.
+//
+svs_err_t *svsBdpRequestAsync(uint16_t bdp_num, bdp_msg_id_t msg_id, void *req, uint16_t req_len, uint16_t rsp_len, int timeout_ms, svs_future_t **future)
+{
+    int rc;
+
+    rc = svsFutureBdpCheck(bdp_num);
+    if(rc != ERR_PASS)
+    {
+        return(errUpdate(rc));
+    }
+    if(msg_id >= MSG_ID_BDP_MAX)
+    {
+        logError("invalid msg ID %d", msg_id);
+        return(errUpdate(ERR_INV_MSG_ID));
+    }
+
+    rc = svsFutureCreate(bdp_num, msg_id, req, req_len, rsp_len, timeout_ms, 0, 0, future);
+
+    return(errUpdate(rc));
+}
+
+static int svsBdpLedSetRsp(svs_future_t *future)
+{
+    bdp_led_set_msg_rsp_t *rsp = (bdp_led_set_msg_rsp_t *)future->rsp;
+
+    return(rsp->status);
+}
+
+svs_err_t *svsBdpLedSetAsync(bdp_led_t *data, int timeout_ms, svs_future_t **future)
+{
+    int rc;
+    bdp_msg_id_t msgId;
+
+    // check pointer
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    // validate structure fields
+    rc = svsFutureBdpCheck(data->bdp_num);
+    if(rc != ERR_PASS)
+    {
+        return(errUpdate(rc));
+    }
+    switch(data->bdp_led_state)
+    {
+        case BDP_LED_STATE_OFF:
+        case BDP_LED_STATE_ON:
+            break;
+
+        default:
+            logError("invalid state");
+            return(errUpdate(ERR_FAIL));
+    }
+    switch(data->bdp_led_color)
+    {
+        case BDP_LED_COLOR_GREEN:
+            msgId = MSG_ID_BDP_GRN_LED_SET;
+            break;
+        case BDP_LED_COLOR_RED:
+            msgId = MSG_ID_BDP_RED_LED_SET;
+            break;
+        case BDP_LED_COLOR_YELLOW:
+            msgId = MSG_ID_BDP_YLW_LED_SET;
+            break;
+        default:
+            logError("invalid state");
+            return(errUpdate(ERR_FAIL));
+    }
+
+    // prepare the message structure
+    bdp_led_set_msg_req_t req;
+    req.bdp_led_state = data->bdp_led_state;
+    // Send message
+    rc = svsFutureCreate(data->bdp_num, msgId, &req, sizeof(req), sizeof(bdp_led_set_msg_rsp_t), timeout_ms, data, svsBdpLedSetRsp, future);
+
+    return(errUpdate(rc));
+}
+
+static int svsBdpBikeLockGetRsp(svs_future_t *future)
+{
+    bdp_bike_lock_t *data = (bdp_bike_lock_t *)future->data;
+    bdp_bike_lock_get_msg_rsp_t *rsp = (bdp_bike_lock_get_msg_rsp_t *)future->rsp;
+
+    data->bdp_bike_lock_state = rsp->bdp_bike_lock_state;
+
+    return(rsp->status);
+}
+
+svs_err_t *svsBdpBikeLockGetAsync(bdp_bike_lock_t *data, int timeout_ms, svs_future_t **future)
+{
+    int rc;
+
+    // check pointer
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    // validate structure fields
+    rc = svsFutureBdpCheck(data->bdp_num);
+    if(rc != ERR_PASS)
+    {
+        return(errUpdate(rc));
+    }
+
+    // prepare the message structure
+    bdp_bike_lock_get_msg_req_t req;
+    // Send message
+    rc = svsFutureCreate(data->bdp_num, MSG_ID_BDP_BIKE_LOCK_GET, &req, sizeof(req), sizeof(bdp_bike_lock_get_msg_rsp_t), timeout_ms, data, svsBdpBikeLockGetRsp, future);
+
+    return(errUpdate(rc));
+}
+
+static int svsBdpBikeLockSetRsp(svs_future_t *future)
+{
+    bdp_bike_lock_set_msg_rsp_t *rsp = (bdp_bike_lock_set_msg_rsp_t *)future->rsp;
+
+    return(rsp->status);
+}
+
+svs_err_t *svsBdpBikeLockSetAsync(bdp_bike_lock_t *data, int timeout_ms, svs_future_t **future)
+{
+    int rc;
+
+    // check pointer
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    // validate structure fields
+    rc = svsFutureBdpCheck(data->bdp_num);
+    if(rc != ERR_PASS)
+    {
+        return(errUpdate(rc));
+    }
+    switch(data->bdp_bike_lock_state)
+    {
+        case BDP_BIKE_LOCK_ENGAGE:
+        case BDP_BIKE_LOCK_DISENGAGE:
+        case BDP_BIKE_LOCK_FORCE_ENGAGE:
+        case BDP_BIKE_LOCK_FORCE_DISENGAGE:
+            break;
+
+        default:
+            logError("invalid state");
+            return(errUpdate(ERR_FAIL));
+    }
+
+    // prepare the message structure
+    bdp_bike_lock_set_msg_req_t req;
+    req.bdp_bike_lock_state = data->bdp_bike_lock_state;
+    // Send message
+    rc = svsFutureCreate(data->bdp_num, MSG_ID_BDP_BIKE_LOCK_SET, &req, sizeof(req), sizeof(bdp_bike_lock_set_msg_rsp_t), timeout_ms, data, svsBdpBikeLockSetRsp, future);
+
+    return(errUpdate(rc));
+}
+
+static int svsBdpSwitchGetRsp(svs_future_t *future)
+{
+    int i;
+    bdp_switch_t *data = (bdp_switch_t *)future->data;
+    bdp_switch_get_msg_rsp_t *rsp = (bdp_switch_get_msg_rsp_t *)future->rsp;
+
+    for(i=0; i<BDP_SWITCH_MAX; i++)
+    {
+        data->bdp_switch_state[i] = rsp->bdp_switch_state[i];
+    }
+
+    return(ERR_PASS);
+}
+
+svs_err_t *svsBdpSwitchGetAsync(bdp_switch_t *data, int timeout_ms, svs_future_t **future)
+{
+    int rc;
+
+    // check pointer
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    // validate structure fields
+    rc = svsFutureBdpCheck(data->bdp_num);
+    if(rc != ERR_PASS)
+    {
+        return(errUpdate(rc));
+    }
+
+    // prepare the message structure
+    bdp_switch_get_msg_req_t req;
+    // Send message
+    rc = svsFutureCreate(data->bdp_num, MSG_ID_BDP_SWITCH_GET, &req, sizeof(req), sizeof(bdp_switch_get_msg_rsp_t), timeout_ms, data, svsBdpSwitchGetRsp, future);
+
+    return(errUpdate(rc));
+}
+
+static int svsBdpRfidGetRsp(svs_future_t *future)
+{
+    bdp_rfid_t *data = (bdp_rfid_t *)future->data;
+    bdp_rfid_get_msg_rsp_t *rsp = (bdp_rfid_get_msg_rsp_t *)future->rsp;
+
+    if(rsp->rfid_uid_len > BDP_RFID_UID_MAX)
+    {
+        logError("rfid uid length out of range %d", rsp->rfid_uid_len);
+        return(ERR_LEN_TOO_LONG);
+    }
+    data->rfid_uid_len  = rsp->rfid_uid_len;
+    data->rfid_type     = rsp->rfid_type;
+    memcpy(data->rfid_uid, rsp->rfid_uid, rsp->rfid_uid_len);
+
+    return(rsp->status);
+}
+
+svs_err_t *svsBdpRfidGetAsync(bdp_rfid_t *data, int timeout_ms, svs_future_t **future)
+{
+    int rc;
+
+    // check pointer
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    // validate structure fields
+    rc = svsFutureBdpCheck(data->bdp_num);
+    if(rc != ERR_PASS)
+    {
+        return(errUpdate(rc));
+    }
+
+    // prepare the message structure
+    bdp_rfid_get_msg_req_t req;
+
+    // set the reader to get data for
+    req.rfid_reader = data->rfid_reader;
+
+    // Send message
+    rc = svsFutureCreate(data->bdp_num, MSG_ID_BDP_RFID_GET, &req, sizeof(req), sizeof(bdp_rfid_get_msg_rsp_t), timeout_ms, data, svsBdpRfidGetRsp, future);
+
+    return(errUpdate(rc));
+}
+
+//
+// Returns ERR_IN_PROGRESS while the request is in flight, the status of the request once done
+//
+svs_err_t *svsFuturePoll(svs_future_t *future)
+{
+    int rc;
+
+    if(future == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+
+    pthread_mutex_lock(&mutexFuture);
+    rc = future->status;
+    pthread_mutex_unlock(&mutexFuture);
+
+    return(errUpdate(rc));
+}
+
+//
+// Waits up to timeout_ms (TIMEOUT_INFINITE to wait until done) for the request to be done.
+// Returns the status of the request, or ERR_TIMEOUT when still in flight.
+//
+svs_err_t *svsFutureWait(svs_future_t *future, int timeout_ms)
+{
+    return(svsFutureWaitAll(&future, 1, timeout_ms));
+}
+
+//
+// Waits up to timeout_ms for all the requests to be done.
+// Returns ERR_PASS once all are done, the individual status is then returned by svsFuturePoll().
+// With a single request, its status is returned.
+//
+svs_err_t *svsFutureWaitAll(svs_future_t **future, int cnt, int timeout_ms)
+{
+    int i, rc = ERR_PASS;
+    int64_t tend_ms = svsTimeGet_ms() + timeout_ms;
+
+    if((future == 0) || (cnt <= 0))
+    {
+        logError("invalid parameters");
+        return(errUpdate(ERR_FAIL));
+    }
+    for(i=0; i<cnt; i++)
+    {
+        if(future[i] == 0)
+        {
+            logError("null pointer");
+            return(errUpdate(ERR_FAIL));
+        }
+    }
+
+    pthread_once(&onceFuture, svsFutureInit);
+
+    pthread_mutex_lock(&mutexFuture);
+    i = 0;
+    while(i < cnt)
+    {
+        if(future[i]->done)
+        {
+            i++;
+            continue;
+        }
+        if(svsFutureCondWait(tend_ms, timeout_ms) == ETIMEDOUT)
+        {
+            rc = ERR_TIMEOUT;
+            break;
+        }
+    }
+    if((rc == ERR_PASS) && (cnt == 1))
+    {
+        rc = future[0]->status;
+    }
+    pthread_mutex_unlock(&mutexFuture);
+
+    return(errUpdate(rc));
+}
+
+//
+// Waits up to timeout_ms for any of the requests to be done.
+// Returns the status of the first request found done and its position in index, or ERR_TIMEOUT.
+//
+svs_err_t *svsFutureWaitAny(svs_future_t **future, int cnt, int timeout_ms, int *index)
+{
+    int i, rc = ERR_TIMEOUT;
+    int64_t tend_ms = svsTimeGet_ms() + timeout_ms;
+
+    if((future == 0) || (cnt <= 0) || (index == 0))
+    {
+        logError("invalid parameters");
+        return(errUpdate(ERR_FAIL));
+    }
+
+    pthread_once(&onceFuture, svsFutureInit);
+
+    pthread_mutex_lock(&mutexFuture);
+    while(1)
+    {
+        for(i=0; i<cnt; i++)
+        {
+            if((future[i] != 0) && future[i]->done)
+            {
+                *index = i;
+                rc = future[i]->status;
+                break;
+            }
+        }
+        if(i < cnt)
+        {
+            break;
+        }
+        if(svsFutureCondWait(tend_ms, timeout_ms) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mutexFuture);
+
+    return(errUpdate(rc));
+}
+
+//
+// Calls fn once the request is done, right away from the calling thread if it is already done,
+// otherwise from the library callback thread, fn may call the API but delays the other callbacks.
+//
+svs_err_t *svsFutureThen(svs_future_t *future, svs_future_fn_t fn, void *arg)
+{
+    uint8_t done;
+
+    if(future == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+
+    pthread_mutex_lock(&mutexFuture);
+    done = future->done;
+    if(!done)
+    {
+        future->fn  = fn;
+        future->arg = arg;
+    }
+    pthread_mutex_unlock(&mutexFuture);
+
+    if(done && fn)
+    {
+        fn(future, future->status, arg);
+    }
+
+    return(errUpdate(ERR_PASS));
+}
+
+//
+// Copies the raw response of a request sent with svsBdpRequestAsync()
+//
+svs_err_t *svsFutureRspGet(svs_future_t *future, void *rsp, uint16_t rsp_len)
+{
+    int rc;
+
+    if((future == 0) || (rsp == 0))
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+
+    pthread_mutex_lock(&mutexFuture);
+    rc = future->status;
+    if(rc == ERR_PASS)
+    {
+        memcpy(rsp, future->rsp, (rsp_len < future->rsp_len) ? rsp_len : future->rsp_len);
+    }
+    pthread_mutex_unlock(&mutexFuture);
+
+    return(errUpdate(rc));
+}
+
+//
+// Called by the application when done with the future. The request may still be in flight,
+// in which case the API structure is no longer updated and the callback no longer called.
+//
+void svsFutureRelease(svs_future_t *future)
+{
+    if(future == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&mutexFuture);
+    future->data  = 0;
+    future->fnRsp = 0;
+    future->fn    = 0;
+    pthread_mutex_unlock(&mutexFuture);
+
+    svsFutureUnref(future);
+}
+
+// ------------------------------------------------------------------
+//  KR
+// ------------------------------------------------------------------
+
+svs_err_t *svsKrAddressGet(kr_address_t *data, int timeout_ms)
+{
+    int rc;
+
+    // check pointer
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    if(data->kr_addr.octet == 0)
+    {
+        logError("data->kr_addr.octet null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    // validate structure fields
+    // this is a special case where we only check for the possible maximum BDPs
+    // in the system rather than the ones available
+    if(data->kr_num != KR_NUM_ALL)
+    {
+        if(data->kr_num >= KR_MAX)
+        {
+            logError("kr number out of range %d %d", data->kr_num, KR_MAX);
+            return(errUpdate(ERR_FAIL));
+        }
+    }
+
+    // prepare the message structure
+    kr_address_get_msg_req_t req;
+    kr_address_get_msg_rsp_t rsp;
+    // Send message
+    rc = svsSocketServerKrTransferSafe(data->kr_num, MSG_ID_KR_ADDR_GET, timeout_ms, 0, (uint8_t *)&req, sizeof(req), (uint8_t *)&rsp, sizeof(rsp));
+    if(rc != ERR_PASS)
+    {
+        return(errUpdate(rc));
+    }
+
+    rc = rsp.status;
+
+    if(rc == ERR_PASS)
+    {
+        memcpy(data->kr_addr.octet, rsp.kr_addr.octet, KR_MSG_ADDR_LENGTH);
+    }
+
+    return(errUpdate(rc));
+}
+
+svs_err_t *svsKrAddressSet(kr_address_t *data, int timeout_ms)
+{
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    return(errUpdate(ERR_NOT_IMPLEMENTED));
+}
+
+svs_err_t *svsKrPowerSet(kr_power_t *data, int timeout_ms)
+{
+    int rc;
+
+    // check pointer
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+
+    switch(data->kr_power_state)
+    {
+        case MODULE_POWER_STATE_ON:
+        case MODULE_POWER_STATE_OFF:
+        case MODULE_POWER_STATE_STANDBY:
+            break;
+
+        default:
+            logError("invalid state");
+            return(errUpdate(ERR_FAIL));
+    }
+
+    // prepare the message structure
+    kr_power_set_msg_req_t req;
+    kr_power_set_msg_rsp_t rsp;
+    req.kr_power_state = data->kr_power_state;
+    // Send message
+    rc = svsSocketServerKrTransferSafe(0, MSG_ID_KR_POWER_SET, timeout_ms, 0, (uint8_t *)&req, sizeof(req), (uint8_t *)&rsp, sizeof(rsp));
+    if(rc != ERR_PASS)
+    {
+        return(errUpdate(rc));
+    }
+
+    rc = rsp.status;
+
+    return(errUpdate(rc));
+}
+
+svs_err_t *svsKrPowerGet(kr_power_t *data, int timeout_ms)
+{
+    int rc;
+
+    // check pointer
+    if(data == 0)
+    {
+        logError("null pointer");
+        return(errUpdate(ERR_FAIL));
+    }
+    switch(data->kr_power_state)
+    {
+        case MODULE_POWER_STATE_ON:
+        case MODULE_POWER_STATE_OFF:
         case MODULE_POWER_STATE_STANDBY:
             break;
 
@@ -2181,9 +3044,11 @@ svs_err_t *svsKrGetBootblockRev(kr_get_rev_t *data, int timeout_ms)
 svs_err_t *svsKrFirmwareUpgrade(kr_firmware_upgrade_t *data, int timeout_ms)
 {
     int      rc;
-    uint16_t len, last_len=0;
+    uint16_t last_len=0;
     uint8_t  tries;
     int      timeout;
+    uint8_t  skip, match;
+    kr_memory_crc_t crc;
 
     // check pointer
     if(data == 0)
@@ -2201,13 +3066,12 @@ svs_err_t *svsKrFirmwareUpgrade(kr_firmware_upgrade_t *data, int timeout_ms)
     kr_firmware_upgrade_msg_req_t req;
     kr_firmware_upgrade_msg_rsp_t rsp;
 
-    // Open the file
-    FILE *imgFd;
-    imgFd = fopen(data->filename, "r");
-    if(imgFd == 0)
+    // the image is read once and shared with the other upgrades using the same file
+    svs_image_t *image;
+    rc = svsImageOpen(data->filename, &image);
+    if(rc != ERR_PASS)
     {
-        logError("failed to open file: %s", strerror(errno));
-        return(errUpdate(ERR_FAIL));
+        return(errUpdate(rc));
     }
 
     req.offset = 0; // assume we're starting at the  start of the file
@@ -2220,28 +3084,45 @@ svs_err_t *svsKrFirmwareUpgrade(kr_firmware_upgrade_t *data, int timeout_ms)
         timeout = data->timeout_erase;
     }
 
+    // with delta, the blocks already in the flash are skipped. The flash is only erased by the first block, so the
+    // whole image is sent from there as soon as one block differs
+    skip = data->delta;
+    memset(&crc, 0, sizeof(crc));
+    crc.kr_num = data->kr_num;
+
     do
     {
-        memset(req.data, 0, FIRMWARE_IMAGE_BLOCK_MAX);
-        // Read file in blocks
-        len = fread(req.data, sizeof(uint8_t), FIRMWARE_IMAGE_BLOCK_MAX, imgFd);
-        //logDebug("fread returned len: %d", len);
-        if(feof(imgFd) != 0)
+        if((req.offset >= image->len) && (last_len != FIRMWARE_IMAGE_BLOCK_MAX))
         {   // are we done?  Only if the last block wasn't full
             // else we have to send a zero length block
-            if(last_len != FIRMWARE_IMAGE_BLOCK_MAX)
-                break;
+            break;
         }
-        else
+        req.len = svsImageBlockCopy(image, req.offset, req.data);
+
+        if(skip && (req.len != 0))
         {
-            if(ferror(imgFd))
+            crc.start_address   = KR_FIRMWARE_APP_ADDR + req.offset;
+            crc.length_in_bytes = req.len;
+            match = (svsKrMemoryCrc(&crc, timeout_ms)->code == ERR_PASS) &&
+                    (crc.returned_crc == image->block_crc[req.offset / FIRMWARE_IMAGE_BLOCK_MAX]);
+            rc    = ERR_PASS;
+            if(match && (req.len == FIRMWARE_IMAGE_BLOCK_MAX))
             {
-                logError("failed to read file: %s", strerror(errno));
-                rc = ERR_FAIL;
-                break;
+                logDebug("skipping %d bytes @ %08X", req.len, req.offset);
+                req.offset += req.len;
+                last_len    = req.len;
+                continue;
+            }
+            skip = 0;
+            if(!match && (req.offset != 0))
+            {   // programmed over flash that was not erased otherwise
+                logDebug("block @ %08X differs, sending the whole image", req.offset);
+                req.offset = 0;
+                last_len   = 0;
+                continue;
             }
+            // the last block matching is sent again, it tells the KR the image is complete and programs the same bytes
         }
-        req.len = len;
         logDebug("sending %d bytes @ %08X", req.len, req.offset);
 
         // Send block as message
@@ -2275,7 +3156,19 @@ svs_err_t *svsKrFirmwareUpgrade(kr_firmware_upgrade_t *data, int timeout_ms)
         last_len    = req.len;
     } while((rc == ERR_PASS) && (req.len > 0));
 
-    fclose(imgFd);
+    if((rc == ERR_PASS) && data->delta)
+    {   // make sure the skipped blocks and the ones sent make up the new image
+        crc.start_address   = KR_FIRMWARE_APP_ADDR;
+        crc.length_in_bytes = req.offset;
+        rc = svsKrMemoryCrc(&crc, (data->timeout_erase != 0) ? data->timeout_erase : timeout_ms)->code;
+        if((rc == ERR_PASS) && (crc.returned_crc != image->crc))
+        {
+            logError("image CRC 0x%04x, expected 0x%04x", crc.returned_crc, image->crc);
+            rc = ERR_FIRMWARE_FAILED_PROGRAM;
+        }
+    }
+
+    svsImageClose(image);
 
     return(errUpdate(rc));
 }
@@ -2397,7 +3290,7 @@ svs_err_t *svsKrEcho(kr_echo_t *data, int timeout_ms)
 svs_err_t *svsKrBootblockUpload(kr_firmware_upgrade_t *data, int timeout_ms)
 {
     int      rc;
-    uint16_t kr_max, len,last_len=0;
+    uint16_t kr_max, last_len=0;
     uint8_t  tries;
     int      timeout;
 
@@ -2432,13 +3325,12 @@ svs_err_t *svsKrBootblockUpload(kr_firmware_upgrade_t *data, int timeout_ms)
     kr_firmware_upgrade_msg_req_t req;
     kr_firmware_upgrade_msg_rsp_t rsp;
 
-    // Open the file
-    FILE *imgFd;
-    imgFd = fopen(data->filename, "r");
-    if(imgFd == 0)
+    // the image is read once and shared with the other upgrades using the same file
+    svs_image_t *image;
+    rc = svsImageOpen(data->filename, &image);
+    if(rc != ERR_PASS)
     {
-        logError("failed to open file: %s", strerror(errno));
-        return(errUpdate(ERR_FAIL));
+        return(errUpdate(rc));
     }
 
     req.offset = 0; // assume we're starting at the  start of the file
@@ -2455,26 +3347,12 @@ svs_err_t *svsKrBootblockUpload(kr_firmware_upgrade_t *data, int timeout_ms)
 
     do
     {
-        memset(req.data, 0, FIRMWARE_IMAGE_BLOCK_MAX);
-        // Read file in blocks
-        len = fread(req.data, sizeof(uint8_t), FIRMWARE_IMAGE_BLOCK_MAX, imgFd);
-        //logDebug("fread returned len: %d", len);
-        if(feof(imgFd) != 0)
+        if((req.offset >= image->len) && (last_len != FIRMWARE_IMAGE_BLOCK_MAX))
         {   // are we done?  Only if the last block wasn't full
             // else we have to send a zero length block
-            if(last_len != FIRMWARE_IMAGE_BLOCK_MAX)
-                break;
-        }
-        else
-        {
-            if(ferror(imgFd))
-            {
-                logError("failed to read file: %s", strerror(errno));
-                rc = ERR_FAIL;
-                break;
-            }
+            break;
         }
-        req.len = len;
+        req.len = svsImageBlockCopy(image, req.offset, req.data);
         //logDebug("KR%d sending %d bytes @ %08X", data->kr_num, req.len, req.offset);
         printf(".");fflush(stdout);
 
@@ -2512,7 +3390,7 @@ svs_err_t *svsKrBootblockUpload(kr_firmware_upgrade_t *data, int timeout_ms)
 
     printf("%08X\n", req.offset);fflush(stdout);
 
-    fclose(imgFd);
+    svsImageClose(image);
 
     return(errUpdate(rc));
 }
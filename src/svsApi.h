@@ -11,6 +11,9 @@
 #define TIMEOUT_MAX         (5000)
 #define TIMEOUT_DEFAULT     (10)
 
+#define BDP_SWEEP_MARGIN_MS (500)   // time allowed to receive the sweep results after the deadline
+#define BDP_UPGRADE_MARGIN_MS (2000) // time allowed to receive the upgrade results after the deadline
+
 // ------------------------------------------------------------------
 //  SVS
 // ------------------------------------------------------------------
@@ -50,6 +53,12 @@ typedef struct
     msn_addr_t    msn_addr;
 } module_msn_t;
 
+// handle to a request sent with one of the asynchronous functions (svsBdp...Async)
+typedef struct svs_future_s svs_future_t;
+
+// called once the request is done, from the library callback thread shared by all the futures
+typedef void (* svs_future_fn_t)(svs_future_t *future, err_t status, void *arg);
+
 // ------------------------------------------------------------------
 
 /* retrieve error message string, given a code. Previously, this was
@@ -60,6 +69,7 @@ typedef struct
 svs_err_t *errUpdate(err_t code);
 
 int svsLogVerbositySet(log_verbosity_t verbosity);
+svs_err_t *svsCallbackStatsGet(callback_stats_t *data, int timeout_ms);
 svs_err_t *svsModuleMsnGet(module_msn_t *data, int timeout_ms);
 
 // ------------------------------------------------------------------
@@ -68,6 +78,7 @@ svs_err_t *svsModuleMsnGet(module_msn_t *data, int timeout_ms);
 int svsBdpAvailableGet(uint16_t *bdp_available);
 svs_err_t *svsBdpScan(void);
 svs_err_t *svsBdpScanForce(void);
+svs_err_t *svsBdpScanRun(bdp_scan_t *data);
 svs_err_t *svsBdpMsnFlush(void);
 
 svs_err_t *svsModulePowerSet(module_power_t *data, blocking_t blocking, int timeout_ms, callback_fn_t callback);
@@ -91,6 +102,8 @@ svs_err_t *svsBdpSwitchGet(bdp_switch_t *data, blocking_t blocking, int timeout_
 
 svs_err_t *svsBdpRfidGet(bdp_rfid_t *data, blocking_t blocking, int timeout_ms, callback_fn_t callback);
 
+svs_err_t *svsBdpSweep(bdp_sweep_t *data);
+
 svs_err_t *svsBdpMotorGet(bdp_motor_t *data, blocking_t blocking, int timeout_ms, callback_fn_t callback);
 svs_err_t *svsBdpMotorSet(bdp_motor_t *data, blocking_t blocking, int timeout_ms, callback_fn_t callback);
 
@@ -102,6 +115,7 @@ svs_err_t *svsBdpStatsGet(bdp_get_stats_t *data, int timeout_ms);
 svs_err_t *svsBdpChangeMode(bdp_change_mode_t *data, int timeout_ms);
 svs_err_t *svsBdpGetMode(bdp_get_mode_t *data, int timeout_ms);
 svs_err_t *svsBdpFirmwareUpgrade(bdp_firmware_upgrade_t *data, int timeout_ms);
+svs_err_t *svsBdpFirmwareUpgradeMany(bdp_upgrade_t *data);
 svs_err_t *svsBdpBootblockUpload(bdp_firmware_upgrade_t *data, int timeout_ms);
 svs_err_t *svsBdpBootblockInstall(bdp_bootblock_install_t *data, int timeout_ms);
 svs_err_t *svsBdpMemoryCrc(bdp_memory_crc_t *data, int timeout_ms);
@@ -117,6 +131,22 @@ svs_err_t *svsBdpMsnForceGet(bdp_address_t *data, blocking_t blocking, int timeo
 svs_err_t *svsBdpCompatibilitySet(bdp_compatibility_t *data, blocking_t blocking, int timeout_ms, callback_fn_t callback);
 svs_err_t *svsBdpCompatibilityGet(bdp_compatibility_t *data, blocking_t blocking, int timeout_ms, callback_fn_t callback);
 
+// asynchronous requests, data must remain valid until the request is done
+svs_err_t *svsBdpRequestAsync(uint16_t bdp_num, bdp_msg_id_t msg_id, void *req, uint16_t req_len, uint16_t rsp_len, int timeout_ms, svs_future_t **future);
+svs_err_t *svsBdpLedSetAsync(bdp_led_t *data, int timeout_ms, svs_future_t **future);
+svs_err_t *svsBdpBikeLockGetAsync(bdp_bike_lock_t *data, int timeout_ms, svs_future_t **future);
+svs_err_t *svsBdpBikeLockSetAsync(bdp_bike_lock_t *data, int timeout_ms, svs_future_t **future);
+svs_err_t *svsBdpSwitchGetAsync(bdp_switch_t *data, int timeout_ms, svs_future_t **future);
+svs_err_t *svsBdpRfidGetAsync(bdp_rfid_t *data, int timeout_ms, svs_future_t **future);
+
+svs_err_t *svsFuturePoll(svs_future_t *future);
+svs_err_t *svsFutureWait(svs_future_t *future, int timeout_ms);
+svs_err_t *svsFutureWaitAll(svs_future_t **future, int cnt, int timeout_ms);
+svs_err_t *svsFutureWaitAny(svs_future_t **future, int cnt, int timeout_ms, int *index);
+svs_err_t *svsFutureThen(svs_future_t *future, svs_future_fn_t fn, void *arg);
+svs_err_t *svsFutureRspGet(svs_future_t *future, void *rsp, uint16_t rsp_len);
+void svsFutureRelease(svs_future_t *future);
+
 
 // ------------------------------------------------------------------
 //  KR
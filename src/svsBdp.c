@@ -1,10 +1,13 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <termios.h>
+#include <time.h>
 #include <fcntl.h>
 #include <netinet/in.h>
 
@@ -15,7 +18,9 @@
 #include <svsCallback.h>
 #include <svsSocket.h>
 #include <svsBdp.h>
+#include <svsShm.h>
 #include <svsConfig.h>
+#include <svsImage.h>
 #include <crc.h>
 
 //
@@ -47,25 +52,73 @@ static socket_thread_info_t     socket_thread_info_tx;
 static socket_thread_info_t     socket_thread_info_rx;
 static int                      svsCallbackSockFd           = -1;
 static bdp_node_t               *bdp_node_head              = 0;
+static bdp_sweep_info_t         bdp_sweep;
+static pthread_mutex_t          mutexSweep;                 // only one sweep runs at a time
+static bdp_scan_info_t          bdp_scan;
+static pthread_mutex_t          mutexScan;                  // only one scan runs at a time
+static bdp_arp_info_t           bdp_arp = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+static bdp_upgrade_info_t       bdp_upgrade;
+static pthread_mutex_t          mutexUpgrade;               // only one firmware upgrade runs at a time
 static pthread_t                frame_thread;
+static pthread_t                coalesce_thread;
+static pthread_mutex_t          mutexCoalesce;
+static pthread_cond_t           condCoalesce;
+static int                      bdp_coalesce_ms             = 0;    // 0: every async frame is forwarded
+static bdp_coalesce_t           *bdp_coalesce               = 0;    // BDP_MAX x BDP_COALESCE_MSG_MAX
+static uint32_t                 bdp_coalesce_cnt            = 0;    // async frames merged into a later one
+static pthread_mutex_t          mutexBdpClient = PTHREAD_MUTEX_INITIALIZER;   // requests come from the server thread and the shared memory links
+static pthread_mutex_t          mutexArpTable = PTHREAD_MUTEX_INITIALIZER;    // ARP table updated by the RX threads, flushed by a scan, saved by its thread
+
+// async messages reporting a state, only the latest one matters to the applications
+// the other async messages (key presses, RFID reads...) are always forwarded one by one
+static const uint8_t            bdp_coalesce_msg[] =
+{
+    MSG_ID_BDP_SWITCH_GET,
+    MSG_ID_BDP_SWITCH_BUSTED_GET,
+    MSG_ID_BDP_BIKE_LOCK_GET,
+    MSG_ID_BDP_MOTOR_GET,
+};
+#define BDP_COALESCE_MSG_MAX    (sizeof(bdp_coalesce_msg) / sizeof(bdp_coalesce_msg[0]))
 pthread_mutex_t                 mutexFrameNodeAccess;       // used to protect the node data
 //pthread_mutex_t                 mutexFrameSend;             // used to protect the svsBdpFrameSend()
 
 static int svsSocketClientBdpHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+static int svsBdpShmAttach(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
 #if BDP_SIMULATOR
 static int svsSocketClientBdpSimHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
 #endif
 static int svsSocketClientBdpDev1Handler(int devFd);
 static int svsSocketClientBdpDev2Handler(int devFd);
 static int svsBdpTx(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+static int svsBdpFrameCreate(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload, uint32_t sweep_id, uint32_t upgrade_id);
+static void svsBdpSweepResultSet(uint32_t sweep_id, uint16_t bdp_num, uint8_t msg_id, uint8_t *payload, uint16_t len);
+static void *svsBdpSweepThread(void *arg);
+static void *svsBdpScanThread(void *arg);
+static void *svsBdpUpgradeThread(void *arg);
+static void svsBdpUpgradeResultSet(uint32_t upgrade_id, uint16_t bdp_num, uint8_t req_msg_id, uint8_t msg_id, uint8_t *req, uint8_t *payload, uint16_t len);
 static int svsBdpRx(int devFd, uint8_t bus);
-static int svsBdpBackoff(uint8_t bus, int64_t timeout_ms);
-static bdp_node_t *svsBdpFrameAdd(bdp_node_t *node_head, svsSocketMsgHeader_t *hdr, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload);
-static int svsBdpFrameFindAndRemove(bdp_node_t *node_head, uint16_t seq, bdp_node_t *node);
+static int svsBdpBackoff(uint8_t bus, int64_t timeout_ms, uint16_t *backoff_iter, int64_t *tx_earliest_us);
+static bdp_node_t *svsBdpFrameAdd(bdp_node_t *node_head, svsSocketMsgHeader_t *hdr, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload, uint32_t sweep_id, uint32_t upgrade_id);
+static int svsBdpFrameFindAndRemove(bdp_node_t *node_head, uint16_t seq, uint16_t dev_num, bdp_node_t *node);
 static int svsBdpFrameSend(int64_t timeout_ms, uint16_t dev_num, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload, uint16_t len);
 static int svsBdpFrameSendBus(uint8_t bus, int64_t timeout_ms, uint16_t dev_num, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload, uint16_t len);
-//static void svsBdpFrameTsentUpdate(bdp_node_t *node);
+static void svsBdpFrameTsentUpdate(uint16_t seq);
+static uint8_t svsBdpMsgIdOrdered(uint8_t msg_id);
+static uint8_t svsBdpNodeIsBefore(bdp_node_t *node1, bdp_node_t *node2);
+static uint8_t svsBdpFrameWindowCheck(bdp_node_t *node);
 static void *svsBdpFrameThread(void *arg);
+static int svsBdpBusTxQueueInit(uint8_t bus);
+static int svsBdpBusTxEnqueue(uint8_t bus, int64_t timeout_ms, uint16_t dev_num, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload, uint16_t len);
+static void *svsBdpBusTxThread(void *arg);
+static int svsBdpCoalesceInit(void);
+static int svsBdpCoalesce(uint16_t bdp_num, uint8_t msg_id, uint8_t *payload, uint16_t len);
+static void *svsBdpCoalesceThread(void *arg);
+static int svsBdpArpLoad(void);
+static int svsBdpArpSave(void);
+static void svsBdpArpChanged(void);
+static void svsBdpArpVerified(uint16_t bdp_num);
+static void *svsBdpArpSaveThread(void *arg);
+static void *svsBdpArpVerifyThread(void *arg);
 
 static char *msgIDStrings[] =
 {
@@ -153,6 +206,35 @@ int svsBdpServerInit(void)
     svsConfigParamIntGet("bdp", "baudrate2", BDP_DEV_DEFAULT_BAUDRATE, &bdp_dev_info.bdp_bus_dev_info[1].baudRate);
     bdp_dev_info.bdp_bus_dev_info[1].devFd    = -1;
 
+    svsConfigParamIntGet("bdp", "window", BDP_WINDOW_DEFAULT, &bdp_dev_info.window);
+    if(bdp_dev_info.window < 1 || bdp_dev_info.window > BDP_WINDOW_MAX)
+    {
+        logWarning("invalid window %d, using %d", bdp_dev_info.window, BDP_WINDOW_DEFAULT);
+        bdp_dev_info.window = BDP_WINDOW_DEFAULT;
+    }
+
+    svsConfigParamIntGet("bdp", "coalesce_ms", 0, &bdp_coalesce_ms);
+    if(bdp_coalesce_ms < 0 || bdp_coalesce_ms > BDP_COALESCE_MS_MAX)
+    {
+        logWarning("invalid coalesce_ms %d, coalescing disabled", bdp_coalesce_ms);
+        bdp_coalesce_ms = 0;
+    }
+
+    svsConfigParamIntGet("bdp", "scan_quiet_ms", BDP_SCAN_QUIET_MS_DEFAULT, &bdp_scan.quiet_ms);
+    if(bdp_scan.quiet_ms < BDP_TIMEOUT_MIN_MS)
+    {
+        logWarning("invalid scan_quiet_ms %d, using %d", bdp_scan.quiet_ms, BDP_SCAN_QUIET_MS_DEFAULT);
+        bdp_scan.quiet_ms = BDP_SCAN_QUIET_MS_DEFAULT;
+    }
+    svsConfigParamIntGet("bdp", "expected", 0, &bdp_scan.expected);
+    if(bdp_scan.expected < 0 || bdp_scan.expected > BDP_MAX)
+    {
+        logWarning("invalid expected %d, ignored", bdp_scan.expected);
+        bdp_scan.expected = 0;
+    }
+
+    svsConfigModuleParamStrGet("bdp", "arp_file", BDP_ARP_FILE_DEFAULT, bdp_arp.path, BDP_ARP_PATH_MAX);
+
     svsConfigParamIntGet("bdp", "loopback", 0, &bdp_dev_info.loopback_enable);
     if(bdp_dev_info.loopback_enable)
     {
@@ -199,6 +281,7 @@ int svsBdpServerInit(void)
     socket_thread_info_tx.fnDev1      = 0;
     socket_thread_info_tx.fnDev2      = 0;
     socket_thread_info_tx.fnThread    = svsSocketServerThread;
+    socket_thread_info_tx.fnClose     = svsShmServerDetach;
     socket_thread_info_tx.len_max     = BDP_MSG_PAYLOAD_MAX;
 
     // create the BDP server
@@ -437,6 +520,49 @@ int svsBdpServerInit(void)
     // set the broadcast address
     memset(&bdp_dev_info.addr_broadcast, 0xFF, BDP_MSG_ADDR_LENGTH);
 
+    // sweep state
+    pthread_condattr_t condAttr;
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&bdp_sweep.mutex, 0);
+    pthread_cond_init(&bdp_sweep.cond, &condAttr);
+    pthread_mutex_init(&mutexSweep, 0);
+
+    // scan state
+    pthread_mutex_init(&bdp_scan.mutex, 0);
+    pthread_cond_init(&bdp_scan.cond, &condAttr);
+    pthread_mutex_init(&mutexScan, 0);
+
+    // firmware upgrade state
+    pthread_mutex_init(&bdp_upgrade.mutex, 0);
+    pthread_cond_init(&bdp_upgrade.cond, &condAttr);
+    pthread_mutex_init(&mutexUpgrade, 0);
+
+    // start one TX thread per bus so that both buses are written concurrently
+    for(i=0;i<BDP_BUS_DEV_MAX;i++)
+    {
+        if(bdp_dev_info.bdp_bus_dev_info[i].devFd < 0)
+        {   // bus not in use
+            continue;
+        }
+        rc = svsBdpBusTxQueueInit(i);
+        if(rc != ERR_PASS)
+        {
+            logError("failed to start TX thread for bus %d", i);
+            return(rc);
+        }
+    }
+
+    if(bdp_coalesce_ms > 0)
+    {
+        rc = svsBdpCoalesceInit();
+        if(rc != ERR_PASS)
+        {
+            logError("failed to start async coalescing");
+            return(rc);
+        }
+    }
+
     // start the frame thread: this is the frame manager
     int status;
     status = pthread_create(&frame_thread, 0, svsBdpFrameThread, 0);
@@ -455,6 +581,34 @@ int svsBdpServerInit(void)
     pthread_mutexattr_setrobust_np(&mutexAttr, PTHREAD_MUTEX_ROBUST_NP);
     pthread_mutex_init(&mutexFrameNodeAccess, &mutexAttr);
 
+    // ARP table learned before svsd restarted, the BDPs are usable right away and verified in the background
+    if(bdp_arp.path[0] != '\0')
+    {
+        pthread_t thread;
+
+        if(svsBdpArpLoad() == ERR_PASS)
+        {
+            status = pthread_create(&thread, 0, svsBdpArpVerifyThread, 0);
+            if(status != 0)
+            {
+                logError("pthread_create: %s", strerror(status));
+            }
+            else
+            {
+                pthread_detach(thread);
+            }
+        }
+        status = pthread_create(&thread, 0, svsBdpArpSaveThread, 0);
+        if(status != 0)
+        {
+            logError("pthread_create: %s", strerror(status));
+        }
+        else
+        {
+            pthread_detach(thread);
+        }
+    }
+
     return(rc);
 }
 
@@ -485,6 +639,11 @@ static int svsSocketClientBdpHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint
         return(ERR_FAIL);
     }
 
+    if(hdr->module_id == MODULE_ID_SHM)
+    {   // the client moves its requests to a shared memory link
+        return(svsBdpShmAttach(sockFd, hdr, payload));
+    }
+
     // Validate msg ID
     if(hdr->u.bdphdr.msg_id >= MSG_ID_BDP_MAX)
     {
@@ -502,6 +661,9 @@ static int svsSocketClientBdpHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint
     }
 
     int i, start, end;
+
+    pthread_mutex_lock(&mutexBdpClient);
+
     // Update request field
     if(hdr->dev_num == BDP_NUM_ALL)
     {
@@ -543,6 +705,9 @@ static int svsSocketClientBdpHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint
 
     // send message to BDP protocol
     rc = svsBdpTx(sockFd, hdr, payload);
+
+    pthread_mutex_unlock(&mutexBdpClient);
+
     if(rc != ERR_PASS)
     {
         logError("");
@@ -552,6 +717,40 @@ static int svsSocketClientBdpHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint
     return(rc);
 }
 
+//
+// Description:
+// Maps the shared memory segment named in the payload, the requests of the client then come from its link
+// and the responses go back through it. The answer is sent on the link when it was set up, on the socket otherwise.
+//
+static int svsBdpShmAttach(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    int rc;
+    int shmFd = sockFd;
+    char name[SVS_SHM_NAME_MAX];
+    svsSocketMsgHeader_t rsp_hdr;
+
+    memset(name, 0, sizeof(name));
+    if(payload != 0)
+    {
+        memcpy(name, payload, MIN(hdr->len, sizeof(name) - 1));
+    }
+
+    rc = svsShmServerAttach(name, sockFd, svsSocketClientBdpHandler, &shmFd);
+    if(rc != ERR_PASS)
+    {
+        logError("client %s on socket %d: shared memory %s not attached", hdr->appName, sockFd, name);
+        shmFd = sockFd;
+    }
+
+    memset(&rsp_hdr, 0, sizeof(rsp_hdr));
+    snprintf(rsp_hdr.appName, sizeof(rsp_hdr.appName), "%s", svsAppNameGet());
+    rsp_hdr.module_id         = MODULE_ID_SHM;
+    rsp_hdr.seq               = hdr->seq;
+    rsp_hdr.u.svshdr.status   = rc;
+
+    return(svsSocketSend(shmFd, &rsp_hdr, 0));
+}
+
 //
 // Description:
 // Called when data becomes available to be read from the device BDP protocol
@@ -708,6 +907,8 @@ int svsBdpArpTableUpdate(uint8_t bus, bdp_addr_t *addr)
         return(ERR_FAIL);
     }
 
+    pthread_mutex_lock(&mutexArpTable);
+
     // Make sure the new address does not exist
     for(i=0; i<bdp_dev_info.bdp_max; i++)
     {
@@ -715,6 +916,15 @@ int svsBdpArpTableUpdate(uint8_t bus, bdp_addr_t *addr)
         {   // address already in the table
             found = 1;
             //logDebug("BDP %d address already in the ARP table", i);
+            if(bdp_state[i].bdp_bus != bus)
+            {   // the BDP was moved to the other bus
+                logInfo("BDP %d moved from bus %d to bus %d", i, bdp_state[i].bdp_bus, bus);
+                bdp_dev_info.bdp_bus_dev_info[bdp_state[i].bdp_bus].bdp_max--;
+                bdp_dev_info.bdp_bus_dev_info[bus].bdp_max++;
+                bdp_state[i].bdp_bus = bus;
+                svsBdpArpChanged();
+            }
+            svsBdpArpVerified(i);
             break;
         }
     }
@@ -723,6 +933,7 @@ int svsBdpArpTableUpdate(uint8_t bus, bdp_addr_t *addr)
     {
         if(bdp_dev_info.bdp_max >= BDP_MAX)
         {
+            pthread_mutex_unlock(&mutexArpTable);
             logError("BDP number exceeded limit");
             return(ERR_FAIL);
         }
@@ -732,15 +943,19 @@ int svsBdpArpTableUpdate(uint8_t bus, bdp_addr_t *addr)
         // Address not found in the ARP table, update the ARP table with the new address
         memcpy(&bdp_state[i].bdp_addr, addr, sizeof(bdp_addr_t));
         bdp_state[i].bdp_bus = bus;
+        bdp_state[i].bdp_verified = 1;
         // Update BDP index
         bdp_dev_info.bdp_max++;
         bdp_dev_info.bdp_bus_dev_info[bus].bdp_max++;
+        svsBdpArpChanged();
         logInfo("BDP %d address updated into ARP table", i);
         logInfo("Total BDP detected: %d", bdp_dev_info.bdp_max);
         logInfo("Total BDP detected on bus 0: %d", bdp_dev_info.bdp_bus_dev_info[0].bdp_max);
         logInfo("Total BDP detected on bus 1: %d", bdp_dev_info.bdp_bus_dev_info[1].bdp_max);
     }
 
+    pthread_mutex_unlock(&mutexArpTable);
+
     return(rc);
 }
 
@@ -748,13 +963,299 @@ void svsArpTableFlush(void)
 {
     int i;
 
+    pthread_mutex_lock(&mutexArpTable);
+
     // Fill address with 0
     for(i=0; i<bdp_dev_info.bdp_max; i++)
     {
         memset(&bdp_state[i].bdp_addr, 0, sizeof(bdp_addr_t));
+        bdp_state[i].bdp_verified = 0;
     }
 
     bdp_dev_info.bdp_max = 0;
+    for(i=0; i<BDP_BUS_DEV_MAX; i++)
+    {
+        bdp_dev_info.bdp_bus_dev_info[i].bdp_max = 0;
+    }
+    svsBdpArpChanged();
+
+    pthread_mutex_unlock(&mutexArpTable);
+}
+
+//
+// Description:
+// Loads the ARP table saved before svsd restarted, the file is ignored when it is not valid as a partial table
+// would give different BDP numbers. The entries are used right away and marked as not verified until the BDP is heard from.
+//
+static int svsBdpArpLoad(void)
+{
+    int rc = ERR_FAIL;
+    int fd;
+    uint16_t i, j;
+    bdp_arp_file_hdr_t hdr;
+    bdp_arp_file_entry_t entry[BDP_MAX];
+    bdp_addr_t addr_zero;
+
+    fd = open(bdp_arp.path, O_RDONLY);
+    if(fd < 0)
+    {
+        if(errno == ENOENT)
+        {
+            logInfo("no ARP table saved in %s, a scan is needed", bdp_arp.path);
+        }
+        else
+        {
+            logWarning("failed to open file %s: %s", bdp_arp.path, strerror(errno));
+        }
+        return(ERR_FAIL);
+    }
+
+    if(read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+    {
+        logWarning("%s: header too short", bdp_arp.path);
+        goto _svsBdpArpLoad;
+    }
+    if((hdr.magic != BDP_ARP_FILE_MAGIC) || (hdr.version != BDP_ARP_FILE_VERSION) || (hdr.count > BDP_MAX))
+    {
+        logWarning("%s: invalid header, magic 0x%08x version %d count %d", bdp_arp.path, hdr.magic, hdr.version, hdr.count);
+        goto _svsBdpArpLoad;
+    }
+    if(read(fd, entry, hdr.count * sizeof(bdp_arp_file_entry_t)) != (ssize_t)(hdr.count * sizeof(bdp_arp_file_entry_t)))
+    {
+        logWarning("%s: %d entries expected", bdp_arp.path, hdr.count);
+        goto _svsBdpArpLoad;
+    }
+    if(crc16_compute((uint8_t *)entry, hdr.count * sizeof(bdp_arp_file_entry_t)) != hdr.crc)
+    {
+        logWarning("%s: CRC mismatch", bdp_arp.path);
+        goto _svsBdpArpLoad;
+    }
+
+    memset(&addr_zero, 0, sizeof(bdp_addr_t));
+    for(i=0; i<hdr.count; i++)
+    {
+        if((entry[i].bus >= BDP_BUS_DEV_MAX) ||
+           (svsBdpAddrMatch(&entry[i].addr, &addr_zero) == ERR_PASS) ||
+           (svsBdpAddrMatch(&entry[i].addr, &bdp_dev_info.addr_broadcast) == ERR_PASS))
+        {
+            logWarning("%s: invalid entry %d", bdp_arp.path, i);
+            goto _svsBdpArpLoad;
+        }
+        for(j=0; j<i; j++)
+        {
+            if(svsBdpAddrMatch(&entry[i].addr, &entry[j].addr) == ERR_PASS)
+            {
+                logWarning("%s: entries %d and %d have the same address", bdp_arp.path, j, i);
+                goto _svsBdpArpLoad;
+            }
+        }
+    }
+
+    for(i=0; i<hdr.count; i++)
+    {
+        memcpy(&bdp_state[i].bdp_addr, &entry[i].addr, sizeof(bdp_addr_t));
+        bdp_state[i].bdp_bus      = entry[i].bus;
+        bdp_state[i].bdp_verified = 0;
+        bdp_dev_info.bdp_bus_dev_info[entry[i].bus].bdp_max++;
+    }
+    bdp_dev_info.bdp_max = hdr.count;
+    bdp_arp.loaded       = hdr.count;
+    logInfo("%d BDPs preloaded from %s, %d on bus 0, %d on bus 1", hdr.count, bdp_arp.path,
+            bdp_dev_info.bdp_bus_dev_info[0].bdp_max, bdp_dev_info.bdp_bus_dev_info[1].bdp_max);
+    rc = (hdr.count != 0) ? ERR_PASS : ERR_FAIL;
+
+    _svsBdpArpLoad:
+
+    close(fd);
+
+    return(rc);
+}
+
+//
+// Description:
+// Writes the ARP table to a temporary file renamed over the previous one, a power loss leaves either table complete.
+//
+static int svsBdpArpSave(void)
+{
+    int rc = ERR_PASS;
+    int fd;
+    uint16_t i;
+    char tmp[BDP_ARP_PATH_MAX + 4];
+    bdp_arp_file_hdr_t hdr;
+    bdp_arp_file_entry_t entry[BDP_MAX];
+
+    // snapshot of the table, a scan may flush it meanwhile
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic   = BDP_ARP_FILE_MAGIC;
+    hdr.version = BDP_ARP_FILE_VERSION;
+    pthread_mutex_lock(&mutexArpTable);
+    hdr.count   = bdp_dev_info.bdp_max;
+    for(i=0; i<hdr.count; i++)
+    {
+        memcpy(&entry[i].addr, &bdp_state[i].bdp_addr, sizeof(bdp_addr_t));
+        entry[i].bus = bdp_state[i].bdp_bus;
+    }
+    pthread_mutex_unlock(&mutexArpTable);
+    hdr.crc = crc16_compute((uint8_t *)entry, hdr.count * sizeof(bdp_arp_file_entry_t));
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", bdp_arp.path);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        logError("failed to open file %s: %s", tmp, strerror(errno));
+        return(ERR_FAIL);
+    }
+    if((write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) ||
+       (write(fd, entry, hdr.count * sizeof(bdp_arp_file_entry_t)) != (ssize_t)(hdr.count * sizeof(bdp_arp_file_entry_t))))
+    {
+        logError("write %s: %s", tmp, strerror(errno));
+        rc = ERR_FAIL;
+    }
+    if((rc == ERR_PASS) && (fsync(fd) < 0))
+    {
+        logError("fsync %s: %s", tmp, strerror(errno));
+        rc = ERR_FAIL;
+    }
+    close(fd);
+
+    if(rc != ERR_PASS)
+    {
+        unlink(tmp);
+        return(rc);
+    }
+    if(rename(tmp, bdp_arp.path) < 0)
+    {
+        logError("rename %s: %s", bdp_arp.path, strerror(errno));
+        unlink(tmp);
+        return(ERR_FAIL);
+    }
+    logDebug("ARP table saved, %d BDPs", hdr.count);
+
+    return(rc);
+}
+
+//
+// Description:
+// Called when the ARP table changed, the save thread writes it shortly after so the RX threads never wait on the file.
+//
+static void svsBdpArpChanged(void)
+{
+    pthread_mutex_lock(&bdp_arp.mutex);
+    bdp_arp.dirty = 1;
+    pthread_cond_signal(&bdp_arp.cond);
+    pthread_mutex_unlock(&bdp_arp.mutex);
+}
+
+static void svsBdpArpVerified(uint16_t bdp_num)
+{
+    if(bdp_state[bdp_num].bdp_verified == 0)
+    {
+        bdp_state[bdp_num].bdp_verified = 1;
+        logDebug("BDP %d address verified", bdp_num);
+    }
+}
+
+static void *svsBdpArpSaveThread(void *arg)
+{
+    while(1)
+    {
+        pthread_mutex_lock(&bdp_arp.mutex);
+        while(bdp_arp.dirty == 0)
+        {
+            pthread_cond_wait(&bdp_arp.cond, &bdp_arp.mutex);
+        }
+        pthread_mutex_unlock(&bdp_arp.mutex);
+
+        // let a scan add its entries, they are saved together
+        usleep(BDP_ARP_SAVE_DELAY_MS * 1000);
+
+        pthread_mutex_lock(&bdp_arp.mutex);
+        bdp_arp.dirty = 0;
+        pthread_mutex_unlock(&bdp_arp.mutex);
+
+        svsBdpArpSave();
+    }
+
+    return(arg);
+}
+
+//
+// Description:
+// Sends a targeted MSG_ID_BDP_ADDR_GET to each preloaded BDP not heard from yet, any frame received from the BDP
+// verifies it as well. The BDPs that never answered keep their number, only a scan rebuilds the table.
+//
+static void *svsBdpArpVerifyThread(void *arg)
+{
+    int rc;
+    int tries;
+    uint16_t i, pending;
+    bdp_address_get_msg_req_t req;
+    svsSocketMsgHeader_t hdr;
+
+    // a scan flushes the table, nothing is left to verify after it
+    pthread_mutex_lock(&mutexScan);
+
+    memset(&req, 0, sizeof(req));
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.module_id           = MODULE_ID_BDP;
+    hdr.len                 = sizeof(req);
+    hdr.u.bdphdr.msg_id     = MSG_ID_BDP_ADDR_GET;
+
+    for(tries=0; tries<BDP_ARP_VERIFY_TRIES; tries++)
+    {
+        pending = 0;
+        i = 0;
+        while(i < bdp_dev_info.bdp_max)
+        {
+            if(bdp_state[i].bdp_verified)
+            {
+                i++;
+                continue;
+            }
+            // no timeout, the response is handled as any ARP response
+            hdr.dev_num  = i;
+            hdr.tsent_ms = svsTimeGet_ms();
+            rc = svsBdpFrameCreate(-1, &hdr, (uint8_t *)&req, 0, 0);
+            if(rc == ERR_BUSY)
+            {   // the frame manager is full, try again
+                usleep(BDP_TIMEOUT_MIN_MS * 1000);
+                continue;
+            }
+            if(rc != ERR_PASS)
+            {
+                logError("ARP request not sent to BDP %d: %d", i, rc);
+            }
+            pending++;
+            i++;
+        }
+        if(pending == 0)
+        {
+            break;
+        }
+        usleep(BDP_ARP_VERIFY_MS * 1000);
+    }
+
+    pending = 0;
+    for(i=0; i<bdp_dev_info.bdp_max; i++)
+    {
+        if(bdp_state[i].bdp_verified == 0)
+        {
+            logWarning("BDP %d preloaded from the ARP table did not answer", i);
+            pending++;
+        }
+    }
+    if(pending != 0)
+    {
+        logWarning("%d of %d preloaded BDPs not verified, a scan rebuilds the ARP table", pending, bdp_arp.loaded);
+    }
+    else
+    {
+        logInfo("ARP table verified, %d BDPs", bdp_dev_info.bdp_max);
+    }
+
+    pthread_mutex_unlock(&mutexScan);
+
+    return(arg);
 }
 
 //
@@ -968,6 +1469,11 @@ int svsBdpRx(int devFd, uint8_t bus)
             {
                 logError("ARP table not updated");
             }
+            // wake up the scan in progress
+            pthread_mutex_lock(&bdp_scan.mutex);
+            bdp_scan.responses++;
+            pthread_cond_signal(&bdp_scan.cond);
+            pthread_mutex_unlock(&bdp_scan.mutex);
             // we are done
             continue;
         }
@@ -982,6 +1488,7 @@ int svsBdpRx(int devFd, uint8_t bus)
         else
         {
             logDebug("Received frame %d from BDP %d", bdp_bus->frame_rx.hdr.seq, bdp_num);
+            svsBdpArpVerified(bdp_num);
 
             // we have the BDP number, update the response field
             if(bdp_state[bdp_num].id_data_addr[msgID].rsp != 0)
@@ -1034,7 +1541,7 @@ int svsBdpRx(int devFd, uint8_t bus)
             do
             {
                 // Find the request associated with this response frame
-                rc = svsBdpFrameFindAndRemove(bdp_node_head, bdp_bus->frame_rx.hdr.seq, &node);
+                rc = svsBdpFrameFindAndRemove(bdp_node_head, bdp_bus->frame_rx.hdr.seq, bdp_num, &node);
                 if(rc != ERR_PASS)
                 {   // frame received but was not in the list
                     logError("Received unexpected frame %d from BDP %d msgID %s", bdp_bus->frame_rx.hdr.seq, bdp_num, msgIDToString(msgID));
@@ -1054,6 +1561,19 @@ int svsBdpRx(int devFd, uint8_t bus)
                     break;
                 }
 
+                if(node.d.sweep_id != 0)
+                {   // response to a station-wide sweep, the sweep thread reports it to the client
+                    svsBdpSweepResultSet(node.d.sweep_id, bdp_num, msgID, bdp_bus->frame_rx.payload, bdp_bus->frame_rx.hdr.len);
+                    break;
+                }
+
+                if(node.d.upgrade_id != 0)
+                {   // block or region check of a firmware upgrade, the request tells which one
+                    svsBdpUpgradeResultSet(node.d.upgrade_id, bdp_num, node.d.frame.hdr.msg_id, msgID, node.d.frame.payload,
+                                           bdp_bus->frame_rx.payload, bdp_bus->frame_rx.hdr.len);
+                    break;
+                }
+
                 if((node.d.timeout_ms == 0) && (node.d.callback == 0))
                 {   // should not have received a response for this case
                     logError("Response for frame %d %s unexpected for timeout 0 and callback 0", bdp_bus->frame_rx.hdr.seq, msgIDToString(msgID));
@@ -1084,7 +1604,7 @@ int svsBdpRx(int devFd, uint8_t bus)
 
                 // all conditions were met, now we can send the response to the client
                 logDebug("Sending response to client socket %d", bdp_bus->frame_rx.hdr.sockFd);
-                rc = svsSocketSendBdp(bdp_bus->frame_rx.hdr.sockFd, msgID, bdp_num, 0, 0, 0, 0, bdp_bus->frame_rx.payload, bdp_bus->frame_rx.hdr.len);
+                rc = svsSocketSendBdp(bdp_bus->frame_rx.hdr.sockFd, node.d.seq_client, msgID, bdp_num, 0, 0, 0, 0, bdp_bus->frame_rx.payload, bdp_bus->frame_rx.hdr.len);
                 if(rc != ERR_PASS)
                 {
                     logError("svsSocketSendBdp: %d", bdp_bus->frame_rx.hdr.sockFd);
@@ -1095,6 +1615,11 @@ int svsBdpRx(int devFd, uint8_t bus)
         {   // check to see if the sockFd is 0, this will signify that it is an asynchronous event
             if(bdp_bus->frame_rx.hdr.sockFd == 0)
             {
+                // state updates inside the coalescing window are held back, the latest one is sent at the end
+                if(svsBdpCoalesce(bdp_num, msgID, bdp_bus->frame_rx.payload, bdp_bus->frame_rx.hdr.len))
+                {
+                    continue;
+                }
                 // async message received, send message to callback server
                 logDebug("Sending async frame %d to callback server", bdp_bus->frame_rx.hdr.seq);
                 rc = svsSocketSendCallback(svsCallbackSockFd, MODULE_ID_BDP, bdp_num, msgID, 0, bdp_bus->frame_rx.payload, bdp_bus->frame_rx.hdr.len);
@@ -1121,9 +1646,20 @@ int svsBdpRx(int devFd, uint8_t bus)
 // Send payload to physical BDP
 //
 int svsBdpTx(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    return(svsBdpFrameCreate(sockFd, hdr, payload, 0, 0));
+}
+
+//
+// Description:
+// Build the frame and add it to the list, sweep_id is set when the frame is part of a station-wide sweep
+// and upgrade_id when it carries a block of a firmware upgrade
+//
+static int svsBdpFrameCreate(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload, uint32_t sweep_id, uint32_t upgrade_id)
 {
     int rc;
     uint16_t crc;
+    int seq_tries;
     svsMsgBdpFrameHeader_t frame_hdr;
 
     logDebug("");
@@ -1168,19 +1704,34 @@ int svsBdpTx(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
     frame_hdr.len_inv   = ~frame_hdr.len;
     frame_hdr.msg_id    = hdr->u.bdphdr.msg_id;
     frame_hdr.flags     = hdr->u.bdphdr.flags;
-    frame_hdr.seq       = bdp_dev_info.seq_num;
     frame_hdr.timestamp = svsTimeGet_ms();
 
-    // update sequence number for next frame
-    bdp_dev_info.seq_num++;
-    // limit the sequence number to 255 due to a BDP limitation (fixed in future release)
-    // this limit could be removed once all BDPs deployed have been upgraded with the fix and before
-    // removing this limitation so to avoid any incompatibilities
-    bdp_dev_info.seq_num = bdp_dev_info.seq_num & 0xFF;
-    if(bdp_dev_info.seq_num == 0)
-    {   // avoid sequence 0, as it represents incoming async frames
-        bdp_dev_info.seq_num = 1;
-    }
+    // responses are matched by sequence number, several frames may be pending for the same BDP
+    // so skip the sequence numbers still in use by frames in the list, all of them may be in use
+    pthread_mutex_lock(&mutexFrameNodeAccess);
+    seq_tries = 0;
+    do
+    {
+        if(seq_tries++ == 255)
+        {
+            pthread_mutex_unlock(&mutexFrameNodeAccess);
+            logError("all sequence numbers in use");
+            return(ERR_BUSY);
+        }
+        frame_hdr.seq = bdp_dev_info.seq_num;
+
+        // update sequence number for next frame
+        bdp_dev_info.seq_num++;
+        // limit the sequence number to 255 due to a BDP limitation (fixed in future release)
+        // this limit could be removed once all BDPs deployed have been upgraded with the fix and before
+        // removing this limitation so to avoid any incompatibilities
+        bdp_dev_info.seq_num = bdp_dev_info.seq_num & 0xFF;
+        if(bdp_dev_info.seq_num == 0)
+        {   // avoid sequence 0, as it represents incoming async frames
+            bdp_dev_info.seq_num = 1;
+        }
+    } while(svsBdpNodeFind(bdp_node_head, frame_hdr.seq) != 0);
+    pthread_mutex_unlock(&mutexFrameNodeAccess);
 
     // compute the CRC which includes the header and the payload but not the preamble
     crc = crc16_compute((uint8_t *)&(frame_hdr.len), sizeof(frame_hdr)-sizeof(frame_hdr.crc));
@@ -1189,7 +1740,7 @@ int svsBdpTx(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
 
     // Insert a copy of the frame into the list
     // the periodic thread will take care of sending it
-    svsBdpFrameAdd(bdp_node_head, hdr, &frame_hdr, payload);
+    svsBdpFrameAdd(bdp_node_head, hdr, &frame_hdr, payload, sweep_id, upgrade_id);
 
     //logDebug("");
     return(rc);
@@ -1229,6 +1780,11 @@ static int svsBdpWakeup(int devFd, int bus)
     return(ERR_PASS);
 }
 
+//
+// Description:
+// Queue the frame on the TX queue of the bus the BDP is attached to, or on all buses for a broadcast.
+// The frame is copied, the actual write is done by the bus TX thread so the caller never waits on the bus.
+//
 static int svsBdpFrameSend(int64_t timeout_ms, uint16_t dev_num, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload, uint16_t payload_len)
 {
     int rc = ERR_PASS;
@@ -1236,13 +1792,13 @@ static int svsBdpFrameSend(int64_t timeout_ms, uint16_t dev_num, svsMsgBdpFrameH
 
     if(dev_num == BDP_NUM_ALL)
     {
-        rc1 = svsBdpFrameSendBus(0, timeout_ms, dev_num, frame_hdr, payload, payload_len);
+        rc1 = svsBdpBusTxEnqueue(0, timeout_ms, dev_num, frame_hdr, payload, payload_len);
         if(rc1 != ERR_PASS)
         {
             logError("");
             rc = rc1;
         }
-        rc2 = svsBdpFrameSendBus(1, timeout_ms, dev_num, frame_hdr, payload, payload_len);
+        rc2 = svsBdpBusTxEnqueue(1, timeout_ms, dev_num, frame_hdr, payload, payload_len);
         if(rc2 != ERR_PASS)
         {
             logError("");
@@ -1252,21 +1808,46 @@ static int svsBdpFrameSend(int64_t timeout_ms, uint16_t dev_num, svsMsgBdpFrameH
     else
     {
         uint8_t bus = bdp_state[dev_num].bdp_bus;
-        rc = svsBdpFrameSendBus(bus, timeout_ms, dev_num, frame_hdr, payload, payload_len);
+        rc = svsBdpBusTxEnqueue(bus, timeout_ms, dev_num, frame_hdr, payload, payload_len);
     }
 
     return(rc);
 }
 
-static int svsBdpFrameSendBus(uint8_t bus, int64_t timeout_ms, uint16_t dev_num, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload, uint16_t payload_len)
+static int svsBdpBusTxQueueInit(uint8_t bus)
 {
-    int rc = ERR_PASS;
-    int len;
-    int devFd = bdp_dev_info.bdp_bus_dev_info[bus].devFd;
+    int status;
+    bdp_bus_tx_queue_t *q = &bdp_dev_info.bdp_bus_dev_info[bus].tx_queue;
 
-//    logDebug("bus %d", bus);
+    q->head  = 0;
+    q->tail  = 0;
+    q->count = 0;
 
-    if(devFd < 0)
+    pthread_mutex_init(&q->mutex, 0);
+    pthread_cond_init(&q->cond, 0);
+
+    status = pthread_create(&q->thread, 0, svsBdpBusTxThread, (void *)&bdp_dev_info.bdp_bus_dev_info[bus]);
+    if(status != 0)
+    {
+        logError("pthread_create: %s", strerror(status));
+        return(ERR_FAIL);
+    }
+
+    return(ERR_PASS);
+}
+
+static int svsBdpBusTxEnqueue(uint8_t bus, int64_t timeout_ms, uint16_t dev_num, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload, uint16_t payload_len)
+{
+    int rc = ERR_PASS;
+    bdp_bus_tx_queue_t *q;
+    bdp_bus_tx_job_t *job;
+
+    if(bus >= BDP_BUS_DEV_MAX)
+    {
+        logError("invalid bus %d", bus);
+        return(ERR_FAIL);
+    }
+    if(bdp_dev_info.bdp_bus_dev_info[bus].devFd < 0)
     {
         return(ERR_FAIL);
     }
@@ -1275,58 +1856,170 @@ static int svsBdpFrameSendBus(uint8_t bus, int64_t timeout_ms, uint16_t dev_num,
         logError("frame_hdr 0");
         return(ERR_FAIL);
     }
-    // Perform backoff
-    rc = svsBdpBackoff(bus, timeout_ms);
-    if(rc != ERR_PASS)
+    if(payload_len > BDP_MSG_PAYLOAD_MAX)
     {
-        return(rc);
+        logError("payload too large %d", payload_len);
+        return(ERR_FAIL);
     }
 
-    // Wakeup BDPs if asleep
-    rc = svsBdpWakeup(devFd, bus);
-    if(rc != ERR_PASS)
+    q = &bdp_dev_info.bdp_bus_dev_info[bus].tx_queue;
+
+    pthread_mutex_lock(&q->mutex);
+
+    if(q->count >= BDP_BUS_TX_QUEUE_MAX)
     {
-        goto _svsBdpFrameSendBus;
+        logWarning("bus %d TX queue full, frame %d dropped", bus, frame_hdr->seq);
+        rc = ERR_BUSY;
+        goto _svsBdpBusTxEnqueue;
     }
 
-    //logDebug("Sending BDP %d frame %d %s", dev_num, frame_hdr->seq, msgIDToString(frame_hdr->msg_id));
+    job = &q->job[q->tail];
+    job->dev_num    = dev_num;
+    job->timeout_ms = timeout_ms;
+    memcpy(&job->frame.hdr, frame_hdr, sizeof(svsMsgBdpFrameHeader_t));
+    if(payload != 0 && payload_len != 0)
+    {
+        memcpy(job->frame.payload, payload, payload_len);
+    }
 
-    // send the preamble
-    len = svsDevWrite(devFd, (uint8_t *)&bdp_dev_info.preamble, sizeof(bdp_dev_info.preamble));
-    if(len < 0)
+    q->tail = (q->tail + 1) % BDP_BUS_TX_QUEUE_MAX;
+    q->count++;
+
+    pthread_cond_signal(&q->cond);
+
+    _svsBdpBusTxEnqueue:
+    pthread_mutex_unlock(&q->mutex);
+
+    return(rc);
+}
+
+//
+// Description:
+// Sleep until the absolute monotonic time given in us, used by the bus TX thread to honor the backoff.
+//
+static void svsBdpSleepUntil(int64_t time_us)
+{
+    struct timespec ts;
+
+    ts.tv_sec  = time_us / 1000000;
+    ts.tv_nsec = (time_us % 1000000) * 1000;
+
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR)
     {
-        logError("svsDevWrite name %s devFd %d",bdp_dev_info.bdp_bus_dev_info[bus].devName, bdp_dev_info.bdp_bus_dev_info[bus].devFd);
-        rc = ERR_FAIL;
-        goto _svsBdpFrameSendBus;
     }
-    else
+}
+
+//
+// Description:
+// One thread per bus, writes the queued frames to the bus device.
+// Backoff, wakeup and write delays on one bus do not affect the other bus nor the frame manager.
+//
+static void *svsBdpBusTxThread(void *arg)
+{
+    int rc;
+    uint8_t bus;
+    bdp_bus_dev_info_t *bdp_bus = (bdp_bus_dev_info_t *)arg;
+    bdp_bus_tx_queue_t *q       = &bdp_bus->tx_queue;
+    bdp_bus_tx_job_t   job;
+    uint16_t           backoff_iter;
+    int64_t            tx_earliest_us;
+
+    bus = bdp_bus - &bdp_dev_info.bdp_bus_dev_info[0];
+
+    while(1)
     {
-        if(len != sizeof(bdp_dev_info.preamble))
+        pthread_mutex_lock(&q->mutex);
+        while(q->count == 0)
         {
-            logError("write incomplete: wrote %d instead of %d", len, sizeof(bdp_dev_info.preamble));
-            rc = ERR_FAIL;
-            goto _svsBdpFrameSendBus;
+            pthread_cond_wait(&q->cond, &q->mutex);
+        }
+        // copy the job out so the queue is not held while writing to the bus
+        memcpy(&job.frame.hdr, &q->job[q->head].frame.hdr, sizeof(svsMsgBdpFrameHeader_t));
+        memcpy(job.frame.payload, q->job[q->head].frame.payload, job.frame.hdr.len);
+        job.dev_num    = q->job[q->head].dev_num;
+        job.timeout_ms = q->job[q->head].timeout_ms;
+        q->head = (q->head + 1) % BDP_BUS_TX_QUEUE_MAX;
+        q->count--;
+        pthread_mutex_unlock(&q->mutex);
+
+        // wait until the bus is free, the frame is dropped after too many backoffs
+        backoff_iter = 0;
+        while(1)
+        {
+            rc = svsBdpBackoff(bus, job.timeout_ms, &backoff_iter, &tx_earliest_us);
+            if(rc != ERR_PASS || tx_earliest_us <= svsTimeGet_us())
+            {
+                break;
+            }
+            svsBdpSleepUntil(tx_earliest_us);
+        }
+        if(rc != ERR_PASS)
+        {
+            logError("bus %d frame %d dropped by backoff", bus, job.frame.hdr.seq);
+            continue;
+        }
+
+        rc = svsBdpFrameSendBus(bus, job.timeout_ms, job.dev_num, &job.frame.hdr, job.frame.payload, job.frame.hdr.len);
+        if(rc != ERR_PASS)
+        {
+            logError("bus %d frame %d not sent", bus, job.frame.hdr.seq);
+            continue;
+        }
+        STATS_INC(bdp_bus->bus_stats.tx_frame_cnt);
+
+        if(job.dev_num != BDP_NUM_ALL)
+        {   // the response timeout starts once the frame is on the bus
+            svsBdpFrameTsentUpdate(job.frame.hdr.seq);
         }
     }
-    // send the header
-    len = svsDevWrite(devFd, (uint8_t *)frame_hdr, sizeof(svsMsgBdpFrameHeader_t));
-    if(len < 0)
+
+    return(arg);
+}
+
+static int svsBdpFrameSendBus(uint8_t bus, int64_t timeout_ms, uint16_t dev_num, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload, uint16_t payload_len)
+{
+    int rc = ERR_PASS;
+    int len, total_len;
+    int devFd = bdp_dev_info.bdp_bus_dev_info[bus].devFd;
+    uint8_t frame_tx[sizeof(svsMsgBdpFramePreamble_t) + sizeof(svsMsgBdpFrame_t)];
+
+//    logDebug("bus %d", bus);
+
+    if(devFd < 0)
+    {
+        return(ERR_FAIL);
+    }
+    if(frame_hdr == 0)
+    {
+        logError("frame_hdr 0");
+        return(ERR_FAIL);
+    }
+    if(payload_len > BDP_MSG_PAYLOAD_MAX)
+    {
+        logError("payload too large %d", payload_len);
+        return(ERR_FAIL);
+    }
+    // Wakeup BDPs if asleep
+    rc = svsBdpWakeup(devFd, bus);
+    if(rc != ERR_PASS)
     {
-        logError("svsDevWrite name %s devFd %d",bdp_dev_info.bdp_bus_dev_info[bus].devName, bdp_dev_info.bdp_bus_dev_info[bus].devFd);
-        rc = ERR_FAIL;
         goto _svsBdpFrameSendBus;
     }
-    else
+
+    //logDebug("Sending BDP %d frame %d %s", dev_num, frame_hdr->seq, msgIDToString(frame_hdr->msg_id));
+
+    // assemble preamble, header and payload so the frame goes out with a single write,
+    // separate writes add latency and may create inter-byte gaps seen as a frame break by the BDPs
+    total_len = sizeof(bdp_dev_info.preamble) + sizeof(svsMsgBdpFrameHeader_t) + payload_len;
+    memcpy(&frame_tx[0], &bdp_dev_info.preamble, sizeof(bdp_dev_info.preamble));
+    memcpy(&frame_tx[sizeof(bdp_dev_info.preamble)], frame_hdr, sizeof(svsMsgBdpFrameHeader_t));
+    if(payload_len != 0)
     {
-        if(len != sizeof(svsMsgBdpFrameHeader_t))
-        {
-            logError("write incomplete: wrote %d instead of %d", len, sizeof(svsMsgBdpFrameHeader_t));
-            rc = ERR_FAIL;
-            goto _svsBdpFrameSendBus;
-        }
+        memcpy(&frame_tx[sizeof(bdp_dev_info.preamble) + sizeof(svsMsgBdpFrameHeader_t)], payload, payload_len);
     }
-    // send the payload
-    len = svsDevWrite(devFd, payload, payload_len);
+
+    // send the frame
+    len = svsDevWrite(devFd, frame_tx, total_len);
     if(len < 0)
     {
         logError("svsDevWrite name %s devFd %d",bdp_dev_info.bdp_bus_dev_info[bus].devName, bdp_dev_info.bdp_bus_dev_info[bus].devFd);
@@ -1335,9 +2028,9 @@ static int svsBdpFrameSendBus(uint8_t bus, int64_t timeout_ms, uint16_t dev_num,
     }
     else
     {
-        if(len != payload_len)
+        if(len != total_len)
         {
-            logError("write incomplete: wrote %d instead of %d", len, payload_len);
+            logError("write incomplete: wrote %d instead of %d", len, total_len);
             rc = ERR_FAIL;
             goto _svsBdpFrameSendBus;
         }
@@ -1350,8 +2043,6 @@ static int svsBdpFrameSendBus(uint8_t bus, int64_t timeout_ms, uint16_t dev_num,
 
     if(rc == ERR_PASS)
     {
-        int total_len;
-        total_len = sizeof(bdp_dev_info.preamble) + sizeof(svsMsgBdpFrameHeader_t) + payload_len;
         logDebug("Sent %d bytes on bus %d BDP %d frame %d %s at %lld ms", total_len, bus, dev_num, frame_hdr->seq, msgIDToString(frame_hdr->msg_id), svsTimeGet_ms());
     }
     else
@@ -1362,62 +2053,75 @@ static int svsBdpFrameSendBus(uint8_t bus, int64_t timeout_ms, uint16_t dev_num,
     return(rc);
 }
 
-static int svsBdpBackoff(uint8_t bus, int64_t timeout_ms)
+//
+// Description:
+// Compute the earliest time a frame can be transmitted on the bus, this function does not sleep.
+// - the inter-frame gap is enforced after the latest TX or RX activity
+// - if the bus had RX activity recently, a random exponential backoff is scheduled, backoff_iter holds
+//   the number of backoffs already performed for the current frame and is incremented on every backoff
+// tx_earliest_us is set to the current time when the frame can be sent right away.
+//
+static int svsBdpBackoff(uint8_t bus, int64_t timeout_ms, uint16_t *backoff_iter, int64_t *tx_earliest_us)
 {
     int rc = ERR_PASS;
-    int64_t delay, tnow;
+    int64_t delay, tnow, tactivity;
+    bdp_bus_dev_info_t *bdp_bus = &bdp_dev_info.bdp_bus_dev_info[bus];
+
+    tnow = svsTimeGet_us();
+    *tx_earliest_us = tnow;
 
     // skip this when loopback is enabled
     if(bdp_dev_info.loopback_enable == 1)
     {
-        return(rc);
+        goto _svsBdpBackoff;
     }
 
     // Compute inter-frame gap (delay between frames) to reduce bus over utilization
-    tnow = svsTimeGet_us();
     // minimum time we last had some bus activity
-    delay = MIN((tnow - bdp_dev_info.bdp_bus_dev_info[bus].timestamp_tx_activity_us),
-                (tnow - bdp_dev_info.bdp_bus_dev_info[bus].timestamp_rx_activity_us));
+    delay = MIN((tnow - bdp_bus->timestamp_tx_activity_us),
+                (tnow - bdp_bus->timestamp_rx_activity_us));
     // check if activity is less than allowed time
     if(delay < BDP_INTER_FRAME_GAP_US)
-    {   // not enough delay in between packets, compute delay
+    {   // not enough delay in between packets, schedule after the gap
         delay = BDP_INTER_FRAME_GAP_US - delay;
         logDebug("bus %d throttling %lld us", bus, delay);
-        // perform gap delay
-        usleep(delay);
+        *tx_earliest_us = tnow + delay;
+        goto _svsBdpBackoff;
     }
 
-#if 1
-    uint16_t j = 0;
-
     // Check for any line activity, if any perform backoff
-    int64_t tactivity;
-    while((svsTimeGet_us() - bdp_dev_info.bdp_bus_dev_info[bus].timestamp_rx_activity_us) < BDP_MIN_LISTEN_US)
+    tactivity = tnow - bdp_bus->timestamp_rx_activity_us;
+    if(tactivity < BDP_MIN_LISTEN_US)
     {
-        tactivity = svsTimeGet_us() - bdp_dev_info.bdp_bus_dev_info[bus].timestamp_rx_activity_us;
-        logDebug("Backoff cnt %d last tactivity %lld usec", j, tactivity);
+        logDebug("Backoff cnt %d last tactivity %lld usec", *backoff_iter, tactivity);
+
+        if(*backoff_iter >= 16)
+        {   // too many retries, cannot send packet
+            STATS_INC(bdp_bus->bus_stats.tx_err_backoff);
+            logError("Backoff delay with too many retries");
+            rc = ERR_FAIL;
+            goto _svsBdpBackoff;
+        }
         //
         // Compute backoff delay
         //
-        STATS_INC(bdp_dev_info.bdp_bus_dev_info[bus].bus_stats.tx_backoff_cnt);
+        STATS_INC(bdp_bus->bus_stats.tx_backoff_cnt);
         // generate random delay
         // - add minimum delay (1 byte duration)
         // - add random number that is a fraction of the average frame size
         // - add an exponential factor that keep on increasing with every iteration
-        //delay = ((rand() * ((1<<j) - 1) * BDP_FRAME_AVG_TIME_US) / RAND_MAX); // get random value (0..2^j-1) * 1000
         delay = rand();
-        delay = (delay * (20*1000)) / RAND_MAX;    // random value from 0..50000
-        //logDebug("delay %lld", delay);
-        delay = delay * (1<<j);                     // delay = delay * (1,2,4,8...)
+        delay = (delay * (20*1000)) / RAND_MAX;    // random value from 0..20000
+        delay = delay * (1<<*backoff_iter);         // delay = delay * (1,2,4,8...)
         delay = delay + BDP_FRAME_AVG_TIME_US;      // delay at least BDP_FRAME_AVG_TIME_US
         delay = MIN(delay, (50*1000));              // put a maximum limit to avoid large delays
 
         logDebug("delay %lld us", delay);
 
         // get the largest delay computed so far
-        if(delay > bdp_dev_info.bdp_bus_dev_info[bus].bus_stats.tx_backoff_delay_max)
+        if(delay > bdp_bus->bus_stats.tx_backoff_delay_max)
         {
-            bdp_dev_info.bdp_bus_dev_info[bus].bus_stats.tx_backoff_delay_max = delay;
+            bdp_bus->bus_stats.tx_backoff_delay_max = delay;
         }
 
         if((timeout_ms != 0) && ((delay/1000) >= timeout_ms))
@@ -1425,19 +2129,13 @@ static int svsBdpBackoff(uint8_t bus, int64_t timeout_ms)
             logWarning("Backoff larger than the timeout %lld ms", delay / 1000);
         }
 
-        j++;
-        if(j>16)
-        {   // too many retries, cannot send packet
-            STATS_INC(bdp_dev_info.bdp_bus_dev_info[bus].bus_stats.tx_err_backoff);
-            logError("Backoff delay with too many retries");
-            rc = ERR_FAIL;
-            break;
-        }
-
-        // perform backoff delay
-        usleep(delay);
+        (*backoff_iter)++;
+        *tx_earliest_us = tnow + delay;
     }
-#endif
+
+    _svsBdpBackoff:
+    bdp_bus->timestamp_tx_earliest_us = *tx_earliest_us;
+
     return(rc);
 }
 
@@ -1739,7 +2437,7 @@ static int svsSocketClientBdpSimHandler(int sockFd, svsSocketMsgHeader_t *hdr, u
         }
     }
 
-    rc = svsSocketSendBdp(sockFd, hdr->u.bdphdr.msg_id, bdp_num, 0, 0, 0, 0, prsp, rsp_len);
+    rc = svsSocketSendBdp(sockFd, hdr->seq, hdr->u.bdphdr.msg_id, bdp_num, 0, 0, 0, 0, prsp, rsp_len);
     if(rc != ERR_PASS)
     {
         logError("svsSocketSendBdp");
@@ -1796,7 +2494,7 @@ int svsBdpPowerGetLocal(uint16_t dev_num, bdp_power_set_msg_req_t **req)
 // All frames to be sent are added. It is up to the periodic thread and the RX thread to remove them from
 // the list.
 //
-bdp_node_t *svsBdpFrameAdd(bdp_node_t *node_head, svsSocketMsgHeader_t *hdr, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload)
+bdp_node_t *svsBdpFrameAdd(bdp_node_t *node_head, svsSocketMsgHeader_t *hdr, svsMsgBdpFrameHeader_t *frame_hdr, uint8_t *payload, uint32_t sweep_id, uint32_t upgrade_id)
 {
     bdp_node_t *node = 0;
     bdp_frame_info_t bdp_frame_info;
@@ -1829,6 +2527,9 @@ bdp_node_t *svsBdpFrameAdd(bdp_node_t *node_head, svsSocketMsgHeader_t *hdr, svs
     bdp_frame_info.tsent_ms             = 0;  // will be updated after sending the frame
     bdp_frame_info.timeout_ms           = hdr->u.bdphdr.timeout_ms;
     bdp_frame_info.callback             = hdr->u.bdphdr.callback;
+    bdp_frame_info.sweep_id             = sweep_id;
+    bdp_frame_info.upgrade_id           = upgrade_id;
+    bdp_frame_info.seq_client           = hdr->seq;
 
     // save actual frame going to the BDP
     memcpy(&bdp_frame_info.frame.hdr, frame_hdr, sizeof(svsMsgBdpFrameHeader_t));
@@ -2040,7 +2741,12 @@ void svsBdpFrameRemove(bdp_node_t *node_head, bdp_node_t *node)
     return;
 }
 
-static int svsBdpFrameFindAndRemove(bdp_node_t *node_head, uint16_t seq, bdp_node_t *node)
+//
+// Description:
+// Removes the frame waiting for the response with this sequence number. The frame stays in the list when it was sent
+// to another BDP, a response with a wrong sequence must not take the frame of the BDP that will answer it.
+//
+static int svsBdpFrameFindAndRemove(bdp_node_t *node_head, uint16_t seq, uint16_t dev_num, bdp_node_t *node)
 {
     int rc = ERR_PASS;
     bdp_node_t *pnode;
@@ -2061,6 +2767,13 @@ static int svsBdpFrameFindAndRemove(bdp_node_t *node_head, uint16_t seq, bdp_nod
         rc = ERR_FAIL;
         goto _svsBdpFrameFindAndRemove;
     }
+    // with several frames pending per BDP, make sure the sequence matched the right BDP
+    if(pnode->d.dev_num != dev_num)
+    {
+        logError("Frame %d sent to BDP %d but response received from BDP %d", seq, pnode->d.dev_num, dev_num);
+        rc = ERR_FAIL;
+        goto _svsBdpFrameFindAndRemove;
+    }
     // copy the node so the caller can use the data at any time and avoid any contention from other threads
     if(node)
     {   // copy if not 0
@@ -2076,6 +2789,104 @@ static int svsBdpFrameFindAndRemove(bdp_node_t *node_head, uint16_t seq, bdp_nod
     return(rc);
 }
 
+//
+// Description:
+// Messages that change the BDP mode or carry an image must not be pipelined,
+// the BDP has to process them one at a time and in order.
+//
+static uint8_t svsBdpMsgIdOrdered(uint8_t msg_id)
+{
+    switch(msg_id)
+    {
+        case MSG_ID_BDP_ADDR_SET:
+        case MSG_ID_BDP_CHANGE_MODE:
+        case MSG_ID_BDP_FIRMWARE_IMAGE_BLOCK_SEND:
+        case MSG_ID_BDP_RESET:
+        case MSG_ID_BDP_BOOTBLOCK_IMAGE_UPLOAD:
+        case MSG_ID_BDP_BOOTBLOCK_IMAGE_INSTALL:
+        case MSG_ID_BDP_COMMS_SET:
+            return(1);
+        default:
+            return(0);
+    }
+}
+
+//
+// Description:
+// Return 1 if node1 is located before node2 in the list.
+//
+static uint8_t svsBdpNodeIsBefore(bdp_node_t *node1, bdp_node_t *node2)
+{
+    bdp_node_t *temp;
+
+    for(temp = node2->prev; temp; temp = temp->prev)
+    {
+        if(temp == node1)
+        {
+            return(1);
+        }
+    }
+    return(0);
+}
+
+//
+// Description:
+// Update the time sent of an active frame, called by the bus TX thread once the frame has been written.
+//
+static void svsBdpFrameTsentUpdate(uint16_t seq)
+{
+    bdp_node_t *node;
+
+    pthread_mutex_lock(&mutexFrameNodeAccess);
+
+    node = svsBdpNodeFind(bdp_node_head, seq);
+    if(node && node->d.state == 1)
+    {
+        node->d.tsent_ms = svsTimeGet_ms();
+    }
+
+    pthread_mutex_unlock(&mutexFrameNodeAccess);
+}
+
+//
+// Description:
+// Return 1 when the idle frame can be sent now:
+// - frames to the same BDP are sent in the order they were queued
+// - the number of active frames for the BDP must be less than the configured window
+// - frames for which the protocol requires ordering are sent alone
+// Must be called with mutexFrameNodeAccess held.
+//
+static uint8_t svsBdpFrameWindowCheck(bdp_node_t *node)
+{
+    bdp_node_t *temp;
+    int active = 0;
+
+    for(temp = bdp_node_head->next; temp; temp = temp->next)
+    {
+        if((temp == node) || (temp->d.dev_num != node->d.dev_num))
+        {
+            continue;
+        }
+        if(temp->d.state == 0)
+        {   // an earlier frame for this BDP is still waiting, keep the order
+            // frames after this node are not considered
+            if(svsBdpNodeIsBefore(temp, node))
+            {
+                return(0);
+            }
+            continue;
+        }
+        // active frame with same dev_num
+        if(svsBdpMsgIdOrdered(temp->d.frame.hdr.msg_id) || svsBdpMsgIdOrdered(node->d.frame.hdr.msg_id))
+        {
+            return(0);
+        }
+        active++;
+    }
+
+    return(active < bdp_dev_info.window ? 1 : 0);
+}
+
 static void *svsBdpFrameThread(void *arg)
 {
     int rc;
@@ -2092,31 +2903,17 @@ static void *svsBdpFrameThread(void *arg)
         while(node)
         {
             if(node->d.state == 0)
-            {   // frame not sent yet, see if another frame with same dev_num is already active
-                temp = bdp_node_head->next;
-                uint8_t send = 1;
-
-                while(temp)
-                {
-                    if(node != temp) // skip this node
-                    {
-                        // look for an active frame
-                        if(temp->d.state == 1)
-                        {   // check to see if it has the same dev_num
-                            if(temp->d.dev_num == node->d.dev_num)
-                            {   // active frame found with same dev_num, we cannot send the frame
-                                send = 0;
-                                break;
-                            }
-                        }
-                    }
-                    // get the next node
-                    temp = temp->next;
-                }
+            {   // frame not sent yet, check the window of frames already active for the same dev_num
+                uint8_t send = svsBdpFrameWindowCheck(node);
 
                 if(send == 1)
-                {   // no other frame found that has same dev_num and is active, send the frame
+                {   // window for this dev_num not full, send the frame
                     rc = svsBdpFrameSend(node->d.timeout_ms, node->d.dev_num, &node->d.frame.hdr, node->d.frame.payload, node->d.frame.hdr.len);
+                    if(rc == ERR_BUSY && node->d.dev_num != BDP_NUM_ALL)
+                    {   // TX queue full, keep the frame idle and try again on the next pass
+                        node = node->next;
+                        continue;
+                    }
                     if(rc != ERR_PASS)
                     {
                         logError("");
@@ -2206,26 +3003,1456 @@ static void *svsBdpFrameThread(void *arg)
     return(arg);
 }
 
-void svsBdpNodePrint(bdp_node_t *node)
+//
+// Description:
+// Station-wide sweep, called by the SVS server when a client requests SVS_MSG_ID_BDP_SWEEP.
+// The request is sent to all available BDPs and the responses are gathered by a sweep thread,
+// the results are sent back to the client in several messages as they are received, the last one
+// being sent when all BDPs responded or when the deadline expired.
+//
+typedef struct
 {
-    if(node == 0)
+    int                 sockFd;
+    uint32_t            seq;        // sequence number of the client request, echoed in the results
+    uint16_t            dev_num;
+    bdp_sweep_msg_req_t req;
+} bdp_sweep_arg_t;
+
+int svsBdpSweepStart(int sockFd, uint32_t seq, uint16_t dev_num, bdp_sweep_msg_req_t *req)
+{
+    int status;
+    pthread_t thread;
+    bdp_sweep_arg_t *arg;
+
+    if(req == 0)
     {
-        return;
+        logError("req null");
+        return(ERR_FAIL);
+    }
+    switch(req->msg_id)
+    {
+        case MSG_ID_BDP_SWITCH_GET:
+        case MSG_ID_BDP_RFID_GET:
+        case MSG_ID_BDP_RFID_ALL_GET:
+            break;
+        default:
+            logError("sweep not supported for %s", msgIDToString(req->msg_id));
+            return(ERR_INV_MSG_ID);
+    }
+    if(req->req_len > BDP_SWEEP_REQ_MAX || req->deadline_ms == 0)
+    {
+        logError("invalid sweep request");
+        return(ERR_FAIL);
     }
 
-    logDebug("node              %08X", node);
-    logDebug("next              %08X", node->next);
-    logDebug("prev              %08X", node->prev);
-    logDebug("dev_num           %d",   node->d.dev_num);
-    logDebug("state             %d",   node->d.state);
-    logDebug("tsent             %lld", node->d.tsent_ms);
-    logDebug("tsent client      %lld", node->d.tsent_client_ms);
-    logDebug("timeout           %lld", node->d.timeout_ms);
-    logDebug("timeout client    %lld", node->d.timeout_client_ms);
-    logDebug("retry             %d",   node->d.retry);
-    logDebug("seq               %d",   node->d.frame.hdr.seq);
-    logDebug("bcast             %d",   node->d.bcast);
-    logDebug("bcast rsp         %d",   node->d.bcast_rsp);
+    arg = (bdp_sweep_arg_t *)malloc(sizeof(bdp_sweep_arg_t));
+    if(arg == 0)
+    {
+        logError("malloc failed");
+        return(ERR_FAIL);
+    }
+    arg->sockFd  = sockFd;
+    arg->seq     = seq;
+    arg->dev_num = dev_num;
+    memcpy(&arg->req, req, sizeof(bdp_sweep_msg_req_t));
+
+    status = pthread_create(&thread, 0, svsBdpSweepThread, arg);
+    if(status != 0)
+    {
+        logError("pthread_create: %s", strerror(status));
+        free(arg);
+        return(ERR_FAIL);
+    }
+    pthread_detach(thread);
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Called by the RX thread when a response to a sweep frame is received.
+//
+static void svsBdpSweepResultSet(uint32_t sweep_id, uint16_t bdp_num, uint8_t msg_id, uint8_t *payload, uint16_t len)
+{
+    bdp_sweep_result_t *result;
+
+    pthread_mutex_lock(&bdp_sweep.mutex);
+
+    if(sweep_id != bdp_sweep.id || bdp_num >= bdp_sweep.bdp_total || bdp_sweep.done[bdp_num])
+    {   // late response for a sweep that already ended
+        logDebug("Dropping sweep response from BDP %d", bdp_num);
+        goto _svsBdpSweepResultSet;
+    }
+
+    result = &bdp_sweep.result[bdp_num];
+    if(msg_id == MSG_ID_BDP_ACK)
+    {   // the BDP could not process the request
+        result->status = ERR_FAIL;
+    }
+    else
+    {
+        result->status  = ERR_PASS;
+        result->rsp_len = MIN(len, BDP_SWEEP_RSP_MAX);
+        memcpy(result->rsp, payload, result->rsp_len);
+    }
+    bdp_sweep.done[bdp_num] = 1;
+    bdp_sweep.pending--;
+    bdp_sweep.ready++;
+
+    pthread_cond_signal(&bdp_sweep.cond);
+
+    _svsBdpSweepResultSet:
+    pthread_mutex_unlock(&bdp_sweep.mutex);
 }
 
+//
+// Description:
+// Send the results that are available and not yet sent to the client, only full messages are sent
+// unless last is set, in which case all the remaining results are sent and the last message is flagged.
+// Called with bdp_sweep.mutex held, the mutex is released while sending.
+//
+static int svsBdpSweepResultSend(int sockFd, uint32_t seq, uint16_t dev_num, uint8_t last)
+{
+    int rc = ERR_PASS;
+    int i;
+    bdp_sweep_msg_rsp_t rsp;
+
+    while(rc == ERR_PASS)
+    {
+        if(!last && (bdp_sweep.ready < BDP_SWEEP_RESULT_CHUNK_MAX))
+        {   // wait until a full message can be sent
+            break;
+        }
 
+        memset(&rsp, 0, sizeof(rsp));
+        rsp.bdp_total = bdp_sweep.bdp_total;
+        for(i=0; (i < bdp_sweep.bdp_total) && (rsp.result_cnt < BDP_SWEEP_RESULT_CHUNK_MAX); i++)
+        {
+            if(bdp_sweep.done[i] && !bdp_sweep.sent[i])
+            {
+                memcpy(&rsp.result[rsp.result_cnt++], &bdp_sweep.result[i], sizeof(bdp_sweep_result_t));
+                bdp_sweep.sent[i] = 1;
+                bdp_sweep.ready--;
+            }
+        }
+        rsp.last = (last && (bdp_sweep.ready == 0)) ? 1 : 0;
+
+        pthread_mutex_unlock(&bdp_sweep.mutex);
+        rc = svsSocketSendSvs(sockFd, seq, SVS_MSG_ID_BDP_SWEEP, dev_num, (uint8_t *)&rsp,
+                              offsetof(bdp_sweep_msg_rsp_t, result) + rsp.result_cnt * sizeof(bdp_sweep_result_t));
+        pthread_mutex_lock(&bdp_sweep.mutex);
+        if(rc != ERR_PASS)
+        {
+            logError("svsSocketSendSvs: %d", sockFd);
+        }
+
+        if(rsp.last)
+        {
+            break;
+        }
+    }
+
+    return(rc);
+}
+
+//
+// Description:
+// Remove the frames of a sweep or of a firmware upgrade still in the list, called once it ended.
+//
+static void svsBdpFramesRemove(uint32_t sweep_id, uint32_t upgrade_id)
+{
+    bdp_node_t *node;
+    bdp_node_t *temp;
+
+    pthread_mutex_lock(&mutexFrameNodeAccess);
+
+    node = bdp_node_head->next;
+    while(node)
+    {
+        temp = node->next;
+        if(((sweep_id != 0) && (node->d.sweep_id == sweep_id)) ||
+           ((upgrade_id != 0) && (node->d.upgrade_id == upgrade_id)))
+        {
+            svsBdpNodeRemove(bdp_node_head, node);
+        }
+        node = temp;
+    }
+
+    pthread_mutex_unlock(&mutexFrameNodeAccess);
+}
+
+static void *svsBdpSweepThread(void *arg)
+{
+    int rc = ERR_PASS;
+    int i;
+    static uint32_t sweep_id = 0;
+    bdp_sweep_arg_t *sweep_arg = (bdp_sweep_arg_t *)arg;
+    svsSocketMsgHeader_t hdr;
+    int64_t tstart_ms, tend_ms, frame_timeout_ms;
+    struct timespec ts;
+
+    // one sweep at a time
+    pthread_mutex_lock(&mutexSweep);
+
+    tstart_ms = svsTimeGet_ms();
+    tend_ms   = tstart_ms + sweep_arg->req.deadline_ms;
+
+    // leave time for the retries within the deadline
+    frame_timeout_ms = MAX(BDP_TIMEOUT_MIN_MS, sweep_arg->req.deadline_ms / (BDP_RETRY_MAX + 1));
+
+    pthread_mutex_lock(&bdp_sweep.mutex);
+    sweep_id++;
+    if(sweep_id == 0)
+    {
+        sweep_id = 1;
+    }
+    bdp_sweep.id        = sweep_id;
+    bdp_sweep.bdp_total = bdp_dev_info.bdp_max;
+    bdp_sweep.pending   = bdp_sweep.bdp_total;
+    bdp_sweep.ready     = 0;
+    memset(bdp_sweep.done, 0, sizeof(bdp_sweep.done));
+    memset(bdp_sweep.sent, 0, sizeof(bdp_sweep.sent));
+    for(i=0; i<bdp_sweep.bdp_total; i++)
+    {
+        memset(&bdp_sweep.result[i], 0, sizeof(bdp_sweep_result_t));
+        bdp_sweep.result[i].bdp_num = i;
+        bdp_sweep.result[i].status  = ERR_TIMEOUT;
+    }
+    pthread_mutex_unlock(&bdp_sweep.mutex);
+
+    logDebug("Sweep %d %s to %d BDPs", sweep_id, msgIDToString(sweep_arg->req.msg_id), bdp_sweep.bdp_total);
+
+    // queue the request for each BDP, the frame manager sends them as soon as the window allows
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.module_id            = MODULE_ID_BDP;
+    hdr.len                  = sweep_arg->req.req_len;
+    hdr.tsent_ms             = tstart_ms;
+    hdr.timeout_ms           = sweep_arg->req.deadline_ms;
+    hdr.u.bdphdr.msg_id      = sweep_arg->req.msg_id;
+    hdr.u.bdphdr.timeout_ms  = frame_timeout_ms;
+
+    for(i=0; i<bdp_sweep.bdp_total; i++)
+    {
+        hdr.dev_num = i;
+        rc = svsBdpFrameCreate(sweep_arg->sockFd, &hdr, sweep_arg->req.req, sweep_id, 0);
+        if(rc != ERR_PASS)
+        {   // report the error for this BDP right away
+            pthread_mutex_lock(&bdp_sweep.mutex);
+            bdp_sweep.result[i].status = rc;
+            bdp_sweep.done[i] = 1;
+            bdp_sweep.pending--;
+            bdp_sweep.ready++;
+            pthread_mutex_unlock(&bdp_sweep.mutex);
+        }
+    }
+
+    // wait for the responses, send them as soon as a message can be filled
+    pthread_mutex_lock(&bdp_sweep.mutex);
+    ts.tv_sec  = tend_ms / 1000;
+    ts.tv_nsec = (tend_ms % 1000) * 1000000;
+    while(bdp_sweep.pending > 0)
+    {
+        rc = pthread_cond_timedwait(&bdp_sweep.cond, &bdp_sweep.mutex, &ts);
+        if(rc == ETIMEDOUT)
+        {
+            break;
+        }
+        // stream the results received so far
+        svsBdpSweepResultSend(sweep_arg->sockFd, sweep_arg->seq, sweep_arg->dev_num, 0);
+    }
+
+    logInfo("Sweep %d done in %lld ms, %d/%d BDPs responded", sweep_id, svsTimeGet_ms() - tstart_ms,
+            bdp_sweep.bdp_total - bdp_sweep.pending, bdp_sweep.bdp_total);
+
+    // the BDPs that did not respond are reported with ERR_TIMEOUT
+    for(i=0; i<bdp_sweep.bdp_total; i++)
+    {
+        if(bdp_sweep.done[i] == 0)
+        {
+            bdp_sweep.done[i] = 1;
+            bdp_sweep.ready++;
+        }
+    }
+    bdp_sweep.id = 0;
+    svsBdpSweepResultSend(sweep_arg->sockFd, sweep_arg->seq, sweep_arg->dev_num, 1);
+    pthread_mutex_unlock(&bdp_sweep.mutex);
+
+    svsBdpFramesRemove(sweep_id, 0);
+
+    pthread_mutex_unlock(&mutexSweep);
+
+    free(sweep_arg);
+
+    return(0);
+}
+
+//
+// Description:
+// Bus scan, called by the SVS server when a client requests SVS_MSG_ID_BDP_SCAN. The ARP table is flushed and the ARP
+// request is broadcast in rounds by a scan thread, which is woken up by the RX threads for each ARP response. A round
+// ends once no BDP answered for bdp_scan.quiet_ms, the scan ends after BDP_SCAN_STABLE_ROUNDS rounds without a new BDP,
+// as soon as the expected number of BDPs is in the table, or at the deadline. The result is sent back to the client.
+//
+typedef struct
+{
+    int                     sockFd;
+    uint32_t                seq;        // sequence number of the client request, echoed in the result
+    uint16_t                dev_num;
+    bdp_scan_msg_req_t      req;
+} bdp_scan_arg_t;
+
+int svsBdpScanStart(int sockFd, uint32_t seq, uint16_t dev_num, bdp_scan_msg_req_t *req)
+{
+    int status;
+    pthread_t thread;
+    bdp_scan_arg_t *arg;
+
+    if(req == 0)
+    {
+        logError("req null");
+        return(ERR_FAIL);
+    }
+
+    arg = (bdp_scan_arg_t *)malloc(sizeof(bdp_scan_arg_t));
+    if(arg == 0)
+    {
+        logError("malloc failed");
+        return(ERR_FAIL);
+    }
+    arg->sockFd  = sockFd;
+    arg->seq     = seq;
+    arg->dev_num = dev_num;
+    memcpy(&arg->req, req, sizeof(bdp_scan_msg_req_t));
+
+    status = pthread_create(&thread, 0, svsBdpScanThread, arg);
+    if(status != 0)
+    {
+        logError("pthread_create: %s", strerror(status));
+        free(arg);
+        return(ERR_FAIL);
+    }
+    pthread_detach(thread);
+
+    return(ERR_PASS);
+}
+
+static void *svsBdpScanThread(void *arg)
+{
+    int rc = ERR_PASS;
+    int stable = 0;
+    uint16_t expected, bdp_max;
+    uint32_t responses;
+    bdp_scan_arg_t *scan_arg = (bdp_scan_arg_t *)arg;
+    bdp_scan_msg_rsp_t rsp;
+    bdp_address_get_msg_req_t req;
+    svsSocketMsgHeader_t hdr;
+    int64_t tstart_ms, tend_ms, tlast_ms, twait_ms;
+    struct timespec ts;
+
+    // one scan at a time
+    pthread_mutex_lock(&mutexScan);
+
+    tstart_ms = svsTimeGet_ms();
+    tend_ms   = tstart_ms + ((scan_arg->req.deadline_ms != 0) ? scan_arg->req.deadline_ms : BDP_SCAN_DEADLINE_MS);
+    expected  = (scan_arg->req.expected != 0) ? scan_arg->req.expected : bdp_scan.expected;
+
+    memset(&rsp, 0, sizeof(rsp));
+    svsArpTableFlush();
+
+    memset(&req, 0, sizeof(req));
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.module_id           = MODULE_ID_BDP;
+    hdr.dev_num             = BDP_NUM_ALL;
+    hdr.len                 = sizeof(req);
+    hdr.u.bdphdr.msg_id     = MSG_ID_BDP_ADDR_GET;
+
+    while((rsp.rounds < BDP_SCAN_ROUND_MAX) && (svsTimeGet_ms() < tend_ms))
+    {
+        pthread_mutex_lock(&bdp_scan.mutex);
+        responses = bdp_scan.responses;
+        bdp_max   = bdp_dev_info.bdp_max;
+        pthread_mutex_unlock(&bdp_scan.mutex);
+
+        // ask all the BDPs to send their address
+        hdr.tsent_ms = svsTimeGet_ms();
+        rc = svsBdpFrameCreate(-1, &hdr, (uint8_t *)&req, 0, 0);
+        if(rc == ERR_BUSY)
+        {   // the frame manager is full, try again
+            usleep(BDP_TIMEOUT_MIN_MS * 1000);
+            continue;
+        }
+        if(rc != ERR_PASS)
+        {
+            logError("ARP request not sent: %d", rc);
+            break;
+        }
+
+        // the round lasts as long as BDPs keep answering
+        pthread_mutex_lock(&bdp_scan.mutex);
+        tlast_ms = svsTimeGet_ms();
+        while(1)
+        {
+            if((expected != 0) && (bdp_dev_info.bdp_max >= expected))
+            {
+                break;
+            }
+            twait_ms = MIN(tlast_ms + bdp_scan.quiet_ms, tend_ms);
+            if(svsTimeGet_ms() >= twait_ms)
+            {
+                break;
+            }
+            ts.tv_sec  = twait_ms / 1000;
+            ts.tv_nsec = (twait_ms % 1000) * 1000000;
+            pthread_cond_timedwait(&bdp_scan.cond, &bdp_scan.mutex, &ts);
+            if(bdp_scan.responses != responses + rsp.round_rsp[rsp.rounds])
+            {   // an ARP response was received
+                rsp.round_rsp[rsp.rounds] = bdp_scan.responses - responses;
+                tlast_ms = svsTimeGet_ms();
+            }
+        }
+        rsp.round_new[rsp.rounds] = bdp_dev_info.bdp_max - bdp_max;
+        pthread_mutex_unlock(&bdp_scan.mutex);
+
+        logInfo("Scan round %d: %d responses, %d new BDPs, %d BDPs detected", rsp.rounds,
+                rsp.round_rsp[rsp.rounds], rsp.round_new[rsp.rounds], bdp_dev_info.bdp_max);
+
+        stable = (rsp.round_new[rsp.rounds] == 0) ? stable + 1 : 0;
+        rsp.rounds++;
+        if((expected != 0) && (bdp_dev_info.bdp_max >= expected))
+        {
+            logInfo("Scan: the %d BDPs expected answered", expected);
+            break;
+        }
+        if(stable >= BDP_SCAN_STABLE_ROUNDS)
+        {
+            break;
+        }
+    }
+
+    rsp.status      = rc;
+    rsp.bdp_max     = bdp_dev_info.bdp_max;
+    rsp.duration_ms = svsTimeGet_ms() - tstart_ms;
+    if((expected != 0) && (rsp.bdp_max < expected))
+    {
+        logWarning("Scan: %d BDPs detected, %d expected", rsp.bdp_max, expected);
+    }
+    logInfo("Scan done in %d ms, %d rounds, %d BDPs detected", rsp.duration_ms, rsp.rounds, rsp.bdp_max);
+
+    rc = svsSocketSendSvs(scan_arg->sockFd, scan_arg->seq, SVS_MSG_ID_BDP_SCAN, scan_arg->dev_num, (uint8_t *)&rsp, sizeof(rsp));
+    if(rc != ERR_PASS)
+    {
+        logError("svsSocketSendSvs: %d", scan_arg->sockFd);
+    }
+
+    pthread_mutex_unlock(&mutexScan);
+
+    free(scan_arg);
+
+    return(0);
+}
+
+//
+// Description:
+// Firmware upgrade of several BDPs, called by the SVS server when a client requests SVS_MSG_ID_BDP_UPGRADE.
+// The image is read once and streamed to all the BDPs at the same time by an upgrade thread, each BDP has up
+// to window blocks in flight and only the blocks that failed or timed out are sent again.
+// The progress is sent back to the client about once per second, with the result of each BDP once it finished.
+//
+typedef struct
+{
+    int                     sockFd;
+    uint32_t                seq;        // sequence number of the client request, echoed in the reports
+    uint16_t                dev_num;
+    bdp_upgrade_msg_req_t   req;
+} bdp_upgrade_arg_t;
+
+int svsBdpUpgradeStart(int sockFd, uint32_t seq, uint16_t dev_num, bdp_upgrade_msg_req_t *req)
+{
+    int status;
+    pthread_t thread;
+    bdp_upgrade_arg_t *arg;
+
+    if(req == 0)
+    {
+        logError("req null");
+        return(ERR_FAIL);
+    }
+    req->filename[BDP_UPGRADE_FILENAME_MAX - 1] = '\0';
+    if((req->filename[0] == '\0') || (req->deadline_ms == 0) || (req->bdp_cnt > BDP_UPGRADE_LIST_MAX))
+    {
+        logError("invalid upgrade request");
+        return(ERR_INV_PARAM);
+    }
+
+    arg = (bdp_upgrade_arg_t *)malloc(sizeof(bdp_upgrade_arg_t));
+    if(arg == 0)
+    {
+        logError("malloc failed");
+        return(ERR_FAIL);
+    }
+    arg->sockFd  = sockFd;
+    arg->seq     = seq;
+    arg->dev_num = dev_num;
+    memcpy(&arg->req, req, sizeof(bdp_upgrade_msg_req_t));
+
+    status = pthread_create(&thread, 0, svsBdpUpgradeThread, arg);
+    if(status != 0)
+    {
+        logError("pthread_create: %s", strerror(status));
+        free(arg);
+        return(ERR_FAIL);
+    }
+    pthread_detach(thread);
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Ends the upgrade of a BDP. Called with bdp_upgrade.mutex held.
+//
+static void svsBdpUpgradeDockEnd(bdp_upgrade_dock_t *dock, int status)
+{
+    dock->running       = 0;
+    dock->result.status = status;
+    dock->result.offset = MIN(dock->acked * FIRMWARE_IMAGE_BLOCK_MAX, bdp_upgrade.image_len);
+    bdp_upgrade.inflight -= dock->inflight;
+    dock->inflight = 0;
+    logInfo("BDP %d upgrade %s, %d bytes acknowledged, %d blocks resent", dock->result.bdp_num,
+            (status == ERR_PASS) ? "done" : "failed", dock->result.offset, dock->result.retried);
+}
+
+//
+// Description:
+// A block was not acknowledged, it is sent again until it was tried bdp_upgrade.retries times. Called with bdp_upgrade.mutex held.
+//
+static void svsBdpUpgradeBlockFail(bdp_upgrade_dock_t *dock, uint32_t block, int status)
+{
+    dock->tsent_ms[block] = 0;
+    dock->inflight--;
+    bdp_upgrade.inflight--;
+    if(dock->tries[block] >= bdp_upgrade.retries)
+    {
+        logError("BDP %d block %d failed after %d attempts", dock->result.bdp_num, block, dock->tries[block]);
+        svsBdpUpgradeDockEnd(dock, status);
+        return;
+    }
+    dock->result.retried++;
+}
+
+//
+// Description:
+// A block was acknowledged by the BDP, or found already programmed after a broadcast. Called with bdp_upgrade.mutex held.
+//
+static void svsBdpUpgradeBlockDone(bdp_upgrade_dock_t *dock, uint32_t block)
+{
+    dock->done[block] = 1;
+    dock->acked++;
+    bdp_upgrade.bytes_done += MIN(bdp_upgrade.image_len - block * FIRMWARE_IMAGE_BLOCK_MAX, FIRMWARE_IMAGE_BLOCK_MAX);
+    while((dock->base < bdp_upgrade.block_cnt) && dock->done[dock->base])
+    {
+        dock->base++;
+    }
+    if(dock->acked == bdp_upgrade.block_cnt)
+    {
+        if(bdp_upgrade.region_cnt == 0)
+        {
+            svsBdpUpgradeDockEnd(dock, ERR_PASS);
+            return;
+        }
+        // blocks were skipped, the CRC of the whole image tells whether the BDP got it right
+        dock->verify = 1;
+    }
+}
+
+//
+// Description:
+// Sends the whole image to a BDP whose flash was not erased in this upgrade: the first block erases it, the blocks
+// found programmed so far are sent again. Called with bdp_upgrade.mutex held, before any block was sent to the BDP.
+//
+static void svsBdpUpgradeDockRestart(bdp_upgrade_dock_t *dock)
+{
+    uint32_t block;
+
+    logDebug("BDP %d differs from the image, sending it from the first block", dock->result.bdp_num);
+    for(block=0; block<bdp_upgrade.block_cnt; block++)
+    {
+        if(dock->done[block])
+        {
+            dock->done[block] = 0;
+            bdp_upgrade.bytes_done -= MIN(bdp_upgrade.image_len - block * FIRMWARE_IMAGE_BLOCK_MAX, FIRMWARE_IMAGE_BLOCK_MAX);
+        }
+    }
+    dock->acked  = 0;
+    dock->base   = 0;
+    dock->verify = 0;
+    dock->region = bdp_upgrade.region_cnt;
+}
+
+//
+// Description:
+// Moves to the next region check of a BDP, the blocks of a region that matched the image are not sent again.
+// The first region holds the block that erases the flash, when it does not match the whole image is sent to
+// the BDP. Without a broadcast the flash is only erased when the first block is sent, so any region that does not
+// match sends the whole image, and when all match the whole image is checked before the last block.
+// Called with bdp_upgrade.mutex held.
+//
+static void svsBdpUpgradeRegionDone(bdp_upgrade_dock_t *dock, uint8_t match)
+{
+    uint32_t block, block_end;
+
+    dock->region_tsent_ms = 0;
+    dock->region_tries    = 0;
+    if(!match)
+    {
+        logDebug("BDP %d region %d to repair", dock->result.bdp_num, dock->region);
+        if(bdp_upgrade.delta)
+        {
+            svsBdpUpgradeDockRestart(dock);
+            return;
+        }
+        dock->region = (dock->region == 0) ? bdp_upgrade.region_cnt : dock->region + 1;
+        return;
+    }
+
+    // the last block is never broadcast, it is sent to each BDP once the others are acknowledged
+    block_end = MIN((dock->region + 1) * bdp_upgrade.region_blocks, bdp_upgrade.block_cnt - 1);
+    for(block=dock->region * bdp_upgrade.region_blocks; block<block_end; block++)
+    {
+        if(!dock->done[block])
+        {
+            svsBdpUpgradeBlockDone(dock, block);
+        }
+    }
+    dock->region++;
+    if(bdp_upgrade.delta && (dock->region == bdp_upgrade.region_cnt))
+    {   // the last block is not part of a region, the image check tells whether it must be programmed
+        dock->verify = 1;
+    }
+}
+
+//
+// Description:
+// A region check or the final image check was not answered. Called with bdp_upgrade.mutex held.
+//
+static void svsBdpUpgradeCheckFail(bdp_upgrade_dock_t *dock)
+{
+    dock->region_tsent_ms = 0;
+    bdp_upgrade.inflight--;
+    if(dock->region_tries < bdp_upgrade.retries)
+    {   // checked again
+        return;
+    }
+    if(dock->verify && (dock->acked != bdp_upgrade.block_cnt))
+    {   // image check before the last block of a delta upgrade
+        dock->region_tries = 0;
+        svsBdpUpgradeDockRestart(dock);
+        return;
+    }
+    if(dock->verify)
+    {
+        logError("BDP %d image not verified", dock->result.bdp_num);
+        svsBdpUpgradeDockEnd(dock, ERR_FIRMWARE_FAILED_PROGRAM);
+        return;
+    }
+    // the region is sent to the BDP
+    svsBdpUpgradeRegionDone(dock, 0);
+}
+
+//
+// Description:
+// Called by the RX thread when a BDP answered a block or a region check of the upgrade in progress.
+//
+static void svsBdpUpgradeResultSet(uint32_t upgrade_id, uint16_t bdp_num, uint8_t req_msg_id, uint8_t msg_id, uint8_t *req, uint8_t *payload, uint16_t len)
+{
+    uint32_t block, region;
+    bdp_upgrade_dock_t *dock;
+    bdp_firmware_upgrade_msg_req_t *block_req = (bdp_firmware_upgrade_msg_req_t *)req;
+    bdp_memory_crc_msg_req_t *crc_req = (bdp_memory_crc_msg_req_t *)req;
+    bdp_memory_crc_msg_rsp_t *crc_rsp = (bdp_memory_crc_msg_rsp_t *)payload;
+
+    pthread_mutex_lock(&bdp_upgrade.mutex);
+
+    dock = &bdp_upgrade.dock[bdp_num];
+    if(req_msg_id == MSG_ID_BDP_MEMORY_CRC)
+    {
+        region = (crc_req->start_address - BDP_UPGRADE_APP_ADDR) / (bdp_upgrade.region_blocks * FIRMWARE_IMAGE_BLOCK_MAX);
+        if((upgrade_id != bdp_upgrade.id) || !dock->running || (dock->region_tsent_ms == 0) ||
+           (!dock->verify && (region != dock->region)))
+        {
+            logDebug("Dropping region check response from BDP %d", bdp_num);
+            goto _svsBdpUpgradeResultSet;
+        }
+        if((msg_id == MSG_ID_BDP_ACK) || (len < sizeof(bdp_memory_crc_msg_rsp_t)) || (crc_rsp->status != 0))
+        {
+            svsBdpUpgradeCheckFail(dock);
+            goto _svsBdpUpgradeResultSet;
+        }
+        dock->region_tsent_ms = 0;
+        bdp_upgrade.inflight--;
+        if(dock->verify && (dock->acked != bdp_upgrade.block_cnt))
+        {   // delta upgrade, all the regions matched: done when the last block matches as well
+            if(crc_rsp->crc != bdp_upgrade.image_crc)
+            {
+                dock->region_tries = 0;
+                svsBdpUpgradeDockRestart(dock);
+                goto _svsBdpUpgradeResultSet;
+            }
+            svsBdpUpgradeBlockDone(dock, bdp_upgrade.block_cnt - 1);
+            svsBdpUpgradeDockEnd(dock, ERR_PASS);
+            goto _svsBdpUpgradeResultSet;
+        }
+        if(dock->verify)
+        {   // CRC of the whole image
+            if(crc_rsp->crc != bdp_upgrade.image_crc)
+            {
+                logError("BDP %d image CRC 0x%04x, expected 0x%04x", bdp_num, crc_rsp->crc, bdp_upgrade.image_crc);
+            }
+            svsBdpUpgradeDockEnd(dock, (crc_rsp->crc == bdp_upgrade.image_crc) ? ERR_PASS : ERR_FIRMWARE_FAILED_PROGRAM);
+            goto _svsBdpUpgradeResultSet;
+        }
+        svsBdpUpgradeRegionDone(dock, crc_rsp->crc == bdp_upgrade.region_crc[region]);
+        goto _svsBdpUpgradeResultSet;
+    }
+
+    block = block_req->offset / FIRMWARE_IMAGE_BLOCK_MAX;
+    if((upgrade_id != bdp_upgrade.id) || !dock->running || (block >= bdp_upgrade.block_cnt) || (dock->tsent_ms[block] == 0))
+    {   // late response, the block already timed out or the upgrade ended
+        logDebug("Dropping upgrade response from BDP %d", bdp_num);
+        goto _svsBdpUpgradeResultSet;
+    }
+
+    if((msg_id == MSG_ID_BDP_ACK) || (len < sizeof(bdp_firmware_upgrade_msg_rsp_t)) ||
+       (((bdp_firmware_upgrade_msg_rsp_t *)payload)->status != 0))
+    {   // the BDP rejected the block
+        svsBdpUpgradeBlockFail(dock, block, ERR_FIRMWARE_FAILED_PROGRAM);
+        goto _svsBdpUpgradeResultSet;
+    }
+
+    dock->tsent_ms[block] = 0;
+    dock->inflight--;
+    bdp_upgrade.inflight--;
+    svsBdpUpgradeBlockDone(dock, block);
+
+    _svsBdpUpgradeResultSet:
+
+    pthread_cond_signal(&bdp_upgrade.cond);
+    pthread_mutex_unlock(&bdp_upgrade.mutex);
+}
+
+//
+// Description:
+// Gets the firmware image from the image cache, it is split in blocks of FIRMWARE_IMAGE_BLOCK_MAX bytes and a last
+// shorter block, empty when the size is a multiple of the block size, that tells the BDP the image is complete.
+//
+static int svsBdpUpgradeImageLoad(char *filename)
+{
+    int rc;
+
+    rc = svsImageOpen(filename, &bdp_upgrade.file);
+    if(rc != ERR_PASS)
+    {
+        bdp_upgrade.file = 0;
+        return(rc);
+    }
+    if(bdp_upgrade.file->len > BDP_UPGRADE_IMAGE_MAX)
+    {
+        logError("%s: invalid image size %d", filename, bdp_upgrade.file->len);
+        svsImageClose(bdp_upgrade.file);
+        bdp_upgrade.file = 0;
+        return(ERR_LEN_TOO_LONG);
+    }
+    bdp_upgrade.image     = bdp_upgrade.file->data;
+    bdp_upgrade.image_len = bdp_upgrade.file->len;
+    bdp_upgrade.block_cnt = bdp_upgrade.file->block_cnt;
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Time allowed to a BDP to acknowledge a block, the frame manager retries it in the meantime.
+//
+static int64_t svsBdpUpgradeBlockTimeout(bdp_upgrade_msg_req_t *req, uint32_t block)
+{
+    int64_t timeout_ms = (block == 0) ? req->timeout_erase : req->timeout_normal;
+
+    if(timeout_ms == 0)
+    {
+        timeout_ms = BDP_UPGRADE_TIMEOUT_MS;
+    }
+
+    return(timeout_ms);
+}
+
+//
+// Description:
+// Sends the progress and the results of the BDPs that finished since the previous report, only one message
+// unless last is set, in which case all the remaining results are sent and the last message is flagged.
+// Called with bdp_upgrade.mutex held, the mutex is released while sending.
+//
+static int svsBdpUpgradeReport(bdp_upgrade_arg_t *upgrade_arg, int64_t tstart_ms, uint8_t last)
+{
+    int rc = ERR_PASS;
+    int i;
+    uint64_t remaining;
+    bdp_upgrade_dock_t *dock;
+    bdp_upgrade_msg_rsp_t rsp;
+
+    do
+    {
+        memset(&rsp, 0, sizeof(rsp));
+        remaining = 0;
+        for(i=0; i<BDP_MAX; i++)
+        {
+            dock = &bdp_upgrade.dock[i];
+            if(!dock->selected)
+            {
+                continue;
+            }
+            rsp.progress.bdp_total++;
+            if(dock->running)
+            {
+                remaining += bdp_upgrade.image_len - MIN(dock->acked * FIRMWARE_IMAGE_BLOCK_MAX, bdp_upgrade.image_len);
+                continue;
+            }
+            if(dock->result.status == ERR_PASS)
+            {
+                rsp.progress.bdp_done++;
+            }
+            else
+            {
+                rsp.progress.bdp_failed++;
+            }
+            if(!dock->reported && (rsp.result_cnt < BDP_UPGRADE_RESULT_CHUNK_MAX))
+            {
+                memcpy(&rsp.result[rsp.result_cnt++], &dock->result, sizeof(bdp_upgrade_result_t));
+                dock->reported = 1;
+            }
+        }
+        rsp.progress.bytes_total = bdp_upgrade.image_len * rsp.progress.bdp_total;
+        rsp.progress.bytes_done  = bdp_upgrade.bytes_done;
+        rsp.progress.elapsed_ms  = svsTimeGet_ms() - tstart_ms;
+        if(rsp.progress.elapsed_ms > 0)
+        {
+            rsp.progress.throughput = ((uint64_t)bdp_upgrade.bytes_done * 1000) / rsp.progress.elapsed_ms;
+        }
+        if(rsp.progress.throughput > 0)
+        {
+            rsp.progress.eta_ms = (remaining * 1000) / rsp.progress.throughput;
+        }
+        rsp.last = (last && (rsp.result_cnt < BDP_UPGRADE_RESULT_CHUNK_MAX)) ? 1 : 0;
+
+        pthread_mutex_unlock(&bdp_upgrade.mutex);
+        rc = svsSocketSendSvs(upgrade_arg->sockFd, upgrade_arg->seq, SVS_MSG_ID_BDP_UPGRADE, upgrade_arg->dev_num, (uint8_t *)&rsp,
+                              offsetof(bdp_upgrade_msg_rsp_t, result) + rsp.result_cnt * sizeof(bdp_upgrade_result_t));
+        pthread_mutex_lock(&bdp_upgrade.mutex);
+        if(rc != ERR_PASS)
+        {
+            logError("svsSocketSendSvs: %d", upgrade_arg->sockFd);
+        }
+    } while(last && !rsp.last);
+
+    return(rc);
+}
+
+//
+// Description:
+// Computes the CRC of each region of region_blocks blocks of the image, each BDP is asked for the CRC of the same
+// regions of its flash before any block is sent to it. The last block is never part of a region. Also computes the
+// CRC of the whole image, checked on each BDP once all its blocks were acknowledged. Called with bdp_upgrade.mutex held.
+//
+static int svsBdpUpgradeRegionInit(uint16_t region_blocks)
+{
+    int i;
+    uint32_t offset, len;
+    uint16_t region_cnt;
+
+    region_cnt = (bdp_upgrade.block_cnt - 1 + region_blocks - 1) / region_blocks;
+    if(region_cnt == 0)
+    {   // the image fits in the last block
+        return(ERR_PASS);
+    }
+    bdp_upgrade.region_crc = (uint16_t *)malloc(region_cnt * sizeof(uint16_t));
+    if(bdp_upgrade.region_crc == 0)
+    {
+        logError("malloc failed");
+        return(ERR_FAIL);
+    }
+    for(i=0; i<region_cnt; i++)
+    {
+        offset = i * region_blocks * FIRMWARE_IMAGE_BLOCK_MAX;
+        len    = MIN(region_blocks * FIRMWARE_IMAGE_BLOCK_MAX, (bdp_upgrade.block_cnt - 1) * FIRMWARE_IMAGE_BLOCK_MAX - offset);
+        bdp_upgrade.region_crc[i] = (region_blocks == 1) ? bdp_upgrade.file->block_crc[i] : crc16_compute(&bdp_upgrade.image[offset], len);
+    }
+    bdp_upgrade.image_crc     = bdp_upgrade.file->crc;
+    bdp_upgrade.region_blocks = region_blocks;
+    bdp_upgrade.region_cnt    = region_cnt;
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Sends the image once to all the BDPs, the broadcast frames are not acknowledged so they are paced with the time a BDP
+// needs to erase its flash and to program a block. The last block, which tells the BDP the image is complete, is not
+// broadcast. Each BDP is then asked for the CRC of each region of its flash and only the blocks of the regions that do
+// not match the image are sent to it. Called with bdp_upgrade.mutex held, the mutex is released while broadcasting.
+//
+static int svsBdpUpgradeBroadcast(bdp_upgrade_arg_t *upgrade_arg, int64_t tend_ms)
+{
+    int rc = ERR_PASS;
+    uint32_t block;
+    svsSocketMsgHeader_t hdr;
+    bdp_firmware_upgrade_msg_req_t block_req;
+
+    pthread_mutex_unlock(&bdp_upgrade.mutex);
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.module_id           = MODULE_ID_BDP;
+    hdr.dev_num             = BDP_NUM_ALL;
+    hdr.len                 = sizeof(block_req);
+    hdr.u.bdphdr.msg_id     = MSG_ID_BDP_FIRMWARE_IMAGE_BLOCK_SEND;
+
+    for(block=0; (block<bdp_upgrade.block_cnt - 1) && (svsTimeGet_ms() < tend_ms); )
+    {
+        block_req.offset = block * FIRMWARE_IMAGE_BLOCK_MAX;
+        block_req.len    = FIRMWARE_IMAGE_BLOCK_MAX;
+        memcpy(block_req.data, &bdp_upgrade.image[block_req.offset], FIRMWARE_IMAGE_BLOCK_MAX);
+        hdr.tsent_ms     = svsTimeGet_ms();
+
+        rc = svsBdpFrameCreate(upgrade_arg->sockFd, &hdr, (uint8_t *)&block_req, 0, bdp_upgrade.id);
+        if(rc == ERR_BUSY)
+        {   // the frame manager is full, try again
+            usleep(BDP_TIMEOUT_MIN_MS * 1000);
+            continue;
+        }
+        if(rc != ERR_PASS)
+        {   // the region checks tell what each BDP is missing
+            logError("Broadcast of block %d failed: %d", block, rc);
+            break;
+        }
+        usleep(((block == 0) ? svsBdpUpgradeBlockTimeout(&upgrade_arg->req, 0) : BDP_UPGRADE_BCAST_GAP_MS) * 1000);
+        block++;
+    }
+    logInfo("Upgrade %d: %d blocks broadcast, checking %d regions per BDP", bdp_upgrade.id, block, bdp_upgrade.region_cnt);
+
+    pthread_mutex_lock(&bdp_upgrade.mutex);
+
+    return(rc);
+}
+
+static void *svsBdpUpgradeThread(void *arg)
+{
+    int rc;
+    int i, send_cnt, running;
+    static uint32_t upgrade_id = 0;
+    bdp_upgrade_arg_t *upgrade_arg = (bdp_upgrade_arg_t *)arg;
+    bdp_upgrade_msg_req_t *req = &upgrade_arg->req;
+    bdp_upgrade_dock_t *dock;
+    bdp_firmware_upgrade_msg_req_t block_req;
+    bdp_memory_crc_msg_req_t crc_req;
+    svsSocketMsgHeader_t hdr;
+    int64_t tstart_ms, tend_ms, treport_ms, tnow_ms, twait_ms;
+    struct timespec ts;
+    uint32_t block, block_end;
+    uint8_t window;
+    uint16_t send_bdp[BDP_UPGRADE_INFLIGHT_MAX];
+    uint32_t send_block[BDP_UPGRADE_INFLIGHT_MAX];
+    uint8_t send_check[BDP_UPGRADE_INFLIGHT_MAX];
+
+    // one upgrade at a time
+    pthread_mutex_lock(&mutexUpgrade);
+
+    tstart_ms  = svsTimeGet_ms();
+    tend_ms    = tstart_ms + req->deadline_ms;
+    treport_ms = tstart_ms + BDP_UPGRADE_REPORT_MS;
+
+    // the frame manager does not send more frames to a BDP than its window
+    window = MIN(MAX(req->window, 1), MIN(bdp_dev_info.window, BDP_UPGRADE_WINDOW_MAX));
+
+    pthread_mutex_lock(&bdp_upgrade.mutex);
+    upgrade_id++;
+    if(upgrade_id == 0)
+    {
+        upgrade_id = 1;
+    }
+    bdp_upgrade.id         = upgrade_id;
+    bdp_upgrade.file       = 0;
+    bdp_upgrade.image      = 0;
+    bdp_upgrade.image_len  = 0;
+    bdp_upgrade.block_cnt  = 0;
+    bdp_upgrade.inflight   = 0;
+    bdp_upgrade.bytes_done = 0;
+    bdp_upgrade.retries    = MAX(req->retries, 1);
+    bdp_upgrade.region_cnt = 0;
+    bdp_upgrade.region_crc = 0;
+    bdp_upgrade.region_blocks = BDP_UPGRADE_REGION_BLOCKS;
+    bdp_upgrade.delta      = 0;
+    memset(bdp_upgrade.dock, 0, sizeof(bdp_upgrade.dock));
+    if(req->bdp_cnt == 0)
+    {   // all the available BDPs
+        for(i=0; i<bdp_dev_info.bdp_max; i++)
+        {
+            bdp_upgrade.dock[i].selected = 1;
+        }
+    }
+    for(i=0; i<req->bdp_cnt; i++)
+    {
+        if(req->bdp_num[i] < bdp_dev_info.bdp_max)
+        {
+            bdp_upgrade.dock[req->bdp_num[i]].selected = 1;
+        }
+        else
+        {
+            logWarning("BDP %d not available, not upgraded", req->bdp_num[i]);
+        }
+    }
+
+    rc = svsBdpUpgradeImageLoad(req->filename);
+    for(i=0; i<BDP_MAX; i++)
+    {
+        dock = &bdp_upgrade.dock[i];
+        if(!dock->selected)
+        {
+            continue;
+        }
+        dock->result.bdp_num = i;
+        dock->running        = 1;
+        if(rc == ERR_PASS)
+        {
+            dock->done     = (uint8_t *)calloc(bdp_upgrade.block_cnt, sizeof(uint8_t));
+            dock->tries    = (uint8_t *)calloc(bdp_upgrade.block_cnt, sizeof(uint8_t));
+            dock->tsent_ms = (int64_t *)calloc(bdp_upgrade.block_cnt, sizeof(int64_t));
+        }
+        if((rc != ERR_PASS) || (dock->done == 0) || (dock->tries == 0) || (dock->tsent_ms == 0))
+        {
+            svsBdpUpgradeDockEnd(dock, (rc != ERR_PASS) ? rc : ERR_FAIL);
+        }
+    }
+
+    logInfo("Upgrade %d: %s, %d bytes in %d blocks, window %d", upgrade_id, req->filename,
+            bdp_upgrade.image_len, bdp_upgrade.block_cnt, window);
+
+    if(req->broadcast && (req->bdp_cnt != 0))
+    {   // a broadcast would also program the BDPs that are not listed
+        logWarning("Upgrade %d: broadcast needs all the BDPs, sending to each BDP", upgrade_id);
+    }
+    else if(req->broadcast && (rc == ERR_PASS))
+    {
+        if(svsBdpUpgradeRegionInit(BDP_UPGRADE_REGION_BLOCKS) == ERR_PASS)
+        {
+            svsBdpUpgradeBroadcast(upgrade_arg, tend_ms);
+        }
+    }
+    if(req->delta && !bdp_upgrade.region_cnt && (rc == ERR_PASS))
+    {   // only the blocks that differ from the flash of each BDP are sent, none when the image is already there
+        if(svsBdpUpgradeRegionInit(1) == ERR_PASS)
+        {
+            bdp_upgrade.delta = (bdp_upgrade.region_cnt != 0);
+        }
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.module_id           = MODULE_ID_BDP;
+
+    while(1)
+    {
+        tnow_ms  = svsTimeGet_ms();
+        running  = 0;
+        send_cnt = 0;
+
+        for(i=0; (i<BDP_MAX) && (tnow_ms < tend_ms); i++)
+        {
+            dock = &bdp_upgrade.dock[i];
+            if(!dock->running)
+            {
+                continue;
+            }
+            block_end = MIN(dock->base + window, bdp_upgrade.block_cnt);
+
+            // blocks not acknowledged in time are sent again
+            for(block=dock->base; (block<block_end) && dock->running; block++)
+            {
+                if((dock->tsent_ms[block] != 0) &&
+                   ((tnow_ms - dock->tsent_ms[block]) >= svsBdpUpgradeBlockTimeout(req, block) * (BDP_RETRY_MAX + 1) + BDP_TIMEOUT_MIN_MS))
+                {
+                    logWarning("BDP %d block %d not acknowledged", i, block);
+                    svsBdpUpgradeBlockFail(dock, block, ERR_TIMEOUT);
+                }
+            }
+            if(!dock->running)
+            {
+                continue;
+            }
+            running++;
+
+            // find the blocks the BDP already has before sending anything to it, check the whole image at the end
+            if((dock->region < bdp_upgrade.region_cnt) || dock->verify)
+            {
+                if((dock->region_tsent_ms != 0) &&
+                   ((tnow_ms - dock->region_tsent_ms) >= svsBdpUpgradeBlockTimeout(req, dock->verify ? 0 : 1) * (BDP_RETRY_MAX + 1) + BDP_TIMEOUT_MIN_MS))
+                {
+                    svsBdpUpgradeCheckFail(dock);
+                }
+                if(dock->running && ((dock->region < bdp_upgrade.region_cnt) || dock->verify) &&
+                   (dock->region_tsent_ms == 0) && (bdp_upgrade.inflight < BDP_UPGRADE_INFLIGHT_MAX))
+                {
+                    dock->region_tsent_ms = tnow_ms;
+                    dock->region_tries++;
+                    bdp_upgrade.inflight++;
+                    send_bdp[send_cnt]   = i;
+                    send_block[send_cnt] = dock->region;
+                    send_check[send_cnt] = dock->verify ? 2 : 1;
+                    send_cnt++;
+                }
+                if((dock->region < bdp_upgrade.region_cnt) || dock->verify)
+                {
+                    continue;
+                }
+            }
+
+            // keep up to window blocks in flight, the first block (erase) and the last one (end of image) are sent alone
+            for(block=dock->base; block<block_end; block++)
+            {
+                if((dock->inflight >= window) || (bdp_upgrade.inflight >= BDP_UPGRADE_INFLIGHT_MAX))
+                {
+                    break;
+                }
+                if(dock->done[block] || (dock->tsent_ms[block] != 0))
+                {
+                    continue;
+                }
+                if(((block == 0) && (dock->inflight != 0)) ||
+                   ((block != 0) && !dock->done[0]) ||
+                   ((block == bdp_upgrade.block_cnt - 1) && (dock->acked != bdp_upgrade.block_cnt - 1)))
+                {
+                    break;
+                }
+                dock->tsent_ms[block] = tnow_ms;
+                dock->tries[block]++;
+                dock->inflight++;
+                bdp_upgrade.inflight++;
+                send_bdp[send_cnt]   = i;
+                send_block[send_cnt] = block;
+                send_check[send_cnt] = 0;
+                send_cnt++;
+                if(block == 0)
+                {
+                    break;
+                }
+            }
+        }
+
+        if((running == 0) || (tnow_ms >= tend_ms))
+        {
+            break;
+        }
+        if(tnow_ms >= treport_ms)
+        {
+            svsBdpUpgradeReport(upgrade_arg, tstart_ms, 0);
+            treport_ms += BDP_UPGRADE_REPORT_MS;
+        }
+
+        // queue the blocks, the frame manager sends them on the bus of each BDP
+        pthread_mutex_unlock(&bdp_upgrade.mutex);
+        for(i=0; i<send_cnt; i++)
+        {
+            if(send_check[i])
+            {   // CRC of a region or of the whole image, compared to the image by svsBdpUpgradeResultSet()
+                crc_req.bdp_num         = send_bdp[i];
+                crc_req.start_address   = BDP_UPGRADE_APP_ADDR;
+                crc_req.length_in_bytes = bdp_upgrade.image_len;
+                if(send_check[i] == 1)
+                {
+                    crc_req.start_address  += send_block[i] * bdp_upgrade.region_blocks * FIRMWARE_IMAGE_BLOCK_MAX;
+                    crc_req.length_in_bytes = MIN(bdp_upgrade.region_blocks * FIRMWARE_IMAGE_BLOCK_MAX,
+                                                  (bdp_upgrade.block_cnt - 1 - send_block[i] * bdp_upgrade.region_blocks) * FIRMWARE_IMAGE_BLOCK_MAX);
+                }
+
+                // computing the CRC of the whole image takes about as long as an erase
+                hdr.dev_num             = send_bdp[i];
+                hdr.len                 = sizeof(crc_req);
+                hdr.tsent_ms            = svsTimeGet_ms();
+                hdr.timeout_ms          = svsBdpUpgradeBlockTimeout(req, send_check[i] - 1) * (BDP_RETRY_MAX + 1);
+                hdr.u.bdphdr.msg_id     = MSG_ID_BDP_MEMORY_CRC;
+                hdr.u.bdphdr.timeout_ms = svsBdpUpgradeBlockTimeout(req, send_check[i] - 1);
+                rc = svsBdpFrameCreate(upgrade_arg->sockFd, &hdr, (uint8_t *)&crc_req, 0, upgrade_id);
+                if(rc != ERR_PASS)
+                {   // not queued, checked again on a next pass
+                    pthread_mutex_lock(&bdp_upgrade.mutex);
+                    dock = &bdp_upgrade.dock[send_bdp[i]];
+                    if(dock->running && (dock->region_tsent_ms != 0))
+                    {
+                        dock->region_tsent_ms = 0;
+                        dock->region_tries--;
+                        bdp_upgrade.inflight--;
+                    }
+                    pthread_mutex_unlock(&bdp_upgrade.mutex);
+                }
+                continue;
+            }
+
+            block = send_block[i];
+            block_req.offset = block * FIRMWARE_IMAGE_BLOCK_MAX;
+            block_req.len    = MIN(bdp_upgrade.image_len - block_req.offset, FIRMWARE_IMAGE_BLOCK_MAX);
+            memset(block_req.data, 0, FIRMWARE_IMAGE_BLOCK_MAX);
+            memcpy(block_req.data, &bdp_upgrade.image[block_req.offset], block_req.len);
+
+            hdr.dev_num             = send_bdp[i];
+            hdr.len                 = sizeof(block_req);
+            hdr.tsent_ms            = svsTimeGet_ms();
+            hdr.timeout_ms          = svsBdpUpgradeBlockTimeout(req, block) * (BDP_RETRY_MAX + 1);
+            hdr.u.bdphdr.msg_id     = MSG_ID_BDP_FIRMWARE_IMAGE_BLOCK_SEND;
+            hdr.u.bdphdr.timeout_ms = svsBdpUpgradeBlockTimeout(req, block);
+            rc = svsBdpFrameCreate(upgrade_arg->sockFd, &hdr, (uint8_t *)&block_req, 0, upgrade_id);
+            if(rc != ERR_PASS)
+            {   // not queued (too many frames), sent again on a next pass
+                pthread_mutex_lock(&bdp_upgrade.mutex);
+                dock = &bdp_upgrade.dock[send_bdp[i]];
+                if(dock->running && (dock->tsent_ms[block] != 0))
+                {
+                    dock->tsent_ms[block] = 0;
+                    dock->tries[block]--;
+                    dock->inflight--;
+                    bdp_upgrade.inflight--;
+                }
+                pthread_mutex_unlock(&bdp_upgrade.mutex);
+            }
+        }
+        pthread_mutex_lock(&bdp_upgrade.mutex);
+
+        // nothing left to send, wait for an acknowledgement or for the next timeout check
+        if(send_cnt == 0)
+        {
+            twait_ms   = MIN(svsTimeGet_ms() + BDP_TIMEOUT_MIN_MS, MIN(treport_ms, tend_ms));
+            ts.tv_sec  = twait_ms / 1000;
+            ts.tv_nsec = (twait_ms % 1000) * 1000000;
+            pthread_cond_timedwait(&bdp_upgrade.cond, &bdp_upgrade.mutex, &ts);
+        }
+    }
+
+    // the BDPs still running ran out of time
+    for(i=0; i<BDP_MAX; i++)
+    {
+        if(bdp_upgrade.dock[i].running)
+        {
+            svsBdpUpgradeDockEnd(&bdp_upgrade.dock[i], ERR_TIMEOUT);
+        }
+    }
+    bdp_upgrade.id = 0;
+
+    logInfo("Upgrade %d done in %lld ms, %d bytes acknowledged", upgrade_id, svsTimeGet_ms() - tstart_ms, bdp_upgrade.bytes_done);
+    svsBdpUpgradeReport(upgrade_arg, tstart_ms, 1);
+
+    for(i=0; i<BDP_MAX; i++)
+    {
+        dock = &bdp_upgrade.dock[i];
+        free(dock->done);
+        free(dock->tries);
+        free(dock->tsent_ms);
+        dock->done     = 0;
+        dock->tries    = 0;
+        dock->tsent_ms = 0;
+    }
+    svsImageClose(bdp_upgrade.file);
+    free(bdp_upgrade.region_crc);
+    bdp_upgrade.file       = 0;
+    bdp_upgrade.image      = 0;
+    bdp_upgrade.region_crc = 0;
+    bdp_upgrade.region_cnt = 0;
+    bdp_upgrade.delta      = 0;
+    pthread_mutex_unlock(&bdp_upgrade.mutex);
+
+    svsBdpFramesRemove(0, upgrade_id);
+
+    pthread_mutex_unlock(&mutexUpgrade);
+
+    free(upgrade_arg);
+
+    return(0);
+}
+
+void svsBdpNodePrint(bdp_node_t *node)
+{
+    if(node == 0)
+    {
+        return;
+    }
+
+    logDebug("node              %08X", node);
+    logDebug("next              %08X", node->next);
+    logDebug("prev              %08X", node->prev);
+    logDebug("dev_num           %d",   node->d.dev_num);
+    logDebug("state             %d",   node->d.state);
+    logDebug("tsent             %lld", node->d.tsent_ms);
+    logDebug("tsent client      %lld", node->d.tsent_client_ms);
+    logDebug("timeout           %lld", node->d.timeout_ms);
+    logDebug("timeout client    %lld", node->d.timeout_client_ms);
+    logDebug("retry             %d",   node->d.retry);
+    logDebug("seq               %d",   node->d.frame.hdr.seq);
+    logDebug("bcast             %d",   node->d.bcast);
+    logDebug("bcast rsp         %d",   node->d.bcast_rsp);
+}
+
+//
+// Description:
+// Starts the thread forwarding the async state updates held back by svsBdpCoalesce().
+//
+static int svsBdpCoalesceInit(void)
+{
+    int status;
+    pthread_condattr_t condAttr;
+
+    bdp_coalesce = calloc(BDP_MAX * BDP_COALESCE_MSG_MAX, sizeof(bdp_coalesce_t));
+    if(bdp_coalesce == 0)
+    {
+        logError("calloc: %s", strerror(errno));
+        return(ERR_FAIL);
+    }
+
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&mutexCoalesce, 0);
+    pthread_cond_init(&condCoalesce, &condAttr);
+
+    status = pthread_create(&coalesce_thread, 0, svsBdpCoalesceThread, 0);
+    if(status != 0)
+    {
+        logError("pthread_create: %s", strerror(status));
+        return(ERR_FAIL);
+    }
+    logInfo("async state updates coalesced over %d ms", bdp_coalesce_ms);
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Returns 1 when the async frame is held back, 0 when it must be forwarded now.
+// The first update of a BDP and msg ID is forwarded right away and opens a window of coalesce_ms, the updates received
+// during the window replace each other and only the latest one is forwarded when the window ends.
+//
+static int svsBdpCoalesce(uint16_t bdp_num, uint8_t msg_id, uint8_t *payload, uint16_t len)
+{
+    int i;
+    int64_t tnow;
+    bdp_coalesce_t *c = 0;
+
+    if((bdp_coalesce == 0) || (bdp_num >= BDP_MAX) || (len > BDP_COALESCE_PAYLOAD_MAX))
+    {
+        return(0);
+    }
+    for(i = 0; i < BDP_COALESCE_MSG_MAX; i++)
+    {
+        if(bdp_coalesce_msg[i] == msg_id)
+        {
+            c = &bdp_coalesce[bdp_num * BDP_COALESCE_MSG_MAX + i];
+            break;
+        }
+    }
+    if(c == 0)
+    {   // not a state message, lossless
+        return(0);
+    }
+
+    tnow = svsTimeGet_ms();
+
+    pthread_mutex_lock(&mutexCoalesce);
+
+    if((c->pending == 0) && ((c->tend_ms == 0) || (tnow >= c->tend_ms)))
+    {   // quiet so far, forward it and open a window
+        c->tend_ms = tnow + bdp_coalesce_ms;
+        pthread_cond_signal(&condCoalesce);
+        pthread_mutex_unlock(&mutexCoalesce);
+        return(0);
+    }
+    if(c->pending)
+    {
+        bdp_coalesce_cnt++;
+    }
+    c->pending  = 1;
+    c->len      = len;
+    memcpy(c->payload, payload, len);
+
+    pthread_mutex_unlock(&mutexCoalesce);
+
+    return(1);
+}
+
+static void *svsBdpCoalesceThread(void *arg)
+{
+    int i;
+    int64_t tnow, tnext;
+    uint16_t bdp_num, len;
+    uint8_t msg_id;
+    uint8_t payload[BDP_COALESCE_PAYLOAD_MAX];
+    bdp_coalesce_t *c;
+    struct timespec ts;
+
+    pthread_mutex_lock(&mutexCoalesce);
+
+    for(;;)
+    {
+        tnow  = svsTimeGet_ms();
+        tnext = 0;
+        c     = 0;
+
+        for(i = 0; i < BDP_MAX * BDP_COALESCE_MSG_MAX; i++)
+        {
+            if(bdp_coalesce[i].tend_ms == 0)
+            {
+                continue;
+            }
+            if(tnow < bdp_coalesce[i].tend_ms)
+            {
+                if((tnext == 0) || (bdp_coalesce[i].tend_ms < tnext))
+                {
+                    tnext = bdp_coalesce[i].tend_ms;
+                }
+                continue;
+            }
+            if(bdp_coalesce[i].pending == 0)
+            {   // nothing came in during the window
+                bdp_coalesce[i].tend_ms = 0;
+                continue;
+            }
+            c = &bdp_coalesce[i];
+            break;
+        }
+
+        if(c != 0)
+        {   // forward the latest update, it opens a new window
+            bdp_num     = i / BDP_COALESCE_MSG_MAX;
+            msg_id      = bdp_coalesce_msg[i % BDP_COALESCE_MSG_MAX];
+            len         = c->len;
+            memcpy(payload, c->payload, len);
+            c->pending  = 0;
+            c->tend_ms  = tnow + bdp_coalesce_ms;
+
+            pthread_mutex_unlock(&mutexCoalesce);
+
+            logDebug("Sending coalesced %s of BDP %d to callback server, %u merged so far", msgIDToString(msg_id), bdp_num, bdp_coalesce_cnt);
+            if(svsSocketSendCallback(svsCallbackSockFd, MODULE_ID_BDP, bdp_num, msg_id, 0, payload, len) != ERR_PASS)
+            {
+                logError("svsSocketSendCallback");
+            }
+
+            pthread_mutex_lock(&mutexCoalesce);
+            continue;
+        }
+
+        if(tnext == 0)
+        {
+            pthread_cond_wait(&condCoalesce, &mutexCoalesce);
+        }
+        else
+        {
+            ts.tv_sec  = tnext / 1000;
+            ts.tv_nsec = (tnext % 1000) * 1000000;
+            pthread_cond_timedwait(&condCoalesce, &mutexCoalesce, &ts);
+        }
+    }
+
+    return(NULL);
+}
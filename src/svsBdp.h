@@ -2,7 +2,9 @@
 #define SVS_BDP_H
 
 #include <termios.h>
+#include <pthread.h>
 #include <svsBdpMsg.h>
+#include <svsImage.h>
 
 #define BDP_NUM_ALL                 (0xFF)      // allows sending to all available BDPs
 #define BDP_NUM_INVALID             (0xFEFE)    // used as an invalid BDP number
@@ -14,6 +16,26 @@
 #define BDP_DEV_DEFAULT_NAME2       "" // set to "" when not in use (see configuration file)
 #define BDP_RETRY_MAX               2
 #define BDP_TIMEOUT_MIN_MS          100
+#define BDP_BUS_TX_QUEUE_MAX        64          // frames waiting to be written on a single bus
+#define BDP_WINDOW_DEFAULT          1           // frames in flight per BDP, see "window" in the configuration file
+#define BDP_WINDOW_MAX              8
+#define BDP_COALESCE_MS_MAX         5000        // async state updates merged per window, see "coalesce_ms" in the configuration file
+#define BDP_COALESCE_PAYLOAD_MAX    64          // larger async payloads are always forwarded
+#define BDP_SCAN_QUIET_MS_DEFAULT   1000        // a scan round ends once no BDP answered for this time, see "scan_quiet_ms"
+#define BDP_ARP_FILE_DEFAULT        "/usr/scu/etc/bdpArp.dat"   // ARP table kept for the next start, see "arp_file"
+#define BDP_ARP_FILE_MAGIC          0x50524142  // "BARP"
+#define BDP_ARP_FILE_VERSION        1
+#define BDP_ARP_PATH_MAX            128
+#define BDP_ARP_SAVE_DELAY_MS       500         // changes made within this time are saved together, a scan adds many entries
+#define BDP_ARP_VERIFY_MS           2000        // time the preloaded BDPs have to answer the targeted ARP request
+#define BDP_ARP_VERIFY_TRIES        2
+#define BDP_UPGRADE_IMAGE_MAX       (1024*1024) // largest firmware image accepted by the upgrade orchestrator
+#define BDP_UPGRADE_INFLIGHT_MAX    128         // blocks in flight on all BDPs, the frame sequence numbers are 8 bits
+#define BDP_UPGRADE_REPORT_MS       1000        // period of the progress reports
+#define BDP_UPGRADE_TIMEOUT_MS      1000        // block timeout when the request leaves it to 0
+#define BDP_UPGRADE_APP_ADDR        0x08004000  // flash address of the application image in a BDP
+#define BDP_UPGRADE_BCAST_GAP_MS    50          // time a BDP needs to program a block, nothing paces a broadcast
+#define BDP_UPGRADE_REGION_BLOCKS   16          // blocks checked by each MSG_ID_BDP_MEMORY_CRC after a broadcast, 1 for a delta upgrade
 
 typedef struct // socket header
 {
@@ -47,6 +69,7 @@ typedef struct
     id_data_addr_t              id_data_addr[MSG_ID_BDP_MAX];
 
     uint8_t                     bdp_valid;          // used to signal the BDP has a valid address/MSN and is not a duplicate
+    uint8_t                     bdp_verified;       // 0 when preloaded from the ARP file and not heard from since svsd started
 
     //
     // Message Data
@@ -152,6 +175,24 @@ typedef struct
 
 } bdp_state_t;
 
+typedef struct
+{
+    uint16_t                dev_num;            // BDP device number, BDP_NUM_ALL for broadcasts
+    int64_t                 timeout_ms;         // frame timeout, used to report excessive backoffs
+    svsMsgBdpFrame_t        frame;              // copy of the frame to write on the bus
+} bdp_bus_tx_job_t;
+
+typedef struct
+{   // per bus transmit queue, drained by the bus TX thread
+    pthread_t               thread;
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond;
+    uint16_t                head;               // next job to write
+    uint16_t                tail;               // next free slot
+    uint16_t                count;              // jobs waiting in the queue
+    bdp_bus_tx_job_t        job[BDP_BUS_TX_QUEUE_MAX];
+} bdp_bus_tx_queue_t;
+
 typedef struct
 {
     char                    devName[BDP_BUS_DEV_NAME_MAX];
@@ -168,7 +209,9 @@ typedef struct
     uint8_t                 frame_done;                 // frame complete flag
     int64_t                 timestamp_rx_activity_us;   // timestamp of latest bus activity, used for backoff
     int64_t                 timestamp_tx_activity_us;   // timestamp of latest bus activity, used for backoff
+    int64_t                 timestamp_tx_earliest_us;   // earliest time the next frame may be sent, set by the backoff
     bdp_bus_stats_t         bus_stats;
+    bdp_bus_tx_queue_t      tx_queue;                   // frames to send, each bus is written by its own thread
 } bdp_bus_dev_info_t;
 
 typedef struct
@@ -180,6 +223,7 @@ typedef struct
     svsMsgBdpFramePreamble_t    preamble;
     bdp_addr_t                  addr_broadcast;
     int                         loopback_enable;    // 0: disable, 1: enable
+    int                         window;             // maximum number of active frames per BDP
 } bdp_dev_info_t;
 
 typedef struct
@@ -195,9 +239,103 @@ typedef struct
     uint8_t         bcast;              // broadcast frame when 1
     uint8_t         bcast_rsp;          // number of responses to a broadcast request
     callback_fn_t   callback;           // callback function to call upon a response (if not 0)
+    uint32_t        sweep_id;           // sweep the frame belongs to, 0 when not part of a sweep
+    uint32_t        upgrade_id;         // firmware upgrade the frame belongs to, 0 when not part of an upgrade
+    uint32_t        seq_client;         // sequence number of the client request, echoed in the response
     svsMsgBdpFrame_t frame;             // the frame to sent and retry upon a timeout
 } bdp_frame_info_t;
 
+typedef struct
+{   // latest async state of a BDP and msg ID held back until the end of the coalescing window
+    int64_t             tend_ms;        // end of the window, 0 when no window is open
+    uint8_t             pending;        // 1 when an update waits for the end of the window
+    uint16_t            len;
+    uint8_t             payload[BDP_COALESCE_PAYLOAD_MAX];
+} bdp_coalesce_t;
+
+typedef struct
+{   // state of the station-wide sweep in progress, only one sweep runs at a time
+    pthread_mutex_t     mutex;          // protects the fields below
+    pthread_cond_t      cond;           // signaled when a response is received
+    uint32_t            id;             // current sweep id, 0 when no sweep is running
+    uint16_t            bdp_total;      // number of BDPs in the sweep
+    uint16_t            pending;        // responses not yet received
+    uint16_t            ready;          // results available but not yet sent to the client
+    uint8_t             done[BDP_MAX];  // 1 when the result is available
+    uint8_t             sent[BDP_MAX];  // 1 when the result was sent to the client
+    bdp_sweep_result_t  result[BDP_MAX];
+} bdp_sweep_info_t;
+
+typedef struct
+{   // ARP responses seen by the RX threads, a scan waits on them instead of polling the table
+    pthread_mutex_t     mutex;          // protects the fields below
+    pthread_cond_t      cond;           // signaled for each ARP response
+    uint32_t            responses;      // ARP responses received since svsd started
+    int                 quiet_ms;       // "scan_quiet_ms" configuration
+    int                 expected;       // "expected" configuration, 0 when not set
+} bdp_scan_info_t;
+
+typedef struct __attribute__ ((__packed__))
+{   // header of the ARP file, followed by count bdp_arp_file_entry_t in BDP number order
+    uint32_t            magic;          // BDP_ARP_FILE_MAGIC
+    uint16_t            version;        // BDP_ARP_FILE_VERSION, a file with another version is ignored
+    uint16_t            count;
+    uint16_t            crc;            // CRC16 of the entries
+} bdp_arp_file_hdr_t;
+
+typedef struct __attribute__ ((__packed__))
+{
+    bdp_addr_t          addr;
+    uint8_t             bus;
+} bdp_arp_file_entry_t;
+
+typedef struct
+{   // ARP table persistence, the RX threads mark the table dirty and a save thread writes it
+    pthread_mutex_t     mutex;          // protects dirty
+    pthread_cond_t      cond;           // signaled when the table changed
+    uint8_t             dirty;
+    uint16_t            loaded;         // entries preloaded at startup
+    char                path[BDP_ARP_PATH_MAX];     // "arp_file" configuration, "" when not persisted
+} bdp_arp_info_t;
+
+typedef struct
+{   // progress of a BDP in the firmware upgrade in progress
+    uint8_t             selected;       // 1 when the BDP is part of the upgrade
+    uint8_t             running;        // 0 once the BDP is upgraded or failed
+    uint8_t             reported;       // 1 once its result was sent to the client
+    uint8_t             inflight;       // blocks sent and not yet acknowledged
+    uint16_t            region;         // next region to check after a broadcast, region_cnt when checked
+    uint8_t             region_tries;   // attempts of the current region or image check
+    int64_t             region_tsent_ms;// time the current region or image check was sent, 0 when not in flight
+    uint8_t             verify;         // 1 once all the blocks were acknowledged, until the image CRC is checked
+    uint32_t            base;           // first block not acknowledged
+    uint32_t            acked;          // blocks acknowledged
+    uint8_t             *done;          // per block, 1 when acknowledged
+    uint8_t             *tries;         // per block, attempts so far
+    int64_t             *tsent_ms;      // per block, time sent, 0 when not in flight
+    bdp_upgrade_result_t result;
+} bdp_upgrade_dock_t;
+
+typedef struct
+{   // state of the firmware upgrade in progress, only one upgrade runs at a time
+    pthread_mutex_t     mutex;          // protects the fields below
+    pthread_cond_t      cond;           // signaled when a block is acknowledged or rejected
+    uint32_t            id;             // current upgrade id, 0 when no upgrade is running
+    svs_image_t         *file;          // image cache entry, image points to its data
+    uint8_t             *image;
+    uint32_t            image_len;
+    uint32_t            block_cnt;      // the last block is shorter than FIRMWARE_IMAGE_BLOCK_MAX, possibly empty
+    uint16_t            inflight;       // blocks in flight on all the BDPs
+    uint8_t             retries;        // attempts per block
+    uint16_t            region_cnt;     // regions checked on each BDP before sending, 0 when the whole image is sent
+    uint8_t             delta;          // 1 when the regions are checked without a broadcast, the flash is not erased yet
+    uint16_t            region_blocks;  // blocks per region
+    uint16_t            *region_crc;    // per region, CRC of the image
+    uint16_t            image_crc;      // checked on each BDP at the end when region_cnt is not 0
+    uint32_t            bytes_done;     // bytes acknowledged by all the BDPs
+    bdp_upgrade_dock_t  dock[BDP_MAX];  // indexed by BDP number
+} bdp_upgrade_info_t;
+
 typedef struct bdp_node
 {
     bdp_frame_info_t    d;
@@ -222,6 +360,9 @@ int svsPortOpen(char *devName, int baudrate);
 int svsBaudRateToSpeed(int baudrate, speed_t *speed);
 
 int svsBdpPowerGetLocal(uint16_t dev_num, bdp_power_set_msg_req_t **req);
+int svsBdpSweepStart(int sockFd, uint32_t seq, uint16_t dev_num, bdp_sweep_msg_req_t *req);
+int svsBdpScanStart(int sockFd, uint32_t seq, uint16_t dev_num, bdp_scan_msg_req_t *req);
+int svsBdpUpgradeStart(int sockFd, uint32_t seq, uint16_t dev_num, bdp_upgrade_msg_req_t *req);
 
 char *msgIDToString(bdp_msg_id_t id);
 
@@ -952,5 +952,170 @@ typedef struct __attribute__ ((__packed__))
 
 // ------------------------------------------------------------------
 
-#endif // SVS_BDP_MSG_H
+// ------------------------------------------------------------------
+// Station-wide sweep: the request is sent to every available BDP and the responses are
+// gathered by the server, see svsBdpSweep(). Supported for MSG_ID_BDP_SWITCH_GET,
+// MSG_ID_BDP_RFID_GET and MSG_ID_BDP_RFID_ALL_GET.
+// ------------------------------------------------------------------
+
+#define BDP_SWEEP_REQ_MAX           8
+#define BDP_SWEEP_RSP_MAX           (sizeof(bdp_rfid_all_get_msg_rsp_t))
+
+typedef struct __attribute__ ((__packed__))
+{
+    uint16_t        bdp_num;
+    int16_t         status;                     // ERR_PASS, ERR_TIMEOUT when the BDP did not respond before the deadline
+    uint8_t         rsp_len;
+    uint8_t         rsp[BDP_SWEEP_RSP_MAX];     // response message, e.g. bdp_switch_get_msg_rsp_t
+} bdp_sweep_result_t;
+
+#define BDP_SWEEP_RESULT_CHUNK_MAX  ((BDP_MSG_PAYLOAD_MAX - 4) / sizeof(bdp_sweep_result_t))
+
+typedef void (*bdp_sweep_fn_t)(bdp_sweep_result_t *result, void *arg);
+
+typedef struct // API structure
+{
+    uint8_t             msg_id;                 // message sent to each BDP
+    uint8_t             req_len;
+    uint8_t             req[BDP_SWEEP_REQ_MAX]; // request message, e.g. bdp_rfid_get_msg_req_t
+    int                 deadline_ms;            // time allowed for the whole sweep
+    bdp_sweep_result_t  *result;                // array of result_max entries, can be 0 when fn is set
+    uint16_t            result_max;
+    uint16_t            result_cnt;             // number of results returned
+    bdp_sweep_fn_t      fn;                     // optional, called for each result as it is received
+    void                *arg;                   // passed to fn
+} bdp_sweep_t;
+
+typedef struct __attribute__ ((__packed__))
+{
+    uint8_t         msg_id;
+    uint32_t        deadline_ms;
+    uint8_t         req_len;
+    uint8_t         req[BDP_SWEEP_REQ_MAX];
+} bdp_sweep_msg_req_t;
+
+typedef struct __attribute__ ((__packed__))
+{   // the results are sent in several messages as they are received
+    uint16_t            bdp_total;              // number of BDPs in the sweep
+    uint8_t             last;                   // 1 on the last message of the sweep
+    uint8_t             result_cnt;             // results in this message
+    bdp_sweep_result_t  result[BDP_SWEEP_RESULT_CHUNK_MAX];
+} bdp_sweep_msg_rsp_t;
+
+// ------------------------------------------------------------------
+// Bus scan run by the server, see svsBdpScanRun(): the ARP request is broadcast in rounds, a round ends
+// once no BDP answered for the "bdp/scan_quiet_ms" configuration. The scan stops after two rounds
+// without a new BDP, or as soon as the expected number of BDPs answered.
+// ------------------------------------------------------------------
+
+#define BDP_SCAN_ROUND_MAX          10
+#define BDP_SCAN_STABLE_ROUNDS      2       // rounds without a new BDP before the scan stops
+#define BDP_SCAN_DEADLINE_MS        15000   // default time allowed for the whole scan
+
+typedef struct // API structure
+{
+    uint16_t        expected;                       // BDPs expected, 0 to use the "bdp/expected" configuration
+    int             deadline_ms;                    // time allowed for the whole scan, 0 for BDP_SCAN_DEADLINE_MS
+    uint16_t        bdp_max;                        // BDPs detected
+    uint8_t         rounds;                         // ARP requests broadcast
+    uint32_t        duration_ms;
+    uint16_t        round_rsp[BDP_SCAN_ROUND_MAX];  // ARP responses received during each round
+    uint16_t        round_new[BDP_SCAN_ROUND_MAX];  // BDPs added to the ARP table during each round
+} bdp_scan_t;
 
+typedef struct __attribute__ ((__packed__))
+{
+    uint16_t        expected;
+    uint32_t        deadline_ms;
+} bdp_scan_msg_req_t;
+
+typedef struct __attribute__ ((__packed__))
+{
+    int16_t         status;
+    uint16_t        bdp_max;
+    uint8_t         rounds;
+    uint32_t        duration_ms;
+    uint16_t        round_rsp[BDP_SCAN_ROUND_MAX];
+    uint16_t        round_new[BDP_SCAN_ROUND_MAX];
+} bdp_scan_msg_rsp_t;
+
+// ------------------------------------------------------------------
+// Firmware upgrade of several BDPs at once: the server reads the image and streams it to all the
+// BDPs in parallel on both buses, see svsBdpFirmwareUpgradeMany(). The progress and the result of
+// each BDP are sent back to the client while the upgrade runs.
+// ------------------------------------------------------------------
+
+#define BDP_UPGRADE_FILENAME_MAX    128
+#define BDP_UPGRADE_LIST_MAX        255     // BDPs listed in a request
+#define BDP_UPGRADE_WINDOW_MAX      8       // blocks in flight per BDP, also limited by the "window" configuration
+
+typedef struct __attribute__ ((__packed__))
+{
+    uint16_t        bdp_num;
+    int16_t         status;                     // ERR_PASS when the whole image was acknowledged
+    uint32_t        offset;                     // bytes acknowledged by the BDP
+    uint16_t        retried;                    // blocks sent again after a failure or a timeout
+} bdp_upgrade_result_t;
+
+typedef struct __attribute__ ((__packed__))
+{   // aggregate progress, reported about once per second
+    uint16_t        bdp_total;                  // BDPs in the upgrade
+    uint16_t        bdp_done;                   // BDPs upgraded
+    uint16_t        bdp_failed;                 // BDPs that failed
+    uint32_t        bytes_total;                // image size times the number of BDPs
+    uint32_t        bytes_done;                 // bytes acknowledged by all the BDPs
+    uint32_t        throughput;                 // bytes per second since the start
+    uint32_t        elapsed_ms;
+    uint32_t        eta_ms;                     // estimated time left at the current throughput
+} bdp_upgrade_progress_t;
+
+#define BDP_UPGRADE_RESULT_CHUNK_MAX ((BDP_MSG_PAYLOAD_MAX - sizeof(bdp_upgrade_progress_t) - 2) / sizeof(bdp_upgrade_result_t))
+
+// called for each progress report, with the results of the BDPs that finished since the previous one
+typedef void (*bdp_upgrade_fn_t)(bdp_upgrade_progress_t *progress, bdp_upgrade_result_t *result, uint16_t result_cnt, void *arg);
+
+typedef struct // API structure
+{
+    const char              *filename;
+    uint16_t                bdp_cnt;                            // 0 to upgrade all the available BDPs
+    uint8_t                 bdp_num[BDP_UPGRADE_LIST_MAX];      // BDPs to upgrade
+    uint8_t                 window;                             // blocks in flight per BDP, 0 is the same as 1
+    uint8_t                 retries;                            // attempts per block, 0 is the same as 1
+    uint8_t                 broadcast;                          // 1 to broadcast the image once then repair each BDP, needs bdp_cnt 0
+    uint8_t                 delta;                              // 1 to only send the blocks that differ from the flash of each BDP
+    int                     timeout_erase;                      // first block, the BDP erases its flash
+    int                     timeout_normal;                     // other blocks
+    int                     deadline_ms;                        // time allowed for the whole upgrade
+    bdp_upgrade_result_t    *result;                            // array of result_max entries, can be 0 when fn is set
+    uint16_t                result_max;
+    uint16_t                result_cnt;                         // number of results returned
+    bdp_upgrade_progress_t  progress;                           // last progress received
+    bdp_upgrade_fn_t        fn;                                 // optional, called for each progress report
+    void                    *arg;                               // passed to fn
+} bdp_upgrade_t;
+
+typedef struct __attribute__ ((__packed__))
+{
+    char            filename[BDP_UPGRADE_FILENAME_MAX];
+    uint8_t         window;
+    uint8_t         retries;
+    uint8_t         broadcast;
+    uint8_t         delta;
+    uint32_t        timeout_erase;
+    uint32_t        timeout_normal;
+    uint32_t        deadline_ms;
+    uint16_t        bdp_cnt;
+    uint8_t         bdp_num[BDP_UPGRADE_LIST_MAX];
+} bdp_upgrade_msg_req_t;
+
+typedef struct __attribute__ ((__packed__))
+{   // sent about once per second and when the upgrade ends
+    bdp_upgrade_progress_t  progress;
+    uint8_t                 last;               // 1 on the last message of the upgrade
+    uint8_t                 result_cnt;         // results in this message
+    bdp_upgrade_result_t    result[BDP_UPGRADE_RESULT_CHUNK_MAX];
+} bdp_upgrade_msg_rsp_t;
+
+// ------------------------------------------------------------------
+
+#endif // SVS_BDP_MSG_H
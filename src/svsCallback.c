@@ -4,6 +4,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 
 #include <svsLog.h>
@@ -13,6 +15,7 @@
 #include <svsCallback.h>
 #include <svsBdp.h>
 #include <svsSocket.h>
+#include <svsConfig.h>
 
 //
 // This is the table holding the callback functions for each of the modules and all the message IDs per module
@@ -25,13 +28,66 @@ static callback_fn_t        cb_upgrade = 0;
 static callback_fn_t        cb_pm = 0;
 static callback_fn_t        cb_wim = 0;
 
-static int app_fds[REGISTERED_APPS_MAX];
-static int app_cnt = 0;
+//
+// Application registered with the callback server: the events are queued by the server thread and
+// written by a thread per application, so an application that stops reading only fills its own queue
+//
+typedef struct
+{
+    int                     sockFd;     // 0 when the slot is free
+    uint8_t                 running;
+    uint8_t                 closing;    // connection shut down, waiting for the server thread to release the slot
+    pthread_t               thread;
+    pthread_cond_t          cond;
+    svsSocketMsg_t          *queue;
+    uint16_t                queue_len;
+    uint16_t                head;
+    uint16_t                count;
+    callback_sub_t          sub[CALLBACK_SUB_MAX];
+    callback_app_stats_t    stats;
+} callback_app_t;
+
+static callback_app_t       cb_app[REGISTERED_APPS_MAX];
+static int                  app_cnt = 0;
+static uint32_t             cb_app_disconnected = 0;
+static int                  cb_queue_len = CALLBACK_QUEUE_DEFAULT;
+static int                  cb_overflow = CALLBACK_OVERFLOW_DROP;
+static pthread_mutex_t      mutexCallbackApp = PTHREAD_MUTEX_INITIALIZER;
+
+// sent by the application when registering with the callback server
+static callback_app_reg_t   cb_app_reg = { CALLBACK_OVERFLOW_DEFAULT };
+
+// application subscriptions, sent again each time the connection is made
+static callback_sub_t       cb_sub[CALLBACK_SUB_MAX];
+static int                  cb_sub_cnt = 0;
+static int                  cb_client_sockFd = 0;
+static pthread_mutex_t      mutexCallbackSub = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// Optional dispatch workers of the application: the receive thread hands each event to the worker of its device,
+// a slow callback then only delays the later events of the same device
+//
+typedef struct
+{
+    pthread_t               thread;
+    pthread_mutex_t         mutex;
+    pthread_cond_t          cond;       // event queued
+    pthread_cond_t          condFree;   // room in the queue
+    svsSocketMsg_t          *queue;
+    uint16_t                head;
+    uint16_t                count;
+} callback_worker_t;
+
+static callback_worker_t    cb_worker[CALLBACK_WORKER_MAX];
+static int                  cb_worker_cnt = 0;      // workers running, 0 to call the callbacks on the receive thread
+static int                  cb_worker_req = 0;      // workers requested with svsCallbackWorkersSet()
 
 static socket_thread_info_t socket_thread_info;
 
 static void *svsClientCallbackHandler(void *arg);
 static int svsSocketServerCallbackHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+static int svsCallbackAppRemove(int sockFd);
+static int svsCallbackDispatch(svsSocketMsg_t *msg);
 
 int svsCallbackServerInit(void)
 {
@@ -42,6 +98,19 @@ int svsCallbackServerInit(void)
 
     memset(&socket_thread_info, 0, sizeof(socket_thread_info_t));
 
+    svsConfigParamIntGet("callback", "queue", CALLBACK_QUEUE_DEFAULT, &cb_queue_len);
+    if((cb_queue_len < 1) || (cb_queue_len > CALLBACK_QUEUE_MAX))
+    {
+        logWarning("callback queue %d out of range, using %d", cb_queue_len, CALLBACK_QUEUE_DEFAULT);
+        cb_queue_len = CALLBACK_QUEUE_DEFAULT;
+    }
+    svsConfigParamIntGet("callback", "overflow", CALLBACK_OVERFLOW_DROP, &cb_overflow);
+    if((cb_overflow <= CALLBACK_OVERFLOW_DEFAULT) || (cb_overflow >= CALLBACK_OVERFLOW_MAX))
+    {
+        logWarning("callback overflow policy %d invalid, dropping events", cb_overflow);
+        cb_overflow = CALLBACK_OVERFLOW_DROP;
+    }
+
     // configure server info
     socket_thread_info.name        = "CALLBACK";
     socket_thread_info.ipAddr      = SVS_SOCKET_SERVER_LISTEN_IP;
@@ -69,12 +138,101 @@ int svsCallbackServerInit(void)
 int svsCallbackServerUninit(void)
 {
     int rc = ERR_PASS;
+    int i;
+
+    for(i = 0; i < REGISTERED_APPS_MAX; i++)
+    {
+        if(cb_app[i].sockFd != 0)
+        {
+            svsCallbackAppRemove(cb_app[i].sockFd);
+        }
+    }
 
     return(rc);
 }
 
 pthread_t   pthread_client;    // thread pointer
 
+static void *svsCallbackWorker(void *arg)
+{
+    callback_worker_t *worker = (callback_worker_t *)arg;
+    svsSocketMsg_t msg;
+
+    for(;;)
+    {
+        pthread_mutex_lock(&worker->mutex);
+        while(worker->count == 0)
+        {
+            pthread_cond_wait(&worker->cond, &worker->mutex);
+        }
+        memcpy(&msg.header, &worker->queue[worker->head].header, sizeof(svsSocketMsgHeader_t));
+        memcpy(msg.payload, worker->queue[worker->head].payload, msg.header.len);
+        worker->head = (worker->head + 1) % CALLBACK_WORKER_QUEUE;
+        worker->count--;
+        pthread_cond_signal(&worker->condFree);
+        pthread_mutex_unlock(&worker->mutex);
+
+        svsCallbackDispatch(&msg);
+    }
+
+    return(NULL);
+}
+
+//
+// Description:
+// Queues an event for a dispatch worker. Waits when the worker is full rather than dropping, the callback server
+// applies the overflow policy of the application once the socket backs up.
+//
+static void svsCallbackWorkerPush(callback_worker_t *worker, svsSocketMsg_t *msg)
+{
+    svsSocketMsg_t *slot;
+
+    pthread_mutex_lock(&worker->mutex);
+    while(worker->count >= CALLBACK_WORKER_QUEUE)
+    {
+        pthread_cond_wait(&worker->condFree, &worker->mutex);
+    }
+    slot = &worker->queue[(worker->head + worker->count) % CALLBACK_WORKER_QUEUE];
+    memcpy(&slot->header, &msg->header, sizeof(svsSocketMsgHeader_t));
+    memcpy(slot->payload, msg->payload, msg->header.len);
+    worker->count++;
+    pthread_cond_signal(&worker->cond);
+    pthread_mutex_unlock(&worker->mutex);
+}
+
+static int svsCallbackWorkersStart(int cnt)
+{
+    int i, status;
+    callback_worker_t *worker;
+
+    // svsInit() again keeps the workers already running
+    for(i = cb_worker_cnt; i < cnt; i++)
+    {
+        worker = &cb_worker[i];
+        memset(worker, 0, sizeof(callback_worker_t));
+        worker->queue = malloc(CALLBACK_WORKER_QUEUE * sizeof(svsSocketMsg_t));
+        if(worker->queue == 0)
+        {
+            logError("malloc: %s", strerror(errno));
+            return(ERR_FAIL);
+        }
+        pthread_mutex_init(&worker->mutex, 0);
+        pthread_cond_init(&worker->cond, 0);
+        pthread_cond_init(&worker->condFree, 0);
+
+        status = pthread_create(&worker->thread, 0, svsCallbackWorker, worker);
+        if(status != 0)
+        {
+            logError("pthread_create: %s", strerror(status));
+            return(ERR_FAIL);
+        }
+        // only hand events to the workers started
+        cb_worker_cnt = i + 1;
+    }
+
+    return(ERR_PASS);
+}
+
 //
 // Called by application
 // - creates client thread
@@ -88,6 +246,12 @@ int svsCallbackInit(void)
     memset(cb_bdp, 0, sizeof(cb_bdp));
     memset(cb_kr, 0, sizeof(cb_kr));
 
+    rc = svsCallbackWorkersStart(cb_worker_req);
+    if(rc != ERR_PASS)
+    {
+        return(rc);
+    }
+
     // Create the thread so the client can receive the message from the callback server and calls the callback function
     status = pthread_create(&pthread_client, 0, svsClientCallbackHandler, 0);
     if(-1 == status)
@@ -159,6 +323,225 @@ int svsCallbackRegister(module_id_t module_id, uint16_t msg_id, callback_fn_t ca
     return(rc);
 }
 
+//
+// Description:
+// Selects what the callback server does with the events of this application when its queue is full.
+// Must be called before svsInit(), the policy is sent when registering with the callback server.
+//
+int svsCallbackOverflowSet(callback_overflow_t overflow)
+{
+    if(overflow >= CALLBACK_OVERFLOW_MAX)
+    {
+        logError("invalid overflow policy: %d", overflow);
+        return(ERR_FAIL);
+    }
+    cb_app_reg.overflow = overflow;
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Runs the callbacks on a pool of worker threads instead of the receive thread, 0 (the default) to keep them inline.
+// The events of a device are handled by a single worker, in order, different devices are handled in parallel.
+// Must be called before svsInit().
+//
+int svsCallbackWorkersSet(int workers)
+{
+    if((workers < 0) || (workers > CALLBACK_WORKER_MAX))
+    {
+        logError("invalid number of workers: %d", workers);
+        return(ERR_FAIL);
+    }
+    cb_worker_req = workers;
+
+    return(ERR_PASS);
+}
+
+void svsCallbackAppRegGet(callback_app_reg_t *reg)
+{
+    memcpy(reg, &cb_app_reg, sizeof(callback_app_reg_t));
+}
+
+static int svsCallbackSubscriptionSend(int sockFd, callback_sub_t *sub, int cnt)
+{
+    svsSocketMsgHeader_t hdr;
+
+    memset(&hdr, 0, sizeof(hdr));
+    snprintf(hdr.appName, sizeof(hdr.appName), "%s", svsAppNameGet());
+    hdr.module_id       = MODULE_ID_CALLBACK;
+    hdr.u.cbhdr.msg_id  = (uint8_t)MSG_ID_CB_SUBSCRIBE;
+    hdr.len             = cnt * sizeof(callback_sub_t);
+
+    return(svsSocketSend(sockFd, &hdr, (uint8_t *)sub));
+}
+
+//
+// Description:
+// Subscribes the application to the events of a module, msg ID and device range, CALLBACK_SUB_ANY matching any
+// module or msg ID. Once subscribed the callback server only sends the matching events, without any subscription
+// the application receives all of them. The callbacks still have to be registered with svsCallbackRegister().
+//
+int svsCallbackSubscribe(uint8_t module_id, uint8_t msg_id, uint16_t dev_first, uint16_t dev_last)
+{
+    int rc = ERR_PASS;
+    callback_sub_t *sub;
+
+    if(dev_first > dev_last)
+    {
+        logError("invalid device range %d-%d", dev_first, dev_last);
+        return(ERR_FAIL);
+    }
+
+    pthread_mutex_lock(&mutexCallbackSub);
+
+    if(cb_sub_cnt >= CALLBACK_SUB_MAX)
+    {
+        logError("maximum subscriptions %d exceeded", CALLBACK_SUB_MAX);
+        rc = ERR_FAIL;
+        goto _svsCallbackSubscribe;
+    }
+    sub = &cb_sub[cb_sub_cnt++];
+    sub->module_id  = module_id;
+    sub->msg_id     = msg_id;
+    sub->dev_first  = dev_first;
+    sub->dev_last   = dev_last;
+
+    // not connected yet, the client thread sends the table once connected
+    if(cb_client_sockFd > 0)
+    {
+        rc = svsCallbackSubscriptionSend(cb_client_sockFd, sub, 1);
+    }
+
+    _svsCallbackSubscribe:
+
+    pthread_mutex_unlock(&mutexCallbackSub);
+
+    return(rc);
+}
+
+//
+// Description:
+// Calls the callback registered for an event, on the receive thread or on a dispatch worker.
+//
+static int svsCallbackDispatch(svsSocketMsg_t *msg)
+{
+    int rc = ERR_PASS;
+    uint8_t msg_id  = msg->header.u.cbhdr.msg_id;
+    uint8_t _msg_id = 255; // some invalid value
+
+    // Call the corresponding callback
+    switch(msg->header.module_id)
+    {
+        case MODULE_ID_BDP:
+            if(msg_id >= MSG_ID_BDP_MAX)
+            {
+                logError("invalid msg_id: %d", msg_id);
+                rc = ERR_FAIL;
+                break;
+            }
+            // check to see if the message had a callback from the client
+            if(msg->header.u.cbhdr.callback != 0)
+            {   // client had requested to override a registered callback or to use the incoming callback
+                // call the callback
+                logDebug("Calling BDP %d callback %s", msg->header.dev_num, msgIDToString(msg_id));
+                (msg->header.u.cbhdr.callback)(msg_id, msg->header.dev_num, msg->payload, msg->header.len);
+                break;
+            }
+
+            //logDebug("cb_bdp fctn %p with msg ID %d module %d", cb_bdp[msg_id], msg_id, msg->header.module_id);
+
+            // check to see if registered for all msg IDs
+            if(cb_bdp[MSG_ID_BDP_ALL] != 0)
+            {
+                _msg_id = MSG_ID_BDP_ALL;
+            }
+            else
+            {
+                if(cb_bdp[msg_id] != 0)
+                {
+                    _msg_id = msg_id;
+                }
+                else
+                {
+                    logWarning("callback function null on module ID %d (not registered for msg ID: %d)", msg->header.module_id, msg_id);
+                    break;
+                }
+            }
+            // call the callback
+            (cb_bdp[_msg_id])(msg_id, msg->header.dev_num, msg->payload, msg->header.len);
+            break;
+
+        case MODULE_ID_KR:
+            if(msg_id >= MSG_ID_KR_MAX)
+            {
+                logError("invalid msg_id: %d", msg_id);
+                rc = ERR_FAIL;
+                break;
+            }
+            // check to see if registered for all msg IDs
+            if(cb_kr[MSG_ID_KR_ALL] != 0)
+            {
+                _msg_id = MSG_ID_KR_ALL;
+            }
+            else
+            {
+                if(cb_kr[msg_id] != 0)
+                {
+                    _msg_id = msg_id;
+                }
+                else
+                {
+                    logWarning("callback function null on module ID %d (not registered for msg ID: %d)", msg->header.module_id, msg_id);
+                    break;
+                }
+            }
+            // call the callback
+            (cb_kr[_msg_id])(msg_id, msg->header.dev_num, msg->payload, msg->header.len);
+            break;
+
+        case MODULE_ID_CCR:
+            if(cb_ccr)
+            {
+                (cb_ccr)(msg_id, msg->header.dev_num, msg->payload, msg->header.len);
+            }
+            break;
+
+        case MODULE_ID_DIO:
+            if(cb_dio)
+            {
+                (cb_dio)(msg_id, msg->header.dev_num, msg->payload, msg->header.len);
+            }
+            break;
+
+        case MODULE_ID_UPGRADE:
+            if(cb_upgrade)
+            {
+                (cb_upgrade)(msg_id, msg->header.dev_num, msg->payload, msg->header.len);
+            }
+            break;
+        case MODULE_ID_PM:
+            if(cb_pm)
+            {
+                (cb_pm)(msg_id, msg->header.dev_num, msg->payload, msg->header.len);
+            }
+            break;
+        case MODULE_ID_WIM:
+            if(cb_wim)
+            {
+                (cb_wim)(msg_id, msg->header.dev_num, msg->payload, msg->header.len);
+            }
+            break;
+
+        default:
+            logError("invalid module ID %d with MSG ID %d", msg->header.module_id, msg_id);
+            rc = ERR_FAIL;
+            break;
+    }
+
+    return(rc);
+}
+
 //
 // Description:
 // This handler is called when the server receives request from client
@@ -166,48 +549,59 @@ int svsCallbackRegister(module_id_t module_id, uint16_t msg_id, callback_fn_t ca
 static void *svsClientCallbackHandler(void *arg)
 {
     int rc = ERR_PASS;
-    int svsCallbackSockFd;
+    int svsCallbackSockFd = 0;
     svsSocketMsg_t msg;
+    svs_socket_reconnect_t rec;
 
     //logDebug("");
 
-    /*
-     * Setup connection with callback server. Note that this function is
-     * called by applications. In order for applications to receive the
-     * callback messages from the server we pass in a 1 as the second
-     * parameter to indicate that we are an application and so should register
-     * with the CB server after connecting. We need to do this because the
-     * same function is used by server threads to connect with the CB server
-     * and this flag allows us to distinguish between applications that need
-     * to receive the callback messages and servers that don't.
-     */
-    rc = svsSocketClientCreateCallback(&svsCallbackSockFd, 1);
-    if(rc != ERR_PASS)
-    {
-        logError("");
-        exit(1);
-    }
+    memset(&rec, 0, sizeof(rec));
 
     for(;;)
     {
+        if(svsCallbackSockFd == 0)
+        {
+            /*
+             * Setup connection with callback server. Note that this function is
+             * called by applications. In order for applications to receive the
+             * callback messages from the server we pass in a 1 as the appflag
+             * parameter to indicate that we are an application and so should register
+             * with the CB server after connecting. We need to do this because the
+             * same function is used by server threads to connect with the CB server
+             * and this flag allows us to distinguish between applications that need
+             * to receive the callback messages and servers that don't.
+             * The connection is made again, with a backoff, whenever the server goes away.
+             */
+            rc = svsSocketReconnect(&rec, SOCKET_PORT_CALLBACK, 1, &svsCallbackSockFd);
+            if(rc != ERR_PASS)
+            {
+                usleep(SVS_SOCKET_MUX_TICK_MS * 1000);
+                continue;
+            }
+
+            // a restarted server knows nothing about us, send the subscriptions again
+            pthread_mutex_lock(&mutexCallbackSub);
+            cb_client_sockFd = svsCallbackSockFd;
+            if(cb_sub_cnt > 0)
+            {
+                svsCallbackSubscriptionSend(svsCallbackSockFd, cb_sub, cb_sub_cnt);
+            }
+            pthread_mutex_unlock(&mutexCallbackSub);
+        }
+
         // Wait for message from callback server
         rc = svsSocketRecvMsg(svsCallbackSockFd, &msg.header, msg.payload, SVS_SOCKET_MSG_PAYLOAD_MAX);
         if(rc != ERR_PASS)
         {
             if (rc == ERR_SOCK_DISC)
             {
-                /*
-                 * Note that this is bogus error handling but it's the best we
-                 * can do with the exiting code. If a server exits the client
-                 * should indeed close as we do here but then should be trying
-                 * to reconnect to the server (expecting it to come back).
-                 * But with the current codebase we have no way to practically
-                 * do this.
-                 */
-                logError("callback server connection closed...exiting");
+                logWarning("callback server connection closed...reconnecting");
+                pthread_mutex_lock(&mutexCallbackSub);
+                cb_client_sockFd = 0;
+                pthread_mutex_unlock(&mutexCallbackSub);
                 close(svsCallbackSockFd);
                 svsCallbackSockFd = 0;
-                return NULL;
+                continue;
             }
             logError("svsSocketRecvMsg");
             continue;
@@ -224,118 +618,346 @@ static void *svsClientCallbackHandler(void *arg)
             }
         }
 
-        uint8_t msg_id  = msg.header.u.cbhdr.msg_id;
-        uint8_t _msg_id = 255; // some invalid value
+        if(cb_worker_cnt == 0)
+        {
+            svsCallbackDispatch(&msg);
+        }
+        else
+        {   // the events of a device always go to the same worker so they stay in order
+            svsCallbackWorkerPush(&cb_worker[msg.header.dev_num % cb_worker_cnt], &msg);
+        }
+    }
+
+    return(NULL);
+}
+
+//
+// Description:
+// Shuts the application connection down, the server thread sees the close and releases the slot.
+// Called with mutexCallbackApp held.
+//
+static void svsCallbackAppClose(callback_app_t *app)
+{
+    if(app->closing)
+    {
+        return;
+    }
+    app->closing = 1;
+    shutdown(app->sockFd, SHUT_RDWR);
+    pthread_cond_signal(&app->cond);
+}
+
+//
+// Description:
+// Writer thread of an application, sends the queued events in order.
+// The send lock shared by the other sockets is not taken, this thread is the only writer of the socket.
+//
+static void *svsCallbackAppWriter(void *arg)
+{
+    int rc;
+    callback_app_t *app = (callback_app_t *)arg;
+    svsSocketMsg_t msg;
+
+    pthread_mutex_lock(&mutexCallbackApp);
+
+    while(app->running && !app->closing)
+    {
+        if(app->count == 0)
+        {
+            pthread_cond_wait(&app->cond, &mutexCallbackApp);
+            continue;
+        }
+        // take the event out so the server thread can queue while we write
+        memcpy(&msg.header, &app->queue[app->head].header, sizeof(svsSocketMsgHeader_t));
+        memcpy(msg.payload, app->queue[app->head].payload, msg.header.len);
+        app->head = (app->head + 1) % app->queue_len;
+        app->count--;
+
+        pthread_mutex_unlock(&mutexCallbackApp);
+
+        rc = svsSocketSendUnlocked(app->sockFd, &msg.header, msg.payload);
+
+        pthread_mutex_lock(&mutexCallbackApp);
+
+        if(rc != ERR_PASS)
+        {   // the stream may be cut in the middle of a message, nothing more can be sent
+            logError("error sending to callback application %s fd %d", app->stats.appName, app->sockFd);
+            svsCallbackAppClose(app);
+            break;
+        }
+        app->stats.sent++;
+    }
+
+    pthread_mutex_unlock(&mutexCallbackApp);
 
-        // Call the corresponding callback
-        switch(msg.header.module_id)
+    return(NULL);
+}
+
+static int svsCallbackAppAdd(int sockFd, char *appName, uint8_t overflow)
+{
+    int rc = ERR_PASS;
+    int i, status;
+    callback_app_t *app = 0;
+
+    pthread_mutex_lock(&mutexCallbackApp);
+
+    for(i = 0; i < REGISTERED_APPS_MAX; i++)
+    {
+        if(cb_app[i].sockFd == 0)
         {
-            case MODULE_ID_BDP:
-                if(msg_id >= MSG_ID_BDP_MAX)
-                {
-                    logError("invalid msg_id: %d", msg_id);
-                    rc = ERR_FAIL;
-                    break;
-                }
-                // check to see if the message had a callback from the client
-                if(msg.header.u.cbhdr.callback != 0)
-                {   // client had requested to override a registered callback or to use the incoming callback
-                    // call the callback
-                    logDebug("Calling BDP %d callback %s", msg.header.dev_num, msgIDToString(msg_id));
-                    (msg.header.u.cbhdr.callback)(msg_id, msg.header.dev_num, msg.payload, msg.header.len);
-                    break;
-                }
+            app = &cb_app[i];
+            break;
+        }
+    }
+    if(app == 0)
+    {
+        logWarning("Maximum registered callback application exceeded...failed to register %d", sockFd);
+        rc = ERR_FAIL;
+        goto _svsCallbackAppAdd;
+    }
 
-                //logDebug("cb_bdp fctn %p with msg ID %d module %d", cb_bdp[msg_id], msg_id, msg.header.module_id);
+    memset(app, 0, sizeof(callback_app_t));
+    app->queue = malloc(cb_queue_len * sizeof(svsSocketMsg_t));
+    if(app->queue == 0)
+    {
+        logError("malloc: %s", strerror(errno));
+        rc = ERR_FAIL;
+        goto _svsCallbackAppAdd;
+    }
+    app->queue_len          = cb_queue_len;
+    app->stats.queue_len    = cb_queue_len;
+    app->stats.overflow     = overflow;
+    snprintf(app->stats.appName, sizeof(app->stats.appName), "%s", appName);
+    pthread_cond_init(&app->cond, 0);
+    app->running            = 1;
 
-                // check to see if registered for all msg IDs
-                if(cb_bdp[MSG_ID_BDP_ALL] != 0)
-                {
-                    _msg_id = MSG_ID_BDP_ALL;
-                }
-                else
-                {
-                    if(cb_bdp[msg_id] != 0)
-                    {
-                        _msg_id = msg_id;
-                    }
-                    else
-                    {
-                        logWarning("callback function null on module ID %d (not registered for msg ID: %d)", msg.header.module_id, msg_id);
-                        break;
-                    }
-                }
-                // call the callback
-                (cb_bdp[_msg_id])(msg_id, msg.header.dev_num, msg.payload, msg.header.len);
-                break;
+    status = pthread_create(&app->thread, 0, svsCallbackAppWriter, app);
+    if(status != 0)
+    {
+        logError("pthread_create: %s", strerror(status));
+        pthread_cond_destroy(&app->cond);
+        free(app->queue);
+        memset(app, 0, sizeof(callback_app_t));
+        rc = ERR_FAIL;
+        goto _svsCallbackAppAdd;
+    }
+    app->sockFd = sockFd;
+    app_cnt++;
+    logInfo("registered app %s with CB server - fd: %d, app_cnt: %d, overflow: %d", app->stats.appName, sockFd, app_cnt, overflow);
 
-            case MODULE_ID_KR:
-                if(msg_id >= MSG_ID_KR_MAX)
-                {
-                    logError("invalid msg_id: %d", msg_id);
-                    rc = ERR_FAIL;
-                    break;
-                }
-                // check to see if registered for all msg IDs
-                if(cb_kr[MSG_ID_KR_ALL] != 0)
-                {
-                    _msg_id = MSG_ID_KR_ALL;
-                }
-                else
+    _svsCallbackAppAdd:
+
+    pthread_mutex_unlock(&mutexCallbackApp);
+
+    return(rc);
+}
+
+//
+// Description:
+// Stops the writer thread and releases the slot of an application, before the server thread closes the socket.
+//
+static int svsCallbackAppRemove(int sockFd)
+{
+    int i;
+    callback_app_t *app = 0;
+
+    pthread_mutex_lock(&mutexCallbackApp);
+
+    for(i = 0; i < REGISTERED_APPS_MAX; i++)
+    {
+        if(cb_app[i].sockFd == sockFd)
+        {
+            app = &cb_app[i];
+            break;
+        }
+    }
+    if(app == 0)
+    {
+        pthread_mutex_unlock(&mutexCallbackApp);
+        return(ERR_PASS);
+    }
+    app->running = 0;
+    pthread_cond_signal(&app->cond);
+
+    pthread_mutex_unlock(&mutexCallbackApp);
+
+    // wakes the writer up if it is blocked on a full socket
+    shutdown(sockFd, SHUT_RDWR);
+    pthread_join(app->thread, 0);
+
+    pthread_mutex_lock(&mutexCallbackApp);
+
+    if(app->stats.dropped || app->stats.coalesced)
+    {
+        logWarning("app %s fd %d: sent %u dropped %u coalesced %u depth max %u", app->stats.appName, sockFd,
+                   app->stats.sent, app->stats.dropped, app->stats.coalesced, app->stats.depth_max);
+    }
+    pthread_cond_destroy(&app->cond);
+    free(app->queue);
+    memset(app, 0, sizeof(callback_app_t));
+    app_cnt--;
+    logInfo("removed registered app - fd: %d, app_cnt: %d", sockFd, app_cnt);
+
+    pthread_mutex_unlock(&mutexCallbackApp);
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Adds the subscriptions received from an application. Called with mutexCallbackApp held.
+//
+static void svsCallbackAppSubscribe(callback_app_t *app, callback_sub_t *sub, int cnt)
+{
+    int i;
+
+    for(i = 0; i < cnt; i++)
+    {
+        if(app->stats.sub_cnt >= CALLBACK_SUB_MAX)
+        {
+            logWarning("app %s fd %d: maximum subscriptions %d exceeded", app->stats.appName, app->sockFd, CALLBACK_SUB_MAX);
+            break;
+        }
+        memcpy(&app->sub[app->stats.sub_cnt++], &sub[i], sizeof(callback_sub_t));
+    }
+}
+
+//
+// Description:
+// Returns 1 when the application is subscribed to the event, all the events match when it has no subscription.
+// Called with mutexCallbackApp held.
+//
+static int svsCallbackAppMatch(callback_app_t *app, svsSocketMsgHeader_t *hdr)
+{
+    int i;
+    callback_sub_t *sub;
+
+    if(app->stats.sub_cnt == 0)
+    {
+        return(1);
+    }
+    for(i = 0; i < app->stats.sub_cnt; i++)
+    {
+        sub = &app->sub[i];
+        if((sub->module_id != CALLBACK_SUB_ANY) && (sub->module_id != hdr->module_id))
+        {
+            continue;
+        }
+        if((sub->msg_id != CALLBACK_SUB_ANY) && (sub->msg_id != hdr->u.cbhdr.msg_id))
+        {
+            continue;
+        }
+        if((hdr->dev_num < sub->dev_first) || (hdr->dev_num > sub->dev_last))
+        {
+            continue;
+        }
+        return(1);
+    }
+
+    return(0);
+}
+
+//
+// Description:
+// Queues an event for an application, never blocks. When the queue is full the application overflow policy applies.
+// Called with mutexCallbackApp held.
+//
+static void svsCallbackAppPush(callback_app_t *app, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    uint16_t i, idx;
+    svsSocketMsg_t *msg = 0;
+
+    if(app->closing)
+    {
+        return;
+    }
+
+    if(app->count < app->queue_len)
+    {
+        msg = &app->queue[(app->head + app->count) % app->queue_len];
+        app->count++;
+    }
+    else
+    {
+        switch(app->stats.overflow)
+        {
+            case CALLBACK_OVERFLOW_COALESCE:
+                // the newer event replaces a queued one from the same source
+                for(i = 0; i < app->count; i++)
                 {
-                    if(cb_kr[msg_id] != 0)
-                    {
-                        _msg_id = msg_id;
-                    }
-                    else
+                    idx = (app->head + i) % app->queue_len;
+                    if((app->queue[idx].header.module_id == hdr->module_id) &&
+                       (app->queue[idx].header.dev_num == hdr->dev_num) &&
+                       (app->queue[idx].header.u.cbhdr.msg_id == hdr->u.cbhdr.msg_id) &&
+                       (app->queue[idx].header.u.cbhdr.callback == hdr->u.cbhdr.callback))
                     {
-                        logWarning("callback function null on module ID %d (not registered for msg ID: %d)", msg.header.module_id, msg_id);
+                        msg = &app->queue[idx];
+                        app->stats.coalesced++;
                         break;
                     }
                 }
-                // call the callback
-                (cb_kr[_msg_id])(msg_id, msg.header.dev_num, msg.payload, msg.header.len);
-                break;
-
-            case MODULE_ID_CCR:
-                if(cb_ccr)
-                {
-                    (cb_ccr)(msg_id, msg.header.dev_num, msg.payload, msg.header.len);
+                if(msg == 0)
+                {   // nothing to merge with, the oldest event makes room
+                    msg = &app->queue[app->head];
+                    app->head = (app->head + 1) % app->queue_len;
+                    app->stats.dropped++;
                 }
                 break;
 
-            case MODULE_ID_DIO:
-                if(cb_dio)
-                {
-                    (cb_dio)(msg_id, msg.header.dev_num, msg.payload, msg.header.len);
-                }
-                break;
+            case CALLBACK_OVERFLOW_DISCONNECT:
+                logWarning("app %s fd %d not reading, %d events queued...disconnecting", app->stats.appName, app->sockFd, app->count);
+                cb_app_disconnected++;
+                svsCallbackAppClose(app);
+                return;
 
-            case MODULE_ID_UPGRADE:
-                if(cb_upgrade)
-                {
-                    (cb_upgrade)(msg_id, msg.header.dev_num, msg.payload, msg.header.len);
-                }
-                break;
-            case MODULE_ID_PM:
-                if(cb_pm)
-                {
-                    (cb_pm)(msg_id, msg.header.dev_num, msg.payload, msg.header.len);
-                }
-                break;
-            case MODULE_ID_WIM:
-                if(cb_wim)
+            default:
+                app->stats.dropped++;
+                if((app->stats.dropped % 100) == 1)
                 {
-                    (cb_wim)(msg_id, msg.header.dev_num, msg.payload, msg.header.len);
+                    logWarning("app %s fd %d not reading, %u events dropped", app->stats.appName, app->sockFd, app->stats.dropped);
                 }
-                break;
+                return;
+        }
+    }
 
-            default:
-                logError("invalid module ID %d with MSG ID %d", msg.header.module_id, msg_id);
-                rc = ERR_FAIL;
-                break;
+    memcpy(&msg->header, hdr, sizeof(svsSocketMsgHeader_t));
+    memcpy(msg->payload, payload, hdr->len);
+
+    if(app->count > app->stats.depth_max)
+    {
+        app->stats.depth_max = app->count;
+    }
+    pthread_cond_signal(&app->cond);
+}
+
+//
+// Description:
+// Copies the queue depth and the overflow counters of the registered applications.
+//
+int svsCallbackServerStatsGet(callback_stats_t *stats)
+{
+    int i, n = 0;
+
+    memset(stats, 0, sizeof(callback_stats_t));
+
+    pthread_mutex_lock(&mutexCallbackApp);
+
+    for(i = 0; i < REGISTERED_APPS_MAX; i++)
+    {
+        if(cb_app[i].sockFd == 0)
+        {
+            continue;
         }
+        memcpy(&stats->app[n], &cb_app[i].stats, sizeof(callback_app_stats_t));
+        stats->app[n].depth = cb_app[i].count;
+        n++;
     }
+    stats->app_cnt      = n;
+    stats->disconnected = cb_app_disconnected;
+
+    pthread_mutex_unlock(&mutexCallbackApp);
+
+    return(ERR_PASS);
 }
 
 /*
@@ -344,12 +966,15 @@ static void *svsClientCallbackHandler(void *arg)
  * be passed up to application space. However, it is also invoked when a
  * registration is received from an application that wants to register for
  * callback messages. Up to REGISTERED_APPS_MAX applications can register
- * for callback messages.
+ * for callback messages. The messages are only queued here, each application
+ * has its own writer thread.
  */
 static int svsSocketServerCallbackHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
 {
     int rc = ERR_PASS;
     int i;
+    uint8_t overflow;
+    callback_app_reg_t *reg;
 
     /*
      * If both hdr and payload are NULL this is an indication that the
@@ -358,29 +983,8 @@ static int svsSocketServerCallbackHandler(int sockFd, svsSocketMsgHeader_t *hdr,
      */
     if ((hdr == NULL) && (payload == NULL))
     {
-        int i;
-
         logInfo("fd = %d went away...trying to remove from our list", sockFd);
-        for (i = 0; i < app_cnt; ++i)
-        {
-            if (app_fds[i] == sockFd)
-            {
-                int j;
-
-                /* This socket closed...remove and adjust */
-                app_fds[i] = 0; /* In case there are no other entries */
-                for (j = i + 1; j < app_cnt; ++j)
-                {
-                    app_fds[j - 1] = app_fds[j];
-                    app_fds[j] = 0;
-                }
-                --app_cnt;
-                logInfo("removed registered app - fd: %d, app_cnt: %d", sockFd, app_cnt);
-                break;
-            }
-        }
-
-        return(rc);
+        return(svsCallbackAppRemove(sockFd));
     }
 
     if (hdr == NULL)
@@ -395,42 +999,68 @@ static int svsSocketServerCallbackHandler(int sockFd, svsSocketMsgHeader_t *hdr,
      */
     if (hdr && (hdr->u.bdphdr.msg_id == MSG_ID_CB_APP))
     {
-        if (app_cnt < REGISTERED_APPS_MAX)
+        overflow = cb_overflow;
+        if (hdr->len >= sizeof(callback_app_reg_t))
         {
-            app_fds[app_cnt++] = sockFd;
-            logInfo("registered app with CB server - fd: %d, app_cnt: %d", sockFd, app_cnt);
+            reg = (callback_app_reg_t *)payload;
+            if ((reg->overflow > CALLBACK_OVERFLOW_DEFAULT) && (reg->overflow < CALLBACK_OVERFLOW_MAX))
+            {
+                overflow = reg->overflow;
+            }
         }
-        else
+        svsCallbackAppAdd(sockFd, hdr->appName, overflow);
+        return(rc);
+    }
+
+    /*
+     * Subscriptions of an application, from then on it only receives the
+     * events it subscribed to.
+     */
+    if ((hdr->module_id == MODULE_ID_CALLBACK) && (hdr->u.cbhdr.msg_id == MSG_ID_CB_SUBSCRIBE))
+    {
+        pthread_mutex_lock(&mutexCallbackApp);
+        for (i = 0; i < REGISTERED_APPS_MAX; ++i)
         {
-            logWarning("Maximum registered callback application exceeded...failed to register %d", sockFd);
+            if (cb_app[i].sockFd == sockFd)
+            {
+                svsCallbackAppSubscribe(&cb_app[i], (callback_sub_t *)payload, hdr->len / sizeof(callback_sub_t));
+                logInfo("app %s fd %d: %d subscriptions", cb_app[i].stats.appName, sockFd, cb_app[i].stats.sub_cnt);
+                break;
+            }
         }
+        pthread_mutex_unlock(&mutexCallbackApp);
         return(rc);
     }
 
     /*
      * Not an identity message...that means it's a message from one of the
-     * servers...forward to all registered applications.
+     * servers...queue for the registered applications subscribed to it.
      */
+    pthread_mutex_lock(&mutexCallbackApp);
+
     if (app_cnt > 0)
     {
-        for (i = 0; i < app_cnt; ++i)
+        for (i = 0; i < REGISTERED_APPS_MAX; ++i)
         {
-            if (app_fds[i] > 0)
+            if (cb_app[i].sockFd <= 0)
             {
-                rc = svsSocketSend(app_fds[i], hdr, payload);
-                if (rc != ERR_PASS)
-                {
-                    logError("error sending to callback application");
-                }
+                continue;
+            }
+            if (svsCallbackAppMatch(&cb_app[i], hdr))
+            {
+                svsCallbackAppPush(&cb_app[i], hdr, payload);
             }
             else
-                logError("app_fds[%d] is not a valid file descriptor - app_cnt: %d", i, app_cnt);
+            {
+                cb_app[i].stats.filtered++;
+            }
         }
     }
     else
         logInfo("no registered callbacks - app_cnt: %d", app_cnt);
 
+    pthread_mutex_unlock(&mutexCallbackApp);
+
     return(rc);
 }
 
-
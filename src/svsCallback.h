@@ -3,6 +3,13 @@
 
 #define CALLBACK_MSG_PAYLOAD_MAX     1024
 #define REGISTERED_APPS_MAX            10
+#define CALLBACK_QUEUE_DEFAULT         64       // events queued per application, "callback/queue" in the config
+#define CALLBACK_QUEUE_MAX            256
+#define CALLBACK_WORKER_MAX            16       // callback dispatch workers of an application
+#define CALLBACK_WORKER_QUEUE          32       // events waiting per dispatch worker
+#define CALLBACK_SUB_MAX               32       // subscriptions per application
+#define CALLBACK_SUB_ANY             0xff       // subscription module or msg ID wildcard
+#define CALLBACK_SUB_DEV_ALL       0xffff       // subscription last device covering all devices
 #include "callback.h"
 #ifndef callback_fn_t
 //typedef int (* callback_fn_t)(uint8_t msg_id, uint8_t dev_num, uint8_t *payload, uint16_t len);
@@ -10,6 +17,7 @@
 
 typedef enum
 {
+    MSG_ID_CB_SUBSCRIBE = 252,
     MSG_ID_CB_APP = 253,
 
     MSG_ID_CB_MAX
@@ -27,11 +35,62 @@ typedef struct
     uint8_t                 payload[CALLBACK_MSG_PAYLOAD_MAX];
 } svsMsgCallback_t;
 
+// what the callback server does with an event when the application queue is full
+typedef enum
+{
+    CALLBACK_OVERFLOW_DEFAULT,      // use the server setting, "callback/overflow" in the config
+    CALLBACK_OVERFLOW_DROP,         // drop the new event
+    CALLBACK_OVERFLOW_COALESCE,     // replace the queued event of the same module, msg ID and device, else drop the oldest
+    CALLBACK_OVERFLOW_DISCONNECT,   // close the application connection
+
+    CALLBACK_OVERFLOW_MAX
+} callback_overflow_t;
+
+typedef struct // payload of the MSG_ID_CB_APP registration
+{
+    uint8_t overflow;   // callback_overflow_t
+} callback_app_reg_t;
+
+// an application subscribed to at least one topic only receives the matching events
+typedef struct // payload of the MSG_ID_CB_SUBSCRIBE message, one or more per message
+{
+    uint8_t     module_id;      // module_id_t or CALLBACK_SUB_ANY
+    uint8_t     msg_id;         // module msg ID or CALLBACK_SUB_ANY
+    uint16_t    dev_first;      // device number range, inclusive
+    uint16_t    dev_last;
+} callback_sub_t;
+
+typedef struct
+{
+    char        appName[32];
+    uint8_t     overflow;       // callback_overflow_t applied to this application
+    uint8_t     sub_cnt;        // subscriptions, 0 when receiving all the events
+    uint16_t    depth;          // events currently queued
+    uint16_t    depth_max;      // highest queue depth seen
+    uint16_t    queue_len;      // queue size
+    uint32_t    sent;           // events written to the application
+    uint32_t    dropped;        // events lost on overflow
+    uint32_t    coalesced;      // events merged into a queued one on overflow
+    uint32_t    filtered;       // events not matching the subscriptions
+} callback_app_stats_t;
+
+typedef struct
+{
+    uint8_t                 app_cnt;
+    uint32_t                disconnected;   // applications closed on overflow since startup
+    callback_app_stats_t    app[REGISTERED_APPS_MAX];
+} callback_stats_t;
+
 int svsCallbackServerInit(void);
 int svsCallbackServerUninit(void);
 
 int svsCallbackInit(void);
 int svsCallbackRegister(module_id_t module_id, uint16_t msg_id, callback_fn_t callback);
+int svsCallbackOverflowSet(callback_overflow_t overflow);
+int svsCallbackWorkersSet(int workers);
+int svsCallbackSubscribe(uint8_t module_id, uint8_t msg_id, uint16_t dev_first, uint16_t dev_last);
+void svsCallbackAppRegGet(callback_app_reg_t *reg);
+int svsCallbackServerStatsGet(callback_stats_t *stats);
 
 
 #endif // SVS_CALLBACK_H
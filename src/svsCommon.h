@@ -35,6 +35,8 @@ typedef enum
     MODULE_ID_PM,       // Power Manager
 
     MODULE_ID_SVS,      // the libSVS itself
+    MODULE_ID_SHM,      // shared memory link setup on a server socket
+    MODULE_ID_WIRE,     // header format negotiation when a connection is set up
 
     MODULE_ID_MAX       // KEEP LAST
 } module_id_t;
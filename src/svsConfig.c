@@ -3,46 +3,467 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/inotify.h>
 
 #include <svsLog.h>
 #include <svsErr.h>
 #include <svsCommon.h>
 #include <svsSocket.h>
 #include <svsConfig.h>
+#include <crc.h>
 
 //static socket_thread_info_t socket_thread_info;
-static svsConfigInfo_t      svsConfigInfo;
+
+//
+// The XML file is parsed once in a table of "module.param" values, the lookups only hash the key and copy the value.
+// A new table is built when the file changes and swapped with the current one, a lookup sees one or the other.
+//
+static svs_config_table_t   *svsConfigTable = 0;
+static pthread_rwlock_t     rwlockConfig = PTHREAD_RWLOCK_INITIALIZER;
+static uint8_t              svsConfigParsed = 0;        // libxml2 was used, cleaned up by svsConfigServerUninit()
+static int                  svsConfigWatchFd = -1;
+static volatile uint8_t     svsConfigWatchRunning = 0;
+static pthread_t            svsConfigWatchThreadId;
 
 //static int svsSocketClientConfigHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
 
-int svsConfigServerInit(void)
+xmlNodePtr svsConfigNodeByNameFind(xmlNode *node, const char *nodeName);
+
+static uint32_t svsConfigHash(const char *module, const char *param)
+{   // FNV-1a of "module.param"
+    uint32_t hash = 2166136261u;
+    const char *c;
+
+    for(c = module; *c; c++)
+    {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+    hash = (hash ^ (uint8_t)'.') * 16777619u;
+    for(c = param; *c; c++)
+    {
+        hash = (hash ^ (uint8_t)*c) * 16777619u;
+    }
+
+    return((hash != 0) ? hash : 1);
+}
+
+static uint8_t svsConfigKeyMatch(const char *key, const char *module, const char *param)
 {
-    int     rc              = 0;
-    const char *fileName    = "/usr/scu/etc/svsConfig.xml";
+    size_t len = strlen(module);
 
-    memset(&svsConfigInfo, 0, sizeof(svsConfigInfo));
+    return((strncmp(key, module, len) == 0) && (key[len] == '.') && (strcmp(&key[len + 1], param) == 0));
+}
+
+static size_t svsConfigTableSize(uint32_t slots)
+{
+    return(sizeof(svs_config_table_hdr_t) + slots * sizeof(svs_config_entry_t));
+}
+
+//
+// Description:
+// Returns the slot of the param, or the free slot where it would be added. The table always has free slots.
+//
+static svs_config_entry_t *svsConfigEntryFind(svs_config_table_t *table, const char *module, const char *param)
+{
+    uint32_t hash = svsConfigHash(module, param);
+    uint32_t i = hash & (table->hdr.slots - 1);
+    svs_config_entry_t *entry;
 
-    svsConfigInfo.doc = xmlReadFile(fileName, 0, 0);
-    if(svsConfigInfo.doc == 0)
+    for(;;)
+    {
+        entry = &table->entry[i];
+        if((entry->hash == 0) || ((entry->hash == hash) && svsConfigKeyMatch(entry->key, module, param)))
+        {
+            return(entry);
+        }
+        i = (i + 1) & (table->hdr.slots - 1);
+    }
+}
+
+//
+// Description:
+// Adds a param, the first one wins when a module has it twice as with the DOM lookups.
+//
+static void svsConfigEntryAdd(svs_config_table_t *table, const char *module, const char *param, const char *value)
+{
+    svs_config_entry_t *entry;
+
+    if(strlen(module) + strlen(param) + 2 > SVS_CONFIG_KEY_MAX)
+    {
+        logWarning("param [%s.%s] name too long, ignored", module, param);
+        return;
+    }
+    entry = svsConfigEntryFind(table, module, param);
+    if(entry->hash != 0)
+    {
+        return;
+    }
+
+    entry->hash = svsConfigHash(module, param);
+    snprintf(entry->key, SVS_CONFIG_KEY_MAX, "%s.%s", module, param);
+    if(value)
+    {
+        if(strlen(value) >= SVS_CONFIG_VALUE_MAX)
+        {
+            logWarning("param [%s] value truncated to %d characters", entry->key, SVS_CONFIG_VALUE_MAX - 1);
+        }
+        strncpy(entry->value, value, SVS_CONFIG_VALUE_MAX - 1);
+        entry->value_int = atoi(entry->value);
+        entry->defined   = 1;
+    }
+    table->hdr.count++;
+}
+
+//
+// Description:
+// Parses the XML file in a new table, the params are the element children of the children of "modules".
+//
+static int svsConfigParse(const char *fileName, struct stat *st, svs_config_table_t **table)
+{
+    int rc = ERR_PASS;
+    uint32_t count = 0;
+    uint32_t slots = 16;
+    xmlNode *modules, *module, *param;
+    xmlChar *str;
+    svsConfigInfo_t info;
+    svs_config_table_t *tbl = 0;
+
+    svsConfigParsed = 1;
+    info.doc = xmlReadFile(fileName, 0, 0);
+    if(info.doc == 0)
     {
         logError("cannot parse configuration file %s", fileName);
         return(ERR_FAIL);
     }
 
     // Get the root element node
-    svsConfigInfo.root_element = xmlDocGetRootElement(svsConfigInfo.doc);
-    if(svsConfigInfo.root_element == 0)
+    info.root_element = xmlDocGetRootElement(info.doc);
+    if(info.root_element == 0)
     {
         logError("empty configuration file");
-        return(ERR_FAIL);
+        rc = ERR_FAIL;
+        goto _svsConfigParse;
     }
     // Validate entry
-    if(xmlStrcmp(svsConfigInfo.root_element->name, (const xmlChar *)"svsLib"))
+    if(xmlStrcmp(info.root_element->name, (const xmlChar *)"svsLib"))
+    {
+        logError("configuration document not for SVSD: %s", info.root_element->name);
+        rc = ERR_FAIL;
+        goto _svsConfigParse;
+    }
+
+    modules = svsConfigNodeByNameFind(info.root_element, "modules");
+    for(module = modules ? modules->xmlChildrenNode : 0; module; module = module->next)
     {
-        logError("configuration document not for SVSD: %s", svsConfigInfo.root_element->name);
+        for(param = (module->type == XML_ELEMENT_NODE) ? module->xmlChildrenNode : 0; param; param = param->next)
+        {
+            count += (param->type == XML_ELEMENT_NODE);
+        }
+    }
+    if(count > SVS_CONFIG_ENTRY_MAX)
+    {
+        logError("%s: %d params, maximum %d", fileName, count, SVS_CONFIG_ENTRY_MAX);
+        rc = ERR_FAIL;
+        goto _svsConfigParse;
+    }
+    while(slots < count * 2)
+    {
+        slots *= 2;
+    }
+
+    tbl = (svs_config_table_t *)calloc(1, svsConfigTableSize(slots));
+    if(tbl == 0)
+    {
+        logError("calloc failed");
+        rc = ERR_FAIL;
+        goto _svsConfigParse;
+    }
+    tbl->hdr.magic          = SVS_CONFIG_CACHE_MAGIC;
+    tbl->hdr.version        = SVS_CONFIG_CACHE_VERSION;
+    tbl->hdr.slots          = slots;
+    tbl->hdr.xml_size       = st->st_size;
+    tbl->hdr.xml_mtime_sec  = st->st_mtim.tv_sec;
+    tbl->hdr.xml_mtime_nsec = st->st_mtim.tv_nsec;
+    tbl->hdr.xml_ino        = st->st_ino;
+
+    for(module = modules ? modules->xmlChildrenNode : 0; module; module = module->next)
+    {
+        // a module given twice is only looked up in the first one
+        if((module->type != XML_ELEMENT_NODE) || (svsConfigNodeByNameFind(modules, (const char *)module->name) != module))
+        {
+            continue;
+        }
+        for(param = module->xmlChildrenNode; param; param = param->next)
+        {
+            if(param->type != XML_ELEMENT_NODE)
+            {
+                continue;
+            }
+            str = xmlNodeListGetString(info.doc, param->xmlChildrenNode, 1);
+            svsConfigEntryAdd(tbl, (const char *)module->name, (const char *)param->name, (const char *)str);
+            xmlFree(str);
+        }
+    }
+    tbl->hdr.crc = crc16_compute((uint8_t *)tbl->entry, slots * sizeof(svs_config_entry_t));
+    logDebug("%s parsed, %d params", fileName, tbl->hdr.count);
+    *table = tbl;
+
+    _svsConfigParse:
+
+    // free the document
+    xmlFreeDoc(info.doc);
+
+    return(rc);
+}
+
+//
+// Description:
+// Loads the table parsed from the XML file before svsd restarted, the cache is ignored when the XML file changed.
+//
+static int svsConfigCacheLoad(struct stat *st, svs_config_table_t **table)
+{
+    int rc = ERR_FAIL;
+    int fd;
+    uint32_t i;
+    size_t size;
+    svs_config_table_hdr_t hdr;
+    svs_config_table_t *tbl = 0;
+
+    fd = open(SVS_CONFIG_CACHE_FILE, O_RDONLY);
+    if(fd < 0)
+    {
+        if(errno != ENOENT)
+        {
+            logWarning("failed to open file %s: %s", SVS_CONFIG_CACHE_FILE, strerror(errno));
+        }
         return(ERR_FAIL);
     }
 
+    if(read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+    {
+        logWarning("%s: header too short", SVS_CONFIG_CACHE_FILE);
+        goto _svsConfigCacheLoad;
+    }
+    if((hdr.magic != SVS_CONFIG_CACHE_MAGIC) || (hdr.version != SVS_CONFIG_CACHE_VERSION) ||
+       (hdr.slots < 16) || (hdr.slots > SVS_CONFIG_ENTRY_MAX * 4) || (hdr.slots & (hdr.slots - 1)) ||
+       (hdr.count * 2 > hdr.slots))
+    {
+        logWarning("%s: invalid header, magic 0x%08x version %d slots %d", SVS_CONFIG_CACHE_FILE, hdr.magic, hdr.version, hdr.slots);
+        goto _svsConfigCacheLoad;
+    }
+    if((hdr.xml_size != st->st_size) || (hdr.xml_mtime_sec != st->st_mtim.tv_sec) ||
+       (hdr.xml_mtime_nsec != st->st_mtim.tv_nsec) || (hdr.xml_ino != st->st_ino))
+    {
+        logInfo("%s changed since %s was saved", SVS_CONFIG_FILE, SVS_CONFIG_CACHE_FILE);
+        goto _svsConfigCacheLoad;
+    }
+
+    size = svsConfigTableSize(hdr.slots);
+    tbl = (svs_config_table_t *)malloc(size);
+    if(tbl == 0)
+    {
+        logError("malloc failed");
+        goto _svsConfigCacheLoad;
+    }
+    tbl->hdr = hdr;
+    if(read(fd, tbl->entry, size - sizeof(hdr)) != (ssize_t)(size - sizeof(hdr)))
+    {
+        logWarning("%s: %d slots expected", SVS_CONFIG_CACHE_FILE, hdr.slots);
+        goto _svsConfigCacheLoad;
+    }
+    if(crc16_compute((uint8_t *)tbl->entry, size - sizeof(hdr)) != hdr.crc)
+    {
+        logWarning("%s: CRC mismatch", SVS_CONFIG_CACHE_FILE);
+        goto _svsConfigCacheLoad;
+    }
+    for(i=0; i<hdr.slots; i++)
+    {
+        tbl->entry[i].key[SVS_CONFIG_KEY_MAX - 1]     = 0;
+        tbl->entry[i].value[SVS_CONFIG_VALUE_MAX - 1] = 0;
+    }
+    logDebug("%s loaded, %d params", SVS_CONFIG_CACHE_FILE, hdr.count);
+    *table = tbl;
+    tbl = 0;
+    rc = ERR_PASS;
+
+    _svsConfigCacheLoad:
+
+    free(tbl);
+    close(fd);
+
+    return(rc);
+}
+
+//
+// Description:
+// Writes the table to a temporary file renamed over the previous one, a power loss leaves either table complete.
+//
+static int svsConfigCacheSave(svs_config_table_t *table)
+{
+    int rc = ERR_PASS;
+    int fd;
+    size_t size = svsConfigTableSize(table->hdr.slots);
+    char tmp[sizeof(SVS_CONFIG_CACHE_FILE) + 4];
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", SVS_CONFIG_CACHE_FILE);
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+    {
+        logError("failed to open file %s: %s", tmp, strerror(errno));
+        return(ERR_FAIL);
+    }
+    if(write(fd, table, size) != (ssize_t)size)
+    {
+        logError("write %s: %s", tmp, strerror(errno));
+        rc = ERR_FAIL;
+    }
+    if((rc == ERR_PASS) && (fsync(fd) < 0))
+    {
+        logError("fsync %s: %s", tmp, strerror(errno));
+        rc = ERR_FAIL;
+    }
+    close(fd);
+
+    if(rc != ERR_PASS)
+    {
+        unlink(tmp);
+        return(rc);
+    }
+    if(rename(tmp, SVS_CONFIG_CACHE_FILE) < 0)
+    {
+        logError("rename %s: %s", SVS_CONFIG_CACHE_FILE, strerror(errno));
+        unlink(tmp);
+        return(ERR_FAIL);
+    }
+
+    return(rc);
+}
+
+//
+// Description:
+// Builds the table, from the cache when it matches the XML file, and swaps it with the current one.
+// The current table is kept when the XML file cannot be parsed.
+//
+static int svsConfigLoad(uint8_t use_cache)
+{
+    int rc;
+    struct stat st;
+    svs_config_table_t *table = 0;
+    svs_config_table_t *old;
+
+    if(stat(SVS_CONFIG_FILE, &st) < 0)
+    {
+        logError("cannot parse configuration file %s: %s", SVS_CONFIG_FILE, strerror(errno));
+        return(ERR_FAIL);
+    }
+
+    rc = use_cache ? svsConfigCacheLoad(&st, &table) : ERR_FAIL;
+    if(rc != ERR_PASS)
+    {
+        rc = svsConfigParse(SVS_CONFIG_FILE, &st, &table);
+        if(rc != ERR_PASS)
+        {
+            return(rc);
+        }
+        svsConfigCacheSave(table);
+    }
+
+    pthread_rwlock_wrlock(&rwlockConfig);
+    old = svsConfigTable;
+    svsConfigTable = table;
+    pthread_rwlock_unlock(&rwlockConfig);
+
+    free(old);
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Reloads the configuration when the XML file is written or replaced, the directory is watched as editors and
+// upgrades replace the file.
+//
+static void *svsConfigWatchThread(void *arg)
+{
+    char buf[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    const char *name = strrchr(SVS_CONFIG_FILE, '/') + 1;
+    struct inotify_event *event;
+    struct timeval tv;
+    fd_set fds;
+    ssize_t len;
+    char *pos;
+    uint8_t changed;
+
+    while(svsConfigWatchRunning)
+    {
+        FD_ZERO(&fds);
+        FD_SET(svsConfigWatchFd, &fds);
+        tv.tv_sec  = SVS_CONFIG_WATCH_MS / 1000;
+        tv.tv_usec = (SVS_CONFIG_WATCH_MS % 1000) * 1000;
+        if(select(svsConfigWatchFd + 1, &fds, 0, 0, &tv) <= 0)
+        {
+            continue;
+        }
+        len = read(svsConfigWatchFd, buf, sizeof(buf));
+        if(len <= 0)
+        {
+            continue;
+        }
+
+        changed = 0;
+        for(pos = buf; pos < buf + len; pos += sizeof(struct inotify_event) + event->len)
+        {
+            event = (struct inotify_event *)pos;
+            if((event->len != 0) && (strcmp(event->name, name) == 0))
+            {
+                changed = 1;
+            }
+        }
+        if(changed)
+        {
+            logInfo("%s changed, reloading", SVS_CONFIG_FILE);
+            svsConfigLoad(0);
+        }
+    }
+
+    return(arg);
+}
+
+int svsConfigServerInit(void)
+{
+    int     rc              = 0;
+    char    dir[sizeof(SVS_CONFIG_FILE)];
+
+    crc16_init();
+
+    rc = svsConfigLoad(1);
+    if(rc != ERR_PASS)
+    {
+        return(rc);
+    }
+
+    strcpy(dir, SVS_CONFIG_FILE);
+    *strrchr(dir, '/') = 0;
+    svsConfigWatchFd = inotify_init();
+    if((svsConfigWatchFd < 0) || (inotify_add_watch(svsConfigWatchFd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0))
+    {
+        logWarning("cannot watch %s, configuration changes need a restart: %s", dir, strerror(errno));
+    }
+    else
+    {
+        svsConfigWatchRunning = 1;
+        if(pthread_create(&svsConfigWatchThreadId, 0, svsConfigWatchThread, 0) != 0)
+        {
+            logWarning("cannot create the configuration watch thread");
+            svsConfigWatchRunning = 0;
+        }
+    }
 
 #if 0
     memset(&socket_thread_info, 0, sizeof(socket_thread_info_t));
@@ -74,10 +495,24 @@ int svsConfigServerUninit(void)
 {
     int rc = ERR_PASS;
 
-    if(svsConfigInfo.doc)
+    if(svsConfigWatchRunning)
+    {
+        svsConfigWatchRunning = 0;
+        pthread_join(svsConfigWatchThreadId, 0);
+    }
+    if(svsConfigWatchFd >= 0)
+    {
+        close(svsConfigWatchFd);
+        svsConfigWatchFd = -1;
+    }
+
+    pthread_rwlock_wrlock(&rwlockConfig);
+    free(svsConfigTable);
+    svsConfigTable = 0;
+    pthread_rwlock_unlock(&rwlockConfig);
+
+    if(svsConfigParsed)
     {
-        // free the document
-        xmlFreeDoc(svsConfigInfo.doc);
         // Free the global variables that may have been allocated by the parser.
         xmlCleanupParser();
     }
@@ -148,42 +583,32 @@ xmlNodePtr svsConfigNodeByNameFind(xmlNode *node, const char *nodeName)
     return(0);
 }
 
-xmlNodePtr svsConfigModuleNodeGet(const char *module)
-{
-    xmlNode *node;
-
-    node = svsConfigNodeByNameFind(svsConfigInfo.root_element, "modules");
-    node = svsConfigNodeByNameFind(node, module);
-
-    return(node);
-}
-
 int svsConfigModuleParamStrGet(const char *module, const char *param, char *strDefaultParam, char *strParam, int strLen)
 {
     int rc = ERR_PASS;
-    xmlNode *node = 0;
-    xmlChar *str = 0;
-
-    node = svsConfigModuleNodeGet(module);
-    node = svsConfigNodeByNameFind(node, param);
+    uint8_t found = 0;
+    uint8_t defined = 0;
+    svs_config_entry_t *entry;
 
-    if(node)
+    pthread_rwlock_rdlock(&rwlockConfig);
+    if(svsConfigTable)
     {
-        //logDebug("param found");
-        str = xmlNodeListGetString(svsConfigInfo.doc, node->xmlChildrenNode, 1);
-        if(str)
-        {
-            strncpy(strParam, (const char *)str, strLen);
-            //logDebug("param value: %s", strParam);
-        }
-        else
+        entry = svsConfigEntryFind(svsConfigTable, module, param);
+        found   = (entry->hash != 0);
+        defined = found && entry->defined;
+        if(defined)
         {
-            logWarning("param [%s] value not defined", param);
+            strncpy(strParam, entry->value, strLen);
         }
-        xmlFree(str);
     }
+    pthread_rwlock_unlock(&rwlockConfig);
 
-    if(node == 0 || str == 0)
+    if(found && !defined)
+    {
+        logWarning("param [%s] value not defined", param);
+    }
+
+    if(!defined)
     {   // param not found or not defined, use default if provided
         if(strDefaultParam)
         {
@@ -202,25 +627,26 @@ int svsConfigModuleParamStrGet(const char *module, const char *param, char *strD
 
 int svsConfigParamIntGet(const char *module, const char *param, int intDefaultParam, int *intParam)
 {
-    int rc;
-    char str[80];
+    uint8_t defined = 0;
+    svs_config_entry_t *entry;
 
-    // convert to string
-    snprintf(str, sizeof(str), "%d", *intParam);
+    pthread_rwlock_rdlock(&rwlockConfig);
+    if(svsConfigTable)
+    {
+        entry = svsConfigEntryFind(svsConfigTable, module, param);
+        if((entry->hash != 0) && entry->defined)
+        {
+            *intParam = entry->value_int;
+            defined   = 1;
+        }
+    }
+    pthread_rwlock_unlock(&rwlockConfig);
 
-    rc = svsConfigModuleParamStrGet(module, param, 0, str, sizeof(str));
-    if(rc == ERR_FAIL)
+    if(!defined)
     {
         *intParam = intDefaultParam;
         logWarning("param [%s] not found, using default value: [%d]", param, *intParam);
     }
-    else
-    {
-        *intParam = atoi(str);
-        //logDebug("param found with value: %d", *intParam);
-    }
 
     return(ERR_PASS);
 }
-
-
@@ -1,6 +1,7 @@
 #ifndef SVS_CONFIG_H
 #define SVS_CONFIG_H
 
+#include <stdint.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
 
@@ -17,12 +18,53 @@ typedef struct
     uint8_t               payload[CONFIG_MSG_PAYLOAD_MAX];
 } svsMsgConfig_t;
 
+#ifndef SVS_CONFIG_FILE
+#define SVS_CONFIG_FILE             "/usr/scu/etc/svsConfig.xml"
+#endif
+#ifndef SVS_CONFIG_CACHE_FILE
+#define SVS_CONFIG_CACHE_FILE       "/usr/scu/etc/svsConfig.cache"  // parsed configuration, read at startup instead of the XML
+#endif
+#define SVS_CONFIG_CACHE_MAGIC      0x47464353                      // "SCFG"
+#define SVS_CONFIG_CACHE_VERSION    1
+#define SVS_CONFIG_KEY_MAX          64      // "module.param"
+#define SVS_CONFIG_VALUE_MAX        256
+#define SVS_CONFIG_ENTRY_MAX        4096    // params accepted in the configuration
+#define SVS_CONFIG_WATCH_MS         1000    // the watch thread checks for svsConfigServerUninit() this often
+
 typedef struct
 {
     xmlDoc  *doc;
     xmlNode *root_element;
 } svsConfigInfo_t;
 
+typedef struct
+{   // parameter of the configuration, a table slot is free when hash is 0
+    uint32_t            hash;               // of the key, never 0
+    uint8_t             defined;            // the parameter has a value
+    int32_t             value_int;          // atoi() of the value
+    char                key[SVS_CONFIG_KEY_MAX];
+    char                value[SVS_CONFIG_VALUE_MAX];
+} svs_config_entry_t;
+
+typedef struct
+{   // header of the parsed configuration, in memory and in the cache file, followed by the table slots
+    uint32_t            magic;              // SVS_CONFIG_CACHE_MAGIC
+    uint16_t            version;            // SVS_CONFIG_CACHE_VERSION, a file with another version is ignored
+    uint16_t            crc;                // CRC16 of the slots
+    uint32_t            slots;              // power of 2, at least twice the number of params
+    uint32_t            count;
+    int64_t             xml_size;           // XML file the table was parsed from, the cache is only used for this file
+    int64_t             xml_mtime_sec;
+    int64_t             xml_mtime_nsec;
+    uint64_t            xml_ino;
+} svs_config_table_hdr_t;
+
+typedef struct
+{
+    svs_config_table_hdr_t  hdr;
+    svs_config_entry_t      entry[];        // hdr.slots entries, open addressing with linear probing
+} svs_config_table_t;
+
 int svsConfigServerInit(void);
 int svsConfigServerUninit(void);
 
@@ -0,0 +1,256 @@
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsBdpMsg.h>
+#include <crc.h>
+#include <svsImage.h>
+
+//
+// Firmware image cache: an image is read the first time it is used and its CRCs are computed once, the upgrades
+// running at the same time with the same file share it. The image is a private copy, a file truncated or rewritten
+// during an upgrade does not change the blocks sent. The file is read again when its modification time, size or
+// inode changed, the previous version stays loaded until the upgrades using it released it.
+//
+static svs_image_t      *svsImageCache[SVS_IMAGE_CACHE_MAX];
+static pthread_mutex_t  mutexImage = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t   svsImageCrcOnce = PTHREAD_ONCE_INIT;
+
+static void svsImageFree(svs_image_t *image)
+{
+    free(image->data);
+    free(image->block_crc);
+    free(image);
+}
+
+static uint8_t svsImageMatch(svs_image_t *image, struct stat *st)
+{
+    return((image->dev == st->st_dev) && (image->ino == st->st_ino) && (image->len == st->st_size) &&
+           (image->mtime.tv_sec == st->st_mtim.tv_sec) && (image->mtime.tv_nsec == st->st_mtim.tv_nsec));
+}
+
+//
+// Description:
+// Reads the file and computes its CRCs.
+//
+static int svsImageRead(const char *filename, svs_image_t **image)
+{
+    int fd;
+    ssize_t n;
+    uint32_t i, len;
+    struct stat st;
+    svs_image_t *img;
+
+    fd = open(filename, O_RDONLY);
+    if(fd < 0)
+    {
+        logError("failed to open file %s: %s", filename, strerror(errno));
+        return(ERR_FAIL);
+    }
+    if(fstat(fd, &st) < 0)
+    {
+        logError("fstat %s: %s", filename, strerror(errno));
+        close(fd);
+        return(ERR_FAIL);
+    }
+    if(st.st_size > SVS_IMAGE_SIZE_MAX)
+    {
+        logError("%s: image size %lld too large", filename, (long long)st.st_size);
+        close(fd);
+        return(ERR_LEN_TOO_LONG);
+    }
+
+    img = (svs_image_t *)calloc(1, sizeof(svs_image_t));
+    if(img == 0)
+    {
+        logError("calloc failed");
+        close(fd);
+        return(ERR_FAIL);
+    }
+    strncpy(img->path, filename, SVS_IMAGE_PATH_MAX - 1);
+    img->dev        = st.st_dev;
+    img->ino        = st.st_ino;
+    img->mtime      = st.st_mtim;
+    img->len        = st.st_size;
+    img->block_cnt  = (img->len / FIRMWARE_IMAGE_BLOCK_MAX) + 1;
+    if(img->len != 0)
+    {
+        img->data = (uint8_t *)malloc(img->len);
+        if(img->data == 0)
+        {
+            logError("malloc failed");
+            close(fd);
+            svsImageFree(img);
+            return(ERR_FAIL);
+        }
+        for(len = 0; len < img->len; len += n)
+        {
+            n = read(fd, &img->data[len], img->len - len);
+            if(n <= 0)
+            {   // truncated while read
+                logError("read %s: %s", filename, (n < 0) ? strerror(errno) : "file truncated");
+                close(fd);
+                svsImageFree(img);
+                return(ERR_FAIL);
+            }
+        }
+    }
+    close(fd);
+
+    img->block_crc = (uint16_t *)malloc(img->block_cnt * sizeof(uint16_t));
+    if(img->block_crc == 0)
+    {
+        logError("malloc failed");
+        svsImageFree(img);
+        return(ERR_FAIL);
+    }
+    pthread_once(&svsImageCrcOnce, crc16_init);
+    for(i=0; i<img->block_cnt; i++)
+    {
+        len = MIN(img->len - i * FIRMWARE_IMAGE_BLOCK_MAX, FIRMWARE_IMAGE_BLOCK_MAX);
+        img->block_crc[i] = crc16_compute(&img->data[i * FIRMWARE_IMAGE_BLOCK_MAX], len);
+        img->crc = crc16_resume_compute(img->crc, &img->data[i * FIRMWARE_IMAGE_BLOCK_MAX], len);
+    }
+    logDebug("%s read, %d bytes in %d blocks, CRC 0x%04x", filename, img->len, img->block_cnt, img->crc);
+
+    *image = img;
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Returns the image of a file from the cache, reading it when it is not cached or when the file changed.
+// Each svsImageOpen() must be followed by an svsImageClose() once the image is no longer used.
+//
+int svsImageOpen(const char *filename, svs_image_t **image)
+{
+    int rc = ERR_PASS;
+    int i, slot = -1;
+    struct stat st;
+    svs_image_t *img;
+
+    if((filename == 0) || (image == 0))
+    {
+        logError("null pointer");
+        return(ERR_FAIL);
+    }
+    if(stat(filename, &st) < 0)
+    {
+        logError("failed to open file %s: %s", filename, strerror(errno));
+        return(ERR_FAIL);
+    }
+
+    pthread_mutex_lock(&mutexImage);
+
+    for(i=0; i<SVS_IMAGE_CACHE_MAX; i++)
+    {
+        img = svsImageCache[i];
+        if((img == 0) || (strncmp(img->path, filename, SVS_IMAGE_PATH_MAX) != 0))
+        {
+            continue;
+        }
+        if(svsImageMatch(img, &st))
+        {
+            img->refcnt++;
+            *image = img;
+            goto _svsImageOpen;
+        }
+        // the file changed, the upgrades still using the previous version keep it until they close it
+        logInfo("%s changed, reading it again", filename);
+        svsImageCache[i] = 0;
+        img->stale = 1;
+        if(img->refcnt == 0)
+        {
+            svsImageFree(img);
+        }
+    }
+
+    // free slot, or the first image not in use
+    for(i=0; (i<SVS_IMAGE_CACHE_MAX) && (slot < 0); i++)
+    {
+        if(svsImageCache[i] == 0)
+        {
+            slot = i;
+        }
+    }
+    for(i=0; (i<SVS_IMAGE_CACHE_MAX) && (slot < 0); i++)
+    {
+        if(svsImageCache[i]->refcnt == 0)
+        {
+            svsImageFree(svsImageCache[i]);
+            svsImageCache[i] = 0;
+            slot = i;
+        }
+    }
+    if(slot < 0)
+    {
+        logError("maximum images in use %d exceeded", SVS_IMAGE_CACHE_MAX);
+        rc = ERR_BUSY;
+        goto _svsImageOpen;
+    }
+
+    rc = svsImageRead(filename, &img);
+    if(rc != ERR_PASS)
+    {
+        goto _svsImageOpen;
+    }
+    img->refcnt = 1;
+    svsImageCache[slot] = img;
+    *image = img;
+
+    _svsImageOpen:
+
+    pthread_mutex_unlock(&mutexImage);
+
+    return(rc);
+}
+
+void svsImageClose(svs_image_t *image)
+{
+    if(image == 0)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&mutexImage);
+
+    image->refcnt--;
+    if((image->refcnt == 0) && image->stale)
+    {
+        svsImageFree(image);
+    }
+
+    pthread_mutex_unlock(&mutexImage);
+}
+
+//
+// Description:
+// Copies the block at offset in data, a FIRMWARE_IMAGE_BLOCK_MAX buffer, the end of the last block is zeroed.
+// Returns the number of bytes of the image in the block, less than FIRMWARE_IMAGE_BLOCK_MAX for the last block.
+//
+uint16_t svsImageBlockCopy(svs_image_t *image, uint32_t offset, uint8_t *data)
+{
+    uint16_t len = 0;
+
+    if(offset < image->len)
+    {
+        len = MIN(image->len - offset, FIRMWARE_IMAGE_BLOCK_MAX);
+        memcpy(data, &image->data[offset], len);
+    }
+    if(len < FIRMWARE_IMAGE_BLOCK_MAX)
+    {
+        memset(&data[len], 0, FIRMWARE_IMAGE_BLOCK_MAX - len);
+    }
+
+    return(len);
+}
@@ -0,0 +1,31 @@
+#ifndef SVS_IMAGE_H
+#define SVS_IMAGE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define SVS_IMAGE_CACHE_MAX     (4)             // firmware images kept loaded per process
+#define SVS_IMAGE_PATH_MAX      (256)
+#define SVS_IMAGE_SIZE_MAX      (1024*1024)     // largest firmware image accepted
+
+typedef struct
+{   // firmware image read once and shared by all the upgrades using the same file
+    char                path[SVS_IMAGE_PATH_MAX];
+    dev_t               dev;            // identify the file version, a different one is read again
+    ino_t               ino;
+    struct timespec     mtime;
+    uint8_t             *data;          // copy of the file, 0 for an empty file
+    uint32_t            len;
+    uint32_t            block_cnt;      // len / FIRMWARE_IMAGE_BLOCK_MAX + 1, the last block is short, possibly empty
+    uint16_t            crc;            // CRC16 of the whole image, see crc.c
+    uint16_t            *block_crc;     // CRC16 of each block
+    int                 refcnt;         // upgrades using the image, it is only freed when 0
+    uint8_t             stale;          // the file changed, freed once released
+} svs_image_t;
+
+int svsImageOpen(const char *filename, svs_image_t **image);
+void svsImageClose(svs_image_t *image);
+uint16_t svsImageBlockCopy(svs_image_t *image, uint32_t offset, uint8_t *data);
+
+#endif // SVS_IMAGE_H
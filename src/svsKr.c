@@ -6,6 +6,7 @@
 #include <unistd.h>
 #include <termios.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <netinet/in.h>
 
 #include <svsLog.h>
@@ -20,6 +21,7 @@
 #include <crc.h>
 
 #define KR_SIMULATOR            0
+#define DEV_WRITE_TIMEOUT_MS    1000    // maximum time to write a frame to a busy device
 
 static kr_dev_info_t            kr_dev_info;
 static kr_state_t               kr_state[KR_MAX];
@@ -744,7 +746,7 @@ int svsKrRx(int devFd, uint8_t bus)
         {   // All is good, send message to the waiting client if any
             if(kr_bus->frame_rx.hdr.sockFd > 0)
             {   // sockFd retrieved from incoming message
-                rc = svsSocketSendKr(kr_bus->frame_rx.hdr.sockFd, msgID, kr_num, 0, 0, kr_bus->frame_rx.payload, kr_bus->frame_rx.hdr.len);
+                rc = svsSocketSendKr(kr_bus->frame_rx.hdr.sockFd, kr_dev_info.seq_client[kr_bus->frame_rx.hdr.seq % KR_SEQ_CLIENT_MAX], msgID, kr_num, 0, 0, kr_bus->frame_rx.payload, kr_bus->frame_rx.hdr.len);
                 if(rc != ERR_PASS)
                 {
                     logError("svsSocketSendKr");
@@ -778,9 +780,10 @@ int svsKrRx(int devFd, uint8_t bus)
 int svsKrTx(int sockFd, uint8_t bus, svsSocketMsgHeader_t *hdr, uint8_t *payload)
 {
     int rc;
-    int len;
+    int len, total_len;
     uint16_t crc;
     svsMsgKrFrameHeader_t frame_hdr;
+    uint8_t frame_tx[sizeof(svsMsgKrFramePreamble_t) + sizeof(svsMsgKrFrame_t)];
 
     //logDebug("");
 
@@ -790,6 +793,11 @@ int svsKrTx(int sockFd, uint8_t bus, svsSocketMsgHeader_t *hdr, uint8_t *payload
     {   // this case is not a failure, devFd is not in use
         return(ERR_PASS);
     }
+    if(hdr->len > KR_MSG_PAYLOAD_MAX)
+    {
+        logError("payload too large %d", hdr->len);
+        return(ERR_FAIL);
+    }
     //
     // fill the frame header
     //
@@ -808,6 +816,8 @@ int svsKrTx(int sockFd, uint8_t bus, svsSocketMsgHeader_t *hdr, uint8_t *payload
     frame_hdr.sockFd    = sockFd;
     frame_hdr.flags     = hdr->u.krhdr.flags;
     frame_hdr.seq       = kr_dev_info.seq_num++;
+    // the KR echoes the frame sequence number, keep the client one to put it back in the response
+    kr_dev_info.seq_client[frame_hdr.seq % KR_SEQ_CLIENT_MAX] = hdr->seq;
     frame_hdr.timestamp = svsTimeGet_ms();
     // compute the CRC which includes the header and the payload but not the preamble
     crc = crc16_compute((uint8_t *)&(frame_hdr.len), sizeof(frame_hdr)-sizeof(frame_hdr.crc));
@@ -863,43 +873,17 @@ int svsKrTx(int sockFd, uint8_t bus, svsSocketMsgHeader_t *hdr, uint8_t *payload
     // TRANSMIT the frame
     //
 
-    // send the preamble
-    len = svsDevWrite(devFd, (uint8_t *)&kr_dev_info.preamble, sizeof(kr_dev_info.preamble));
-    if(len < 0)
-    {
-        logError("svsDevWrite name %s devFd %d",kr_dev_info.kr_bus_dev_info[bus].devName, kr_dev_info.kr_bus_dev_info[bus].devFd);
-        return(ERR_FAIL);
-    }
-    else
+    // assemble preamble, header and payload so the frame goes out with a single write
+    total_len = sizeof(kr_dev_info.preamble) + sizeof(frame_hdr) + hdr->len;
+    memcpy(&frame_tx[0], &kr_dev_info.preamble, sizeof(kr_dev_info.preamble));
+    memcpy(&frame_tx[sizeof(kr_dev_info.preamble)], &frame_hdr, sizeof(frame_hdr));
+    if(hdr->len != 0)
     {
-        if(len != sizeof(kr_dev_info.preamble))
-        {
-            logError("write incomplete: wrote %d instead of %d", len, sizeof(kr_dev_info.preamble));
-            return(ERR_FAIL);
-        }
-    }
-    // send the header
-    len = svsDevWrite(devFd, (uint8_t *)&frame_hdr, sizeof(frame_hdr));
-    if(len < 0)
-    {
-        logError("svsDevWrite name %s devFd %d",kr_dev_info.kr_bus_dev_info[bus].devName, kr_dev_info.kr_bus_dev_info[bus].devFd);
-        return(ERR_FAIL);
-    }
-    else
-    {
-        if(len != sizeof(frame_hdr))
-        {
-            logError("write incomplete: wrote %d instead of %d", len, sizeof(frame_hdr));
-            return(ERR_FAIL);
-        }
+        memcpy(&frame_tx[sizeof(kr_dev_info.preamble) + sizeof(frame_hdr)], payload, hdr->len);
     }
 
-    logDebug("wrote header %d\n", len);
-
-    //logDebug("writing payload with length %d\n", hdr->len);
-
-    // send the payload
-    len = svsDevWrite(devFd, payload, hdr->len);
+    // send the frame
+    len = svsDevWrite(devFd, frame_tx, total_len);
     if(len < 0)
     {
         logError("svsDevWrite name %s devFd %d",kr_dev_info.kr_bus_dev_info[bus].devName, kr_dev_info.kr_bus_dev_info[bus].devFd);
@@ -907,9 +891,9 @@ int svsKrTx(int sockFd, uint8_t bus, svsSocketMsgHeader_t *hdr, uint8_t *payload
     }
     else
     {
-        if(len != hdr->len)
+        if(len != total_len)
         {
-            logError("write incomplete: wrote %d instead of %d", len, hdr->len);
+            logError("write incomplete: wrote %d instead of %d", len, total_len);
             return(ERR_FAIL);
         }
     }
@@ -922,7 +906,7 @@ int svsKrTx(int sockFd, uint8_t bus, svsSocketMsgHeader_t *hdr, uint8_t *payload
     }
 #endif
 
-    logDebug("wrote payload %d\n", len);
+    logDebug("wrote frame %d\n", len);
 
     return(rc);
 }
@@ -944,20 +928,25 @@ int svsDevWrite(int devFd, uint8_t *data, int len)
 #if 1
     //
     // To solve the problem when using USB dongles or when using serial devices with a small hardware/software
-    // buffer, we monitor the write() and retry for as long as there are characters in the buffer to send
-    // and for as long as the EAGAIN (device busy) error is occuring.
-    // In between calls we add a delay (could use a select call on write)
+    // buffer, we monitor the write() and retry for as long as there are characters in the buffer to send.
+    // When the device is busy (EAGAIN) we wait in poll() for it to become writable, so the remaining bytes
+    // are sent as soon as the driver has room instead of after a fixed delay.
     //
 
     int      len_written    = 0;
-    int      retry = 0;
-    do
+    int      retry          = 0;
+    int64_t  tend_ms        = svsTimeGet_ms() + DEV_WRITE_TIMEOUT_MS;
+    struct pollfd pfd;
+
+    pfd.fd     = devFd;
+    pfd.events = POLLOUT;
+
+    while(len_written < len)
     {
         rc = write(devFd, &data[len_written], len - len_written);
-        //logDebug("write %d", rc);
         if(rc < 0)
         {   // ignore the resource busy error
-            if(errno != EAGAIN)
+            if(errno != EAGAIN && errno != EINTR)
             {   // some other error
                 logError("write: %d %s", errno, strerror(errno));
                 return(rc);
@@ -972,12 +961,20 @@ int svsDevWrite(int devFd, uint8_t *data, int len)
             }
         }
 
-        logDebug("wrote %d/%d", len_written, len);
+        // wait for the device to accept more data
+        int64_t tleft_ms = tend_ms - svsTimeGet_ms();
+        if(tleft_ms <= 0)
+        {
+            break;
+        }
         retry++;
-        usleep(10000); // delay in between calls when EAGAIN is set
-    } while(retry < 100);
-
-    //logDebug("len_written %d, retry %d", len_written, retry);
+        rc = poll(&pfd, 1, tleft_ms);
+        if(rc < 0 && errno != EINTR)
+        {
+            logError("poll: %d %s", errno, strerror(errno));
+            break;
+        }
+    }
 
     if(len_written != len)
     {
@@ -1297,7 +1294,7 @@ static int svsSocketClientKrSimHandler(int sockFd, svsSocketMsgHeader_t *hdr, ui
     }
 
 
-    rc = svsSocketSendKr(sockFd, hdr->u.krhdr.msg_id, kr_num, 0, 0, prsp, rsp_len);
+    rc = svsSocketSendKr(sockFd, hdr->seq, hdr->u.krhdr.msg_id, kr_num, 0, 0, prsp, rsp_len);
     if(rc != ERR_PASS)
     {
         logError("svsSocketSendKr");
@@ -9,6 +9,7 @@
 #define KR_BUS_DEV_NAME_MAX        64
 #define KR_DEV_DEFAULT_BAUDRATE    115200
 #define KR_DEV_DEFAULT_NAME1       ""   // set to "" when not in use (see configuration file)
+#define KR_SEQ_CLIENT_MAX          256     // client sequence numbers kept for the frames in flight
 
 typedef struct // socket header
 {
@@ -113,6 +114,7 @@ typedef struct
     kr_bus_dev_info_t           kr_bus_dev_info[KR_BUS_DEV_MAX];
     uint8_t                     kr_max;    // maximum number of available KR devices on all buses
     uint32_t                    seq_num;    // message sequence number
+    uint32_t                    seq_client[KR_SEQ_CLIENT_MAX];  // client request sequence number indexed by frame sequence number
     svsMsgKrFramePreamble_t     preamble;
     kr_addr_t                   addr_broadcast;
     int                         loopback_enable;    // 0: disable, 1: enable
@@ -103,7 +103,7 @@ typedef enum
 
     MSG_ID_KR_BOOTBLOCK_IMAGE_UPLOAD,    // when performing _bootblock_ FW upgrades, image is sent in blocks
     MSG_ID_KR_BOOTBLOCK_IMAGE_INSTALL,   // unlike the application, the bootblock doesn't get updated until this is received
-    MSG_ID_KR_MEMORY_CRC,
+    MSG_ID_KR_MEMORY_CRC,
 
     MSG_ID_KR_MAX // KEEP LAST
 
@@ -264,8 +264,11 @@ typedef struct
     uint8_t          retries;   // 1-254 retries, 255=infinite, 0 is the same as 1
     int              timeout_erase; // if zero, it will use the value passed in timeout_ms
     int              timeout_normal;
+    uint8_t          delta;     // 1 to skip the blocks already in the KR flash, the image CRC is then checked at the end
 } kr_firmware_upgrade_t;
 
+#define KR_FIRMWARE_APP_ADDR    0x08004000  // flash address of the application image, see kr_memory_crc_t
+
 typedef struct __attribute__ ((__packed__))
 {
     uint32_t    offset;                         // offset in bytes from the start of the bin file
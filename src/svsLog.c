@@ -16,15 +16,19 @@
 #include <svsSocket.h>
 #include <libSVS.h>
 
+#define LOG_RSP_TIMEOUT_MS  (10)  // time the client waits for the log server to send the line back
+
 static socket_thread_info_t socket_thread_info;
 static int log_server = 0;
 static log_verbosity_t  log_verbosity = LOG_VERBOSITY_DEBUG;
 static const char *log_file;
 static FILE *log_fd = 0;
 static uint32_t current_log_limit = (4 * 1024 * 1024);
+static svs_socket_reconnect_t log_reconnect;   // backoff of the client connection to the log server
+static pthread_mutex_t log_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP; // one line at a time, the buffer and the round trip to the server are shared
 
 static int svsSocketClientLogHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
-static int log_svsSocketSendLog(int sockFd, log_verbosity_t verbosity, uint8_t *payload, uint16_t len);
+static int log_svsSocketSendLog(int sockFd, uint32_t seq, log_verbosity_t verbosity, uint8_t *payload, uint16_t len);
 static int log_svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
 static void logShow(char *payload);
 
@@ -114,6 +118,9 @@ void logOutput(log_verbosity_t verb, char *file, const char *fctn, int line, con
     va_list ap;
     static int busy = 0;
 
+    // a thread waiting for its line must not read the line of another one, the responses are matched by seq
+    pthread_mutex_lock(&log_mutex);
+
     // prevent recursive calls
     if(log_server && busy)
     {   // disabled for now, just need to make sure the functions used in this context do not call the LOG routines
@@ -121,6 +128,17 @@ void logOutput(log_verbosity_t verb, char *file, const char *fctn, int line, con
     }
     busy = 1;
 
+    // the log server went away, try to get it back before formatting, a failed attempt logs through here
+    if((log_server == 0) && (svsLogSockFdGet() == 0))
+    {
+        int sockFd;
+
+        if(svsSocketReconnect(&log_reconnect, SOCKET_PORT_LOG, 0, &sockFd) == ERR_PASS)
+        {
+            svsLogSockFdSet(sockFd);
+        }
+    }
+
     //memset(buf, 0, LOG_BUF_SIZE);
 
     len = 0;
@@ -209,7 +227,8 @@ void logOutput(log_verbosity_t verb, char *file, const char *fctn, int line, con
     // Send buffer to LOG server if LOG server socket connection is available
     if((log_server == 0) && (sockFd > 0))
     {   // Send the output to the server
-        rc = log_svsSocketSendLog(sockFd, verb, (uint8_t *)buf, len);
+        uint32_t seq = svsSocketSeqNext();
+        rc = log_svsSocketSendLog(sockFd, seq, verb, (uint8_t *)buf, len);
         if(rc != ERR_PASS)
         {
             if (rc == ERR_SOCK_DISC)
@@ -221,21 +240,13 @@ void logOutput(log_verbosity_t verb, char *file, const char *fctn, int line, con
             fprintf(stderr, "ERROR: log_svsSocketSendLog\n");
             goto _logOutput;
         }
-        // Set timeout to wait on socket
-        struct timeval timeout;
-        int timeout_ms = 10;
-        // Set timeout on the socket
-        timeout.tv_sec  = timeout_ms / 1000 ;
-        timeout.tv_usec = (timeout_ms % 1000) * 1000;
-        rc = setsockopt(sockFd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-        if(rc < 0)
-        {
-            fprintf(stderr, "setsockopt: %s",  strerror(errno));
-            goto _logOutput;
-        }
-        // Wait for a message from the server
+        // Wait for the server to send the message back, messages that came back too late for a previous line are skipped
         svsSocketMsgHeader_t    hdr;
-        rc = svsSocketRecvMsg(sockFd, &hdr, (uint8_t *)buf, LOG_BUF_SIZE);
+        int64_t                 tend_ms = svsTimeGet_ms() + LOG_RSP_TIMEOUT_MS;
+        do
+        {
+            rc = svsSocketRecvMsgDeadline(sockFd, tend_ms, &hdr, (uint8_t *)buf, LOG_BUF_SIZE);
+        } while ((rc == ERR_PASS) && (hdr.seq != seq));
         if (rc != ERR_PASS)
         {
             fprintf(stderr, "svsSocketRecvMsg: %s",  strerror(errno));
@@ -263,6 +274,7 @@ void logOutput(log_verbosity_t verb, char *file, const char *fctn, int line, con
     _logOutput:
 
     busy = 0;
+    pthread_mutex_unlock(&log_mutex);
 }
 
 //
@@ -301,7 +313,7 @@ static int svsSocketClientLogHandler(int sockFd, svsSocketMsgHeader_t *hdr, uint
     return rc;
 }
 
-int log_svsSocketSendLog(int sockFd, log_verbosity_t verbosity, uint8_t *payload, uint16_t len)
+int log_svsSocketSendLog(int sockFd, uint32_t seq, log_verbosity_t verbosity, uint8_t *payload, uint16_t len)
 {
     int rc;
     svsSocketMsgHeader_t hdr;
@@ -312,6 +324,7 @@ int log_svsSocketSendLog(int sockFd, log_verbosity_t verbosity, uint8_t *payload
     hdr.module_id = MODULE_ID_LOG;
     hdr.dev_num   = 0;
     hdr.len       = len;
+    hdr.seq       = seq;
 
     hdr.u.loghdr.verbosity = verbosity;
 
@@ -322,7 +335,9 @@ int log_svsSocketSendLog(int sockFd, log_verbosity_t verbosity, uint8_t *payload
 
 int log_svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
 {
-    int rc, flag;
+    int rc, flag, hdr_len;
+    uint8_t hdr_buf[SVS_SOCKET_WIRE_HDR_MAX];
+    uint8_t *hdr_data;
 
     // *** DO NOT CALL LOG ROUTINES FROM THIS FUNCTION
     if(hdr == 0)
@@ -340,8 +355,9 @@ int log_svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
         flag = MSG_MORE | MSG_NOSIGNAL;
     }
 
-    // First send the header, but hold OFF with MSG_MORE
-    rc = send(sockFd, hdr, sizeof(svsSocketMsgHeader_t), flag);
+    // First send the header, but hold OFF with MSG_MORE, compact when the connection negotiated it
+    hdr_len = svsSocketWireHdrEncode(sockFd, hdr, hdr_buf, &hdr_data);
+    rc = send(sockFd, hdr_data, hdr_len, flag);
     if(rc < 0)
     {
         fprintf(stderr, "send1: %s\n", strerror(errno));
@@ -351,7 +367,7 @@ int log_svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
     }
     else
     {
-        if(rc != sizeof(svsSocketMsgHeader_t))
+        if(rc != hdr_len)
         {
             fprintf(stderr, "header partially sent %d\n",  rc);
             return ERR_FAIL;
@@ -0,0 +1,405 @@
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsSocket.h>
+#include <svsShm.h>
+
+//
+// Shared memory transport: a client creates a segment holding a request ring and a response ring, the server maps it
+// and both ends exchange the messages through the rings instead of the socket. The socket stays open, it carries the
+// setup and tells the server when the client goes away.
+// The links are addressed with virtual socket FDs (SVS_SHM_FD_BASE + index), svsSocketSend() hands the messages sent
+// to such a FD to svsShmSend(), so the servers answer a request the same way whatever transport it came from.
+//
+static svs_shm_link_t   svsShmLink[SVS_SHM_LINK_MAX];
+static pthread_mutex_t  mutexShmLink = PTHREAD_MUTEX_INITIALIZER;
+static uint8_t          svsShmEnable = 0;
+static pthread_once_t   svsShmLinkOnce = PTHREAD_ONCE_INIT;
+
+static void *svsShmRxThread(void *arg);
+
+//
+// Description:
+// Selects the shared memory transport for the BDP requests of this application. Must be called before svsInit(),
+// the socket transport is used when svsd does not accept the segment.
+//
+void svsShmEnableSet(uint8_t enable)
+{
+    svsShmEnable = enable;
+}
+
+uint8_t svsShmEnableGet(void)
+{
+    return(svsShmEnable);
+}
+
+static int svsShmFutexWait(volatile uint32_t *addr, uint32_t val, int timeout_ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec  = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+
+    // not FUTEX_PRIVATE_FLAG, the word is shared with the other process
+    return(syscall(SYS_futex, addr, FUTEX_WAIT, val, &ts, 0, 0));
+}
+
+static void svsShmFutexWake(volatile uint32_t *addr)
+{
+    syscall(SYS_futex, addr, FUTEX_WAKE, 1, 0, 0, 0);
+}
+
+static void svsShmLinkInit(void)
+{
+    int i;
+
+    // never destroyed, a sender may still be waiting on the lock of a link being released
+    for(i = 0; i < SVS_SHM_LINK_MAX; i++)
+    {
+        pthread_mutex_init(&svsShmLink[i].mutexTx, 0);
+    }
+}
+
+static void svsShmRingInit(svs_shm_ring_t *ring)
+{
+    ring->head      = 0;
+    ring->tail      = 0;
+    ring->doorbell  = 0;
+    ring->waiting   = 0;
+    ring->full      = 0;
+}
+
+//
+// Description:
+// Sets up a link on a mapped segment and starts its receiver thread.
+//
+static int svsShmLinkAdd(svs_shm_t *shm, uint8_t server, int sockFd, msg_hdlr_fn_t fnRx, int *shmFd)
+{
+    int i, status;
+    int rc = ERR_BUSY;
+    svs_shm_link_t *link;
+
+    pthread_once(&svsShmLinkOnce, svsShmLinkInit);
+    pthread_mutex_lock(&mutexShmLink);
+
+    for(i = 0; i < SVS_SHM_LINK_MAX; i++)
+    {
+        link = &svsShmLink[i];
+        if(link->shm != 0)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&link->mutexTx);
+        link->shm       = shm;
+        link->tx        = server ? &shm->rsp : &shm->req;
+        link->rx        = server ? &shm->req : &shm->rsp;
+        link->sockFd    = sockFd;
+        link->fnRx      = fnRx;
+        link->running   = 1;
+        pthread_mutex_unlock(&link->mutexTx);
+
+        status = pthread_create(&link->thread, 0, svsShmRxThread, link);
+        if(status != 0)
+        {
+            logError("pthread_create: %s", strerror(status));
+            pthread_mutex_lock(&link->mutexTx);
+            link->running = 0;
+            link->shm = 0;
+            pthread_mutex_unlock(&link->mutexTx);
+            rc = ERR_FAIL;
+            break;
+        }
+        *shmFd = SVS_SHM_FD_BASE + i;
+        rc = ERR_PASS;
+        break;
+    }
+    if(rc == ERR_BUSY)
+    {
+        logError("maximum shared memory links %d exceeded", SVS_SHM_LINK_MAX);
+    }
+
+    pthread_mutex_unlock(&mutexShmLink);
+
+    return(rc);
+}
+
+static svs_shm_t *svsShmMap(char *name, int oflag)
+{
+    int fd;
+    svs_shm_t *shm;
+
+    fd = shm_open(name, oflag, 0600);
+    if(fd < 0)
+    {
+        logError("shm_open %s: %s", name, strerror(errno));
+        return(0);
+    }
+    if((oflag & O_CREAT) && (ftruncate(fd, sizeof(svs_shm_t)) < 0))
+    {
+        logError("ftruncate %s: %s", name, strerror(errno));
+        close(fd);
+        return(0);
+    }
+    shm = mmap(0, sizeof(svs_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shm == MAP_FAILED)
+    {
+        logError("mmap %s: %s", name, strerror(errno));
+        return(0);
+    }
+
+    return(shm);
+}
+
+//
+// Description:
+// Called by the client: creates the segment, the name is then sent to the server over sockFd.
+// The client unlinks the name once the server answered, the segment lives as long as it is mapped.
+//
+int svsShmClientCreate(char *name, int sockFd, msg_hdlr_fn_t fnRx, int *shmFd)
+{
+    int rc;
+    svs_shm_t *shm;
+
+    shm_unlink(name);   // left over by a previous run with the same PID
+    shm = svsShmMap(name, O_CREAT | O_EXCL | O_RDWR);
+    if(shm == 0)
+    {
+        return(ERR_FAIL);
+    }
+    shm->slots = SVS_SHM_RING_SLOTS;
+    svsShmRingInit(&shm->req);
+    svsShmRingInit(&shm->rsp);
+    __sync_synchronize();
+    shm->magic = SVS_SHM_MAGIC;
+
+    rc = svsShmLinkAdd(shm, 0, sockFd, fnRx, shmFd);
+    if(rc != ERR_PASS)
+    {
+        munmap(shm, sizeof(svs_shm_t));
+        shm_unlink(name);
+    }
+
+    return(rc);
+}
+
+//
+// Description:
+// Called by the server when a client sends the name of its segment on sockFd.
+//
+int svsShmServerAttach(char *name, int sockFd, msg_hdlr_fn_t fnRx, int *shmFd)
+{
+    int rc;
+    svs_shm_t *shm;
+
+    name[SVS_SHM_NAME_MAX - 1] = '\0';
+    shm = svsShmMap(name, O_RDWR);
+    if(shm == 0)
+    {
+        return(ERR_FAIL);
+    }
+    if((shm->magic != SVS_SHM_MAGIC) || (shm->slots != SVS_SHM_RING_SLOTS))
+    {
+        logError("%s: incompatible segment magic 0x%x slots %d", name, shm->magic, shm->slots);
+        munmap(shm, sizeof(svs_shm_t));
+        return(ERR_FAIL);
+    }
+
+    rc = svsShmLinkAdd(shm, 1, sockFd, fnRx, shmFd);
+    if(rc != ERR_PASS)
+    {
+        munmap(shm, sizeof(svs_shm_t));
+        return(rc);
+    }
+    logInfo("client on socket %d attached %s as %d", sockFd, name, *shmFd);
+
+    return(rc);
+}
+
+int svsShmDestroy(int shmFd)
+{
+    svs_shm_link_t *link;
+
+    if(!SVS_SHM_FD(shmFd) || (shmFd >= SVS_SHM_FD_BASE + SVS_SHM_LINK_MAX))
+    {
+        return(ERR_INV_PARAM);
+    }
+    link = &svsShmLink[shmFd - SVS_SHM_FD_BASE];
+    if(link->shm == 0)
+    {
+        return(ERR_PASS);
+    }
+
+    // the receiver thread checks the flag at each doorbell timeout, the senders under the lock of the link
+    pthread_mutex_lock(&link->mutexTx);
+    link->running = 0;
+    pthread_mutex_unlock(&link->mutexTx);
+    __sync_fetch_and_add(&link->rx->doorbell, 1);
+    svsShmFutexWake(&link->rx->doorbell);
+    pthread_join(link->thread, 0);
+
+    // a sender in the middle of a message is waited for before the segment goes away
+    pthread_mutex_lock(&mutexShmLink);
+    pthread_mutex_lock(&link->mutexTx);
+    munmap(link->shm, sizeof(svs_shm_t));
+    link->shm = 0;
+    pthread_mutex_unlock(&link->mutexTx);
+    pthread_mutex_unlock(&mutexShmLink);
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Releases the links set up on a socket that was closed, called by the server thread.
+//
+void svsShmServerDetach(int sockFd)
+{
+    int i;
+
+    for(i = 0; i < SVS_SHM_LINK_MAX; i++)
+    {
+        if((svsShmLink[i].shm != 0) && (svsShmLink[i].sockFd == sockFd))
+        {
+            logInfo("client on socket %d gone, releasing %d", sockFd, SVS_SHM_FD_BASE + i);
+            svsShmDestroy(SVS_SHM_FD_BASE + i);
+        }
+    }
+}
+
+//
+// Description:
+// Writes a message in the ring of the link and rings the doorbell, the consumer is only woken up when it sleeps.
+// Waits up to SVS_SHM_FULL_TIMEOUT_MS for a free slot and returns ERR_BUSY after that.
+//
+int svsShmSend(int shmFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    int rc = ERR_PASS;
+    int waited_ms = 0;
+    uint32_t head, tail;
+    svs_shm_link_t *link;
+    svs_shm_ring_t *ring;
+    svsSocketMsg_t *slot;
+
+    if(shmFd >= SVS_SHM_FD_BASE + SVS_SHM_LINK_MAX)
+    {
+        return(ERR_FILE_DESC);
+    }
+    link = &svsShmLink[shmFd - SVS_SHM_FD_BASE];
+    pthread_once(&svsShmLinkOnce, svsShmLinkInit);
+
+    // the link may be released meanwhile, checked under its lock
+    pthread_mutex_lock(&link->mutexTx);
+    if((link->shm == 0) || !link->running)
+    {
+        rc = ERR_SOCK_DISC;
+        goto _svsShmSend;
+    }
+    ring = link->tx;
+
+    head = ring->head;
+    for(;;)
+    {
+        tail = ring->tail;
+        if((head - tail) < SVS_SHM_RING_SLOTS)
+        {
+            break;
+        }
+        if(waited_ms >= SVS_SHM_FULL_TIMEOUT_MS)
+        {
+            logError("ring %d full", shmFd);
+            rc = ERR_BUSY;
+            goto _svsShmSend;
+        }
+        ring->full = 1;
+        __sync_synchronize();
+        svsShmFutexWait(&ring->tail, tail, 1);
+        waited_ms++;
+    }
+
+    slot = &ring->slot[head % SVS_SHM_RING_SLOTS];
+    memcpy(&slot->header, hdr, sizeof(svsSocketMsgHeader_t));
+    if(hdr->len != 0)
+    {
+        memcpy(slot->payload, payload, hdr->len);
+    }
+    // publish the message before the index
+    __sync_synchronize();
+    ring->head = head + 1;
+    __sync_fetch_and_add(&ring->doorbell, 1);
+    if(ring->waiting)
+    {
+        svsShmFutexWake(&ring->doorbell);
+    }
+
+    _svsShmSend:
+
+    pthread_mutex_unlock(&link->mutexTx);
+
+    return(rc);
+}
+
+//
+// Description:
+// Consumer of the rx ring of a link, calls the handler of the link for each message.
+//
+static void *svsShmRxThread(void *arg)
+{
+    uint32_t doorbell, tail;
+    svs_shm_link_t *link = (svs_shm_link_t *)arg;
+    svs_shm_ring_t *ring = link->rx;
+    svsSocketMsg_t msg;
+    int shmFd = SVS_SHM_FD_BASE + (link - svsShmLink);
+
+    while(link->running)
+    {
+        // read the doorbell first, a message published after that changes it and the wait returns at once
+        doorbell = ring->doorbell;
+        tail     = ring->tail;
+        if(tail == ring->head)
+        {
+            ring->waiting = 1;
+            __sync_synchronize();
+            if(tail == ring->head)
+            {
+                svsShmFutexWait(&ring->doorbell, doorbell, SVS_SOCKET_MUX_TICK_MS);
+            }
+            ring->waiting = 0;
+            continue;
+        }
+
+        __sync_synchronize();
+        memcpy(&msg.header, &ring->slot[tail % SVS_SHM_RING_SLOTS].header, sizeof(svsSocketMsgHeader_t));
+        if(msg.header.len > SVS_SOCKET_MSG_PAYLOAD_MAX)
+        {
+            logError("ring %d: payload length out of range %d", shmFd, msg.header.len);
+            msg.header.len = 0;
+        }
+        memcpy(msg.payload, ring->slot[tail % SVS_SHM_RING_SLOTS].payload, msg.header.len);
+        __sync_synchronize();
+        ring->tail = tail + 1;
+        if(ring->full)
+        {
+            ring->full = 0;
+            svsShmFutexWake(&ring->tail);
+        }
+
+        link->fnRx(shmFd, &msg.header, msg.payload);
+    }
+
+    return(NULL);
+}
@@ -0,0 +1,57 @@
+#ifndef SVS_SHM_H
+#define SVS_SHM_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <svsSocket.h>
+
+#define SVS_SHM_MAGIC           (0x53565331)    // "SVS1"
+#define SVS_SHM_FD_BASE         (0x10000)       // socket FDs from this value are routed to a shared memory ring
+#define SVS_SHM_LINK_MAX        (16)            // shared memory links per process (clients on the server side)
+#define SVS_SHM_RING_SLOTS      (64)            // messages per ring, as many as the requests in flight on a mux
+#define SVS_SHM_NAME_MAX        (32)
+#define SVS_SHM_FULL_TIMEOUT_MS (100)           // time a sender waits for a slot before giving up
+#define SVS_SHM_ATTACH_TIMEOUT_MS (500)         // a server without shared memory support does not answer the attach request
+
+#define SVS_SHM_FD(fd)          ((fd) >= SVS_SHM_FD_BASE)
+
+typedef struct
+{   // single producer single consumer ring, the indexes only increase
+    volatile uint32_t   head;       // next message written by the producer
+    volatile uint32_t   tail;       // next message read by the consumer
+    volatile uint32_t   doorbell;   // futex word, incremented by the producer for each message
+    volatile uint32_t   waiting;    // 1 while the consumer sleeps on the doorbell
+    volatile uint32_t   full;       // 1 while the producer waits for a free slot
+    svsSocketMsg_t      slot[SVS_SHM_RING_SLOTS];
+} svs_shm_ring_t;
+
+typedef struct
+{   // shared memory segment created by a client, mapped by both processes
+    uint32_t            magic;
+    uint32_t            slots;
+    svs_shm_ring_t      req;        // client to server
+    svs_shm_ring_t      rsp;        // server to client
+} svs_shm_t;
+
+typedef struct
+{   // one end of a shared memory segment in this process
+    svs_shm_t           *shm;
+    svs_shm_ring_t      *tx;        // ring written by this process
+    svs_shm_ring_t      *rx;        // ring read by this process
+    int                 sockFd;     // socket the link was set up on, the link goes away with it
+    uint8_t             running;
+    pthread_t           thread;     // receives the messages from rx
+    pthread_mutex_t     mutexTx;    // one producer at a time
+    msg_hdlr_fn_t       fnRx;       // called for each message received
+} svs_shm_link_t;
+
+void svsShmEnableSet(uint8_t enable);
+uint8_t svsShmEnableGet(void);
+
+int svsShmClientCreate(char *name, int sockFd, msg_hdlr_fn_t fnRx, int *shmFd);
+int svsShmServerAttach(char *name, int sockFd, msg_hdlr_fn_t fnRx, int *shmFd);
+int svsShmDestroy(int shmFd);
+void svsShmServerDetach(int sockFd);
+int svsShmSend(int shmFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+
+#endif // SVS_SHM_H
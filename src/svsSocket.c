@@ -13,6 +13,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/mman.h>
+#include <poll.h>
 
 #include <svsLog.h>
 #include <svsErr.h>
@@ -22,11 +23,38 @@
 #include <svsBdp.h>
 #include <libSVS.h>
 #include <svsSocket.h>
-
-static int svsSocketRecvFlush(int sockFd);
+#include <svsShm.h>
+
+static void *svsSocketMuxThread(void *arg);
+static int svsSocketMuxWaiterAdd(svs_socket_mux_t *mux, uint32_t seq, uint8_t *rsp_payload, uint16_t rsp_len, svs_socket_done_fn_t fn, void *arg, int64_t tend_ms, svs_socket_waiter_t **waiter);
+static void svsSocketMuxExpire(svs_socket_mux_t *mux, int rc, uint8_t all);
+static int svsSocketMuxWaiterCancel(svs_socket_mux_t *mux, svs_socket_waiter_t *waiter, uint32_t seq);
+static void svsSocketMuxWaiterRemove(svs_socket_mux_t *mux, svs_socket_waiter_t *waiter);
+static int svsSocketMuxWait(svs_socket_mux_t *mux, svs_socket_waiter_t *waiter, int timeout_ms, svsSocketMsgHeader_t *hdr);
+static int svsSocketMuxReconnect(svs_socket_mux_t *mux);
+static uint8_t svsSocketMuxStopped(svs_socket_mux_t *mux);
+static void svsSocketMuxDeliver(svs_socket_mux_t *mux, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+static int svsSocketMuxShmAttach(svs_socket_mux_t *mux, uint8_t receiver);
+static int svsSocketMuxPump(svs_socket_mux_t *mux, svs_socket_waiter_t *waiter, int timeout_ms, svsSocketMsgHeader_t *hdr);
+static int svsSocketMuxShmRxBdp(int shmFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+static void svsSocketWireReset(int sockFd);
+static int svsSocketWireHello(int sockFd);
+static int svsSocketWireAccept(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+static int svsSocketWireHdrRecv(int sockFd, svsSocketMsgHeader_t *hdr);
+
+static svs_socket_mux_t svsSocketMuxBdp;   // client BDP socket shared by all the threads of the application
+static svs_socket_mux_t svsSocketMuxKr;    // client KR socket shared by all the threads of the application
 
 extern pthread_mutex_t mutexSocketRecv;
 extern pthread_mutex_t mutexSocketSend;
+extern pthread_mutex_t mutexSocketClientBdp;
+extern pthread_mutex_t mutexSocketClientKr;
+
+static svs_socket_reconnect_t svsSocketReconnectSvs;
+static svs_socket_wire_t      svsSocketWire[SVS_SOCKET_WIRE_FD_MAX];      // indexed by socket FD
+static uint8_t                svsSocketWireVersion = SVS_SOCKET_WIRE_V1; // requested by the clients of this process
+static pthread_mutex_t        svsSocketSendMutex[SVS_SOCKET_WIRE_FD_MAX]; // indexed by socket FD, a stalled peer only blocks its own senders
+static pthread_once_t         svsSocketSendOnce = PTHREAD_ONCE_INIT;
 
 int svsSocketClientCreateSvs(int *sockFd)
 {
@@ -66,24 +94,49 @@ int svsSocketClientCreateCallback(int *sockFd, uint8_t appflag)
 
 int svsSocketClientCreateBdp(int *sockFd)
 {
-    return(svsSocketClientCreate(SVS_SOCKET_SERVER_IP, SOCKET_PORT_BDP_TX, sockFd, 0));
+    int rc;
+
+    rc = svsSocketClientCreate(SVS_SOCKET_SERVER_IP, SOCKET_PORT_BDP_TX, sockFd, 0);
+    if (rc != ERR_PASS)
+    {
+        return(rc);
+    }
+
+    rc = svsSocketMuxCreate(&svsSocketMuxBdp, "BDP", SOCKET_PORT_BDP_TX, *sockFd, &mutexSocketClientBdp, svsBdpSockFdSet);
+    if ((rc == ERR_PASS) && svsShmEnableGet())
+    {   // the socket stays in use when the shared memory cannot be set up
+        svsSocketMuxBdp.fnShm = svsSocketMuxShmRxBdp;
+        svsSocketMuxShmAttach(&svsSocketMuxBdp, 0);
+    }
+
+    return(rc);
 }
 
 int svsSocketClientCreateKr(int *sockFd)
 {
-    return(svsSocketClientCreate(SVS_SOCKET_SERVER_IP, SOCKET_PORT_KR, sockFd, 0));
+    int rc;
+
+    rc = svsSocketClientCreate(SVS_SOCKET_SERVER_IP, SOCKET_PORT_KR, sockFd, 0);
+    if (rc != ERR_PASS)
+    {
+        return(rc);
+    }
+
+    return(svsSocketMuxCreate(&svsSocketMuxKr, "KR", SOCKET_PORT_KR, *sockFd, &mutexSocketClientKr, svsKrSockFdSet));
 }
 
 int svsSocketClientDestroyKr(int socketFd)
 {
-    svsSocketClientDestroy(socketFd);
+    // the mux owns the socket, it may have been replaced after a reconnection
+    svsSocketMuxDestroy(&svsSocketMuxKr);
 
     return(ERR_PASS);
 }
 
 int svsSocketClientDestroyBdp(int socketFd)
 {
-    svsSocketClientDestroy(socketFd);
+    // the mux owns the socket, it may have been replaced after a reconnection
+    svsSocketMuxDestroy(&svsSocketMuxBdp);
 
     return(ERR_PASS);
 }
@@ -91,18 +144,23 @@ int svsSocketClientDestroyBdp(int socketFd)
 int svsSocketClientCreate(char *ipAddr, int port, int *sockFd, uint8_t appflag)
 {
     int rc;
+    int fd;
+    int yes = 1;    // for setsockopt() TCP_NODELAY, below
     struct sockaddr_in servaddr;
 
     //logDebug("");
 
-    *sockFd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (*sockFd == -1)
+    // *sockFd is only set once the socket is ready, another thread can use it from then on for its
+    // own messages (e.g. a log line) and would take the answers of the header negotiation
+    fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (fd == -1)
     {
+        *sockFd = -1;
         logError("socket: %s",  strerror(errno));
         return(ERR_FAIL);
     }
 
-    //logDebug("svsSocketClientCreate port %d socket %d\n", port, *sockFd);
+    //logDebug("svsSocketClientCreate port %d socket %d\n", port, fd);
 
     bzero((void *) &servaddr, sizeof(servaddr));
     servaddr.sin_family         = AF_INET;
@@ -112,7 +170,7 @@ int svsSocketClientCreate(char *ipAddr, int port, int *sockFd, uint8_t appflag)
     int retry = 0;
     do
     {
-        rc = connect(*sockFd, (struct sockaddr *)&servaddr, sizeof(servaddr));
+        rc = connect(fd, (struct sockaddr *)&servaddr, sizeof(servaddr));
         if (rc == -1)
         {   // allow some time for server to startup
             usleep(1000);
@@ -125,14 +183,26 @@ int svsSocketClientCreate(char *ipAddr, int port, int *sockFd, uint8_t appflag)
     } while(rc < 0);
     if (rc < 0)
     {
-        close(*sockFd);
-        logError("failed to contact server after %d retries, socket %d", retry, *sockFd);
+        close(fd);
+        *sockFd = fd;
+        logError("failed to contact server after %d retries, socket %d", retry, fd);
         return(ERR_FAIL);
     }
 
+    // a message goes out as one segment already (MSG_MORE), it must not wait for the ACK of the previous one,
+    // e.g. the acknowledgement of the wire hello is not answered and the peer delays its ACK
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+    svsSocketWireReset(fd);
+    if (svsSocketWireVersion != SVS_SOCKET_WIRE_LEGACY)
+    {
+        svsSocketWireHello(fd);
+    }
+
     if (appflag)
     {
         svsSocketMsgHeader_t hdr;
+        callback_app_reg_t reg;
 
         /*
          * Register with the callback server as an application. This allows
@@ -149,15 +219,52 @@ int svsSocketClientCreate(char *ipAddr, int port, int *sockFd, uint8_t appflag)
         hdr.module_id = MODULE_ID_CALLBACK;
 
         hdr.u.cbhdr.msg_id = (uint8_t)MSG_ID_CB_APP;
+        // tell the server what to do with our events when we fall behind
+        svsCallbackAppRegGet(&reg);
+        hdr.len = sizeof(reg);
 
-        rc = svsSocketSend(*sockFd, &hdr, NULL);
+        rc = svsSocketSend(fd, &hdr, (uint8_t *)&reg);
         if (rc < 0)
         {
+            *sockFd = fd;
             logError("Failed to register application with callback server");
             return(ERR_FAIL);
         }
     }
-    //logInfo("success in contacting server after %d retries, socket %d", retry, *sockFd);
+    //logInfo("success in contacting server after %d retries, socket %d", retry, fd);
+
+    *sockFd = fd;
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Tries to connect again to a server that went away, at most once per backoff delay.
+// The delay starts at SVS_SOCKET_RECONNECT_MIN_MS and doubles after each failure up to SVS_SOCKET_RECONNECT_MAX_MS.
+// Returns ERR_SOCK_RECONNECT while the server cannot be reached, the caller fails its request right away.
+//
+int svsSocketReconnect(svs_socket_reconnect_t *rec, int port, uint8_t appflag, int *sockFd)
+{
+    int rc;
+    int64_t tnow_ms = svsTimeGet_ms();
+
+    if (tnow_ms < rec->tnext_ms)
+    {
+        return(ERR_SOCK_RECONNECT);
+    }
+    // set before the attempt, a failed connection is logged and the log client may reconnect from there
+    rec->delay_ms = (rec->delay_ms == 0) ? SVS_SOCKET_RECONNECT_MIN_MS : MIN(rec->delay_ms * 2, SVS_SOCKET_RECONNECT_MAX_MS);
+    rec->tnext_ms = tnow_ms + rec->delay_ms;
+
+    rc = svsSocketClientCreate(SVS_SOCKET_SERVER_IP, port, sockFd, appflag);
+    if (rc != ERR_PASS)
+    {
+        *sockFd = 0;
+        return(ERR_SOCK_RECONNECT);
+    }
+    logInfo("connected to port %d, socket %d", port, *sockFd);
+    rec->delay_ms = 0;
+    rec->tnext_ms = 0;
 
     return(ERR_PASS);
 }
@@ -169,6 +276,614 @@ int svsSocketClientDestroy(int socketFd)
     return(ERR_PASS);
 }
 
+//
+// Description:
+// Starts the receiver thread of a client socket shared by several threads.
+// Each request registers a waiter with its sequence number before being sent, the receiver thread
+// routes the responses to the waiters, so any number of requests can be in flight on the socket.
+//
+int svsSocketMuxCreate(svs_socket_mux_t *mux, char *name, int port, int sockFd, pthread_mutex_t *mutexSend, void (* fdSet)(int))
+{
+    int i, status;
+    pthread_condattr_t condAttr;
+
+    memset(mux, 0, sizeof(svs_socket_mux_t));
+    mux->name       = name;
+    mux->sockFd     = sockFd;
+    mux->port       = port;
+    mux->mutexSend  = mutexSend;
+    mux->fdSet      = fdSet;
+
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&mux->mutex, 0);
+    for (i=0; i<SVS_SOCKET_MUX_WAITER_MAX; i++)
+    {
+        pthread_cond_init(&mux->waiter[i].cond, &condAttr);
+    }
+    pthread_condattr_destroy(&condAttr);
+
+    if (pipe(mux->wakeFd) < 0)
+    {
+        logError("pipe: %s", strerror(errno));
+        return(ERR_FAIL);
+    }
+
+    mux->running = 1;
+    status = pthread_create(&mux->thread, NULL, svsSocketMuxThread, (void *)mux);
+    if (status != 0)
+    {
+        logError("pthread_create: %s", strerror(status));
+        mux->running = 0;
+        close(mux->wakeFd[0]);
+        close(mux->wakeFd[1]);
+        return(ERR_FAIL);
+    }
+
+    return(ERR_PASS);
+}
+
+int svsSocketMuxDestroy(svs_socket_mux_t *mux)
+{
+    int i;
+
+    if (mux->sockFd == 0)
+    {   // never created
+        return(ERR_PASS);
+    }
+
+    // wake up the receiver thread, it fails the requests still waiting and exits instead of reconnecting
+    // the pipe reaches it while it polls the socket as well as between two reconnection attempts
+    pthread_mutex_lock(&mux->mutex);
+    mux->stop = 1;
+    pthread_mutex_unlock(&mux->mutex);
+    if (write(mux->wakeFd[1], "", 1) != 1)
+    {
+        logError("write: %s", strerror(errno));
+    }
+    pthread_join(mux->thread, NULL);
+    close(mux->wakeFd[0]);
+    close(mux->wakeFd[1]);
+
+    for (i=0; i<SVS_SOCKET_MUX_WAITER_MAX; i++)
+    {
+        pthread_cond_destroy(&mux->waiter[i].cond);
+    }
+    pthread_mutex_destroy(&mux->mutex);
+    if (mux->sockFd > 0)
+    {
+        close(mux->sockFd);
+    }
+    mux->sockFd = 0;
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Receives all the responses from the server on a shared client socket and hands them to the
+// request with the same sequence number. Responses nobody waits for anymore (the request timed out) are dropped.
+// Asynchronous requests are completed from this thread, when their response arrives or their deadline expires.
+// When the server goes away the requests in flight fail with ERR_SOCK_DISC, the new ones with ERR_SOCK_RECONNECT,
+// until this thread connects again.
+//
+static void *svsSocketMuxThread(void *arg)
+{
+    int                     i, rc;
+    svs_socket_mux_t        *mux = (svs_socket_mux_t *)arg;
+    svsSocketMsgHeader_t    hdr;
+    uint8_t                 payload[SVS_SOCKET_MSG_PAYLOAD_MAX];
+    struct pollfd           pfd[2];
+
+    logDebug("%s receiver started on socket %d", mux->name, mux->sockFd);
+
+    pfd[0].events = POLLIN;
+    pfd[1].fd     = mux->wakeFd[0];
+    pfd[1].events = POLLIN;
+
+    while (1)
+    {
+        pfd[0].fd = mux->sockFd;
+
+        while (1)
+        {
+            // wake up periodically to expire the asynchronous requests nobody waits for
+            rc = poll(pfd, 2, SVS_SOCKET_MUX_TICK_MS);
+            if ((rc > 0) && (pfd[1].revents != 0))
+            {   // destroyed
+                break;
+            }
+            if (rc <= 0)
+            {
+                if ((rc < 0) && (errno != EINTR))
+                {
+                    logError("poll: %s", strerror(errno));
+                    break;
+                }
+                svsSocketMuxExpire(mux, ERR_COMMS_TIMEOUT, 0);
+                continue;
+            }
+
+            rc = svsSocketRecvMsg(mux->sockFd, &hdr, payload, sizeof(payload));
+            if ((rc == ERR_SOCK_DISC) || (rc == ERR_SOCK_FAIL))
+            {
+                break;
+            }
+            if (rc != ERR_PASS)
+            {
+                continue;
+            }
+
+            svsSocketMuxDeliver(mux, &hdr, payload);
+        }
+
+        // the connection is gone, fail the requests in flight right away instead of letting them time out
+        pthread_mutex_lock(&mux->mutex);
+        mux->running = 0;
+        for (i=0; i<SVS_SOCKET_MUX_WAITER_MAX; i++)
+        {
+            if ((mux->waiter[i].seq != 0) && !mux->waiter[i].done && (mux->waiter[i].fn == 0))
+            {
+                mux->waiter[i].rc   = ERR_SOCK_DISC;
+                mux->waiter[i].done = 1;
+                pthread_cond_signal(&mux->waiter[i].cond);
+            }
+        }
+        pthread_mutex_unlock(&mux->mutex);
+        svsSocketMuxExpire(mux, ERR_SOCK_DISC, 1);
+
+        if (svsSocketMuxReconnect(mux) != ERR_PASS)
+        {   // destroyed
+            break;
+        }
+    }
+
+    logDebug("%s receiver stopped", mux->name);
+
+    return(0);
+}
+
+static uint8_t svsSocketMuxStopped(svs_socket_mux_t *mux)
+{
+    uint8_t stop;
+
+    pthread_mutex_lock(&mux->mutex);
+    stop = mux->stop;
+    pthread_mutex_unlock(&mux->mutex);
+
+    return(stop);
+}
+
+//
+// Description:
+// Hands a response to the request with the same sequence number, called by the receiver thread of the socket
+// and by the one of the shared memory link.
+//
+static void svsSocketMuxDeliver(svs_socket_mux_t *mux, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    int                     i;
+    svs_socket_done_fn_t    fn;
+    void                    *fn_arg;
+
+    fn = 0;
+    fn_arg = 0;
+    pthread_mutex_lock(&mux->mutex);
+    for (i=0; i<SVS_SOCKET_MUX_WAITER_MAX; i++)
+    {
+        svs_socket_waiter_t *waiter = &mux->waiter[i];
+
+        if ((waiter->seq == 0) || (waiter->seq != hdr->seq) || waiter->done)
+        {
+            continue;
+        }
+        memcpy(&waiter->hdr, hdr, sizeof(svsSocketMsgHeader_t));
+        if (waiter->rsp != 0)
+        {
+            memcpy(waiter->rsp, payload, (hdr->len < waiter->rsp_len) ? hdr->len : waiter->rsp_len);
+        }
+        if (waiter->fn != 0)
+        {   // asynchronous request, nobody waits on it, release the slot and report the result
+            fn     = waiter->fn;
+            fn_arg = waiter->arg;
+            waiter->seq = 0;
+            waiter->fn  = 0;
+            waiter->rsp = 0;
+            break;
+        }
+        waiter->rc   = ERR_PASS;
+        waiter->done = 1;
+        pthread_cond_signal(&waiter->cond);
+        break;
+    }
+    pthread_mutex_unlock(&mux->mutex);
+
+    if (i == SVS_SOCKET_MUX_WAITER_MAX)
+    {
+        logDebug("%s response %d dropped, no request waiting for it", mux->name, hdr->seq);
+    }
+    if (fn != 0)
+    {
+        fn(fn_arg, ERR_PASS, hdr);
+    }
+}
+
+//
+// Description:
+// Connects the shared client socket again after the server went away, with an exponential backoff.
+// The senders see an invalid socket until then. Returns ERR_SOCK_DISC when the mux is destroyed, checked after
+// each attempt.
+//
+static int svsSocketMuxReconnect(svs_socket_mux_t *mux)
+{
+    int sockFd, shmFd;
+    svs_socket_reconnect_t rec;
+    struct pollfd pfd;
+
+    memset(&rec, 0, sizeof(rec));
+
+    pthread_mutex_lock(mux->mutexSend);
+    close(mux->sockFd);
+    mux->sockFd = -1;
+    shmFd = mux->shmFd;
+    mux->shmFd = 0;
+    if (mux->fdSet)
+    {
+        mux->fdSet(0);
+    }
+    pthread_mutex_unlock(mux->mutexSend);
+
+    // the server released its end with the socket, not under mutexSend, the link thread may be in a callback sending a request
+    if (shmFd > 0)
+    {
+        svsShmDestroy(shmFd);
+    }
+
+    if (svsSocketMuxStopped(mux))
+    {
+        return(ERR_SOCK_DISC);
+    }
+    logWarning("%s server connection lost...reconnecting", mux->name);
+
+    while (1)
+    {
+        if (svsSocketReconnect(&rec, mux->port, 0, &sockFd) != ERR_PASS)
+        {   // the wake up pipe interrupts the wait when destroyed
+            pfd.fd     = mux->wakeFd[0];
+            pfd.events = POLLIN;
+            poll(&pfd, 1, SVS_SOCKET_MUX_TICK_MS);
+            if (svsSocketMuxStopped(mux))
+            {
+                return(ERR_SOCK_DISC);
+            }
+            continue;
+        }
+        pthread_mutex_lock(mux->mutexSend);
+        mux->sockFd = sockFd;
+        if (mux->fdSet)
+        {
+            mux->fdSet(sockFd);
+        }
+        pthread_mutex_unlock(mux->mutexSend);
+
+        // destroyed while connecting, the socket is closed with the mux
+        pthread_mutex_lock(&mux->mutex);
+        if (mux->stop)
+        {
+            pthread_mutex_unlock(&mux->mutex);
+            return(ERR_SOCK_DISC);
+        }
+        mux->running = 1;
+        pthread_mutex_unlock(&mux->mutex);
+
+        logInfo("%s server connection restored on socket %d", mux->name, sockFd);
+        if (mux->fnShm)
+        {   // called by the receiver thread, it reads the answer itself
+            svsSocketMuxShmAttach(mux, 1);
+        }
+        return(ERR_PASS);
+    }
+
+    return(ERR_SOCK_DISC);
+}
+
+//
+// Description:
+// Moves the requests of a shared client socket to a shared memory link. The segment name is sent on the socket,
+// the server answers through the link itself so a working link is proven before it is used.
+// The socket keeps carrying the requests when the server does not support it, a failure is answered on the socket.
+// receiver is 1 when called by the receiver thread of the mux, nobody else reads the socket then.
+//
+static int svsSocketMuxShmAttach(svs_socket_mux_t *mux, uint8_t receiver)
+{
+    int                     rc;
+    int                     shmFd = 0;
+    uint32_t                seq;
+    char                    name[SVS_SHM_NAME_MAX];
+    svsSocketMsgHeader_t    hdr;
+    svs_socket_waiter_t     *waiter = 0;
+
+    snprintf(name, sizeof(name), "/svs.%d.%s", getpid(), mux->name);
+    rc = svsShmClientCreate(name, mux->sockFd, mux->fnShm, &shmFd);
+    if (rc != ERR_PASS)
+    {
+        goto _svsSocketMuxShmAttach;
+    }
+
+    seq = svsSocketSeqNext();
+    rc = svsSocketMuxWaiterAdd(mux, seq, 0, 0, 0, 0, 0, &waiter);
+    if (rc != ERR_PASS)
+    {
+        goto _svsSocketMuxShmAttach;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    snprintf(hdr.appName, sizeof(hdr.appName), "%s", svsAppNameGet());
+    hdr.module_id   = MODULE_ID_SHM;
+    hdr.len         = strlen(name) + 1;
+    hdr.seq         = seq;
+    hdr.u.svshdr.id = 0xffff;   // invalid BDP message ID, rejected by a server without shared memory support
+
+    pthread_mutex_lock(mux->mutexSend);
+    rc = svsSocketSend(mux->sockFd, &hdr, (uint8_t *)name);
+    pthread_mutex_unlock(mux->mutexSend);
+    if (rc != ERR_PASS)
+    {
+        goto _svsSocketMuxShmAttach;
+    }
+
+    if (receiver)
+    {
+        rc = svsSocketMuxPump(mux, waiter, SVS_SHM_ATTACH_TIMEOUT_MS, &hdr);
+    }
+    else
+    {
+        rc = svsSocketMuxWait(mux, waiter, SVS_SHM_ATTACH_TIMEOUT_MS, &hdr);
+    }
+    if (rc == ERR_PASS)
+    {
+        rc = hdr.u.svshdr.status;
+    }
+
+    _svsSocketMuxShmAttach:
+
+    if (waiter != 0)
+    {
+        svsSocketMuxWaiterRemove(mux, waiter);
+    }
+    // the server mapped it or gave up, the segment is released when both sides unmap it
+    shm_unlink(name);
+
+    if (rc == ERR_PASS)
+    {
+        pthread_mutex_lock(mux->mutexSend);
+        mux->shmFd = shmFd;
+        pthread_mutex_unlock(mux->mutexSend);
+        logInfo("%s requests sent through %s", mux->name, name);
+    }
+    else
+    {
+        if (shmFd > 0)
+        {
+            svsShmDestroy(shmFd);
+        }
+        logWarning("%s shared memory not available (%d), using socket %d", mux->name, rc, mux->sockFd);
+    }
+
+    return(rc);
+}
+
+//
+// Description:
+// Waits for the response of a registered request from the receiver thread: the socket is read and its messages
+// delivered until the waiter is done, the response may come from the socket or from the shared memory link.
+//
+static int svsSocketMuxPump(svs_socket_mux_t *mux, svs_socket_waiter_t *waiter, int timeout_ms, svsSocketMsgHeader_t *hdr)
+{
+    int                     rc;
+    uint8_t                 done;
+    int64_t                 tend_ms = svsTimeGet_ms() + timeout_ms;
+    svsSocketMsgHeader_t    rsp_hdr;
+    uint8_t                 payload[SVS_SOCKET_MSG_PAYLOAD_MAX];
+    struct pollfd           pfd;
+
+    pfd.fd     = mux->sockFd;
+    pfd.events = POLLIN;
+
+    while (1)
+    {
+        pthread_mutex_lock(&mux->mutex);
+        done = waiter->done;
+        if (done)
+        {
+            rc = waiter->rc;
+            memcpy(hdr, &waiter->hdr, sizeof(svsSocketMsgHeader_t));
+        }
+        pthread_mutex_unlock(&mux->mutex);
+        if (done)
+        {
+            return(rc);
+        }
+        if (svsTimeGet_ms() >= tend_ms)
+        {
+            return(ERR_COMMS_TIMEOUT);
+        }
+
+        // short wait, an answer through the link does not wake up the poll
+        if (poll(&pfd, 1, SVS_SOCKET_MUX_PUMP_MS) <= 0)
+        {
+            continue;
+        }
+        rc = svsSocketRecvMsg(mux->sockFd, &rsp_hdr, payload, sizeof(payload));
+        if ((rc == ERR_SOCK_DISC) || (rc == ERR_SOCK_FAIL))
+        {   // the receiver loop finds it out again
+            return(rc);
+        }
+        if (rc == ERR_PASS)
+        {
+            svsSocketMuxDeliver(mux, &rsp_hdr, payload);
+        }
+    }
+}
+
+static int svsSocketMuxShmRxBdp(int shmFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    svsSocketMuxDeliver(&svsSocketMuxBdp, hdr, payload);
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Completes the asynchronous requests past their deadline, or all of them when the connection is lost.
+// The callbacks are called without holding the mux mutex, they may send new requests.
+//
+static void svsSocketMuxExpire(svs_socket_mux_t *mux, int rc, uint8_t all)
+{
+    int                     i, cnt = 0;
+    int64_t                 tnow_ms = svsTimeGet_ms();
+    svs_socket_done_fn_t    fn[SVS_SOCKET_MUX_WAITER_MAX];
+    void                    *fn_arg[SVS_SOCKET_MUX_WAITER_MAX];
+
+    pthread_mutex_lock(&mux->mutex);
+    for (i=0; i<SVS_SOCKET_MUX_WAITER_MAX; i++)
+    {
+        svs_socket_waiter_t *waiter = &mux->waiter[i];
+
+        if ((waiter->seq == 0) || (waiter->fn == 0))
+        {
+            continue;
+        }
+        if (all || (tnow_ms >= waiter->tend_ms))
+        {
+            fn[cnt]     = waiter->fn;
+            fn_arg[cnt] = waiter->arg;
+            cnt++;
+            waiter->seq = 0;
+            waiter->fn  = 0;
+            waiter->rsp = 0;
+        }
+    }
+    pthread_mutex_unlock(&mux->mutex);
+
+    for (i=0; i<cnt; i++)
+    {
+        fn[i](fn_arg[i], rc, 0);
+    }
+}
+
+//
+// Description:
+// Registers a request before it is sent so that its response cannot be missed.
+//
+static int svsSocketMuxWaiterAdd(svs_socket_mux_t *mux, uint32_t seq, uint8_t *rsp_payload, uint16_t rsp_len, svs_socket_done_fn_t fn, void *arg, int64_t tend_ms, svs_socket_waiter_t **waiter)
+{
+    int i;
+    int rc = ERR_BUSY;
+
+    pthread_mutex_lock(&mux->mutex);
+    if (!mux->running)
+    {   // fail fast while the connection is being restored
+        rc = ERR_SOCK_RECONNECT;
+        goto _svsSocketMuxWaiterAdd;
+    }
+    for (i=0; i<SVS_SOCKET_MUX_WAITER_MAX; i++)
+    {
+        if (mux->waiter[i].seq == 0)
+        {
+            mux->waiter[i].seq     = seq;
+            mux->waiter[i].done    = 0;
+            mux->waiter[i].rc      = ERR_COMMS_TIMEOUT;
+            mux->waiter[i].rsp     = rsp_payload;
+            mux->waiter[i].rsp_len = rsp_len;
+            mux->waiter[i].fn      = fn;
+            mux->waiter[i].arg     = arg;
+            mux->waiter[i].tend_ms = tend_ms;
+            *waiter = &mux->waiter[i];
+            rc = ERR_PASS;
+            break;
+        }
+    }
+    if (rc == ERR_BUSY)
+    {
+        logError("%s too many requests in flight", mux->name);
+    }
+
+    _svsSocketMuxWaiterAdd:
+
+    pthread_mutex_unlock(&mux->mutex);
+
+    return(rc);
+}
+
+static void svsSocketMuxWaiterRemove(svs_socket_mux_t *mux, svs_socket_waiter_t *waiter)
+{
+    pthread_mutex_lock(&mux->mutex);
+    waiter->seq = 0;
+    waiter->fn  = 0;
+    waiter->rsp = 0;
+    pthread_mutex_unlock(&mux->mutex);
+}
+
+//
+// Description:
+// Removes an asynchronous request that could not be sent.
+// Returns ERR_DONE when the receiver thread already completed it, its callback was called.
+//
+static int svsSocketMuxWaiterCancel(svs_socket_mux_t *mux, svs_socket_waiter_t *waiter, uint32_t seq)
+{
+    int rc = ERR_DONE;
+
+    pthread_mutex_lock(&mux->mutex);
+    if (waiter->seq == seq)
+    {
+        waiter->seq = 0;
+        waiter->fn  = 0;
+        waiter->rsp = 0;
+        rc = ERR_PASS;
+    }
+    pthread_mutex_unlock(&mux->mutex);
+
+    return(rc);
+}
+
+//
+// Description:
+// Waits up to timeout_ms for the response of a registered request.
+// Returns ERR_COMMS_TIMEOUT when no response was received, the waiter stays registered so that
+// the request can be resent with the same sequence number.
+//
+static int svsSocketMuxWait(svs_socket_mux_t *mux, svs_socket_waiter_t *waiter, int timeout_ms, svsSocketMsgHeader_t *hdr)
+{
+    int             rc;
+    int64_t         tend_ms;
+    struct timespec ts;
+
+    tend_ms    = svsTimeGet_ms() + timeout_ms;
+    ts.tv_sec  = tend_ms / 1000;
+    ts.tv_nsec = (tend_ms % 1000) * 1000000;
+
+    pthread_mutex_lock(&mux->mutex);
+    while (!waiter->done)
+    {
+        if (pthread_cond_timedwait(&waiter->cond, &mux->mutex, &ts) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    if (waiter->done)
+    {
+        rc = waiter->rc;
+        memcpy(hdr, &waiter->hdr, sizeof(svsSocketMsgHeader_t));
+    }
+    else
+    {
+        rc = ERR_COMMS_TIMEOUT;
+    }
+    pthread_mutex_unlock(&mux->mutex);
+
+    return(rc);
+}
+
 int svsSocketServerCreate(socket_thread_info_t *thread_info)
 {
     int rc = ERR_PASS;
@@ -209,30 +924,26 @@ int svsSocketServerDestroy(socket_thread_info_t *thread_info)
 
 //
 // Description:
-// The client application calls this function to send the request to the server and waits for a response
+// The client application calls this function to send the request to the server and waits for a response.
+// The socket is shared by all the threads of the application, the mutex is held only while sending,
+// the response is routed back to this request by the receiver thread using the sequence number.
 //
-int svsSocketServerBdpTransfer(int sockFdRx, int sockFdTx, module_id_t module_id, uint16_t dev_num, uint16_t msgID, blocking_t blocking, int timeout_ms, uint8_t flags, callback_fn_t callback, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len)
+int svsSocketServerBdpTransfer(svs_socket_mux_t *mux, module_id_t module_id, uint16_t dev_num, uint16_t msgID, blocking_t blocking, int timeout_ms, uint8_t flags, callback_fn_t callback, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len)
 {
     int                     rc;
-    struct timeval          timeout;
     svsSocketMsgHeader_t    hdr;
     int                     timeout_client_ms;
+    uint32_t                seq;
+    svs_socket_waiter_t     *waiter = 0;
+    extern pthread_mutex_t  mutexSocketClientBdp;
 
-    if (sockFdRx <= 0)
-        return ERR_FAIL;
+    if (mux->sockFd <= 0)
+        return((mux->sockFd < 0) ? ERR_SOCK_RECONNECT : ERR_FAIL);
 
     // in non blocking calls, the response is not set, so we clear all its data as this will set the status to ERR_PASS
     // just a way to avoid setting this in every API function
     memset(rsp_payload, 0, rsp_len);
 
-    // flush the socket, in case previous message were not handled
-    rc = svsSocketRecvFlush(sockFdRx);
-    if ((rc != ERR_PASS) && (rc != ERR_COMMS_TIMEOUT))
-    {
-        logError("svsSocketRecvFlush failed");
-        return(rc);
-    }
-
     if (dev_num == BDP_NUM_ALL)
     {
         // We ask the BDP to respond when in broadcast for MSG_ID_BDP_ADDR_GET, otherwise it depends on the timeout and callback value
@@ -275,14 +986,27 @@ int svsSocketServerBdpTransfer(int sockFdRx, int sockFdTx, module_id_t module_id
     // might need to change the timeout
     timeout_client_ms = timeout_ms * (BDP_RETRY_MAX + 1);
 
+    // register the request before sending it, the response may come back before the send returns
+    seq = svsSocketSeqNext();
+    if (blocking == BLOCKING_ON)
+    {
+        rc = svsSocketMuxWaiterAdd(mux, seq, rsp_payload, rsp_len, 0, 0, 0, &waiter);
+        if (rc != ERR_PASS)
+        {
+            return(rc);
+        }
+    }
+
     int64_t tstart = svsTimeGet_ms();
-    logDebug("Client sending BDP %d %s %lld ms", dev_num, msgIDToString(msgID), tstart);
+    logDebug("Client sending BDP %d %s seq %d %lld ms", dev_num, msgIDToString(msgID), seq, tstart);
     // Send request to server
-    rc = svsSocketSendBdp(sockFdRx, msgID, dev_num, timeout_client_ms, timeout_ms, flags, callback, req_payload, req_len);
+    pthread_mutex_lock(&mutexSocketClientBdp);
+    rc = svsSocketSendBdp((mux->shmFd > 0) ? mux->shmFd : mux->sockFd, seq, msgID, dev_num, timeout_client_ms, timeout_ms, flags, callback, req_payload, req_len);
+    pthread_mutex_unlock(&mutexSocketClientBdp);
     if (rc != ERR_PASS)
     {
         logError("svsSocketSendBdp");
-        return(rc);
+        goto _svsSocketServerBdpTransfer;
     }
 
     if (blocking == BLOCKING_OFF)
@@ -291,8 +1015,6 @@ int svsSocketServerBdpTransfer(int sockFdRx, int sockFdTx, module_id_t module_id
     }
 
     // For a blocking call we need some timeout value so as not to block the client in case the server fails to respond.
-
-    // Set timeout on the socket (time to wait for the server to respond)
     if (timeout_client_ms == 0)
     {   // we need to wait for the server to let us know that it is done sending
         // in this case, the server does not wait for a response from the BDP
@@ -300,17 +1022,8 @@ int svsSocketServerBdpTransfer(int sockFdRx, int sockFdTx, module_id_t module_id
         timeout_client_ms = BDP_TIMEOUT_MIN_MS;
     }
 
-    timeout.tv_sec  = timeout_client_ms / 1000 ;
-    timeout.tv_usec = (timeout_client_ms % 1000) * 1000;
-    rc = setsockopt(sockFdRx, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-    if (rc != 0)
-    {
-        logError("setsockopt: %s",  strerror(errno));
-        return(ERR_FAIL);
-    }
-
     // Wait for response from server
-    rc = svsSocketRecvMsg(sockFdRx, &hdr, rsp_payload, rsp_len);
+    rc = svsSocketMuxWait(mux, waiter, timeout_client_ms, &hdr);
     if (rc == ERR_PASS)
     {
         logDebug("Received BDP server response, roundtrip %lld ms", svsTimeGet_ms() - tstart);
@@ -325,7 +1038,7 @@ int svsSocketServerBdpTransfer(int sockFdRx, int sockFdTx, module_id_t module_id
                 bdp_ack_msg_rsp = (bdp_ack_msg_rsp_t *)rsp_payload;
                 rc = bdp_ack_msg_rsp->status;
                 logError("ACK message ID received with status %d", rc);
-                return(rc);
+                goto _svsSocketServerBdpTransfer;
             }
             else
             {
@@ -338,7 +1051,8 @@ int svsSocketServerBdpTransfer(int sockFdRx, int sockFdTx, module_id_t module_id
             if (hdr.dev_num != dev_num)
             {
                 logError("dev num mismatch %d %d", hdr.dev_num, dev_num);
-                return(ERR_FAIL);
+                rc = ERR_FAIL;
+                goto _svsSocketServerBdpTransfer;
             }
         }
     }
@@ -346,15 +1060,8 @@ int svsSocketServerBdpTransfer(int sockFdRx, int sockFdTx, module_id_t module_id
     {
         if (rc == ERR_COMMS_TIMEOUT)
         {
-            if (timeout_client_ms == 0)
-            {
-                rc = ERR_PASS;
-            }
-            else
-            {
-                logWarning("Timeout waiting for BDP server");
-                logDebug("No BDP server response after %lld ms", svsTimeGet_ms() - tstart);
-            }
+            logWarning("Timeout waiting for BDP server");
+            logDebug("No BDP server response after %lld ms", svsTimeGet_ms() - tstart);
         }
         else
         {
@@ -362,26 +1069,36 @@ int svsSocketServerBdpTransfer(int sockFdRx, int sockFdTx, module_id_t module_id
         }
     }
 
+    _svsSocketServerBdpTransfer:
+
+    if (waiter != 0)
+    {
+        svsSocketMuxWaiterRemove(mux, waiter);
+    }
+
     return(rc);
 }
 
 //
 // Description:
-// The client application calls this function to send the request to the server and waits for a response
+// The client application calls this function to send the request to the server and waits for a response.
+// The request is resent with the same sequence number on timeout, so a late response to a previous attempt is accepted.
 //
-int svsSocketServerKrTransfer(int sockFd, module_id_t module_id, uint16_t dev_num, uint16_t msgID, int timeout_ms, uint8_t flags, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len)
+int svsSocketServerKrTransfer(svs_socket_mux_t *mux, module_id_t module_id, uint16_t dev_num, uint16_t msgID, int timeout_ms, uint8_t flags, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len)
 {
     int                     rc;
-    struct timeval          timeout;
     svsSocketMsgHeader_t    hdr;
+    uint32_t                seq;
+    svs_socket_waiter_t     *waiter = 0;
+    extern pthread_mutex_t  mutexSocketClientKr;
 
-    if (sockFd <= 0)
-        return ERR_FAIL;
+    if (mux->sockFd <= 0)
+        return((mux->sockFd < 0) ? ERR_SOCK_RECONNECT : ERR_FAIL);
 
-    rc = svsSocketRecvFlush(sockFd);
-    if ((rc != ERR_PASS) && (rc != ERR_COMMS_TIMEOUT))
+    seq = svsSocketSeqNext();
+    rc = svsSocketMuxWaiterAdd(mux, seq, rsp_payload, rsp_len, 0, 0, 0, &waiter);
+    if (rc != ERR_PASS)
     {
-        logError("svsSocketRecvFlush failed");
         return(rc);
     }
 
@@ -389,25 +1106,17 @@ int svsSocketServerKrTransfer(int sockFd, module_id_t module_id, uint16_t dev_nu
     do
     {
         // Send request to server
-        rc = svsSocketSendKr(sockFd, msgID, dev_num, timeout_ms, flags, req_payload, req_len);
+        pthread_mutex_lock(&mutexSocketClientKr);
+        rc = svsSocketSendKr(mux->sockFd, seq, msgID, dev_num, timeout_ms, flags, req_payload, req_len);
+        pthread_mutex_unlock(&mutexSocketClientKr);
         if (rc != ERR_PASS)
         {
             logError("svsSocketSendKr");
-            return(rc);
-        }
-
-        // Set timeout on the socket
-        timeout.tv_sec  = timeout_ms / 1000 ;
-        timeout.tv_usec = (timeout_ms % 1000) * 1000;
-        rc = setsockopt(sockFd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-        if (rc != 0)
-        {
-            logError("setsockopt: %s",  strerror(errno));
-            return(ERR_FAIL);
+            goto _svsSocketServerKrTransfer;
         }
 
         // Wait for response from server
-        rc = svsSocketRecvMsg(sockFd, &hdr, rsp_payload, rsp_len);
+        rc = svsSocketMuxWait(mux, waiter, timeout_ms, &hdr);
         if (rc == ERR_PASS)
         {
             break;
@@ -420,14 +1129,14 @@ int svsSocketServerKrTransfer(int sockFd, module_id_t module_id, uint16_t dev_nu
         else
         {
             logError("Failed to communicate with KR");
-            return(rc);
+            goto _svsSocketServerKrTransfer;
         }
     } while(retry <= 10);
 
     if (rc == ERR_COMMS_TIMEOUT)
     {
         logError("Failed to communicate with KR after %d retries", retry-1);
-        return(rc);
+        goto _svsSocketServerKrTransfer;
     }
     //
     // Validate the header
@@ -435,80 +1144,101 @@ int svsSocketServerKrTransfer(int sockFd, module_id_t module_id, uint16_t dev_nu
     if (hdr.u.krhdr.msg_id != msgID)
     {
         logError("message ID mismatch expected %d, received %d", msgID, hdr.u.krhdr.msg_id);
-        return(ERR_FAIL);
+        rc = ERR_FAIL;
     }
 
-    return(ERR_PASS);
+    _svsSocketServerKrTransfer:
+
+    svsSocketMuxWaiterRemove(mux, waiter);
+
+    return(rc);
 }
 
+//
+// Description:
+// Thread safe, any number of threads may have a request in flight at the same time.
+//
 int svsSocketServerBdpTransferSafe(uint16_t dev_num, bdp_msg_id_t msg_id, blocking_t blocking, int timeout_ms, uint8_t flags, callback_fn_t callback, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len)
 {
-    int rc1, rc2;
-    extern pthread_mutex_t mutexSocketClientBdp;
-
-    // Perform atomic operation
-    rc1 = pthread_mutex_lock(&mutexSocketClientBdp);
-    if (rc1 != 0)
-    {
-        logError("pthread_mutex_lock: %s",  strerror(errno));
-        return(ERR_FAIL);
-    }
+    int rc;
 
     // Send message to the server
-    rc1 = svsSocketServerBdpTransfer(svsBdpSockFdGet(), svsBdpSockFdGet(), MODULE_ID_BDP, dev_num, msg_id, blocking, timeout_ms, flags, callback, req_payload, req_len, rsp_payload, rsp_len);
-    if (rc1 != ERR_PASS)
+    rc = svsSocketServerBdpTransfer(&svsSocketMuxBdp, MODULE_ID_BDP, dev_num, msg_id, blocking, timeout_ms, flags, callback, req_payload, req_len, rsp_payload, rsp_len);
+    if (rc != ERR_PASS)
     {
-        if (rc1 == ERR_SOCK_DISC)
-        {
-            close(svsBdpSockFdGet());
-            svsBdpSockFdSet(0);
-        }
         logError("");
     }
 
-    rc2 = pthread_mutex_unlock(&mutexSocketClientBdp);
-    if (rc2 != 0)
-    {
-        logError("pthread_mutex_unlock: %s",  strerror(errno));
-        return(ERR_FAIL);
-    }
-
-    return(rc1);
+    return(rc);
 }
 
-int svsSocketServerKrTransferSafe(uint16_t dev_num, kr_msg_id_t msg_id, int timeout_ms, uint8_t flags, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len)
+//
+// Description:
+// Sends a BDP request and returns without waiting for the response.
+// fn is called from the receiver thread exactly once, with the response copied in rsp_payload,
+// or with ERR_COMMS_TIMEOUT/ERR_SOCK_DISC. It is not called when an error is returned here.
+// rsp_payload must remain valid until fn is called.
+//
+int svsSocketServerBdpTransferAsync(uint16_t dev_num, bdp_msg_id_t msg_id, int timeout_ms, uint8_t flags, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len, svs_socket_done_fn_t fn, void *arg)
 {
-    int rc1, rc2;
-    extern pthread_mutex_t mutexSocketClientKr;
+    int                     rc;
+    int                     timeout_client_ms;
+    uint32_t                seq;
+    svs_socket_waiter_t     *waiter = 0;
+    svs_socket_mux_t        *mux = &svsSocketMuxBdp;
+    extern pthread_mutex_t  mutexSocketClientBdp;
+
+    if (mux->sockFd <= 0)
+        return((mux->sockFd < 0) ? ERR_SOCK_RECONNECT : ERR_FAIL);
+
+    if ((fn == 0) || (timeout_ms <= 0) || (dev_num == BDP_NUM_ALL))
+    {   // a response is required to complete the request
+        logError("invalid parameters");
+        return(ERR_INV_PARAM);
+    }
 
-    // Perform atomic operation
-    rc1 = pthread_mutex_lock(&mutexSocketClientKr);
-    if (rc1 != 0)
+    // same client timeout as a blocking request
+    timeout_client_ms = timeout_ms * (BDP_RETRY_MAX + 1);
+
+    seq = svsSocketSeqNext();
+    rc = svsSocketMuxWaiterAdd(mux, seq, rsp_payload, rsp_len, fn, arg, svsTimeGet_ms() + timeout_client_ms, &waiter);
+    if (rc != ERR_PASS)
     {
-        logError("pthread_mutex_lock: %s",  strerror(errno));
-        return(ERR_FAIL);
+        return(rc);
     }
 
-    // Send message to the server
-    rc1 = svsSocketServerKrTransfer(svsKrSockFdGet(), MODULE_ID_KR, dev_num, msg_id, timeout_ms, flags, req_payload, req_len, rsp_payload, rsp_len);
-    if (rc1 != ERR_PASS)
+    logDebug("Client sending async BDP %d %s seq %d", dev_num, msgIDToString(msg_id), seq);
+    pthread_mutex_lock(&mutexSocketClientBdp);
+    rc = svsSocketSendBdp((mux->shmFd > 0) ? mux->shmFd : mux->sockFd, seq, msg_id, dev_num, timeout_client_ms, timeout_ms, flags, 0, req_payload, req_len);
+    pthread_mutex_unlock(&mutexSocketClientBdp);
+    if (rc != ERR_PASS)
     {
-        if (rc1 == ERR_SOCK_DISC)
-        {
-            close(svsKrSockFdGet());
-            svsKrSockFdSet(0);
+        logError("svsSocketSendBdp");
+        if (svsSocketMuxWaiterCancel(mux, waiter, seq) == ERR_DONE)
+        {   // already reported through fn
+            rc = ERR_PASS;
         }
-        logError("");
     }
 
-    rc2 = pthread_mutex_unlock(&mutexSocketClientKr);
-    if (rc2 != 0)
+    return(rc);
+}
+
+//
+// Description:
+// Thread safe, any number of threads may have a request in flight at the same time.
+//
+int svsSocketServerKrTransferSafe(uint16_t dev_num, kr_msg_id_t msg_id, int timeout_ms, uint8_t flags, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len)
+{
+    int rc;
+
+    // Send message to the server
+    rc = svsSocketServerKrTransfer(&svsSocketMuxKr, MODULE_ID_KR, dev_num, msg_id, timeout_ms, flags, req_payload, req_len, rsp_payload, rsp_len);
+    if (rc != ERR_PASS)
     {
-        logError("pthread_mutex_unlock: %s",  strerror(errno));
-        return(ERR_FAIL);
+        logError("");
     }
 
-    return(rc1);
+    return(rc);
 }
 
 int svsSocketServerSvsTransferSafe(uint16_t dev_num, svs_msg_id_t msg_id, int timeout_ms, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len)
@@ -524,18 +1254,32 @@ int svsSocketServerSvsTransferSafe(uint16_t dev_num, svs_msg_id_t msg_id, int ti
         return(ERR_FAIL);
     }
 
+    if (svsSvsSockFdGet() == 0)
+    {   // the server went away, fail right away until it is back
+        int sockFd;
+
+        rc1 = svsSocketReconnect(&svsSocketReconnectSvs, SOCKET_PORT_SVS, 0, &sockFd);
+        if (rc1 != ERR_PASS)
+        {
+            goto _svsSocketServerSvsTransferSafe;
+        }
+        svsSvsSockFdSet(sockFd);
+    }
+
     // Send message to the server
     rc1 = svsSocketServerSvsTransfer(svsSvsSockFdGet(), MODULE_ID_SVS, dev_num, msg_id, timeout_ms, req_payload, req_len, rsp_payload, rsp_len);
     if (rc1 != 0)
     {
         if (rc1 == ERR_SOCK_DISC)
         {
-            close(svsKrSockFdGet());
-            svsKrSockFdSet(0);
+            close(svsSvsSockFdGet());
+            svsSvsSockFdSet(0);
         }
         logError("");
     }
 
+    _svsSocketServerSvsTransferSafe:
+
     rc2 = pthread_mutex_unlock(&mutexSocketClientSvs);
     if (rc2 != 0)
     {
@@ -553,35 +1297,31 @@ int svsSocketServerSvsTransferSafe(uint16_t dev_num, svs_msg_id_t msg_id, int ti
 int svsSocketServerSvsTransfer(int sockFd, module_id_t module_id, uint16_t dev_num, uint16_t msgID, int timeout_ms, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len)
 {
     int                     rc;
-    struct timeval          timeout;
-    svsSocketMsgHeader_t    hdr;
-
-    rc = svsSocketRecvFlush(sockFd);
-    if ((rc != ERR_PASS) && (rc != ERR_COMMS_TIMEOUT))
-    {
-        logError("svsSocketRecvFlush failed");
-        return(rc);
-    }
+    svsSocketMsgHeader_t    hdr;
+    uint32_t                seq;
+    int64_t                 tend_ms;
 
     // Send request to server
-    rc = svsSocketSendSvs(sockFd, msgID, dev_num, req_payload, req_len);
+    seq = svsSocketSeqNext();
+    rc = svsSocketSendSvs(sockFd, seq, msgID, dev_num, req_payload, req_len);
     if (rc != ERR_PASS)
     {
         logError("svsSocketSendSvs");
         return(rc);
     }
 
-    // Set timeout on the socket
-    timeout.tv_sec  = timeout_ms / 1000 ;
-    timeout.tv_usec = (timeout_ms % 1000) * 1000;
-    rc = setsockopt(sockFd, SOL_SOCKET, SO_RCVTIMEO, (char *)&timeout, sizeof(timeout));
-    if (rc != 0)
+    // Wait for response from server, responses to previous requests that timed out are skipped
+    tend_ms = svsTimeGet_ms() + timeout_ms;
+    do
     {
-        logError("setsockopt: %s",  strerror(errno));
-        return(ERR_FAIL);
-    }
-    // Wait for response from server
-    rc = svsSocketRecvMsg(sockFd, &hdr, rsp_payload, rsp_len);
+        rc = svsSocketRecvMsgDeadline(sockFd, tend_ms, &hdr, rsp_payload, rsp_len);
+        if ((rc == ERR_PASS) && (hdr.seq != seq))
+        {
+            logDebug("stale response %d dropped, expected %d", hdr.seq, seq);
+            continue;
+        }
+        break;
+    } while (1);
     if (rc != ERR_PASS)
     {
         logError("svsSocketRecvMsg");
@@ -615,6 +1355,81 @@ int svsSocketServerSvsTransfer(int sockFd, module_id_t module_id, uint16_t dev_n
     return(rc);
 }
 
+//
+// Description:
+// Same as svsSocketServerSvsTransferSafe() for requests answered with several messages.
+// fn is called for each response received and returns 1 once the last response has been processed.
+// timeout_ms applies to the whole transfer.
+// The transfer has its own connection, the other requests of the application are not held up for its duration.
+//
+int svsSocketServerSvsStreamTransferSafe(uint16_t dev_num, svs_msg_id_t msg_id, int timeout_ms, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len, msg_stream_fn_t fn, void *arg)
+{
+    int                     rc;
+    int                     sockFd;
+    int64_t                 tend_ms;
+    uint32_t                seq;
+    svsSocketMsgHeader_t    hdr;
+
+    if (fn == 0)
+    {
+        logError("fn null");
+        return(ERR_FAIL);
+    }
+
+    rc = svsSocketClientCreateSvs(&sockFd);
+    if (rc != ERR_PASS)
+    {
+        return(rc);
+    }
+    tend_ms = svsTimeGet_ms() + timeout_ms;
+
+    // Send request to server
+    seq = svsSocketSeqNext();
+    rc = svsSocketSendSvs(sockFd, seq, msg_id, dev_num, req_payload, req_len);
+    if (rc != ERR_PASS)
+    {
+        logError("svsSocketSendSvs");
+        goto _svsSocketServerSvsStreamTransferSafe;
+    }
+
+    while (1)
+    {
+        // Wait for next response from server
+        rc = svsSocketRecvMsgDeadline(sockFd, tend_ms, &hdr, rsp_payload, rsp_len);
+        if (rc != ERR_PASS)
+        {
+            logError("svsSocketRecvMsg");
+            break;
+        }
+        if (hdr.seq != seq)
+        {   // response to a previous request that timed out
+            logDebug("stale response %d dropped, expected %d", hdr.seq, seq);
+            continue;
+        }
+        if ((hdr.module_id != MODULE_ID_SVS) || (hdr.u.svshdr.id != msg_id) || (hdr.dev_num != dev_num))
+        {
+            logError("unexpected response module %d id %d dev %d", hdr.module_id, hdr.u.svshdr.id, hdr.dev_num);
+            rc = ERR_FAIL;
+            break;
+        }
+        rc = hdr.u.svshdr.status;
+        if (rc != ERR_PASS)
+        {
+            break;
+        }
+        if (fn(rsp_payload, hdr.len, arg) != 0)
+        {   // last response processed
+            break;
+        }
+    }
+
+    _svsSocketServerSvsStreamTransferSafe:
+
+    svsSocketClientDestroy(sockFd);
+
+    return(rc);
+}
+
 void *svsSocketServerThread(void *arg)
 {
     int rc;
@@ -756,6 +1571,8 @@ void *svsSocketServerThread(void *arg)
                     else
                     {
                         FD_SET(newfd, &master); // add to master set
+                        setsockopt(newfd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(int));
+                        svsSocketWireReset(newfd);
                         if (newfd > fdmax)
                         {
                             fdmax = newfd;
@@ -824,6 +1641,10 @@ void *svsSocketServerThread(void *arg)
                                     {
                                         thread_info->fnClient(i, NULL, NULL);
                                     }
+                                    if (thread_info->fnClose)
+                                    {
+                                        thread_info->fnClose(i);
+                                    }
                                     
                                     FD_CLR(i, &master);
                                     close(i);
@@ -832,7 +1653,11 @@ void *svsSocketServerThread(void *arg)
                             }
                             else
                             {
-                                if (thread_info->fnClient)
+                                if (hdr.module_id == MODULE_ID_WIRE)
+                                {   // connection setup, the handlers never see it
+                                    svsSocketWireAccept(i, &hdr, thread_info->payload);
+                                }
+                                else if (thread_info->fnClient)
                                 {
                                     rc = thread_info->fnClient(i, &hdr, thread_info->payload);
                                     if (rc != ERR_PASS)
@@ -853,6 +1678,10 @@ void *svsSocketServerThread(void *arg)
                                             {
                                                 thread_info->fnClient(i, NULL, NULL);
                                             }
+                                            if (thread_info->fnClose)
+                                            {
+                                                thread_info->fnClose(i);
+                                            }
                                             
                                             FD_CLR(i, &master);
                                             close(i);
@@ -869,40 +1698,36 @@ void *svsSocketServerThread(void *arg)
     } // for
 }
 
-int svsSocketRecvFlush(int sockFd)
+//
+// Description:
+// Waits until tend_ms for a message and receives it. The socket options are left untouched,
+// the deadline is enforced with poll(). Returns ERR_COMMS_TIMEOUT when no message arrived in time.
+//
+int svsSocketRecvMsgDeadline(int sockFd, int64_t tend_ms, svsSocketMsgHeader_t *hdr, uint8_t *payload, uint16_t len_max)
 {
-    int rc = ERR_PASS;
-    int len;
-    static uint8_t buf[sizeof(svsSocketMsg_t)];
+    int             rc;
+    int64_t         tleft_ms;
+    struct pollfd   pfd;
 
+    pfd.fd     = sockFd;
+    pfd.events = POLLIN;
     do
     {
-        len = recv(sockFd, buf, sizeof(svsSocketMsg_t), MSG_DONTWAIT);
-        if (len <= 0)
-        {
-            if (len == 0)
-            {
-                logWarning("client disconnected, on socket %d: %s", sockFd, strerror(errno));
-                rc = ERR_SOCK_DISC;
-            }
-            else
-            {
-                if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
-                {
-                    //logWarning("svsSocketRecvMsg1 timedout: %s", strerror(errno));
-                    rc = ERR_COMMS_TIMEOUT;
-                }
-                else
-                {
-                    logError("recv: %s",  strerror(errno));
-                    rc = ERR_SOCK_FAIL;
-                    close(sockFd);
-                }
-            }
-        }
-    } while(len > 0);
+        tleft_ms = tend_ms - svsTimeGet_ms();
+        rc = poll(&pfd, 1, (tleft_ms > 0) ? (int)tleft_ms : 0);
+    } while ((rc < 0) && (errno == EINTR));
 
-    return(rc);
+    if (rc < 0)
+    {
+        logError("poll: %s", strerror(errno));
+        return(ERR_SOCK_FAIL);
+    }
+    if (rc == 0)
+    {
+        return(ERR_COMMS_TIMEOUT);
+    }
+
+    return(svsSocketRecvMsg(sockFd, hdr, payload, len_max));
 }
 
 int svsSocketRecvMsg(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload, uint16_t len_max)
@@ -917,8 +1742,20 @@ int svsSocketRecvMsg(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload, ui
         goto _svsSocketRecvMsg;
     }
 
-    // First get the header
-    len = recv(sockFd, hdr, sizeof(svsSocketMsgHeader_t), MSG_WAITALL);
+    if ((sockFd >= 0) && (sockFd < SVS_SOCKET_WIRE_FD_MAX) && (svsSocketWire[sockFd].version == SVS_SOCKET_WIRE_V1))
+    {
+        rc = svsSocketWireHdrRecv(sockFd, hdr);
+        if (rc != ERR_PASS)
+        {
+            goto _svsSocketRecvMsg;
+        }
+        len = sizeof(svsSocketMsgHeader_t);
+    }
+    else
+    {
+        // First get the header
+        len = recv(sockFd, hdr, sizeof(svsSocketMsgHeader_t), MSG_WAITALL);
+    }
     if (len <= 0)
     {
         if (len == 0)
@@ -949,9 +1786,11 @@ int svsSocketRecvMsg(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload, ui
     }
 
     // Validate payload length
+    uint16_t len_discard = 0;
     if (hdr->len > len_max)
     {
         logError("length: payload length out of range %d %d, truncating message", hdr->len, len_max);
+        len_discard = hdr->len - len_max;
         hdr->len = len_max;
     }
 
@@ -996,12 +1835,25 @@ int svsSocketRecvMsg(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload, ui
         }
     }
 
+    // drop the rest of a truncated payload, so the next message is read from its header
+    while (len_discard > 0)
+    {
+        uint8_t discard[64];
+
+        len = recv(sockFd, discard, MIN(len_discard, sizeof(discard)), MSG_WAITALL);
+        if (len <= 0)
+        {
+            break;
+        }
+        len_discard -= len;
+    }
+
     _svsSocketRecvMsg:
 
     return(rc);
 }
 
-int svsSocketSendBdp(int sockFd, uint16_t msg_id, uint16_t dev_num, int timeout_client_ms, int timeout_ms, uint8_t flags, callback_fn_t callback, uint8_t *payload, uint16_t len)
+int svsSocketSendBdp(int sockFd, uint32_t seq, uint16_t msg_id, uint16_t dev_num, int timeout_client_ms, int timeout_ms, uint8_t flags, callback_fn_t callback, uint8_t *payload, uint16_t len)
 {
     int rc;
     svsSocketMsgHeader_t hdr;
@@ -1014,6 +1866,7 @@ int svsSocketSendBdp(int sockFd, uint16_t msg_id, uint16_t dev_num, int timeout_
     hdr.module_id   = MODULE_ID_BDP;
     hdr.dev_num     = dev_num;
     hdr.len         = len;
+    hdr.seq         = seq;
     hdr.timeout_ms  = timeout_client_ms;
     hdr.tsent_ms    = svsTimeGet_ms();
 
@@ -1029,7 +1882,7 @@ int svsSocketSendBdp(int sockFd, uint16_t msg_id, uint16_t dev_num, int timeout_
     return(rc);
 }
 
-int svsSocketSendKr(int sockFd, uint16_t msg_id, uint16_t dev_num, int timeout_ms, uint8_t flags, uint8_t *payload, uint16_t len)
+int svsSocketSendKr(int sockFd, uint32_t seq, uint16_t msg_id, uint16_t dev_num, int timeout_ms, uint8_t flags, uint8_t *payload, uint16_t len)
 {
     int rc;
     svsSocketMsgHeader_t hdr;
@@ -1040,6 +1893,7 @@ int svsSocketSendKr(int sockFd, uint16_t msg_id, uint16_t dev_num, int timeout_m
     hdr.module_id  = MODULE_ID_KR;
     hdr.dev_num    = dev_num;
     hdr.len        = len;
+    hdr.seq        = seq;
     hdr.timeout_ms = timeout_ms;
     hdr.tsent_ms   = svsTimeGet_ms();
 
@@ -1095,7 +1949,7 @@ int svsSocketSendCallback(int sockFd, uint8_t module_id, uint16_t dev_num, uint1
     return(rc);
 }
 
-int svsSocketSendSvs(int sockFd, uint16_t msg_id, uint16_t dev_num, uint8_t *payload, uint16_t len)
+int svsSocketSendSvs(int sockFd, uint32_t seq, uint16_t msg_id, uint16_t dev_num, uint8_t *payload, uint16_t len)
 {
     int rc;
     svsSocketMsgHeader_t hdr;
@@ -1106,6 +1960,7 @@ int svsSocketSendSvs(int sockFd, uint16_t msg_id, uint16_t dev_num, uint8_t *pay
     hdr.module_id = MODULE_ID_SVS;
     hdr.len       = len;
     hdr.dev_num   = dev_num;
+    hdr.seq       = seq;
 
     //logDebug("svsSocketSendSvs %s moduleID %d msdID %d", hdr.appName, hdr.module_id, msg_id);
 
@@ -1116,24 +1971,305 @@ int svsSocketSendSvs(int sockFd, uint16_t msg_id, uint16_t dev_num, uint8_t *pay
     return(rc);
 }
 
-int svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+//
+// Description:
+// Returns the next socket message sequence number, never 0.
+// Called from any thread, the requests multiplexed on a client socket are told apart by this number.
+//
+uint32_t svsSocketSeqNext(void)
+{
+    static uint32_t seq = 0;
+    uint32_t        next;
+
+    do
+    {
+        next = __sync_add_and_fetch(&seq, 1);
+    } while(next == 0);
+
+    return(next);
+}
+
+//
+// Description:
+// Selects the header format requested by the clients of this process, SVS_SOCKET_WIRE_LEGACY turns the
+// negotiation off. Must be called before svsInit(), the connections already set up keep their format.
+//
+void svsSocketWireVersionSet(uint8_t version)
+{
+    svsSocketWireVersion = version;
+}
+
+static void svsSocketWireReset(int sockFd)
+{
+    if ((sockFd >= 0) && (sockFd < SVS_SOCKET_WIRE_FD_MAX))
+    {   // a new connection on a reused FD starts with the full header
+        memset(&svsSocketWire[sockFd], 0, sizeof(svs_socket_wire_t));
+    }
+}
+
+static int svsSocketVarintPut(uint8_t *buf, uint64_t value)
+{
+    int n = 0;
+
+    while (value >= 0x80)
+    {
+        buf[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buf[n++] = (uint8_t)value;
+
+    return(n);
+}
+
+static int svsSocketVarintGet(uint8_t *buf, int len, int *pos, uint64_t *value)
+{
+    int shift = 0;
+
+    *value = 0;
+    while (*pos < len)
+    {
+        *value |= (uint64_t)(buf[*pos] & 0x7f) << shift;
+        if ((buf[(*pos)++] & 0x80) == 0)
+        {
+            return(ERR_PASS);
+        }
+        shift += 7;
+        if (shift >= 64)
+        {
+            break;
+        }
+    }
+
+    return(ERR_FAIL);
+}
+
+//
+// Description:
+// Returns in data the header bytes to send on sockFd and their count.
+// On a connection that negotiated SVS_SOCKET_WIRE_V1 the header is encoded in buf (SVS_SOCKET_WIRE_HDR_MAX bytes):
+//   version, length of what follows, module_id, varints dev_num, len, seq, zigzag varints tsent_ms, timeout_ms,
+//   varint count then the bytes of the module header without its trailing zeros.
+// The application name is left out, the receiver uses the one sent at connection setup.
+// Otherwise data points to hdr itself. Does not log, it is used by the log client.
+//
+int svsSocketWireHdrEncode(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *buf, uint8_t **data)
+{
+    int n, ulen;
+    uint8_t *u = (uint8_t *)&hdr->u;
+
+    if ((sockFd < 0) || (sockFd >= SVS_SOCKET_WIRE_FD_MAX) || (svsSocketWire[sockFd].version != SVS_SOCKET_WIRE_V1))
+    {
+        *data = (uint8_t *)hdr;
+        return(sizeof(svsSocketMsgHeader_t));
+    }
+
+    for (ulen = sizeof(hdr->u); (ulen > 0) && (u[ulen - 1] == 0); ulen--)
+        ;
+
+    n = 2;
+    buf[n++] = hdr->module_id;
+    n += svsSocketVarintPut(&buf[n], hdr->dev_num);
+    n += svsSocketVarintPut(&buf[n], hdr->len);
+    n += svsSocketVarintPut(&buf[n], hdr->seq);
+    n += svsSocketVarintPut(&buf[n], ((uint64_t)hdr->tsent_ms << 1) ^ (uint64_t)(hdr->tsent_ms >> 63));
+    n += svsSocketVarintPut(&buf[n], ((uint64_t)hdr->timeout_ms << 1) ^ (uint64_t)(hdr->timeout_ms >> 63));
+    buf[n++] = (uint8_t)ulen;
+    memcpy(&buf[n], u, ulen);
+    n += ulen;
+
+    buf[0] = SVS_SOCKET_WIRE_V1;
+    buf[1] = (uint8_t)(n - 2);
+    *data  = buf;
+
+    return(n);
+}
+
+//
+// Description:
+// Reads a compact header and expands it in hdr. A malformed header leaves the stream out of step,
+// ERR_SOCK_DISC is returned so that the connection is dropped.
+//
+static int svsSocketWireHdrRecv(int sockFd, svsSocketMsgHeader_t *hdr)
+{
+    int         len, pos = 0;
+    uint8_t     buf[SVS_SOCKET_WIRE_HDR_MAX];
+    uint64_t    value[5];
+    int         i;
+
+    len = recv(sockFd, buf, 2, MSG_WAITALL);
+    if (len <= 0)
+    {
+        if (len == 0)
+        {
+            logWarning("client disconnected, on socket %d", sockFd);
+            return(ERR_SOCK_DISC);
+        }
+        if (errno == EAGAIN)
+        {
+            return(ERR_COMMS_TIMEOUT);
+        }
+        logError("recv1: %s",  strerror(errno));
+        close(sockFd);
+        return(ERR_SOCK_FAIL);
+    }
+    if ((len != 2) || (buf[0] != SVS_SOCKET_WIRE_V1) || (buf[1] > SVS_SOCKET_WIRE_HDR_MAX - 2))
+    {
+        logError("socket %d: invalid compact header %02x %02x", sockFd, buf[0], buf[1]);
+        return(ERR_SOCK_DISC);
+    }
+    len = buf[1];
+    if (recv(sockFd, buf, len, MSG_WAITALL) != len)
+    {
+        logError("socket %d: compact header truncated", sockFd);
+        return(ERR_SOCK_DISC);
+    }
+
+    memset(hdr, 0, sizeof(svsSocketMsgHeader_t));
+    memcpy(hdr->appName, svsSocketWire[sockFd].appName, SVS_SOCKET_MSG_APPNAME_MAX);
+    hdr->module_id = buf[pos++];
+    for (i=0; i<5; i++)
+    {
+        if (svsSocketVarintGet(buf, len, &pos, &value[i]) != ERR_PASS)
+        {
+            logError("socket %d: invalid compact header field %d", sockFd, i);
+            return(ERR_SOCK_DISC);
+        }
+    }
+    hdr->dev_num    = (uint16_t)value[0];
+    hdr->len        = (uint16_t)value[1];
+    hdr->seq        = (uint32_t)value[2];
+    hdr->tsent_ms   = (int64_t)((value[3] >> 1) ^ -(value[3] & 1));
+    hdr->timeout_ms = (int64_t)((value[4] >> 1) ^ -(value[4] & 1));
+    if ((pos >= len) || (buf[pos] > sizeof(hdr->u)) || (pos + 1 + buf[pos] != len))
+    {
+        logError("socket %d: invalid compact module header", sockFd);
+        return(ERR_SOCK_DISC);
+    }
+    memcpy(&hdr->u, &buf[pos + 1], buf[pos]);
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Called by a client right after connecting: offers the compact header and sends the application name once.
+// The request is sent with the full header, a server that does not know it rejects or drops it and the connection
+// keeps the full header. Its module header is filled with values no handler accepts.
+// An answer in time is acknowledged with the full header, both ends use the compact one after that. Without the
+// acknowledgement the server keeps the full header, a late answer cannot leave the two ends with different formats.
+// The server sends nothing else before the acknowledgement, the connection is not used yet.
+//
+static int svsSocketWireHello(int sockFd)
+{
+    int                     rc;
+    uint8_t                 version = svsSocketWireVersion;
+    uint8_t                 rsp[SVS_SOCKET_MSG_PAYLOAD_MAX];
+    svsSocketMsgHeader_t    req;
+    svsSocketMsgHeader_t    hdr;
+
+    memset(&req, 0, sizeof(req));
+    snprintf(req.appName, sizeof(req.appName), "%s", svsAppNameGet());
+    req.module_id = MODULE_ID_WIRE;
+    req.seq       = svsSocketSeqNext();
+    req.len       = sizeof(version);
+    memset(&req.u, 0x7f, sizeof(req.u));
+
+    rc = svsSocketSend(sockFd, &req, &version);
+    if (rc != ERR_PASS)
+    {
+        return(rc);
+    }
+
+    rc = svsSocketRecvMsgDeadline(sockFd, svsTimeGet_ms() + SVS_SOCKET_WIRE_HELLO_TIMEOUT_MS, &hdr, rsp, sizeof(rsp));
+    if ((rc == ERR_PASS) && (hdr.module_id == MODULE_ID_WIRE) && (hdr.len >= 1) && (rsp[0] == SVS_SOCKET_WIRE_V1))
+    {   // the acknowledgement is the same request, still with the full header
+        rc = svsSocketSend(sockFd, &req, &version);
+        if (rc != ERR_PASS)
+        {
+            return(rc);
+        }
+        memcpy(svsSocketWire[sockFd].appName, hdr.appName, SVS_SOCKET_MSG_APPNAME_MAX);
+        svsSocketWire[sockFd].appName[SVS_SOCKET_MSG_APPNAME_MAX - 1] = '\0';
+        svsSocketWire[sockFd].version = SVS_SOCKET_WIRE_V1;
+        return(ERR_PASS);
+    }
+    if (rc == ERR_SOCK_DISC)
+    {
+        return(rc);
+    }
+    // an answer of an older server is consumed here, the late ones are dropped like the late responses
+    logInfo("socket %d: compact header not supported by the server, using the full header", sockFd);
+
+    return(ERR_NOT_IMPLEMENTED);
+}
+
+//
+// Description:
+// Server side of svsSocketWireHello(), the answer is sent with the full header. The compact one is used in both
+// directions once the client sent the same request again to acknowledge the answer, it is not answered.
+//
+static int svsSocketWireAccept(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    int     rc;
+    uint8_t version = SVS_SOCKET_WIRE_LEGACY;
+
+    if ((sockFd >= SVS_SOCKET_WIRE_FD_MAX) || (hdr->len < 1) || (payload == 0))
+    {
+        logWarning("socket %d: invalid header negotiation", sockFd);
+    }
+    else if (svsSocketWire[sockFd].offered)
+    {   // acknowledgement, the next messages in both directions use the compact header
+        svsSocketWire[sockFd].offered = 0;
+        svsSocketWire[sockFd].version = SVS_SOCKET_WIRE_V1;
+        logDebug("socket %d: %s uses the compact header", sockFd, svsSocketWire[sockFd].appName);
+        return(ERR_PASS);
+    }
+    else
+    {
+        memcpy(svsSocketWire[sockFd].appName, hdr->appName, SVS_SOCKET_MSG_APPNAME_MAX);
+        svsSocketWire[sockFd].appName[SVS_SOCKET_MSG_APPNAME_MAX - 1] = '\0';
+        if (payload[0] == SVS_SOCKET_WIRE_V1)
+        {
+            version = SVS_SOCKET_WIRE_V1;
+        }
+    }
+
+    snprintf(hdr->appName, sizeof(hdr->appName), "%s", svsAppNameGet());
+    hdr->len = sizeof(version);
+    rc = svsSocketSend(sockFd, hdr, &version);
+    if ((rc == ERR_PASS) && (version == SVS_SOCKET_WIRE_V1))
+    {   // the client may have given up waiting for the answer, it keeps the full header then
+        svsSocketWire[sockFd].offered = 1;
+    }
+
+    return(rc);
+}
+
+//
+// Description:
+// Sends a message without taking the shared send lock.
+// Only for sockets written by a single thread, such as the callback subscriber writers, so a
+// peer that stops reading cannot hold up the senders on the other sockets.
+//
+int svsSocketSendUnlocked(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
 {
     int rc = ERR_PASS;
-    int flag, len;
-    uint32_t static seq = 1;
+    int flag, len, hdr_len;
+    uint8_t hdr_buf[SVS_SOCKET_WIRE_HDR_MAX];
+    uint8_t *hdr_data;
 
     if (hdr == 0)
     {
         logError("hdr null");
         rc = ERR_FAIL;
-        goto _svsSocketSend;
+        goto _svsSocketSendUnlocked;
     }
 
     if (hdr->len > SVS_SOCKET_MSG_PAYLOAD_MAX)
     {
         logError("payload length out of range %d", hdr->len);
         rc = ERR_FAIL;
-        goto _svsSocketSend;
+        goto _svsSocketSendUnlocked;
     }
 
     if (hdr->len == 0)
@@ -1147,13 +2283,19 @@ int svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
 
     if ((hdr->seq == 0) && (hdr->module_id == MODULE_ID_BDP))
     {
-        hdr->seq = seq;
-        seq++;
+        hdr->seq = svsSocketSeqNext();
+    }
+
+    if (SVS_SHM_FD(sockFd))
+    {   // shared memory link set up on a socket, see svsShm.c
+        rc = svsShmSend(sockFd, hdr, payload);
+        goto _svsSocketSendUnlocked;
     }
     //logDebug("sending module %d seq %d", hdr->module_id, hdr->seq);
 
     // First send the header, but hold OFF with MSG_MORE only if payload length is not 0
-    len = send(sockFd, hdr, sizeof(svsSocketMsgHeader_t), flag);
+    hdr_len = svsSocketWireHdrEncode(sockFd, hdr, hdr_buf, &hdr_data);
+    len = send(sockFd, hdr_data, hdr_len, flag);
     if (len < 0)
     {
         logError("send1: sockFd %d %s", sockFd, strerror(errno));
@@ -1161,15 +2303,15 @@ int svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
             rc = ERR_SOCK_DISC;
         else
             rc = ERR_FAIL;
-        goto _svsSocketSend;
+        goto _svsSocketSendUnlocked;
     }
     else
     {
-        if (len != sizeof(svsSocketMsgHeader_t))
+        if (len != hdr_len)
         {
             logError("header partially sent %d",  len);
             rc = ERR_FAIL;
-            goto _svsSocketSend;
+            goto _svsSocketSendUnlocked;
         }
     }
     // Next send the payload
@@ -1202,7 +2344,43 @@ int svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
         }
     }
 
-    _svsSocketSend:
+    _svsSocketSendUnlocked:
+
+    return(rc);
+}
+
+static void svsSocketSendMutexInit(void)
+{
+    int i;
+
+    for (i = 0; i < SVS_SOCKET_WIRE_FD_MAX; i++)
+    {
+        pthread_mutex_init(&svsSocketSendMutex[i], 0);
+    }
+}
+
+int svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    int rc;
+    pthread_mutex_t *mutex;
+
+    if (SVS_SHM_FD(sockFd))
+    {   // a message is written at once in the ring, under the lock of the link
+        return(svsSocketSendUnlocked(sockFd, hdr, payload));
+    }
+
+    // several threads may send on the same socket, the header and the payload must not be interleaved
+    // each socket has its own lock so that a peer not reading its socket does not block the others
+    pthread_once(&svsSocketSendOnce, svsSocketSendMutexInit);
+    if ((sockFd >= 0) && (sockFd < SVS_SOCKET_WIRE_FD_MAX))
+        mutex = &svsSocketSendMutex[sockFd];
+    else
+        mutex = &mutexSocketSend;
+    pthread_mutex_lock(mutex);
+
+    rc = svsSocketSendUnlocked(sockFd, hdr, payload);
+
+    pthread_mutex_unlock(mutex);
 
     return(rc);
 }
@@ -16,6 +16,16 @@
 
 #define SVS_SOCKET_MSG_PAYLOAD_MAX     (1024)
 #define SVS_SOCKET_MSG_APPNAME_MAX     (32)
+#define SVS_SOCKET_MUX_WAITER_MAX      (64)         // maximum number of requests in flight on a multiplexed client socket
+#define SVS_SOCKET_MUX_TICK_MS         (50)         // period at which the asynchronous request deadlines are checked
+#define SVS_SOCKET_MUX_PUMP_MS         (5)          // poll period of the receiver thread while it waits for a response itself
+#define SVS_SOCKET_RECONNECT_MIN_MS    (100)        // delay before the second attempt to reconnect to a server
+#define SVS_SOCKET_RECONNECT_MAX_MS    (5000)       // the delay doubles after each failed attempt up to this value
+#define SVS_SOCKET_WIRE_LEGACY         (0)          // the whole svsSocketMsgHeader_t is sent with each message
+#define SVS_SOCKET_WIRE_V1             (0xa1)       // compact header, see svsSocketWireHdrEncode()
+#define SVS_SOCKET_WIRE_FD_MAX         (1024)       // FD_SETSIZE, the servers select() on their sockets
+#define SVS_SOCKET_WIRE_HDR_MAX        (64)         // longest compact header
+#define SVS_SOCKET_WIRE_HELLO_TIMEOUT_MS (200)      // a server without compact header support does not answer
 
 typedef enum
 {
@@ -38,7 +48,7 @@ typedef struct
     uint8_t     module_id;          // module ID needed to select appropriate header union below
     uint16_t    dev_num;            // device number
     uint16_t    len;                // payload length
-    uint32_t    seq;                // sequence number (internally used within SVSD to track/debug socket frames)
+    uint32_t    seq;                // sequence number, echoed by the server in the response to route it to the waiting request
     int64_t     tsent_ms;           // time message sent
     int64_t     timeout_ms;         // timeout value in ms associated with sending and receiving a message to a device
     union
@@ -57,9 +67,58 @@ typedef struct
     uint8_t                 payload[SVS_SOCKET_MSG_PAYLOAD_MAX];
 } svsSocketMsg_t;
 
+typedef struct
+{   // header format used on a connection, negotiated when it is set up
+    uint8_t                 version;    // SVS_SOCKET_WIRE_xxx
+    uint8_t                 offered;    // server side, compact header answered, used once the client acknowledged it
+    char                    appName[SVS_SOCKET_MSG_APPNAME_MAX];    // name of the peer, not repeated in the compact header
+} svs_socket_wire_t;
+
 typedef int (* msg_hdlr_fn_t)(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+
+// called by the receiver thread with the result of an asynchronous request, hdr is 0 when no response was received
+typedef void (* svs_socket_done_fn_t)(void *arg, int rc, svsSocketMsgHeader_t *hdr);
+
+typedef struct
+{   // a request waiting for its response on a multiplexed client socket
+    uint32_t                seq;        // sequence number of the request, 0 when the slot is free
+    uint8_t                 done;       // 1 when the response was received
+    int                     rc;         // status of the response
+    svsSocketMsgHeader_t    hdr;        // header of the response
+    uint8_t                 *rsp;       // response payload buffer
+    uint16_t                rsp_len;    // response payload buffer length
+    pthread_cond_t          cond;       // signaled when the response is received
+    int64_t                 tend_ms;    // deadline of an asynchronous request
+    svs_socket_done_fn_t    fn;         // set for an asynchronous request, called instead of signaling cond
+    void                    *arg;       // argument passed to fn
+} svs_socket_waiter_t;
+
+typedef struct
+{   // reconnection state of a client socket, the attempts are spaced with an exponential backoff
+    int64_t                 tnext_ms;   // earliest time of the next attempt
+    int                     delay_ms;   // delay added after the next failed attempt
+} svs_socket_reconnect_t;
+
+typedef struct
+{   // client socket shared by all the threads of an application, responses are routed by sequence number
+    char                    *name;      // name used in the logs
+    int                     sockFd;     // client socket FD, -1 while reconnecting
+    int                     port;       // server port, used to reconnect
+    uint8_t                 running;    // 1 while connected
+    uint8_t                 stop;       // set to stop the receiver thread instead of reconnecting, under mutex
+    int                     wakeFd[2];  // pipe written when stopped, wakes up the receiver thread wherever it waits
+    pthread_mutex_t         *mutexSend; // held by the senders, the socket is replaced under it
+    void                    (* fdSet)(int sockFd);  // publishes the new socket to the application
+    int                     shmFd;      // shared memory link carrying the requests instead of the socket, 0 when none
+    msg_hdlr_fn_t           fnShm;      // receives the responses from the shared memory link
+    pthread_t               thread;     // receiver thread
+    pthread_mutex_t         mutex;      // protects the waiters
+    svs_socket_waiter_t     waiter[SVS_SOCKET_MUX_WAITER_MAX];
+} svs_socket_mux_t;
+
 typedef int (* msg_dev_hdlr_fn_t)(int devFd);
 typedef void *(* thread_fn_t)(void *arg);
+typedef int (* msg_stream_fn_t)(uint8_t *payload, uint16_t len, void *arg);
 
 typedef struct
 {
@@ -77,6 +136,7 @@ typedef struct
     uint8_t             *payload;   // payload buffer when receiving data from client
     uint16_t            len_max;    // maximum payload buffer length
     uint8_t             cbserver;   // when set to 1 identifies the callback server thread
+    void                (* fnClose)(int sockFd);    // called before a client socket is closed, 0 if not used
 } socket_thread_info_t;
 
 extern void *svsSocketServerThread(void *arg);
@@ -102,23 +162,35 @@ int svsSocketServerCreateBdp(void);
 int svsSocketServerDestroyBdp(void);
 
 int svsSocketClientCreate(char *ipAddr, int port, int *sockFd, uint8_t appflag);
+int svsSocketReconnect(svs_socket_reconnect_t *rec, int port, uint8_t appflag, int *sockFd);
 int svsSocketServerCreate(socket_thread_info_t *thread_info);
 int svsSocketServerDestroy(socket_thread_info_t *thread_info);
 int svsSocketClientDestroy(int socketFd);
 
 int svsSocketRecvMsg(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload, uint16_t len);
+int svsSocketRecvMsgDeadline(int sockFd, int64_t tend_ms, svsSocketMsgHeader_t *hdr, uint8_t *payload, uint16_t len_max);
 int svsSocketSend(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+int svsSocketSendUnlocked(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *payload);
+uint32_t svsSocketSeqNext(void);
+
+void svsSocketWireVersionSet(uint8_t version);
+int svsSocketWireHdrEncode(int sockFd, svsSocketMsgHeader_t *hdr, uint8_t *buf, uint8_t **data);
+
+int svsSocketMuxCreate(svs_socket_mux_t *mux, char *name, int port, int sockFd, pthread_mutex_t *mutexSend, void (* fdSet)(int));
+int svsSocketMuxDestroy(svs_socket_mux_t *mux);
 
-int svsSocketSendBdp(int sockFd, uint16_t msg_id, uint16_t dev_num, int timeout_client_ms, int timeout_ms, uint8_t flags, callback_fn_t callback, uint8_t *payload, uint16_t len);
-int svsSocketSendKr(int sockFd, uint16_t msg_id, uint16_t dev_num, int timeout_ms, uint8_t flags, uint8_t *payload, uint16_t len);
+int svsSocketSendBdp(int sockFd, uint32_t seq, uint16_t msg_id, uint16_t dev_num, int timeout_client_ms, int timeout_ms, uint8_t flags, callback_fn_t callback, uint8_t *payload, uint16_t len);
+int svsSocketSendKr(int sockFd, uint32_t seq, uint16_t msg_id, uint16_t dev_num, int timeout_ms, uint8_t flags, uint8_t *payload, uint16_t len);
 int svsSocketSendLog(int sockFd, log_verbosity_t verbosity, uint8_t *payload, uint16_t len);
 int svsSocketSendCallback(int sockFd, uint8_t module_id, uint16_t dev_num, uint16_t msg_id, callback_fn_t callback, uint8_t *payload, uint16_t len);
-int svsSocketSendSvs(int sockFd, uint16_t msg_id, uint16_t dev_num, uint8_t *payload, uint16_t len);
+int svsSocketSendSvs(int sockFd, uint32_t seq, uint16_t msg_id, uint16_t dev_num, uint8_t *payload, uint16_t len);
 
 int svsSocketServerSvsTransfer(int sockFd, module_id_t module_id, uint16_t dev_num, uint16_t msgID, int timeout_ms, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len);
 int svsSocketServerSvsTransferSafe(uint16_t dev_num, svs_msg_id_t msg_id, int timeout_ms, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len);
+int svsSocketServerSvsStreamTransferSafe(uint16_t dev_num, svs_msg_id_t msg_id, int timeout_ms, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len, msg_stream_fn_t fn, void *arg);
 
 int svsSocketServerBdpTransferSafe(uint16_t dev_num, bdp_msg_id_t msg_id, blocking_t blocking, int timeout_ms, uint8_t flags, callback_fn_t callback, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len);
+int svsSocketServerBdpTransferAsync(uint16_t dev_num, bdp_msg_id_t msg_id, int timeout_ms, uint8_t flags, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len, svs_socket_done_fn_t fn, void *arg);
 int svsSocketServerKrTransferSafe(uint16_t dev_num, kr_msg_id_t msg_id, int timeout_ms, uint8_t flags, uint8_t *req_payload, uint16_t req_len, uint8_t *rsp_payload, uint16_t rsp_len);
 
 #endif // SVS_SOCKET_H
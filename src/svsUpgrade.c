@@ -55,8 +55,13 @@
 
 #define SWU_MANAGER_DAEMON_NAME "/usr/scu/bin/upgrademanager"
 
+#define PROGRESS_THREAD_SELECT_TIMEOUT_SECS 1
+
 int upgradeManagerCmdSocket = -1;
 
+static int bUpgradeProgressMode = 0;
+static pthread_t upgradeProgressThreadId;
+
 svs_err_t swu_err[] =
 {
     UPGRADE_ERROR_STR
@@ -324,6 +329,7 @@ static int sendUpgradeManagerCommand(
         break;
 
         case UPGRADE_MANAGER_EXIT:
+        case UPGRADE_MANAGER_STATION_UP:
             pUpgradeMgrCmd->command = cmd;
         break;
 
@@ -384,6 +390,147 @@ static int openTCPConnectionToUpgradeManager(void)
 }
 
 
+/*********************************************************
+ * NAME:   upgradeProgressThread()
+ * DESCRIPTION: Thread function that forwards the USB
+ *              upgrade progress notifications received from
+ *              the Upgrade Manager to the MODULE_ID_UPGRADE
+ *              callbacks.
+ *
+ * IN:   arg - Not used.
+ * OUT: void pointer to the passed in arg pointer.
+ *********************************************************/
+static void *upgradeProgressThread(void *arg)
+{
+    swu_connection_type_t connectionType = swu_Async;
+    int dataLength = sizeof(swu_Async);
+    int upgradeManagerAsyncSocket;
+    int upgradeManagerCBSocket = -1;
+    int rc;
+
+    upgradeManagerAsyncSocket = openTCPConnectionToUpgradeManager();
+    if (upgradeManagerAsyncSocket >= 0)
+    {
+        /* Register our socket with the upgrade manager */
+        sendUpgradeManagerCommand(upgradeManagerAsyncSocket, UPGRADE_MANAGER_CONN_TYPE, dataLength, &connectionType);
+    }
+
+    /*
+     * Create the callback client, this will send the messages
+     * to the callback server.
+     */
+    rc = svsSocketClientCreateCallback(&upgradeManagerCBSocket, 0);
+    if (rc)
+    {
+        logError("[%s] failed to create callback", __func__);
+        if (upgradeManagerAsyncSocket >= 0)
+        {
+            close(upgradeManagerAsyncSocket);
+        }
+        return arg;
+    }
+
+    /* While thread is alive process async notifications from Upgrade Manager */
+    while (bUpgradeProgressMode)
+    {
+        struct timeval selectTimeout;
+        fd_set read_fds;
+        int status;
+        swu_upgradeUsbProgress_t theProgressMsg;
+        int dataSize;
+        int received;
+
+        if (upgradeManagerAsyncSocket < 0)
+        {
+            sleep(1);
+            /*
+             * Try to reconnect, in case the Upgrade Manager dropped and
+             * has restarted.
+             */
+            upgradeManagerAsyncSocket = openTCPConnectionToUpgradeManager();
+            if (upgradeManagerAsyncSocket >= 0)
+            {
+                /* Register with the upgrade manager */
+                sendUpgradeManagerCommand(upgradeManagerAsyncSocket, UPGRADE_MANAGER_CONN_TYPE, dataLength, &connectionType);
+            }
+            continue;
+        }
+
+        FD_ZERO(&read_fds);
+        FD_SET(upgradeManagerAsyncSocket, &read_fds);
+
+        /* Always reset the timeout value here. */
+        selectTimeout.tv_sec = PROGRESS_THREAD_SELECT_TIMEOUT_SECS;
+        selectTimeout.tv_usec = 0;
+
+        status = select(upgradeManagerAsyncSocket + 1, &read_fds, (fd_set *)0, (fd_set *)0, &selectTimeout);
+        if (status < 0)
+        {
+            if ((errno == EBADF) && (fcntl(upgradeManagerAsyncSocket, F_GETFL) < 0))
+            {
+                /* File descriptor is bad...probably disconnected. */
+                close(upgradeManagerAsyncSocket);
+                upgradeManagerAsyncSocket = -1;
+            }
+            continue;
+        }
+
+        if (status == 0)
+        {
+            /* select() timeout happened. */
+            continue;
+        }
+
+        /*
+         * A progress message can arrive in more than one segment, keep
+         * reading until the whole structure is in so later messages
+         * stay aligned with the stream.
+         */
+        received = 0;
+        rc = 0;
+        while (received < (int)sizeof(theProgressMsg))
+        {
+            dataSize = sizeof(theProgressMsg) - received;
+            rc = recvTCPBuffer(&upgradeManagerAsyncSocket, (uint8_t *)&theProgressMsg + received, &dataSize);
+            if (rc)
+            {
+                break;
+            }
+            received += dataSize;
+        }
+
+        if (rc)
+        {
+            logError("[%s] progress recv error", __func__);
+            if (upgradeManagerAsyncSocket >= 0)
+            {
+                /* Partial message lost, resync on a new connection. */
+                close(upgradeManagerAsyncSocket);
+                upgradeManagerAsyncSocket = -1;
+            }
+            continue;
+        }
+
+        if (theProgressMsg.swuResult.command == UPGRADE_MANAGER_USB_PROGRESS)
+        {
+            rc = svsSocketSendCallback(upgradeManagerCBSocket, MODULE_ID_UPGRADE, 0, 0, NULL,
+                                       (uint8_t *)&theProgressMsg, sizeof(theProgressMsg));
+            if (rc != ERR_PASS)
+            {
+                logError("[%s] svsSocketSendCallback failed", __func__);
+            }
+        }
+    }
+
+    if (upgradeManagerAsyncSocket >= 0)
+    {
+        close(upgradeManagerAsyncSocket);
+    }
+    svsSocketClientDestroyCallback(upgradeManagerCBSocket);
+
+    return arg;
+}
+
 /*********************************************************
  *   NAME: svsSWUServerInit
  *   DESCRIPTION: Called when application starts.  Forks a
@@ -441,9 +588,50 @@ int svsSWUServerInit(void)
         return -1;
     }
 
+    /* Forward the USB upgrade progress to the applications */
+    bUpgradeProgressMode = 1;
+    nRetVal = pthread_create(&upgradeProgressThreadId, NULL, upgradeProgressThread, NULL);
+    if (nRetVal)
+    {
+        bUpgradeProgressMode = 0;
+        return -1;
+    }
+
     return nRetVal;
 }
 
+/*********************************************************
+ *   NAME: svsSWUStationUp
+ *   DESCRIPTION: Called once all the server modules are up,
+ *               tells the Upgrade Manager the station is up
+ *               so it can end the trial of a new release.
+ *   IN: Nothing.
+ *   OUT:  Success (0) or negative error code.
+ *
+ **********************************************************/
+int svsSWUStationUp(void)
+{
+    swu_upgradeMgrResult_t UpgradeMgrResult;
+    unsigned char commandData[32];
+    int rc;
+    int dataSize;
+
+    rc = sendUpgradeManagerCommand(upgradeManagerCmdSocket, UPGRADE_MANAGER_STATION_UP, 0, commandData);
+    if (rc < 0)
+    {
+        return -1;
+    }
+
+    dataSize = sizeof(swu_upgradeMgrResult_t);
+    rc = recvUpgradeManagerResult(&upgradeManagerCmdSocket, &UpgradeMgrResult, &dataSize);
+    if (rc)
+    {
+        return -1;
+    }
+
+    return ERR_PASS;
+}
+
 /* Kill off the Upgrade Manager, we are finished with it. */
 /*********************************************************
  *   NAME: svsSWUServerUninit
@@ -461,6 +649,13 @@ int svsSWUServerUninit(void)
     int rc;
     int dataSize;
 
+    /* Stop the progress thread, it exits on its next select() timeout */
+    if (bUpgradeProgressMode)
+    {
+        bUpgradeProgressMode = 0;
+        pthread_join(upgradeProgressThreadId, NULL);
+    }
+
     rc = sendUpgradeManagerCommand(upgradeManagerCmdSocket, UPGRADE_MANAGER_EXIT, 0, commandData);
     if (rc < 0)
     {
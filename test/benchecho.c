@@ -0,0 +1,73 @@
+//
+// Round trip of svsBdpEcho through the TCP socket or the shared memory rings. The simulated bus is
+// infinitely fast and the BDPs answer right away, what remains is the transport between the
+// application and svsd and the frame manager of svsd.
+//
+// usage: benchecho [tcp|shm] [requests]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsApi.h>
+#include <svsShm.h>
+#include <libSVS.h>
+
+#include "svssim.h"
+
+int main(int argc, char *argv[])
+{
+    int shm   = (argc > 1) && (strcmp(argv[1], "shm") == 0);
+    int cnt   = (argc > 2) ? atoi(argv[2]) : 2000;
+    int64_t *rtt_us;
+    int64_t t_us;
+    sim_cfg_t cfg;
+    bdp_echo_t echo;
+    svs_err_t *err;
+    int i, failed = 0;
+    pid_t pid;
+
+    simCfgDefault(&cfg);
+    cfg.docks         = 2;
+    cfg.byte_us       = 0;
+    cfg.turnaround_us = 0;
+    pid = simStart(&cfg);
+    if(pid < 0)
+    {
+        return(1);
+    }
+    svsShmEnableSet(shm);
+    if(simAppInit("benchecho") != ERR_PASS)
+    {
+        simStop(pid);
+        return(1);
+    }
+
+    rtt_us = calloc(cnt, sizeof(int64_t));
+    for(i = 0; i < cnt; i++)
+    {
+        memset(&echo, 0, sizeof(echo));
+        memset(echo.payload, i, sizeof(echo.payload));
+        echo.bdp_num = i % cfg.docks;
+        t_us = simTimeUs();
+        err = svsBdpEcho(&echo, 1000);
+        rtt_us[i] = simTimeUs() - t_us;
+        if(err->code != ERR_PASS)
+        {
+            failed++;
+        }
+    }
+
+    printf("benchecho: %s, %d requests of %d bytes, %d failed, round trip us p50 %lld p99 %lld\n",
+           shm ? "shared memory" : "tcp", cnt, BDP_ECHO_PAYLOAD_MAX, failed,
+           (long long)simPercentile(rtt_us, cnt, 50), (long long)simPercentile(rtt_us, cnt, 99));
+    fflush(stdout);
+    simStop(pid);
+    free(rtt_us);
+
+    return(failed != 0);
+}
@@ -0,0 +1,77 @@
+//
+// Frames on the wire: an application echoes 255 bytes to two simulated BDPs, one per bus, and reads
+// their switches. The BDPs record for every frame written by svsd the time between its first and
+// its last byte and the number of reads it arrived in, a frame written in several pieces shows
+// the pauses a BDP would see as a frame break on the RS485 bus.
+//
+// usage: benchframe [requests]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsApi.h>
+#include <libSVS.h>
+
+#include "svssim.h"
+
+int main(int argc, char *argv[])
+{
+    int cnt = (argc > 1) ? atoi(argv[1]) : 2000;
+    int64_t *rtt_us;
+    int64_t t_us;
+    sim_cfg_t cfg;
+    bdp_echo_t echo;
+    bdp_switch_t sw;
+    svs_err_t *err;
+    int i, failed = 0;
+    pid_t pid;
+
+    simCfgDefault(&cfg);
+    cfg.docks = 2;
+    pid = simStart(&cfg);
+    if(pid < 0)
+    {
+        return(1);
+    }
+    if(simAppInit("benchframe") != ERR_PASS)
+    {
+        simStop(pid);
+        return(1);
+    }
+
+    rtt_us = calloc(cnt, sizeof(int64_t));
+    for(i = 0; i < cnt; i++)
+    {
+        t_us = simTimeUs();
+        if(i & 1)
+        {
+            memset(&sw, 0, sizeof(sw));
+            sw.bdp_num = (i / 2) % cfg.docks;
+            err = svsBdpSwitchGet(&sw, BLOCKING_ON, 1000, 0);
+        }
+        else
+        {
+            memset(&echo, i, sizeof(echo));
+            echo.bdp_num = (i / 2) % cfg.docks;
+            err = svsBdpEcho(&echo, 1000);
+        }
+        rtt_us[i] = simTimeUs() - t_us;
+        if((err == 0) || (err->code != ERR_PASS))
+        {
+            failed++;
+        }
+    }
+
+    printf("benchframe: %d requests, %d failed, round trip us p50 %lld p99 %lld\n", cnt, failed,
+           (long long)simPercentile(rtt_us, cnt, 50), (long long)simPercentile(rtt_us, cnt, 99));
+    fflush(stdout);
+    simStop(pid);
+    free(rtt_us);
+
+    return(failed != 0);
+}
@@ -0,0 +1,155 @@
+//
+// Station-wide status sweep: the green LED is set, the switches and the bike RFID are read on every
+// BDP of a simulated station with the asynchronous API, as many requests in flight as the client
+// socket allows. The requests are issued BDP after BDP, the three requests of a BDP are only sent
+// together to the bus when the "bdp/window" configuration allows it.
+//
+// usage: benchsweep [window] [docks] [sweeps]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsApi.h>
+#include <svsSocket.h>
+#include <libSVS.h>
+
+#include "svssim.h"
+
+#define SWEEP_MSG_CNT       3       // requests per BDP
+#define SWEEP_TIMEOUT_MS    2000
+
+typedef struct
+{
+    bdp_led_t       led;
+    bdp_switch_t    sw;
+    bdp_rfid_t      rfid;
+} sweep_dock_t;
+
+static sweep_dock_t sweep_dock[BDP_MAX];
+
+static svs_err_t *sweepSend(int req, svs_future_t **future)
+{
+    sweep_dock_t *dock = &sweep_dock[req / SWEEP_MSG_CNT];
+    uint16_t bdp_num = req / SWEEP_MSG_CNT;
+
+    switch(req % SWEEP_MSG_CNT)
+    {
+        case 0:
+            memset(&dock->led, 0, sizeof(dock->led));
+            dock->led.bdp_num       = bdp_num;
+            dock->led.bdp_led_color = BDP_LED_COLOR_GREEN;
+            dock->led.bdp_led_state = BDP_LED_STATE_ON;
+            return(svsBdpLedSetAsync(&dock->led, SWEEP_TIMEOUT_MS, future));
+
+        case 1:
+            memset(&dock->sw, 0, sizeof(dock->sw));
+            dock->sw.bdp_num = bdp_num;
+            return(svsBdpSwitchGetAsync(&dock->sw, SWEEP_TIMEOUT_MS, future));
+
+        default:
+            memset(&dock->rfid, 0, sizeof(dock->rfid));
+            dock->rfid.bdp_num     = bdp_num;
+            dock->rfid.rfid_reader = BDP_RFID_READER_BIKE;
+            return(svsBdpRfidGetAsync(&dock->rfid, SWEEP_TIMEOUT_MS, future));
+    }
+}
+
+//
+// Description:
+// One sweep, returns the number of requests that failed.
+//
+static int sweepRun(int docks)
+{
+    svs_future_t *future[SVS_SOCKET_MUX_WAITER_MAX];
+    int req_cnt = docks * SWEEP_MSG_CNT;
+    int req = 0, done = 0, failed = 0;
+    svs_err_t *err;
+    int i;
+
+    memset(future, 0, sizeof(future));
+    while(done < req_cnt)
+    {
+        // keep every slot of the client socket busy
+        for(i = 0; (i < SVS_SOCKET_MUX_WAITER_MAX) && (req < req_cnt); i++)
+        {
+            if(future[i] == 0)
+            {
+                err = sweepSend(req++, &future[i]);
+                if(err->code != ERR_PASS)
+                {
+                    future[i] = 0;
+                    failed++;
+                    done++;
+                }
+            }
+        }
+        if(done >= req_cnt)
+        {
+            break;
+        }
+
+        err = svsFutureWaitAny(future, SVS_SOCKET_MUX_WAITER_MAX, SWEEP_TIMEOUT_MS * 2, &i);
+        if(err->code == ERR_TIMEOUT)
+        {
+            fprintf(stderr, "benchsweep: no response\n");
+            return(failed + req_cnt - done);
+        }
+        if(err->code != ERR_PASS)
+        {
+            failed++;
+        }
+        svsFutureRelease(future[i]);
+        future[i] = 0;
+        done++;
+    }
+
+    return(failed);
+}
+
+int main(int argc, char *argv[])
+{
+    int window = (argc > 1) ? atoi(argv[1]) : 1;
+    int docks  = (argc > 2) ? atoi(argv[2]) : 64;
+    int sweeps = (argc > 3) ? atoi(argv[3]) : 20;
+    int64_t *sweep_us;
+    int64_t t_us;
+    sim_cfg_t cfg;
+    int i, failed = 0;
+    pid_t pid;
+
+    simCfgDefault(&cfg);
+    cfg.docks  = MIN(docks, BDP_MAX);
+    cfg.window = window;
+    pid = simStart(&cfg);
+    if(pid < 0)
+    {
+        return(1);
+    }
+    if(simAppInit("benchsweep") != ERR_PASS)
+    {
+        simStop(pid);
+        return(1);
+    }
+
+    sweep_us = calloc(sweeps, sizeof(int64_t));
+    for(i = 0; i < sweeps; i++)
+    {
+        t_us = simTimeUs();
+        failed += sweepRun(cfg.docks);
+        sweep_us[i] = simTimeUs() - t_us;
+    }
+
+    printf("benchsweep: window %d, %d BDPs, %d sweeps of %d requests, %d failed, sweep ms p50 %lld max %lld\n",
+           window, cfg.docks, sweeps, cfg.docks * SWEEP_MSG_CNT, failed,
+           (long long)simPercentile(sweep_us, sweeps, 50) / 1000, (long long)simPercentile(sweep_us, sweeps, 100) / 1000);
+    fflush(stdout);
+    simStop(pid);
+    free(sweep_us);
+
+    return(failed != 0);
+}
@@ -0,0 +1,149 @@
+//
+// System calls per API call. strace is not available on the station nor in every build
+// environment, the socket and timing functions of the C library are wrapped at link time instead
+// (see the Makefile) and counted in every thread of the application, the receiver threads included.
+// The simulated svsd runs in a child process, its own calls are not counted.
+//
+// usage: benchsyscall [calls]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsApi.h>
+#include <libSVS.h>
+
+#include "svssim.h"
+
+typedef enum
+{
+    SYSCALL_SEND,
+    SYSCALL_RECV,
+    SYSCALL_POLL,
+    SYSCALL_SELECT,
+    SYSCALL_SETSOCKOPT,
+    SYSCALL_READ,
+    SYSCALL_WRITE,
+    SYSCALL_USLEEP,
+    SYSCALL_MAX
+} syscall_id_t;
+
+static const char *syscall_name[SYSCALL_MAX] = { "send", "recv", "poll", "select", "setsockopt", "read", "write", "usleep" };
+static uint32_t syscall_cnt[SYSCALL_MAX];
+
+#define SYSCALL_COUNT(id)   __sync_fetch_and_add(&syscall_cnt[id], 1)
+
+ssize_t __real_send(int fd, const void *buf, size_t len, int flags);
+ssize_t __real_recv(int fd, void *buf, size_t len, int flags);
+int     __real_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+int     __real_select(int nfds, fd_set *rd, fd_set *wr, fd_set *ex, struct timeval *timeout);
+int     __real_setsockopt(int fd, int level, int name, const void *val, socklen_t len);
+ssize_t __real_read(int fd, void *buf, size_t len);
+ssize_t __real_write(int fd, const void *buf, size_t len);
+int     __real_usleep(useconds_t usec);
+
+ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags)     { SYSCALL_COUNT(SYSCALL_SEND); return(__real_send(fd, buf, len, flags)); }
+ssize_t __wrap_recv(int fd, void *buf, size_t len, int flags)           { SYSCALL_COUNT(SYSCALL_RECV); return(__real_recv(fd, buf, len, flags)); }
+int     __wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout)       { SYSCALL_COUNT(SYSCALL_POLL); return(__real_poll(fds, nfds, timeout)); }
+int     __wrap_select(int nfds, fd_set *rd, fd_set *wr, fd_set *ex, struct timeval *timeout)
+                                                                        { SYSCALL_COUNT(SYSCALL_SELECT); return(__real_select(nfds, rd, wr, ex, timeout)); }
+int     __wrap_setsockopt(int fd, int level, int name, const void *val, socklen_t len)
+                                                                        { SYSCALL_COUNT(SYSCALL_SETSOCKOPT); return(__real_setsockopt(fd, level, name, val, len)); }
+ssize_t __wrap_read(int fd, void *buf, size_t len)                      { SYSCALL_COUNT(SYSCALL_READ); return(__real_read(fd, buf, len)); }
+ssize_t __wrap_write(int fd, const void *buf, size_t len)               { SYSCALL_COUNT(SYSCALL_WRITE); return(__real_write(fd, buf, len)); }
+int     __wrap_usleep(useconds_t usec)                                  { SYSCALL_COUNT(SYSCALL_USLEEP); return(__real_usleep(usec)); }
+
+static int callAvailable(int i)
+{
+    uint16_t bdp_max;
+
+    return(svsBdpAvailableGet(&bdp_max));
+}
+
+static int callLog(int i)
+{
+    logInfo("benchsyscall line %d", i);
+    return(ERR_PASS);
+}
+
+static int callSwitch(int i)
+{
+    bdp_switch_t sw;
+    svs_err_t *err;
+
+    memset(&sw, 0, sizeof(sw));
+    sw.bdp_num = i & 1;
+    err = svsBdpSwitchGet(&sw, BLOCKING_ON, 1000, 0);
+    return(err->code);
+}
+
+static const struct
+{
+    const char  *name;
+    int         (*fn)(int i);
+} bench_call[] =
+{
+    { "svsBdpAvailableGet", callAvailable },
+    { "logInfo",            callLog },
+    { "svsBdpSwitchGet",    callSwitch },
+};
+
+int main(int argc, char *argv[])
+{
+    int cnt = (argc > 1) ? atoi(argv[1]) : 1000;
+    uint32_t before[SYSCALL_MAX];
+    uint32_t total;
+    sim_cfg_t cfg;
+    int c, i, id, failed;
+    pid_t pid;
+
+    simCfgDefault(&cfg);
+    cfg.docks = 2;
+    pid = simStart(&cfg);
+    if(pid < 0)
+    {
+        return(1);
+    }
+    if(simAppInit("benchsyscall") != ERR_PASS)
+    {
+        simStop(pid);
+        return(1);
+    }
+
+    for(c = 0; c < (int)(sizeof(bench_call) / sizeof(bench_call[0])); c++)
+    {
+        failed = 0;
+        memcpy(before, syscall_cnt, sizeof(before));
+        for(i = 0; i < cnt; i++)
+        {
+            if(bench_call[c].fn(i) != ERR_PASS)
+            {
+                failed++;
+            }
+        }
+
+        printf("benchsyscall: %-18s %d calls, %d failed, per call:", bench_call[c].name, cnt, failed);
+        total = 0;
+        for(id = 0; id < SYSCALL_MAX; id++)
+        {
+            if(syscall_cnt[id] != before[id])
+            {
+                printf(" %s %.2f", syscall_name[id], (double)(syscall_cnt[id] - before[id]) / cnt);
+                total += syscall_cnt[id] - before[id];
+            }
+        }
+        printf(", total %.2f\n", (double)total / cnt);
+    }
+    fflush(stdout);
+    simStop(pid);
+
+    return(0);
+}
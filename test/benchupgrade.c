@@ -0,0 +1,131 @@
+//
+// Firmware upgrade of the BDPs of a simulated station: one BDP after the other with
+// svsBdpFirmwareUpgrade() (serial), or all of them at once by the upgrade orchestrator of svsd with
+// svsBdpFirmwareUpgradeMany() (many). The bus runs at 115200 baud and a BDP writes each block to
+// its flash before it answers, see svssim.h.
+//
+// usage: benchupgrade [serial|many] [docks] [image KB] [window]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsApi.h>
+#include <svsBdp.h>
+#include <libSVS.h>
+
+#include "svssim.h"
+
+#define UPGRADE_IMAGE           SIM_DIR "/image.bin"
+#define UPGRADE_TIMEOUT_MS      2000
+
+static int upgradeImageWrite(int len)
+{
+    FILE *fp;
+    int i;
+
+    fp = fopen(UPGRADE_IMAGE, "w");
+    if(fp == 0)
+    {
+        perror(UPGRADE_IMAGE);
+        return(ERR_FAIL);
+    }
+    for(i = 0; i < len; i++)
+    {
+        fputc(rand() & 0xff, fp);
+    }
+    fclose(fp);
+
+    return(ERR_PASS);
+}
+
+static int upgradeSerial(int docks)
+{
+    bdp_firmware_upgrade_t data;
+    svs_err_t *err;
+    int i, failed = 0;
+
+    for(i = 0; i < docks; i++)
+    {
+        memset(&data, 0, sizeof(data));
+        data.bdp_num        = i;
+        data.filename       = UPGRADE_IMAGE;
+        data.retries        = 3;
+        data.timeout_erase  = UPGRADE_TIMEOUT_MS;
+        data.timeout_normal = UPGRADE_TIMEOUT_MS;
+        err = svsBdpFirmwareUpgrade(&data, UPGRADE_TIMEOUT_MS);
+        if(err->code != ERR_PASS)
+        {
+            failed++;
+        }
+    }
+
+    return(failed);
+}
+
+static int upgradeMany(int docks, int window)
+{
+    bdp_upgrade_result_t result[BDP_MAX];
+    bdp_upgrade_t data;
+    svs_err_t *err;
+
+    memset(&data, 0, sizeof(data));
+    data.filename       = UPGRADE_IMAGE;
+    data.bdp_cnt        = 0;
+    data.window         = window;
+    data.retries        = 3;
+    data.timeout_erase  = UPGRADE_TIMEOUT_MS;
+    data.timeout_normal = UPGRADE_TIMEOUT_MS;
+    data.deadline_ms    = 3600 * 1000;
+    data.result         = result;
+    data.result_max     = BDP_MAX;
+    err = svsBdpFirmwareUpgradeMany(&data);
+    if(err->code != ERR_PASS)
+    {
+        fprintf(stderr, "benchupgrade: %s\n", err->str);
+    }
+
+    return(data.progress.bdp_total - data.progress.bdp_done);
+}
+
+int main(int argc, char *argv[])
+{
+    int many   = (argc > 1) && (strcmp(argv[1], "many") == 0);
+    int docks  = (argc > 2) ? atoi(argv[2]) : 8;
+    int len    = ((argc > 3) ? atoi(argv[3]) : 16) * 1024;
+    int window = (argc > 4) ? atoi(argv[4]) : 0;
+    int64_t t_us;
+    sim_cfg_t cfg;
+    int failed;
+    pid_t pid;
+
+    simCfgDefault(&cfg);
+    cfg.docks  = MIN(docks, BDP_MAX);
+    cfg.window = window;
+    pid = simStart(&cfg);
+    if(pid < 0)
+    {
+        return(1);
+    }
+    if((upgradeImageWrite(len) != ERR_PASS) || (simAppInit("benchupgrade") != ERR_PASS))
+    {
+        simStop(pid);
+        return(1);
+    }
+
+    t_us = simTimeUs();
+    failed = many ? upgradeMany(cfg.docks, window) : upgradeSerial(cfg.docks);
+    t_us = simTimeUs() - t_us;
+
+    printf("benchupgrade: %s, window %d, %d BDPs, image %d bytes, %d failed, %.1f s, %.0f bytes/s\n",
+           many ? "many" : "serial", window, cfg.docks, len, failed,
+           (double)t_us / 1000000, (double)len * (cfg.docks - failed) * 1000000 / t_us);
+    fflush(stdout);
+    simStop(pid);
+
+    return(failed != 0);
+}
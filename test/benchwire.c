@@ -0,0 +1,176 @@
+//
+// Bytes and messages per second of the log and callback traffic, with the full svsSocketMsgHeader_t
+// on every message (legacy) or the compact header negotiated at connection setup (v1). The bytes
+// are counted in the socket calls of the application, wrapped at link time (see the Makefile):
+// a log line is sent and its echo received, a callback event is sent to svsd on a connection of
+// its own, as a BDP module would, and received back by the callback thread of the application.
+//
+// usage: benchwire [legacy|v1] [messages]
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsApi.h>
+#include <svsCallback.h>
+#include <svsSocket.h>
+#include <libSVS.h>
+
+#include "svssim.h"
+
+#define WIRE_EVENT_WINDOW   128     // events in flight, below the callback queue of the application
+#define WIRE_EVENT_WAIT_MS  2000
+
+static uint64_t wire_sent;
+static uint64_t wire_rcvd;
+
+static uint32_t event_rcvd;
+static pthread_mutex_t event_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t event_cond = PTHREAD_COND_INITIALIZER;
+
+ssize_t __real_send(int fd, const void *buf, size_t len, int flags);
+ssize_t __real_recv(int fd, void *buf, size_t len, int flags);
+
+ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags)
+{
+    ssize_t n = __real_send(fd, buf, len, flags);
+
+    if(n > 0)
+    {
+        __sync_fetch_and_add(&wire_sent, n);
+    }
+    return(n);
+}
+
+ssize_t __wrap_recv(int fd, void *buf, size_t len, int flags)
+{
+    ssize_t n = __real_recv(fd, buf, len, flags);
+
+    if(n > 0)
+    {
+        __sync_fetch_and_add(&wire_rcvd, n);
+    }
+    return(n);
+}
+
+static int wireEvent(uint8_t msg_id, uint8_t dev_num, uint8_t *payload, uint16_t len)
+{
+    pthread_mutex_lock(&event_mutex);
+    event_rcvd++;
+    pthread_cond_signal(&event_cond);
+    pthread_mutex_unlock(&event_mutex);
+
+    return(ERR_PASS);
+}
+
+//
+// Description:
+// Waits until at least cnt events were received, returns ERR_TIMEOUT when they stop coming.
+//
+static int wireEventWait(uint32_t cnt)
+{
+    struct timespec ts;
+    int rc = ERR_PASS;
+
+    pthread_mutex_lock(&event_mutex);
+    while((event_rcvd < cnt) && (rc == ERR_PASS))
+    {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += WIRE_EVENT_WAIT_MS / 1000;
+        if(pthread_cond_timedwait(&event_cond, &event_mutex, &ts) != 0)
+        {
+            rc = ERR_TIMEOUT;
+        }
+    }
+    pthread_mutex_unlock(&event_mutex);
+
+    return(rc);
+}
+
+static void wireReport(const char *what, int cnt, int64_t t_us, uint64_t sent, uint64_t rcvd)
+{
+    printf("benchwire: %-8s %d messages, %.0f messages/s, bytes per message sent %.1f received %.1f\n",
+           what, cnt, (double)cnt * 1000000 / t_us, (double)sent / cnt, (double)rcvd / cnt);
+}
+
+int main(int argc, char *argv[])
+{
+    int legacy = (argc > 1) && (strcmp(argv[1], "legacy") == 0);
+    int cnt    = (argc > 2) ? atoi(argv[2]) : 5000;
+    uint64_t sent, rcvd;
+    uint8_t payload = 1;
+    int64_t t_us;
+    sim_cfg_t cfg;
+    int i, fd, rc = 0;
+    pid_t pid;
+
+    simCfgDefault(&cfg);
+    cfg.docks          = 2;
+    cfg.callback_queue = CALLBACK_QUEUE_MAX;
+    pid = simStart(&cfg);
+    if(pid < 0)
+    {
+        return(1);
+    }
+    svsSocketWireVersionSet(legacy ? SVS_SOCKET_WIRE_LEGACY : SVS_SOCKET_WIRE_V1);
+    if(simAppInit("benchwire") != ERR_PASS)
+    {
+        simStop(pid);
+        return(1);
+    }
+    svsCallbackRegister(MODULE_ID_BDP, MSG_ID_BDP_SWITCH_GET, wireEvent);
+    printf("benchwire: %s header\n", legacy ? "legacy" : "compact");
+
+    // log lines, each one waits for its echo
+    sent = wire_sent;
+    rcvd = wire_rcvd;
+    t_us = simTimeUs();
+    for(i = 0; i < cnt; i++)
+    {
+        logInfo("benchwire %d", i);
+    }
+    wireReport("log", cnt, simTimeUs() - t_us, wire_sent - sent, wire_rcvd - rcvd);
+
+    // callback events with a 1 byte payload, as many in flight as the callback queue takes
+    if(svsSocketClientCreateCallback(&fd, 0) != ERR_PASS)
+    {
+        simStop(pid);
+        return(1);
+    }
+    sent = wire_sent;
+    rcvd = wire_rcvd;
+    t_us = simTimeUs();
+    for(i = 0; (i < cnt) && (rc == ERR_PASS); i++)
+    {
+        if(i >= WIRE_EVENT_WINDOW)
+        {
+            rc = wireEventWait(i - WIRE_EVENT_WINDOW + 1);
+        }
+        if(rc == ERR_PASS)
+        {
+            rc = svsSocketSendCallback(fd, MODULE_ID_BDP, i % cfg.docks, MSG_ID_BDP_SWITCH_GET, 0, &payload, 1);
+        }
+    }
+    if(rc == ERR_PASS)
+    {
+        rc = wireEventWait(cnt);
+    }
+    if(rc != ERR_PASS)
+    {
+        fprintf(stderr, "benchwire: %u of %d events received\n", event_rcvd, cnt);
+    }
+    wireReport("callback", cnt, simTimeUs() - t_us, wire_sent - sent, wire_rcvd - rcvd);
+    fflush(stdout);
+    close(fd);
+    simStop(pid);
+
+    return(rc != ERR_PASS);
+}
@@ -0,0 +1,658 @@
+//
+// Simulated station used by the benchmarks.
+//
+// svsd runs in a child process forked by simStart(), the same way as on the station except that the
+// WIM and the upgrade manager are stubbed (see svsstub.c). Each BDP bus is a pseudo terminal, svsd
+// opens the slave side as it opens the RS485 adapters and the BDPs are emulated on the master side:
+// - the frames are parsed the way the BDP firmware does, the BDP addressed answers the messages used
+//   by the benchmarks (LEDs, switch, echo, RFID, firmware blocks, memory CRC)
+// - the bus is half duplex, a frame occupies it for byte_us per byte, a BDP handles one request
+//   at a time and answers turnaround_us after the request ended on the wire
+// - the time between the first and the last byte of each frame written by svsd, and the number of
+//   writes it was received in, are recorded and printed by simStop()
+//
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsApi.h>
+#include <svsCallback.h>
+#include <svsBdp.h>
+#include <svsConfig.h>
+#include <libSVS.h>
+#include <crc.h>
+
+#include "svssim.h"
+
+#define SIM_BUS_MAX         2
+#define SIM_RSP_QUEUE_MAX   512
+#define SIM_FRAME_LOG_MAX   200000
+#define SIM_FRAME_MAX       (sizeof(svsMsgBdpFramePreamble_t) + sizeof(svsMsgBdpFrame_t))
+#define SIM_SETTLE_MS       500     // the servers listen from their own threads
+
+typedef struct
+{
+    uint8_t     used;
+    int64_t     due_us;             // the BDP is ready to answer
+    uint16_t    len;                // frame length including the preamble
+    uint8_t     frame[SIM_FRAME_MAX];
+} sim_rsp_t;
+
+typedef struct
+{
+    int                 bus;
+    int                 fd;                         // pty master
+    char                devName[64];                // pty slave, opened by svsd
+    pthread_t           pthread_rx;
+    pthread_t           pthread_tx;
+    pthread_mutex_t     mutex;
+    pthread_cond_t      cond;                       // a response was queued
+    sim_rsp_t           rsp[SIM_RSP_QUEUE_MAX];
+    int64_t             busy_until_us;              // end of the last frame on the wire
+
+    // frame being received
+    bdp_frame_state_t   state;
+    int                 preamble_cnt;
+    int                 index;
+    uint8_t             rx[sizeof(svsMsgBdpFrame_t)];
+    int64_t             t_first_us;                 // read() that returned the first byte of the frame
+    int64_t             t_prev_us;                  // previous read() of the frame
+    int                 chunks;                     // read() calls the frame was received in
+    int64_t             gap_max_us;
+} sim_bus_t;
+
+typedef struct
+{
+    bdp_addr_t          addr;
+    int                 bus;
+    int64_t             busy_until_us;              // the BDP handles one request at a time
+} sim_dock_t;
+
+typedef struct
+{   // frames written by svsd, summed over both buses
+    pthread_mutex_t     mutex;
+    int                 cnt;
+    int64_t             span_us[SIM_FRAME_LOG_MAX]; // first to last byte of a frame
+    int64_t             gap_us[SIM_FRAME_LOG_MAX];  // longest pause inside a frame
+    uint32_t            chunks[4];                  // frames received in 1, 2, 3 and more reads
+    uint32_t            crc_err;
+    uint32_t            rsp;                        // frames answered
+} sim_stats_t;
+
+static sim_cfg_t        sim_cfg;
+static sim_bus_t        sim_bus[SIM_BUS_MAX];
+static sim_dock_t       sim_dock[BDP_MAX];
+static sim_stats_t      sim_stats;
+static volatile int     sim_stop;
+
+static const uint8_t    sim_preamble[sizeof(svsMsgBdpFramePreamble_t)] = { 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, BDP_FRAME_SOF };
+
+int64_t simTimeUs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+static int simCompare(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+
+    return((x > y) - (x < y));
+}
+
+int64_t simPercentile(int64_t *sample, int cnt, int p)
+{
+    int i;
+
+    if(cnt == 0)
+    {
+        return(0);
+    }
+    qsort(sample, cnt, sizeof(int64_t), simCompare);
+    i = (cnt * p + 99) / 100 - 1;
+    if(i < 0)
+    {
+        i = 0;
+    }
+    return(sample[i]);
+}
+
+void simCfgDefault(sim_cfg_t *cfg)
+{
+    memset(cfg, 0, sizeof(sim_cfg_t));
+    cfg->docks          = 8;
+    cfg->byte_us        = SIM_BYTE_US_DEFAULT;
+    cfg->turnaround_us  = SIM_TURNAROUND_US;
+    cfg->flash_us       = SIM_FLASH_US;
+}
+
+static void simTimespec(int64_t t_us, struct timespec *ts)
+{
+    ts->tv_sec  = t_us / 1000000;
+    ts->tv_nsec = (t_us % 1000000) * 1000;
+}
+
+//
+// Description:
+// Response length of the messages the BDPs answer, 0 for the messages they ignore.
+//
+static uint16_t simRspLen(uint8_t msg_id)
+{
+    switch(msg_id)
+    {
+        case MSG_ID_BDP_GRN_LED_SET:
+        case MSG_ID_BDP_RED_LED_SET:
+        case MSG_ID_BDP_YLW_LED_SET:                return(sizeof(bdp_led_set_msg_rsp_t));
+        case MSG_ID_BDP_SWITCH_GET:                 return(sizeof(bdp_switch_get_msg_rsp_t));
+        case MSG_ID_BDP_ECHO:                       return(sizeof(bdp_echo_msg_rsp_t));
+        case MSG_ID_BDP_RFID_GET:                   return(sizeof(bdp_rfid_get_msg_rsp_t));
+        case MSG_ID_BDP_FIRMWARE_IMAGE_BLOCK_SEND:  return(sizeof(bdp_firmware_upgrade_msg_rsp_t));
+        case MSG_ID_BDP_MEMORY_CRC:                 return(sizeof(bdp_memory_crc_msg_rsp_t));
+        default:                                    break;
+    }
+    return(0);
+}
+
+static void simDockAddr(int dock, bdp_addr_t *addr)
+{
+    memset(addr, 0, sizeof(bdp_addr_t));
+    addr->octet[0] = 'S';
+    addr->octet[1] = 'I';
+    addr->octet[2] = 'M';
+    addr->octet[6] = (dock + 1) >> 8;
+    addr->octet[7] = (dock + 1) & 0xFF;
+}
+
+static sim_dock_t *simDockFind(bdp_addr_t *addr)
+{
+    int dock;
+
+    if((addr->octet[0] != 'S') || (addr->octet[1] != 'I') || (addr->octet[2] != 'M'))
+    {
+        return(0);
+    }
+    dock = ((addr->octet[6] << 8) | addr->octet[7]) - 1;
+    if((dock < 0) || (dock >= sim_cfg.docks))
+    {
+        return(0);
+    }
+    return(&sim_dock[dock]);
+}
+
+//
+// Description:
+// Queue the answer of a BDP, the TX thread of the bus writes it once due and once the bus is free.
+//
+static void simRspQueue(sim_bus_t *bus, int64_t due_us, svsMsgBdpFrameHeader_t *req, uint8_t *payload, uint16_t len)
+{
+    svsMsgBdpFrameHeader_t *hdr;
+    sim_rsp_t *rsp = 0;
+    int i;
+
+    pthread_mutex_lock(&bus->mutex);
+    for(i = 0; i < SIM_RSP_QUEUE_MAX; i++)
+    {
+        if(bus->rsp[i].used == 0)
+        {
+            rsp = &bus->rsp[i];
+            break;
+        }
+    }
+    if(rsp == 0)
+    {
+        pthread_mutex_unlock(&bus->mutex);
+        fprintf(stderr, "svssim: bus %d response queue full\n", bus->bus);
+        return;
+    }
+
+    memcpy(rsp->frame, sim_preamble, sizeof(sim_preamble));
+    hdr = (svsMsgBdpFrameHeader_t *)&rsp->frame[sizeof(sim_preamble)];
+    memcpy(hdr, req, sizeof(svsMsgBdpFrameHeader_t));
+    hdr->len     = len;
+    hdr->len_inv = ~len;
+    memcpy(&rsp->frame[sizeof(sim_preamble) + sizeof(svsMsgBdpFrameHeader_t)], payload, len);
+    hdr->crc     = crc16_compute((uint8_t *)&hdr->len, sizeof(svsMsgBdpFrameHeader_t) - sizeof(hdr->crc) + len);
+    rsp->len     = sizeof(sim_preamble) + sizeof(svsMsgBdpFrameHeader_t) + len;
+    rsp->due_us  = due_us;
+    rsp->used    = 1;
+
+    pthread_cond_signal(&bus->cond);
+    pthread_mutex_unlock(&bus->mutex);
+}
+
+//
+// Description:
+// A complete frame was received by the BDPs of the bus, the BDP addressed answers it.
+//
+static void simFrameHandle(sim_bus_t *bus, svsMsgBdpFrame_t *frame, int64_t tnow_us)
+{
+    uint8_t payload[BDP_MSG_PAYLOAD_MAX];
+    int64_t wire_end_us, due_us;
+    sim_dock_t *dock;
+    uint16_t len;
+
+    // the frame occupied the bus until its last byte went through
+    pthread_mutex_lock(&bus->mutex);
+    wire_end_us = MAX(tnow_us, bus->busy_until_us) +
+                  (int64_t)(sizeof(sim_preamble) + sizeof(svsMsgBdpFrameHeader_t) + frame->hdr.len) * sim_cfg.byte_us;
+    bus->busy_until_us = wire_end_us;
+    pthread_mutex_unlock(&bus->mutex);
+
+    dock = simDockFind(&frame->hdr.addr);
+    len  = simRspLen(frame->hdr.msg_id);
+    if((dock == 0) || (dock->bus != bus->bus) || (len == 0) || (frame->hdr.flags & BDP_MSG_FRAME_FLAG_NO_ACK))
+    {   // broadcast, other bus or message the BDPs ignore
+        return;
+    }
+
+    memset(payload, 0, len);
+    switch(frame->hdr.msg_id)
+    {
+        case MSG_ID_BDP_SWITCH_GET:
+            ((bdp_switch_get_msg_rsp_t *)payload)->bdp_switch_state[BDP_SWITCH_BIKE] = BDP_SWITCH_STATE_ON;
+            break;
+
+        case MSG_ID_BDP_ECHO:
+            memcpy(((bdp_echo_msg_rsp_t *)payload)->payload, frame->payload, MIN(frame->hdr.len, BDP_ECHO_PAYLOAD_MAX));
+            break;
+
+        default:
+            break;  // status ERR_PASS
+    }
+
+    due_us = MAX(wire_end_us, dock->busy_until_us) + sim_cfg.turnaround_us;
+    if(frame->hdr.msg_id == MSG_ID_BDP_FIRMWARE_IMAGE_BLOCK_SEND)
+    {
+        due_us += sim_cfg.flash_us;
+    }
+    dock->busy_until_us = due_us;
+
+    simRspQueue(bus, due_us, &frame->hdr, payload, len);
+}
+
+static void simFrameDone(sim_bus_t *bus, int64_t tnow_us)
+{
+    pthread_mutex_lock(&sim_stats.mutex);
+    if(sim_stats.cnt < SIM_FRAME_LOG_MAX)
+    {
+        sim_stats.span_us[sim_stats.cnt] = tnow_us - bus->t_first_us;
+        sim_stats.gap_us[sim_stats.cnt]  = bus->gap_max_us;
+        sim_stats.cnt++;
+    }
+    sim_stats.chunks[MIN(bus->chunks, 4) - 1]++;
+    pthread_mutex_unlock(&sim_stats.mutex);
+}
+
+//
+// Description:
+// Receive the frames written by svsd on the bus, same state machine as svsBdpRx() and the BDP firmware.
+//
+static void *simBusRxThread(void *arg)
+{
+    sim_bus_t *bus = (sim_bus_t *)arg;
+    svsMsgBdpFrame_t *frame = (svsMsgBdpFrame_t *)bus->rx;
+    uint8_t buf[2048];
+    int64_t tnow_us;
+    uint16_t crc;
+    int i, cnt;
+
+    for(;;)
+    {
+        cnt = read(bus->fd, buf, sizeof(buf));
+        if(cnt <= 0)
+        {   // EIO until svsd opened the slave
+            usleep(1000);
+            continue;
+        }
+        tnow_us = simTimeUs();
+
+        if(bus->state != BDP_FRAME_STATE_IDLE)
+        {   // the frame continues in this read
+            bus->chunks++;
+            bus->gap_max_us = MAX(bus->gap_max_us, tnow_us - bus->t_prev_us);
+        }
+        bus->t_prev_us = tnow_us;
+
+        for(i = 0; i < cnt; i++)
+        {
+            switch(bus->state)
+            {
+                case BDP_FRAME_STATE_IDLE:
+                    bus->preamble_cnt = 0;
+                    bus->index        = 0;
+                    bus->t_first_us   = tnow_us;
+                    bus->chunks       = 1;
+                    bus->gap_max_us   = 0;
+                    bus->state        = BDP_FRAME_STATE_PREAMBLE;
+                    // fall through
+
+                case BDP_FRAME_STATE_PREAMBLE:
+                    if(buf[i] == 0xAA)
+                    {
+                        if(++bus->preamble_cnt >= BDP_FRAME_PREAMBLE_SIZE)
+                        {
+                            bus->state = BDP_FRAME_STATE_SOF;
+                        }
+                    }
+                    else
+                    {   // wakeup bytes or noise
+                        bus->state = BDP_FRAME_STATE_IDLE;
+                    }
+                    break;
+
+                case BDP_FRAME_STATE_SOF:
+                    bus->state = (buf[i] == BDP_FRAME_SOF) ? BDP_FRAME_STATE_FRAME : BDP_FRAME_STATE_IDLE;
+                    break;
+
+                case BDP_FRAME_STATE_FRAME:
+                    bus->rx[bus->index++] = buf[i];
+                    if((bus->index == sizeof(svsMsgBdpFrameHeader_t)) &&
+                       ((frame->hdr.len != (~frame->hdr.len_inv & 0xFFFF)) || (frame->hdr.len > BDP_MSG_PAYLOAD_MAX)))
+                    {
+                        sim_stats.crc_err++;
+                        bus->state = BDP_FRAME_STATE_IDLE;
+                        break;
+                    }
+                    if((bus->index >= sizeof(svsMsgBdpFrameHeader_t)) && (bus->index == sizeof(svsMsgBdpFrameHeader_t) + frame->hdr.len))
+                    {
+                        bus->state = BDP_FRAME_STATE_IDLE;
+                        crc = crc16_compute((uint8_t *)&frame->hdr.len, bus->index - sizeof(frame->hdr.crc));
+                        if(crc != frame->hdr.crc)
+                        {
+                            sim_stats.crc_err++;
+                            break;
+                        }
+                        simFrameDone(bus, tnow_us);
+                        simFrameHandle(bus, frame, tnow_us);
+                    }
+                    break;
+
+                default:
+                    bus->state = BDP_FRAME_STATE_IDLE;
+                    break;
+            }
+        }
+    }
+    return(0);
+}
+
+//
+// Description:
+// Write the answers of the BDPs in the order they are due, one frame at a time on the bus.
+//
+static void *simBusTxThread(void *arg)
+{
+    sim_bus_t *bus = (sim_bus_t *)arg;
+    sim_rsp_t *rsp;
+    struct timespec ts;
+    int64_t tnow_us, end_us;
+    uint8_t frame[SIM_FRAME_MAX];
+    int i, len, sent, n;
+
+    pthread_mutex_lock(&bus->mutex);
+    for(;;)
+    {
+        rsp = 0;
+        for(i = 0; i < SIM_RSP_QUEUE_MAX; i++)
+        {
+            if(bus->rsp[i].used && ((rsp == 0) || (bus->rsp[i].due_us < rsp->due_us)))
+            {
+                rsp = &bus->rsp[i];
+            }
+        }
+        if(rsp == 0)
+        {
+            pthread_cond_wait(&bus->cond, &bus->mutex);
+            continue;
+        }
+        tnow_us = simTimeUs();
+        if(rsp->due_us > tnow_us)
+        {   // an earlier answer may be queued meanwhile
+            simTimespec(rsp->due_us, &ts);
+            pthread_cond_timedwait(&bus->cond, &bus->mutex, &ts);
+            continue;
+        }
+
+        // the BDP gets the bus, the frame is complete on the other end once its last byte went through
+        len = rsp->len;
+        memcpy(frame, rsp->frame, len);
+        rsp->used = 0;
+        end_us = MAX(tnow_us, bus->busy_until_us) + (int64_t)len * sim_cfg.byte_us;
+        bus->busy_until_us = end_us;
+        pthread_mutex_unlock(&bus->mutex);
+
+        while((tnow_us = simTimeUs()) < end_us)
+        {
+            usleep(end_us - tnow_us);
+        }
+        for(sent = 0; sent < len; sent += n)
+        {
+            n = write(bus->fd, &frame[sent], len - sent);
+            if(n < 0)
+            {
+                if(errno != EAGAIN)
+                {
+                    fprintf(stderr, "svssim: bus %d write: %s\n", bus->bus, strerror(errno));
+                    break;
+                }
+                n = 0;
+            }
+        }
+        sim_stats.rsp++;
+
+        pthread_mutex_lock(&bus->mutex);
+    }
+    return(0);
+}
+
+static int simBusOpen(sim_bus_t *bus, int num)
+{
+    pthread_condattr_t condAttr;
+
+    memset(bus, 0, sizeof(sim_bus_t));
+    bus->bus = num;
+    bus->fd  = posix_openpt(O_RDWR | O_NOCTTY);
+    if((bus->fd < 0) || (grantpt(bus->fd) < 0) || (unlockpt(bus->fd) < 0))
+    {
+        perror("svssim: posix_openpt");
+        return(ERR_FAIL);
+    }
+    snprintf(bus->devName, sizeof(bus->devName), "%s", ptsname(bus->fd));
+
+    pthread_mutex_init(&bus->mutex, 0);
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&bus->cond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    return(ERR_PASS);
+}
+
+static int simConfigWrite(void)
+{
+    FILE *fp;
+
+    fp = fopen(SVS_CONFIG_FILE, "w");
+    if(fp == 0)
+    {
+        perror("svssim: " SVS_CONFIG_FILE);
+        return(ERR_FAIL);
+    }
+    fprintf(fp, "<svsLib>\n<modules>\n");
+    fprintf(fp, "<bdp>\n");
+    fprintf(fp, "<devname1>%s</devname1>\n", sim_bus[0].devName);
+    fprintf(fp, "<devname2>%s</devname2>\n", sim_bus[1].devName);
+    if(sim_cfg.window != 0)
+    {
+        fprintf(fp, "<window>%d</window>\n", sim_cfg.window);
+    }
+    fprintf(fp, "<arp_file>%s/arp</arp_file>\n", SIM_DIR);
+    fprintf(fp, "</bdp>\n");
+    fprintf(fp, "<kr>\n<devname>/dev/null</devname>\n</kr>\n");
+    if(sim_cfg.callback_queue != 0)
+    {
+        fprintf(fp, "<callback>\n<queue>%d</queue>\n</callback>\n", sim_cfg.callback_queue);
+    }
+    fprintf(fp, "</modules>\n</svsLib>\n");
+    fclose(fp);
+
+    return(ERR_PASS);
+}
+
+static void simStopHandler(int sig)
+{
+    sim_stop = 1;
+}
+
+static void simStatsPrint(void)
+{
+    int cnt = sim_stats.cnt;
+
+    printf("svssim: %d frames from svsd, %u answered, %u bad", cnt, sim_stats.rsp, sim_stats.crc_err);
+    printf(", reads per frame 1:%u 2:%u 3:%u 4+:%u\n", sim_stats.chunks[0], sim_stats.chunks[1], sim_stats.chunks[2], sim_stats.chunks[3]);
+    printf("svssim: first to last byte of a frame us p50 %lld p99 %lld max %lld\n",
+           (long long)simPercentile(sim_stats.span_us, cnt, 50), (long long)simPercentile(sim_stats.span_us, cnt, 99),
+           (long long)simPercentile(sim_stats.span_us, cnt, 100));
+    printf("svssim: longest gap inside a frame us p50 %lld p99 %lld max %lld\n",
+           (long long)simPercentile(sim_stats.gap_us, cnt, 50), (long long)simPercentile(sim_stats.gap_us, cnt, 99),
+           (long long)simPercentile(sim_stats.gap_us, cnt, 100));
+    fflush(stdout);
+}
+
+//
+// Description:
+// svsd side of the simulation, runs in the child until simStop().
+//
+static void simRun(int readyFd)
+{
+    int i;
+
+    if((system("rm -rf " SIM_DIR " && mkdir -p " SIM_DIR) != 0) ||
+       (simBusOpen(&sim_bus[0], 0) != ERR_PASS) || (simBusOpen(&sim_bus[1], 1) != ERR_PASS) ||
+       (simConfigWrite() != ERR_PASS))
+    {
+        _exit(1);
+    }
+
+    crc16_init();
+    pthread_mutex_init(&sim_stats.mutex, 0);
+    for(i = 0; i < sim_cfg.docks; i++)
+    {
+        simDockAddr(i, &sim_dock[i].addr);
+        sim_dock[i].bus = i % SIM_BUS_MAX;
+    }
+    for(i = 0; i < SIM_BUS_MAX; i++)
+    {
+        pthread_create(&sim_bus[i].pthread_rx, 0, simBusRxThread, &sim_bus[i]);
+        pthread_create(&sim_bus[i].pthread_tx, 0, simBusTxThread, &sim_bus[i]);
+    }
+
+    if(svsServerInit("svsd", SIM_DIR "/svsd.log") != ERR_PASS)
+    {
+        fprintf(stderr, "svssim: svsServerInit failed, see %s/svsd.log\n", SIM_DIR);
+        _exit(1);
+    }
+    // the BDPs answered a scan
+    for(i = 0; i < sim_cfg.docks; i++)
+    {
+        svsBdpArpTableUpdate(sim_dock[i].bus, &sim_dock[i].addr);
+    }
+    usleep(SIM_SETTLE_MS * 1000);
+
+    signal(SIGTERM, simStopHandler);
+    if(write(readyFd, "", 1) != 1)
+    {
+        _exit(1);
+    }
+    close(readyFd);
+
+    while(sim_stop == 0)
+    {
+        usleep(10000);
+    }
+    simStatsPrint();
+    _exit(0);
+}
+
+pid_t simStart(const sim_cfg_t *cfg)
+{
+    int fd[2];
+    char ready;
+    pid_t pid;
+
+    sim_cfg = *cfg;
+    if(sim_cfg.docks > BDP_MAX)
+    {
+        sim_cfg.docks = BDP_MAX;
+    }
+
+    if(pipe(fd) < 0)
+    {
+        return(-1);
+    }
+    fflush(stdout);
+    pid = fork();
+    if(pid == 0)
+    {   // svsd must not outlive a benchmark that was interrupted, it holds the server ports
+        prctl(PR_SET_PDEATHSIG, SIGTERM);
+        close(fd[0]);
+        simRun(fd[1]);
+    }
+    close(fd[1]);
+    if((pid < 0) || (read(fd[0], &ready, 1) != 1))
+    {
+        fprintf(stderr, "svssim: svsd did not start\n");
+        close(fd[0]);
+        return(-1);
+    }
+    close(fd[0]);
+
+    return(pid);
+}
+
+int simAppInit(char *appName)
+{
+    uint16_t bdp_max;
+    int retry;
+
+    if(svsCommonInit(appName) != ERR_PASS)
+    {
+        return(ERR_FAIL);
+    }
+    // svsd registers the new clients before it answers them, the first requests can time out
+    for(retry = 0; retry < 100; retry++)
+    {
+        if(svsBdpAvailableGet(&bdp_max) == ERR_PASS)
+        {
+            return(ERR_PASS);
+        }
+        usleep(10000);
+    }
+    fprintf(stderr, "svssim: svsd does not answer\n");
+
+    return(ERR_FAIL);
+}
+
+void simStop(pid_t pid)
+{
+    if(pid > 0)
+    {
+        kill(pid, SIGTERM);
+        waitpid(pid, 0, 0);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef SVSSIM_H
+#define SVSSIM_H
+
+//
+// Simulated station used by the benchmarks: svsd runs in a child process with its two BDP buses on
+// pseudo terminals, the BDPs are emulated on the master side of the ptys.
+//
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#define SIM_DIR                 "/tmp/svssim"   // configuration, log and ARP files of the simulated svsd
+#define SIM_BYTE_US_DEFAULT     86              // one byte on the wire at 115200 baud
+#define SIM_TURNAROUND_US       2000            // a BDP answers this long after the request ended on the wire
+#define SIM_FLASH_US            5000            // a BDP writes a firmware block to its flash in this time
+
+typedef struct
+{
+    int         docks;          // BDPs, alternating between the two buses, BDP n has the number n in the ARP table
+    int         window;         // "bdp/window", 0 keeps the svsd default
+    int         byte_us;        // on-wire time of one byte, 0 for an infinitely fast bus
+    int         turnaround_us;  // see SIM_TURNAROUND_US
+    int         flash_us;       // see SIM_FLASH_US
+    int         callback_queue; // "callback/queue", 0 keeps the svsd default
+} sim_cfg_t;
+
+void    simCfgDefault(sim_cfg_t *cfg);
+
+// Starts svsd and the BDPs, returns once the servers accept connections, the caller is the application.
+// Must be called before the caller creates any thread.
+pid_t   simStart(const sim_cfg_t *cfg);
+
+// svsCommonInit() for the caller, returns once svsd answers its requests
+int     simAppInit(char *appName);
+
+// Stops svsd, the statistics of the frames received by the BDPs are printed first.
+void    simStop(pid_t pid);
+
+int64_t simTimeUs(void);
+
+// p in percent, sorts the samples
+int64_t simPercentile(int64_t *sample, int cnt, int p);
+
+#endif // SVSSIM_H
@@ -0,0 +1,15 @@
+//
+// The WIM and the upgrade manager are not part of the simulated station, see svssim.c
+//
+#include <svsErr.h>
+
+int svsWIMServerInit(void)      { return(ERR_PASS); }
+int svsWIMServerUninit(void)    { return(ERR_PASS); }
+int svsWIMInit(void)            { return(ERR_PASS); }
+int svsWIMUninit(void)          { return(ERR_PASS); }
+
+int svsUpgradeInit(void)        { return(ERR_PASS); }
+int svsUpgradeUninit(void)      { return(ERR_PASS); }
+int svsSWUServerInit(void)      { return(ERR_PASS); }
+int svsSWUStationUp(void)       { return(ERR_PASS); }
+int svsSWUServerUninit(void)    { return(ERR_PASS); }
@@ -0,0 +1,161 @@
+//
+// Routing of the responses on the shared BDP client socket by sequence number, see svsSocketMux.
+// Threads send blocking echoes while the main thread keeps asynchronous echoes in flight and waits
+// for them in the reverse order, every request carries its own payload. The responses of the two
+// buses come back interleaved, each request must get the echo of its own payload.
+//
+// usage: testmux
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsApi.h>
+#include <svsBdpMsg.h>
+#include <libSVS.h>
+
+#include "svssim.h"
+
+#define TEST_DOCKS          4
+#define TEST_THREADS        4
+#define TEST_THREAD_ECHOES  25
+#define TEST_ASYNC_ROUNDS   10
+#define TEST_ASYNC_ECHOES   32      // in flight at once
+#define TEST_TIMEOUT_MS     5000
+
+typedef struct
+{
+    int         id;
+    pthread_t   thread;
+    int         failed;
+} test_thread_t;
+
+static void testPayload(uint8_t *payload, uint32_t tag)
+{
+    int i;
+
+    for(i = 0; i < BDP_ECHO_PAYLOAD_MAX; i++)
+    {
+        payload[i] = (uint8_t)(tag >> ((i % 4) * 8)) ^ (uint8_t)i;
+    }
+}
+
+static void *testBlocking(void *arg)
+{
+    test_thread_t *t = (test_thread_t *)arg;
+    uint8_t expect[BDP_ECHO_PAYLOAD_MAX];
+    bdp_echo_t echo;
+    svs_err_t *err;
+    uint32_t tag;
+    int i;
+
+    for(i = 0; i < TEST_THREAD_ECHOES; i++)
+    {
+        tag = 0x10000 * (t->id + 1) + i;
+        memset(&echo, 0, sizeof(echo));
+        echo.bdp_num = (t->id + i) % TEST_DOCKS;
+        testPayload(echo.payload, tag);
+        memcpy(expect, echo.payload, sizeof(expect));
+        err = svsBdpEcho(&echo, TEST_TIMEOUT_MS);
+        if((err->code != ERR_PASS) || (memcmp(echo.payload, expect, sizeof(expect)) != 0))
+        {
+            t->failed++;
+        }
+    }
+
+    return(0);
+}
+
+static int testAsync(int round)
+{
+    svs_future_t *future[TEST_ASYNC_ECHOES];
+    bdp_echo_msg_req_t req[TEST_ASYNC_ECHOES];
+    bdp_echo_msg_rsp_t rsp;
+    svs_err_t *err;
+    int i, failed = 0;
+
+    for(i = 0; i < TEST_ASYNC_ECHOES; i++)
+    {
+        testPayload(req[i].payload, 0x1000000 * (round + 1) + i);
+        err = svsBdpRequestAsync(i % TEST_DOCKS, MSG_ID_BDP_ECHO, &req[i], sizeof(req[i]), sizeof(rsp),
+                                 TEST_TIMEOUT_MS, &future[i]);
+        if(err->code != ERR_PASS)
+        {
+            future[i] = 0;
+            failed++;
+        }
+    }
+    for(i = TEST_ASYNC_ECHOES - 1; i >= 0; i--)
+    {
+        if(future[i] == 0)
+        {
+            continue;
+        }
+        memset(&rsp, 0, sizeof(rsp));
+        err = svsFutureWait(future[i], TEST_TIMEOUT_MS);
+        if(err->code == ERR_PASS)
+        {
+            err = svsFutureRspGet(future[i], &rsp, sizeof(rsp));
+        }
+        if((err->code != ERR_PASS) || (rsp.status != ERR_PASS) ||
+           (memcmp(rsp.payload, req[i].payload, BDP_ECHO_PAYLOAD_MAX) != 0))
+        {
+            failed++;
+        }
+        svsFutureRelease(future[i]);
+    }
+
+    return(failed);
+}
+
+int main(int argc, char *argv[])
+{
+    test_thread_t thread[TEST_THREADS];
+    sim_cfg_t cfg;
+    int i, failed = 0, failed_async = 0;
+    pid_t pid;
+
+    simCfgDefault(&cfg);
+    cfg.docks   = TEST_DOCKS;
+    cfg.byte_us = 10;
+    pid = simStart(&cfg);
+    if(pid < 0)
+    {
+        return(1);
+    }
+    if(simAppInit("testmux") != ERR_PASS)
+    {
+        simStop(pid);
+        return(1);
+    }
+
+    for(i = 0; i < TEST_THREADS; i++)
+    {
+        thread[i].id     = i;
+        thread[i].failed = 0;
+        pthread_create(&thread[i].thread, 0, testBlocking, &thread[i]);
+    }
+    for(i = 0; i < TEST_ASYNC_ROUNDS; i++)
+    {
+        failed_async += testAsync(i);
+    }
+    for(i = 0; i < TEST_THREADS; i++)
+    {
+        pthread_join(thread[i].thread, 0);
+        failed += thread[i].failed;
+    }
+
+    printf("%s: %d blocking echoes from %d threads, %d wrong or missing\n", failed ? "FAIL" : "PASS",
+           TEST_THREADS * TEST_THREAD_ECHOES, TEST_THREADS, failed);
+    printf("%s: %d asynchronous echoes waited for in reverse order, %d wrong or missing\n", failed_async ? "FAIL" : "PASS",
+           TEST_ASYNC_ROUNDS * TEST_ASYNC_ECHOES, failed_async);
+    fflush(stdout);
+    simStop(pid);
+
+    return((failed + failed_async) != 0);
+}
@@ -0,0 +1,160 @@
+//
+// Shared memory rings, see svsShm.c. Both ends of a link run in this process: the requests go
+// through the ring many times over, with the consumer stalled so that the producer finds the ring
+// full, and start with indexes close to 2^32 so that they wrap around. Every request is echoed on
+// the response ring. The messages must arrive complete, once and in order in both directions.
+//
+// usage: testshm
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsSocket.h>
+#include <svsShm.h>
+
+#define TEST_MSG_CNT        (SVS_SHM_RING_SLOTS * 10 + 3)
+#define TEST_STALL_MS       20      // consumer stalled on the first message, below SVS_SHM_FULL_TIMEOUT_MS
+#define TEST_WAIT_MS        2000
+
+typedef struct
+{
+    uint32_t    rcvd;
+    uint32_t    bad;
+} test_end_t;
+
+static test_end_t test_server;
+static test_end_t test_client;
+static int test_server_fd;
+
+static uint16_t testLen(uint32_t seq)
+{   // from empty to full payloads
+    return((seq * 97) % (SVS_SOCKET_MSG_PAYLOAD_MAX + 1));
+}
+
+static int testCheck(test_end_t *end, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    uint32_t seq = end->rcvd++;
+    uint16_t i;
+
+    if((hdr->seq != seq) || (hdr->len != testLen(seq)) || (hdr->dev_num != (uint16_t)seq))
+    {
+        end->bad++;
+        return(ERR_FAIL);
+    }
+    for(i = 0; i < hdr->len; i++)
+    {
+        if(payload[i] != (uint8_t)(seq + i))
+        {
+            end->bad++;
+            return(ERR_FAIL);
+        }
+    }
+
+    return(ERR_PASS);
+}
+
+static int testServerRx(int shmFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    if(test_server.rcvd == 0)
+    {   // the client fills the ring meanwhile
+        usleep(TEST_STALL_MS * 1000);
+    }
+    testCheck(&test_server, hdr, payload);
+
+    return(svsShmSend(test_server_fd, hdr, payload));
+}
+
+static int testClientRx(int shmFd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    return(testCheck(&test_client, hdr, payload));
+}
+
+//
+// Description:
+// Moves the indexes of a ring that is not used yet close to the point where they wrap around.
+//
+static int testRingWrapSet(char *name)
+{
+    svs_shm_t *shm;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0600);
+    if(fd < 0)
+    {
+        perror(name);
+        return(ERR_FAIL);
+    }
+    shm = mmap(0, sizeof(svs_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(shm == MAP_FAILED)
+    {
+        perror(name);
+        return(ERR_FAIL);
+    }
+    shm->req.head = shm->req.tail = (uint32_t)-(SVS_SHM_RING_SLOTS * 2 + 5);
+    munmap(shm, sizeof(svs_shm_t));
+
+    return(ERR_PASS);
+}
+
+int main(int argc, char *argv[])
+{
+    char name[SVS_SHM_NAME_MAX];
+    uint8_t payload[SVS_SOCKET_MSG_PAYLOAD_MAX];
+    svsSocketMsgHeader_t hdr;
+    int client_fd, i, rc;
+    uint32_t seq;
+
+    snprintf(name, sizeof(name), "/testshm.%d", getpid());
+    if((svsShmClientCreate(name, 0, testClientRx, &client_fd) != ERR_PASS) ||
+       (testRingWrapSet(name) != ERR_PASS) ||
+       (svsShmServerAttach(name, 0, testServerRx, &test_server_fd) != ERR_PASS))
+    {
+        printf("FAIL: link set up\n");
+        shm_unlink(name);
+        return(1);
+    }
+    shm_unlink(name);
+
+    for(seq = 0; seq < TEST_MSG_CNT; seq++)
+    {
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.module_id = MODULE_ID_BDP;
+        hdr.seq       = seq;
+        hdr.dev_num   = (uint16_t)seq;
+        hdr.len       = testLen(seq);
+        for(i = 0; i < hdr.len; i++)
+        {
+            payload[i] = (uint8_t)(seq + i);
+        }
+        rc = svsShmSend(client_fd, &hdr, payload);
+        if(rc != ERR_PASS)
+        {
+            printf("FAIL: request %u not sent: %d\n", seq, rc);
+            break;
+        }
+    }
+
+    for(i = 0; (i < TEST_WAIT_MS) && (test_client.rcvd < TEST_MSG_CNT); i++)
+    {
+        usleep(1000);
+    }
+    svsShmDestroy(client_fd);
+    svsShmDestroy(test_server_fd);
+
+    printf("%s: %u requests received, %u bad\n", (test_server.rcvd == TEST_MSG_CNT) && (test_server.bad == 0) ? "PASS" : "FAIL",
+           test_server.rcvd, test_server.bad);
+    printf("%s: %u responses received, %u bad\n", (test_client.rcvd == TEST_MSG_CNT) && (test_client.bad == 0) ? "PASS" : "FAIL",
+           test_client.rcvd, test_client.bad);
+
+    return((test_server.rcvd != TEST_MSG_CNT) || (test_server.bad != 0) ||
+           (test_client.rcvd != TEST_MSG_CNT) || (test_client.bad != 0));
+}
@@ -0,0 +1,169 @@
+/*
+ * Decrypts and extracts a package made with the openssl and tar commands,
+ * the way the packaging tool makes them, through the streaming path of
+ * performUpdate().
+ *
+ * The secret file ends with a newline like any file written by a shell,
+ * "openssl enc -pass file:" drops it, the streaming path has to do the same.
+ * The inner archive holds the longest name a ustar header can store, split
+ * between the prefix and the name fields.
+ *
+ * Built with -DKEYDIR so the keys are read from TEST_DIR/keys.
+ */
+#include "../upgrade/swupdate.c"
+
+#define TEST_DIR        "/tmp/testswupdate"
+// 155 characters, the whole ustar prefix field, and a 100 characters name: 257 bytes with the '/' and the NUL
+#define TEST_LONG_DIR   "usr/scu/share/" \
+                        "dddddddddddddddddddddddddddddddddddddddddddddddddddddddddddd/" \
+                        "eeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeeee/" \
+                        "fffffffffffffffffff"
+#define TEST_LONG_NAME  "gggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggggg.bin"
+
+// Only the stream functions of swupdate.c are used, nothing is activated.
+bool abSlotEnabled(void) { return false; }
+int abSlotPrepare(char *slotDir, int slotDirSize) { return -1; }
+int abSlotActivate(const char *slotDir) { return -1; }
+void abSlotRecordActivation(void) { }
+xmlNode *getNodeByName(xmlNode *node, char *name) { return NULL; }
+char *getNodeContentByName(xmlNode *node, char *name) { return NULL; }
+
+static int run(const char *cmd)
+{
+    int ret = system(cmd);
+
+    if ((ret == -1) || !WIFEXITED(ret) || (WEXITSTATUS(ret) != 0))
+    {
+        fprintf(stderr, "FAIL: %s\n", cmd);
+        return -1;
+    }
+    return 0;
+}
+
+static int makePackage(void)
+{
+    static const char * const cmds[] =
+    {
+        "rm -rf " TEST_DIR,
+        "mkdir -p " TEST_DIR "/keys " TEST_DIR "/out " TEST_DIR "/pkg/usr/scu/default "
+            TEST_DIR "/pkg/usr/scu/bin " TEST_DIR "/pkg/" TEST_LONG_DIR,
+        "echo '<versions/>' > " TEST_DIR "/pkg/usr/scu/default/versions.xml",
+        "echo 'echo backup' > " TEST_DIR "/pkg/usr/scu/bin/dobackup",
+        "echo 'echo upgrade' > " TEST_DIR "/pkg/usr/scu/bin/upgrade",
+        "head -c 200000 /dev/urandom > " TEST_DIR "/pkg/" TEST_LONG_DIR "/" TEST_LONG_NAME,
+        "tar --format=ustar -czf " TEST_DIR "/kioskupgrade.tgz -C " TEST_DIR "/pkg usr",
+        "tar -czf " TEST_DIR "/package.tgz -C " TEST_DIR " kioskupgrade.tgz",
+        // keys as installed on the station, the secret file ends with a newline
+        "openssl genrsa -out " TEST_DIR "/keys/upgrade.prv 2048 2>/dev/null",
+        "openssl rsa -in " TEST_DIR "/keys/upgrade.prv -pubout -out " TEST_DIR "/upgrade.pub 2>/dev/null",
+        "openssl rand -hex 32 > " TEST_DIR "/secret",
+        "openssl pkeyutl -encrypt -pubin -inkey " TEST_DIR "/upgrade.pub -in " TEST_DIR "/secret -out "
+            TEST_DIR "/keys/secret.key",
+        // the packaging tool ran OpenSSL 1.0.x, MD5 was the default digest, OpenSSL 3 needs the legacy provider
+        "openssl enc -blowfish -md md5 -pass file:" TEST_DIR "/secret -in " TEST_DIR "/package.tgz -out "
+            TEST_DIR "/package.enc 2>/dev/null || "
+        "openssl enc -provider legacy -provider default -blowfish -md md5 -pass file:" TEST_DIR "/secret -in "
+            TEST_DIR "/package.tgz -out " TEST_DIR "/package.enc",
+        NULL
+    };
+    int i;
+
+    for (i = 0; cmds[i]; i++)
+    {
+        if (run(cmds[i]) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int extractPackage(size_t chunk)
+{
+    static const char * const packageEntries[] = { UPGRADE_PKG_BASENAME".tgz", NULL };
+    swStream_t *s;
+    FILE *fp;
+    size_t n;
+    int ret;
+
+    s = (swStream_t *)calloc(1, sizeof(swStream_t));
+    if (s == NULL)
+    {
+        return ERR_SWUPDATE_OUT_OF_MEMORY;
+    }
+    s->decrypt.gz = &s->outerGz;
+    s->outerGz.tar = &s->outerTar;
+    s->outerTar.fd = -1;
+    s->outerTar.destDir = TEST_DIR "/out";
+    s->outerTar.only = packageEntries;
+    s->outerTar.nestedName = packageEntries[0];
+    s->outerTar.nested = &s->innerGz;
+    s->innerGz.tar = &s->innerTar;
+    s->innerTar.fd = -1;
+    s->innerTar.destDir = TEST_DIR "/out";
+    s->innerTar.only = NULL;
+
+    s->decrypt.secretLen = sizeof(s->decrypt.secret);
+    ret = decryptSecretKey(s->decrypt.secret, &s->decrypt.secretLen);
+
+    fp = fopen(TEST_DIR "/package.enc", "rb");
+    if (fp == NULL)
+    {
+        ret = ERR_PKG_FILE_NOT_FOUND;
+    }
+    // pieces of any size, the salt header and the cipher blocks are split across them
+    while ((ret == SWUPDATE_SUCCESS) && ((n = fread(s->in, 1, chunk, fp)) > 0))
+    {
+        ret = decryptWrite(&s->decrypt, s->in, n);
+    }
+    if (ret == SWUPDATE_SUCCESS)
+    {
+        ret = decryptEnd(s);
+    }
+    if (fp)
+    {
+        fclose(fp);
+    }
+    streamFree(s);
+
+    return ret;
+}
+
+int main(int argc, char *argv[])
+{
+    static const size_t chunks[] = { 1, 7, 4096, SWUPDATE_STREAM_BUFSZ };
+    int i;
+    int ret;
+    int failed = 0;
+
+    if (makePackage() < 0)
+    {
+        return 1;
+    }
+
+    for (i = 0; i < (int)(sizeof(chunks) / sizeof(chunks[0])); i++)
+    {
+        run("rm -rf " TEST_DIR "/out && mkdir " TEST_DIR "/out");
+        ret = extractPackage(chunks[i]);
+        if (ret != SWUPDATE_SUCCESS)
+        {
+            printf("FAIL: %zu byte pieces: error %d\n", chunks[i], ret);
+            failed++;
+            continue;
+        }
+        if ((run("cmp " TEST_DIR "/kioskupgrade.tgz " TEST_DIR "/out/kioskupgrade.tgz") < 0) ||
+            (run("diff -r " TEST_DIR "/pkg/usr " TEST_DIR "/out/usr") < 0))
+        {
+            printf("FAIL: %zu byte pieces: extracted files differ\n", chunks[i]);
+            failed++;
+            continue;
+        }
+        printf("PASS: %zu byte pieces\n", chunks[i]);
+    }
+
+    if (!failed)
+    {
+        run("rm -rf " TEST_DIR);
+    }
+    return failed ? 1 : 0;
+}
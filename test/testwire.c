@@ -0,0 +1,264 @@
+//
+// Header negotiation of a new connection, see svsSocketWireHello(). Against svsd, a client offering
+// the compact header uses it in both directions and the server learns the application name once, a
+// client that does not offer it keeps the full header. Against servers emulated here that do not
+// take the compact header (no answer, a refusal, an answer after the client gave up) the client keeps
+// the full header and the message it sends next reaches the server with the full header.
+//
+// usage: testwire
+//
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include <svsLog.h>
+#include <svsErr.h>
+#include <svsCommon.h>
+#include <svsApi.h>
+#include <svsSocket.h>
+#include <libSVS.h>
+
+#include "svssim.h"
+
+#define TEST_APP_NAME       "testwire"
+#define TEST_LINE           "testwire line"
+#define TEST_RECV_MS        2000
+
+typedef enum
+{
+    PEER_SILENT,            // a server that drops the unknown message
+    PEER_REFUSE,            // answers the offer with the full header only
+    PEER_LATE,              // accepts the offer once the client stopped waiting for it
+} peer_mode_t;
+
+static const char *peer_name[] = { "no answer", "refused", "late answer" };
+
+typedef struct
+{
+    peer_mode_t             mode;
+    int                     listenFd;
+    int                     rc;
+    svsSocketMsgHeader_t    next;       // message received after the offer, full header expected
+    uint8_t                 payload[SVS_SOCKET_MSG_PAYLOAD_MAX];
+} peer_t;
+
+//
+// Description:
+// Receives a message sent with the full header.
+//
+static int peerRecv(int fd, svsSocketMsgHeader_t *hdr, uint8_t *payload)
+{
+    if(recv(fd, hdr, sizeof(*hdr), MSG_WAITALL) != sizeof(*hdr))
+    {
+        return(ERR_FAIL);
+    }
+    if((hdr->len > SVS_SOCKET_MSG_PAYLOAD_MAX) ||
+       ((hdr->len > 0) && (recv(fd, payload, hdr->len, MSG_WAITALL) != hdr->len)))
+    {
+        return(ERR_FAIL);
+    }
+
+    return(ERR_PASS);
+}
+
+static void *peerThread(void *arg)
+{
+    peer_t *peer = (peer_t *)arg;
+    struct timeval tv = { TEST_RECV_MS / 1000, 0 };
+    svsSocketMsgHeader_t hdr;
+    uint8_t version;
+    int fd;
+
+    peer->rc = ERR_FAIL;
+    fd = accept(peer->listenFd, 0, 0);
+    if(fd < 0)
+    {
+        return(0);
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    if((peerRecv(fd, &hdr, peer->payload) != ERR_PASS) || (hdr.module_id != MODULE_ID_WIRE))
+    {
+        fprintf(stderr, "testwire: no header offer\n");
+        goto _peerThread;
+    }
+    switch(peer->mode)
+    {
+        case PEER_REFUSE:
+            version = SVS_SOCKET_WIRE_LEGACY;
+            hdr.len = sizeof(version);
+            send(fd, &hdr, sizeof(hdr), MSG_NOSIGNAL);
+            send(fd, &version, sizeof(version), MSG_NOSIGNAL);
+            break;
+
+        case PEER_LATE:
+            usleep((SVS_SOCKET_WIRE_HELLO_TIMEOUT_MS + 100) * 1000);
+            version = SVS_SOCKET_WIRE_V1;
+            hdr.len = sizeof(version);
+            send(fd, &hdr, sizeof(hdr), MSG_NOSIGNAL);
+            send(fd, &version, sizeof(version), MSG_NOSIGNAL);
+            break;
+
+        default:
+            break;
+    }
+
+    // the client must not acknowledge, its next message still has the full header
+    peer->rc = peerRecv(fd, &peer->next, peer->payload);
+
+    _peerThread:
+
+    close(fd);
+
+    return(0);
+}
+
+static int testPeer(peer_mode_t mode)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    uint8_t buf[SVS_SOCKET_WIRE_HDR_MAX];
+    svsSocketMsgHeader_t hdr;
+    uint8_t *data;
+    pthread_t thread;
+    peer_t peer;
+    int fd = -1, failed = 0;
+
+    memset(&peer, 0, sizeof(peer));
+    peer.mode     = mode;
+    peer.listenFd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_addr.s_addr = inet_addr(SVS_SOCKET_SERVER_IP);
+    if((bind(peer.listenFd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || (listen(peer.listenFd, 1) < 0) ||
+       (getsockname(peer.listenFd, (struct sockaddr *)&addr, &addr_len) < 0))
+    {
+        perror("testwire: listen");
+        close(peer.listenFd);
+        return(1);
+    }
+    pthread_create(&thread, 0, peerThread, &peer);
+
+    if(svsSocketClientCreate(SVS_SOCKET_SERVER_IP, ntohs(addr.sin_port), &fd, 0) != ERR_PASS)
+    {
+        printf("FAIL: %s: no connection\n", peer_name[mode]);
+        failed++;
+    }
+    else
+    {
+        memset(&hdr, 0, sizeof(hdr));
+        if(svsSocketWireHdrEncode(fd, &hdr, buf, &data) != sizeof(svsSocketMsgHeader_t))
+        {
+            printf("FAIL: %s: the client uses the compact header\n", peer_name[mode]);
+            failed++;
+        }
+        svsSocketSendLog(fd, LOG_VERBOSITY_INFO, (uint8_t *)TEST_LINE, sizeof(TEST_LINE));
+    }
+    pthread_join(thread, 0);
+
+    if(fd >= 0)
+    {
+        if((peer.rc != ERR_PASS) || (peer.next.module_id != MODULE_ID_LOG) ||
+           (peer.next.len != sizeof(TEST_LINE)) || (strcmp(peer.next.appName, TEST_APP_NAME) != 0) ||
+           (memcmp(peer.payload, TEST_LINE, sizeof(TEST_LINE)) != 0))
+        {
+            printf("FAIL: %s: the next message does not have the full header\n", peer_name[mode]);
+            failed++;
+        }
+        close(fd);
+    }
+    close(peer.listenFd);
+    if(!failed)
+    {
+        printf("PASS: %s: full header\n", peer_name[mode]);
+    }
+
+    return(failed);
+}
+
+//
+// Description:
+// Sends a line to the log server of svsd and checks its echo.
+//
+static int testSvsd(uint8_t version)
+{
+    const char *name = (version == SVS_SOCKET_WIRE_V1) ? "svsd, compact header offered" : "svsd, legacy client";
+    uint8_t buf[SVS_SOCKET_MSG_PAYLOAD_MAX];
+    svsSocketMsgHeader_t hdr;
+    uint8_t *data;
+    int fd, len, failed = 0;
+
+    svsSocketWireVersionSet(version);
+    if(svsSocketClientCreate(SVS_SOCKET_SERVER_IP, SOCKET_PORT_LOG, &fd, 0) != ERR_PASS)
+    {
+        printf("FAIL: %s: no connection\n", name);
+        return(1);
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    len = svsSocketWireHdrEncode(fd, &hdr, buf, &data);
+    if((version == SVS_SOCKET_WIRE_V1) != (len < (int)sizeof(svsSocketMsgHeader_t)))
+    {
+        printf("FAIL: %s: header of %d bytes\n", name, len);
+        failed++;
+    }
+
+    svsSocketSendLog(fd, LOG_VERBOSITY_INFO, (uint8_t *)TEST_LINE, sizeof(TEST_LINE));
+    if((svsSocketRecvMsgDeadline(fd, svsTimeGet_ms() + TEST_RECV_MS, &hdr, buf, sizeof(buf)) != ERR_PASS) ||
+       (hdr.module_id != MODULE_ID_LOG) || (hdr.len != sizeof(TEST_LINE)) || (memcmp(buf, TEST_LINE, hdr.len) != 0))
+    {
+        printf("FAIL: %s: no echo of the line\n", name);
+        failed++;
+    }
+    else if((version == SVS_SOCKET_WIRE_V1) && (strcmp(hdr.appName, "svsd") != 0))
+    {   // the compact header leaves the name out, it is the one sent by the server at connection setup
+        printf("FAIL: %s: echo from \"%s\"\n", name, hdr.appName);
+        failed++;
+    }
+    close(fd);
+    svsSocketWireVersionSet(SVS_SOCKET_WIRE_V1);
+
+    if(!failed)
+    {
+        printf("PASS: %s\n", name);
+    }
+
+    return(failed);
+}
+
+int main(int argc, char *argv[])
+{
+    sim_cfg_t cfg;
+    int failed = 0;
+    pid_t pid;
+
+    simCfgDefault(&cfg);
+    cfg.docks = 2;
+    pid = simStart(&cfg);
+    if(pid < 0)
+    {
+        return(1);
+    }
+    if(simAppInit(TEST_APP_NAME) != ERR_PASS)
+    {
+        simStop(pid);
+        return(1);
+    }
+
+    failed += testSvsd(SVS_SOCKET_WIRE_V1);
+    failed += testSvsd(SVS_SOCKET_WIRE_LEGACY);
+    failed += testPeer(PEER_SILENT);
+    failed += testPeer(PEER_REFUSE);
+    failed += testPeer(PEER_LATE);
+    fflush(stdout);
+
+    simStop(pid);
+
+    return(failed != 0);
+}
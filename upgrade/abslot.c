@@ -0,0 +1,680 @@
+/*
+ * Copyright (C) 2011, 2012 MapleLeaf Software, Inc
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * abslot.c
+ *
+ * Description: A/B slot upgrades.  The new release is extracted to the
+ *              inactive slot by performUpdate() while the station keeps
+ *              running, the activation switches the slot link and
+ *              restarts the station.  The new release is on trial until
+ *              it passes the health check, the previous slot is
+ *              activated again when it does not.  The station downtime
+ *              of each upgrade is measured, from the activation to the
+ *              time svsd reports that all its servers are up again.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "xmlConfig.h"
+#include "upgrademanager.h"
+#include "swupdate.h"
+#include "abslot.h"
+
+typedef struct
+{
+    char active;                // slot activated by the last upgrade or rollback
+    char previous;              // slot to go back to while the active one is on trial
+    int trial;                  // the active slot has not passed the health check yet
+    int attempts;               // starts of the upgrade manager during the trial
+    long long activatedMs;      // time of the activation, 0 once the station is up again
+    long long downtimeMs;       // station downtime of the last upgrade
+    int rollbacks;
+} abSlotState_t;
+
+// Directories of the running release copied to the new slot before it is activated.
+static const char * const abSlotKeepDirs[] = { "usr/scu/etc", "usr/scu/keys", NULL };
+
+static char abSlotRestartCmd[SWUPDATE_MAX_CMD] = SWUPDATE_RESTART_CMD;
+static int abSlotHealthSecs = SWUPDATE_HEALTH_CHECK_SECS;
+
+// Serializes the updates of the state file, made by the main loop and the health check thread.
+static pthread_mutex_t abSlotStateMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t abSlotMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t abSlotCond;     // waits on CLOCK_MONOTONIC, set up by abSlotInit()
+static bool abSlotUp = false;
+
+/*********************************************************
+ * NAME: abSlotNowMs
+ * DESCRIPTION: Returns the wall clock time, the downtime
+ *              is measured across a restart.
+ *
+ * IN:  Nothing.
+ * OUT: Time in milliseconds.
+ *
+ **********************************************************/
+static long long abSlotNowMs(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return ((long long)tv.tv_sec * 1000) + (tv.tv_usec / 1000);
+}
+
+/*********************************************************
+ * NAME: abSlotCurrent
+ * DESCRIPTION: Gets the active slot from the slot link.
+ *
+ * IN:  pSlot pointer to receive the slot, 'a' or 'b'.
+ * OUT: SUCCESS (0), or -1 when the station does not use
+ *      slots.
+ *
+ **********************************************************/
+static int abSlotCurrent(char *pSlot)
+{
+    char target[8];
+    ssize_t len;
+
+    len = readlink(SWUPDATE_SLOT_LINK, target, sizeof(target) - 1);
+    if (len != 1)
+    {
+        return -1;
+    }
+    if ((target[0] != 'a') && (target[0] != 'b'))
+    {
+        return -1;
+    }
+    *pSlot = target[0];
+    return 0;
+}
+
+/*********************************************************
+ * NAME: abSlotStateLoad
+ * DESCRIPTION: Reads the upgrade state file.
+ *
+ * IN:  pState pointer to the state, cleared when there
+ *             is no state file.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+static void abSlotStateLoad(abSlotState_t *pState)
+{
+    FILE *fp;
+    char key[32];
+    char value[32];
+
+    memset(pState, 0, sizeof(abSlotState_t));
+
+    fp = fopen(SWUPDATE_STATE_FILE, "r");
+    if (fp == NULL)
+    {
+        return;
+    }
+    while (fscanf(fp, " %31[^=]=%31s", key, value) == 2)
+    {
+        if (strcmp(key, "active") == 0)
+        {
+            pState->active = value[0];
+        }
+        else if (strcmp(key, "previous") == 0)
+        {
+            pState->previous = value[0];
+        }
+        else if (strcmp(key, "trial") == 0)
+        {
+            pState->trial = atoi(value);
+        }
+        else if (strcmp(key, "attempts") == 0)
+        {
+            pState->attempts = atoi(value);
+        }
+        else if (strcmp(key, "activated") == 0)
+        {
+            pState->activatedMs = atoll(value);
+        }
+        else if (strcmp(key, "downtime") == 0)
+        {
+            pState->downtimeMs = atoll(value);
+        }
+        else if (strcmp(key, "rollbacks") == 0)
+        {
+            pState->rollbacks = atoi(value);
+        }
+    }
+    fclose(fp);
+}
+
+/*********************************************************
+ * NAME: abSlotStateSave
+ * DESCRIPTION: Writes the upgrade state file, replaced
+ *              atomically so that a power loss leaves the
+ *              previous or the new state.
+ *
+ * IN:  pState pointer to the state.
+ * OUT: SUCCESS (0) or -1 on error.
+ *
+ **********************************************************/
+static int abSlotStateSave(abSlotState_t *pState)
+{
+    FILE *fp;
+    int ret = 0;
+    char szTempName[SWUPDATE_MAX_PATH];
+
+    sprintf(szTempName, "%s.tmp", SWUPDATE_STATE_FILE);
+    fp = fopen(szTempName, "w");
+    if (fp == NULL)
+    {
+        printf("[%s] Cannot create %s: %s\n", __func__, szTempName, strerror(errno));
+        return -1;
+    }
+    fprintf(fp, "active=%c\n", pState->active ? pState->active : '-');
+    fprintf(fp, "previous=%c\n", pState->previous ? pState->previous : '-');
+    fprintf(fp, "trial=%d\n", pState->trial);
+    fprintf(fp, "attempts=%d\n", pState->attempts);
+    fprintf(fp, "activated=%lld\n", pState->activatedMs);
+    fprintf(fp, "downtime=%lld\n", pState->downtimeMs);
+    fprintf(fp, "rollbacks=%d\n", pState->rollbacks);
+    if ((fflush(fp) != 0) || (fsync(fileno(fp)) < 0))
+    {
+        ret = -1;
+    }
+    if ((fclose(fp) != 0) || (ret < 0) || (rename(szTempName, SWUPDATE_STATE_FILE) < 0))
+    {
+        printf("[%s] Cannot write %s: %s\n", __func__, SWUPDATE_STATE_FILE, strerror(errno));
+        unlink(szTempName);
+        return -1;
+    }
+    return 0;
+}
+
+/*********************************************************
+ * NAME: abSlotSwitch
+ * DESCRIPTION: Points the slot link to the slot, the link
+ *              is replaced atomically.
+ *
+ * IN:  slot 'a' or 'b'.
+ * OUT: SUCCESS (0) or -1 on error.
+ *
+ **********************************************************/
+static int abSlotSwitch(char slot)
+{
+    char target[2] = { slot, '\0' };
+    char szTempLink[SWUPDATE_MAX_PATH];
+    int fd;
+
+    sprintf(szTempLink, "%s.new", SWUPDATE_SLOT_LINK);
+    unlink(szTempLink);
+    if ((symlink(target, szTempLink) < 0) || (rename(szTempLink, SWUPDATE_SLOT_LINK) < 0))
+    {
+        printf("[%s] Cannot switch to slot %c: %s\n", __func__, slot, strerror(errno));
+        unlink(szTempLink);
+        return -1;
+    }
+
+    // Commit the link before restarting.
+    fd = open(SWUPDATE_SLOTS_DIR, O_RDONLY | O_DIRECTORY);
+    if (fd >= 0)
+    {
+        fsync(fd);
+        close(fd);
+    }
+    return 0;
+}
+
+/*********************************************************
+ * NAME: abSlotRestart
+ * DESCRIPTION: Restarts the station, the restart command
+ *              runs in its own session as it stops svsd
+ *              and the upgrade manager.
+ *
+ * IN:  Nothing.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+static void abSlotRestart(void)
+{
+    pid_t pid;
+
+    sync();
+
+    pid = fork();
+    switch (pid)
+    {
+        case -1:
+            printf("[%s] fork of %s failed\n", __func__, abSlotRestartCmd);
+        break;
+
+        case 0:
+            setsid();
+            execl("/bin/sh", "sh", "-c", abSlotRestartCmd, (char *)NULL);
+            _exit(127);
+        break;
+
+        default:
+        break;
+    }
+}
+
+/*********************************************************
+ * NAME: abSlotRollback
+ * DESCRIPTION: Activates the previous slot again, the new
+ *              release did not pass the health check.
+ *
+ * IN:  pReason pointer to the reason, logged.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+static void abSlotRollback(const char *pReason)
+{
+    abSlotState_t state;
+    char current;
+    int ret;
+
+    pthread_mutex_lock(&abSlotStateMutex);
+    abSlotStateLoad(&state);
+    if ((abSlotCurrent(&current) < 0) || !state.trial ||
+        ((state.previous != 'a') && (state.previous != 'b')))
+    {
+        pthread_mutex_unlock(&abSlotStateMutex);
+        return;
+    }
+
+    printf("[%s] Slot %c %s, going back to slot %c\n", __func__, current, pReason, state.previous);
+
+    state.active = state.previous;
+    state.previous = current;
+    state.trial = 0;
+    state.attempts = 0;
+    state.activatedMs = abSlotNowMs();
+    state.rollbacks++;
+    ret = abSlotStateSave(&state);
+    if (ret == 0)
+    {
+        ret = abSlotSwitch(state.active);
+    }
+    pthread_mutex_unlock(&abSlotStateMutex);
+
+    if (ret == 0)
+    {
+        abSlotRestart();
+    }
+}
+
+/*********************************************************
+ * NAME: abSlotHealthCheck
+ * DESCRIPTION: Runs the health check of the new release,
+ *              the releases without one only need svsd to
+ *              have started all its servers.
+ *
+ * IN:  Nothing.
+ * OUT: true if the release is healthy.
+ *
+ **********************************************************/
+static bool abSlotHealthCheck(void)
+{
+    int ret;
+
+    if (access(SWUPDATE_HEALTH_CHECK_CMD, X_OK) < 0)
+    {
+        return true;
+    }
+
+    ret = system(SWUPDATE_HEALTH_CHECK_CMD);
+    if ((ret == -1) || !WIFEXITED(ret) || (WEXITSTATUS(ret) != 0))
+    {
+        printf("[%s] %s failed: %d\n", __func__, SWUPDATE_HEALTH_CHECK_CMD, ret);
+        return false;
+    }
+    return true;
+}
+
+/*********************************************************
+ * NAME: abSlotHealthThread
+ * DESCRIPTION: Thread function that keeps the new release
+ *              if the station comes up and passes the
+ *              health check in time, or rolls back.
+ *
+ * IN:  arg not used.
+ * OUT: arg.
+ *
+ **********************************************************/
+static void *abSlotHealthThread(void *arg)
+{
+    struct timespec deadline;
+    abSlotState_t state;
+    bool healthy;
+
+    // The clock may be set right after the restart, the trial must not end early.
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += abSlotHealthSecs;
+
+    pthread_mutex_lock(&abSlotMutex);
+    while (!abSlotUp)
+    {
+        if (pthread_cond_timedwait(&abSlotCond, &abSlotMutex, &deadline) == ETIMEDOUT)
+        {
+            break;
+        }
+    }
+    healthy = abSlotUp;
+    pthread_mutex_unlock(&abSlotMutex);
+
+    if (!healthy)
+    {
+        abSlotRollback("did not come up");
+        return arg;
+    }
+    if (!abSlotHealthCheck())
+    {
+        abSlotRollback("failed the health check");
+        return arg;
+    }
+
+    pthread_mutex_lock(&abSlotStateMutex);
+    abSlotStateLoad(&state);
+    state.trial = 0;
+    state.attempts = 0;
+    abSlotStateSave(&state);
+    pthread_mutex_unlock(&abSlotStateMutex);
+    printf("[%s] Slot %c passed the health check\n", __func__, state.active);
+
+    return arg;
+}
+
+/*********************************************************
+ * NAME: abSlotEnabled
+ * DESCRIPTION: Tells if the station runs from the slots.
+ *
+ * IN:  Nothing.
+ * OUT: true if the upgrades use the A/B slots.
+ *
+ **********************************************************/
+bool abSlotEnabled(void)
+{
+    char slot;
+
+    return (abSlotCurrent(&slot) == 0);
+}
+
+/*********************************************************
+ * NAME: abSlotPrepare
+ * DESCRIPTION: Empties the inactive slot for the release
+ *              about to be extracted.  The slot is kept as
+ *              long as the active one is on trial.
+ *
+ * IN:  slotDir pointer to receive the inactive slot
+ *              directory.
+ *      slotDirSize size of slotDir.
+ * OUT: 0 for success or error code on failure.
+ *
+ **********************************************************/
+int abSlotPrepare(char *slotDir, int slotDirSize)
+{
+    abSlotState_t state;
+    char current;
+    char szSystemCmd[SWUPDATE_MAX_CMD];
+    int ret;
+
+    if (abSlotCurrent(&current) < 0)
+    {
+        return ERR_SWUPDATE_FAILURE;
+    }
+    abSlotStateLoad(&state);
+    if (state.trial)
+    {
+        printf("[%s] Slot %c is on trial, upgrade refused\n", __func__, current);
+        return SWUPDATE_IN_PROGRESS;
+    }
+
+    snprintf(slotDir, slotDirSize, "%s/%c", SWUPDATE_SLOTS_DIR, (current == 'a') ? 'b' : 'a');
+    sprintf(szSystemCmd, "rm -rf %s", slotDir);
+    ret = system(szSystemCmd);
+    if ((WEXITSTATUS(ret) != 0) || ((mkdir(slotDir, 0755) < 0) && (errno != EEXIST)))
+    {
+        printf("[%s] Cannot empty %s\n", __func__, slotDir);
+        return ERR_SWUPDATE_NO_DISK_SPACE;
+    }
+    return SWUPDATE_SUCCESS;
+}
+
+/*********************************************************
+ * NAME: abSlotActivate
+ * DESCRIPTION: Activates the slot the new release was
+ *              extracted and verified to: copies the
+ *              configuration, switches the slot link and
+ *              restarts the station.
+ *
+ * IN:  slotDir pointer to the inactive slot directory.
+ * OUT: 0 for success or error code on failure.
+ *
+ **********************************************************/
+int abSlotActivate(const char *slotDir)
+{
+    abSlotState_t state;
+    char current;
+    char szSystemCmd[SWUPDATE_MAX_CMD];
+    struct stat info;
+    int ret;
+    int i;
+
+    if (abSlotCurrent(&current) < 0)
+    {
+        return ERR_SWUPDATE_FAILURE;
+    }
+
+    for (i = 0; abSlotKeepDirs[i]; i++)
+    {
+        sprintf(szSystemCmd, "/%s", abSlotKeepDirs[i]);
+        if (stat(szSystemCmd, &info) < 0)
+        {
+            continue;
+        }
+        sprintf(szSystemCmd, "mkdir -p %s/%s && cp -a /%s/. %s/%s/",
+                slotDir, abSlotKeepDirs[i], abSlotKeepDirs[i], slotDir, abSlotKeepDirs[i]);
+        ret = system(szSystemCmd);
+        if (WEXITSTATUS(ret) != 0)
+        {
+            printf("[%s] Cannot copy /%s to %s: %d\n", __func__, abSlotKeepDirs[i], slotDir, WEXITSTATUS(ret));
+            return ERR_SWUPDATE_NO_DISK_SPACE;
+        }
+    }
+    sync();
+
+    pthread_mutex_lock(&abSlotStateMutex);
+    abSlotStateLoad(&state);
+    state.previous = current;
+    state.active = slotDir[strlen(slotDir) - 1];
+    state.trial = 1;
+    state.attempts = 0;
+    state.activatedMs = abSlotNowMs();
+    if (abSlotStateSave(&state) < 0)
+    {
+        pthread_mutex_unlock(&abSlotStateMutex);
+        return ERR_SWUPDATE_FAILURE;
+    }
+
+    if (abSlotSwitch(state.active) < 0)
+    {
+        state.active = current;
+        state.trial = 0;
+        state.activatedMs = 0;
+        abSlotStateSave(&state);
+        pthread_mutex_unlock(&abSlotStateMutex);
+        return ERR_SWUPDATE_FAILURE;
+    }
+    pthread_mutex_unlock(&abSlotStateMutex);
+
+    printf("[%s] Slot %c activated, restarting\n", __func__, state.active);
+    abSlotRestart();
+
+    return SWUPDATE_SUCCESS;
+}
+
+/*********************************************************
+ * NAME: abSlotRecordActivation
+ * DESCRIPTION: Records the start of a legacy upgrade, for
+ *              its downtime to be measured as well.
+ *
+ * IN:  Nothing.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+void abSlotRecordActivation(void)
+{
+    abSlotState_t state;
+
+    pthread_mutex_lock(&abSlotStateMutex);
+    abSlotStateLoad(&state);
+    state.activatedMs = abSlotNowMs();
+    abSlotStateSave(&state);
+    pthread_mutex_unlock(&abSlotStateMutex);
+}
+
+/*********************************************************
+ * NAME: abSlotStationUp
+ * DESCRIPTION: Called when svsd reports that all its
+ *              servers are up: ends the downtime measurement
+ *              of the last upgrade and starts the health
+ *              check.
+ *
+ * IN:  Nothing.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+void abSlotStationUp(void)
+{
+    abSlotState_t state;
+    bool up;
+
+    pthread_mutex_lock(&abSlotMutex);
+    up = abSlotUp;
+    abSlotUp = true;
+    pthread_mutex_unlock(&abSlotMutex);
+    if (up)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&abSlotStateMutex);
+    abSlotStateLoad(&state);
+    if (state.activatedMs != 0)
+    {
+        state.downtimeMs = abSlotNowMs() - state.activatedMs;
+        state.activatedMs = 0;
+        abSlotStateSave(&state);
+        printf("[%s] Station downtime for the upgrade: %lld ms\n", __func__, state.downtimeMs);
+    }
+    pthread_mutex_unlock(&abSlotStateMutex);
+
+    pthread_mutex_lock(&abSlotMutex);
+    pthread_cond_signal(&abSlotCond);
+    pthread_mutex_unlock(&abSlotMutex);
+}
+
+/*********************************************************
+ * NAME: abSlotInit
+ * DESCRIPTION: Called at startup, starts the health check
+ *              of a release on trial, rolls back a release
+ *              that keeps restarting.
+ *
+ * IN:  Nothing.
+ * OUT: SUCCESS (0) or error.
+ *
+ **********************************************************/
+int abSlotInit(void)
+{
+    abSlotState_t state;
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_condattr_t condAttr;
+    char current;
+    int ret;
+
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&abSlotCond, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+
+    xmlConfigModuleParamStrGet("upgrademanager", "restartcmd", SWUPDATE_RESTART_CMD,
+                               abSlotRestartCmd, sizeof(abSlotRestartCmd));
+    xmlConfigParamIntGet("upgrademanager", "healthchecksecs", SWUPDATE_HEALTH_CHECK_SECS, &abSlotHealthSecs);
+
+    if (abSlotCurrent(&current) < 0)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&abSlotStateMutex);
+    abSlotStateLoad(&state);
+    if (state.trial && (state.active != current))
+    {
+        // Stopped between the state update and the switch, still on the previous slot.
+        state.active = current;
+        state.trial = 0;
+        state.activatedMs = 0;
+        abSlotStateSave(&state);
+    }
+    if (state.trial)
+    {
+        state.attempts++;
+        abSlotStateSave(&state);
+    }
+    pthread_mutex_unlock(&abSlotStateMutex);
+
+    if (!state.trial)
+    {
+        return 0;
+    }
+    if (state.attempts > SWUPDATE_SLOT_MAX_STARTS)
+    {
+        abSlotRollback("keeps restarting");
+        return 0;
+    }
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, abSlotHealthThread, NULL);
+    pthread_attr_destroy(&attr);
+
+    return ret;
+}
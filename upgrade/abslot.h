@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2011, 2012 MapleLeaf Software, Inc
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * abslot.h
+ *
+ * Description: Header file for the A/B slot upgrades.
+ *
+ *              The release runs from one of two slots, /usr/scu is a
+ *              link to SWUPDATE_SLOT_LINK/usr/scu and SWUPDATE_SLOT_LINK
+ *              is a link to the active slot, "a" or "b".  A new release
+ *              is extracted to the inactive slot while the station runs,
+ *              the upgrade only switches the link and restarts.  The
+ *              legacy upgrade script is used when the links are not there.
+ */
+
+#ifndef __ABSLOT_H__
+#define __ABSLOT_H__
+
+#define SWUPDATE_SLOTS_DIR "/slots"
+#define SWUPDATE_SLOT_LINK SWUPDATE_SLOTS_DIR"/current"
+
+// Upgrade state, kept outside of the slots and of /usr/scu.
+#define SWUPDATE_STATE_FILE "/sysrecovery/upgrade.state"
+
+// Run from the new release when it ships one, must exit with 0 for the release to be kept.
+#define SWUPDATE_HEALTH_CHECK_CMD "/usr/scu/bin/healthcheck"
+
+// Restarts scu and svsd on the new slot, "restartcmd" in the upgrademanager configuration.
+#define SWUPDATE_RESTART_CMD "/etc/init.d/scu restart"
+
+// Time given to the new release to come up and pass the health check, "healthchecksecs" in the configuration.
+#define SWUPDATE_HEALTH_CHECK_SECS 120
+
+// Starts of the upgrade manager on a new release not yet healthy before going back to the previous one.
+#define SWUPDATE_SLOT_MAX_STARTS 3
+
+extern int abSlotInit(void);
+extern bool abSlotEnabled(void);
+extern int abSlotPrepare(char *slotDir, int slotDirSize);
+extern int abSlotActivate(const char *slotDir);
+extern void abSlotRecordActivation(void);
+extern void abSlotStationUp(void);
+
+#endif /* __ABSLOT_H__ */
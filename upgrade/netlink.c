@@ -60,6 +60,7 @@
 #include "netlink.h"
 #include "upgrademanager.h"
 #include "swupdate.h"
+#include "usbstage.h"
 
 // How long to wait for the USB drive mount to happen
 #define MOUNT_TIMEOUT_SECS 10
@@ -267,7 +268,6 @@ bool isMountComplete(char *pDiskName, char *pMountPoint)
 void process_netlink_uevent_message(int fd)
 {
     char buf[UEVENT_BUFFER_SIZE*2];
-    int ret;
     ssize_t buflen;
     ssize_t keys;
     const char *action, *subsys;
@@ -290,201 +290,39 @@ void process_netlink_uevent_message(int fd)
 
     if (strcmp(subsys, "block") == 0)
     {
-        char szSystemCmd[256];
         char szWorkBuffer[256];
-        int rc;
 
-        if (strcmp(action, "add") == 0)
+        devpath = search_key("DEVPATH", &buf[keys], buflen);
+        devname = search_key("DEVNAME", &buf[keys], buflen);
+        if (devname == NULL)
         {
-            devpath = search_key("DEVPATH", &buf[keys], buflen);
-            devname = search_key("DEVNAME", &buf[keys], buflen);
-
-            // Build the dev path for the block device.
-            strcpy(szWorkBuffer, "/dev/");
-            strcat(szWorkBuffer, devname);
+            return;
+        }
 
-            /*
-            *   Check to see if this USB disk device has an upgrade file
-            *   on it.  If it is not yet mounted then we will need to mount
-            *   the device.
-            */
+        // Build the dev path for the block device.
+        snprintf(szWorkBuffer, sizeof(szWorkBuffer), "/dev/%s", devname);
 
-            strcpy(szDiskName, szWorkBuffer);
+        /*
+        *   The mount, the copy of the upgrade package and the upgrade
+        *   are done by the USB staging worker, we only pass it the
+        *   notification.
+        */
+        if (strcmp(action, "add") == 0)
+        {
 #ifdef DEBUG
-            printf("%s: added disk dev node %s\n", __func__, szDiskName);
+            printf("%s: added disk dev node %s\n", __func__, szWorkBuffer);
 #endif
-            /*
-            *   See if we have the disk mounted
-            */
-
             // Do I need to find a better way?  In testing it is sd(x)1 for the
             // partition.
-            if(strchr(szDiskName, '1') != NULL)
+            if(strchr(szWorkBuffer, '1') != NULL)
             {
-                sleep(2);
-                
                 // Only try to mount and process if we have the partition, not the entire disk.
-                sprintf(szSystemCmd, "mount %s %s >/dev/null 2>&1", szDiskName,
-                        SWUPDATE_MOUNT_POINT);
-
-#ifdef DEBUG
-                printf("%s: running %s\n", __func__, szSystemCmd);
-#endif
-                ret = system(szSystemCmd);
-#ifdef DEBUG
-                printf("%s: system returned %d\n", __func__, ret);
-#endif
-
-                ret = WEXITSTATUS(ret);
-
-                // Expand test later, e.g. 32 is mount failed, but any non-zero
-                // means the mount didn't succeed so try unmounting and remount.
-                if (ret != 0)
-                {
-#ifdef DEBUG
-                    printf("%s: mount error in USB upgrade: %d...retrying.\n", __func__, ret);
-#endif
-                    // Try to unmount the
-                    sprintf(szSystemCmd, "umount %s >/dev/null 2>&1", szDiskName);
-                    ret = system(szSystemCmd);
-
-                    ret = WEXITSTATUS(ret);
-                    if(ret)
-                    {
-                        // Test and log if error
-#ifdef DEBUG
-                        printf("%s: umount error in USB upgrade: %d\n", __func__, ret);
-#endif
-                    }
-
-                    // Now try to mount again, if still and error then
-                    // log it and move on.
-                    sprintf(szSystemCmd, "mount %s %s >/dev/null 2>&1", szDiskName,
-                            SWUPDATE_MOUNT_POINT);
-
-                    ret = system(szSystemCmd);
-
-                    ret = WEXITSTATUS(ret);
-                    if (ret)
-                    {
-                        // Test and log if error
-#ifdef DEBUG
-                        printf("%s: mount error on retry of mount in USB upgrade: %d\n", __func__, ret);
-#endif
-                    }
-                }
-
-#ifdef DEBUG
-                printf("%s: checking mount status...\n", __func__);
-#endif
-                bDiskDeviceMounted = isMountComplete(szDiskName, SWUPDATE_MOUNT_POINT);
-
-#ifdef DEBUG
-                printf("%s: mount status %s\n", __func__, bDiskDeviceMounted ? "true":"false");
-#endif
-                if (!bDiskDeviceAttached && bDiskDeviceMounted)
-                {
-                    // Check for the upgrade package file.
-#ifdef DEBUG
-                    printf("%s: checking for package\n", __func__);
-#endif
-                    rc = isSoftwareUpdatePackagePresent();
-                    if (rc == true)
-                    {
-                        char szUpgradePackageName[256];
-                        sprintf(szUpgradePackageName, "%s%s", SWUPDATE_MOUNT_POINT,
-                                SWUPDATE_PACKAGE_FILENAME);
-
-#ifdef DEBUG
-                        printf("%s: package found...kicking off update\n", __func__);
-#endif
-                        // Kick off the software update process, this will check versions, and
-                        // do the upgrade if appropriate.
-                        performUpdate(szUpgradePackageName);
-                        // Unmount the drive to commit any changes.
-                        sprintf(szSystemCmd, "umount %s >/dev/null 2>&1", szDiskName);
-
-                        ret = system(szSystemCmd);
-
-                        ret = WEXITSTATUS(ret);
-                        if(ret)
-                        {
-                            // Test and log if error
-                            printf("umount error after software upgrade: %d\n", ret);
-                        }
-
-                         // Mark as unmounted and not attached.
-                        bDiskDeviceMounted = false;
-                   }
-                   else
-                   {
-                        // Did not find an upgrade package.
-                        // Copy log files from the system to the USB drive.
-#define LOGFILES_PATHNAME "/usr/scu/logs"
-                        sprintf(szSystemCmd, "cp -r %s %s", LOGFILES_PATHNAME, SWUPDATE_MOUNT_POINT);
-                        ret = system(szSystemCmd);
-
-                        ret = WEXITSTATUS(ret);
-                        if(ret)
-                        {
-                            // Error copying log files
-                            // Log the error and return.
-                            printf("cp error copying of log files: %d\n", ret);
-                        }
-
-                        // Unmount the USB drive, commit the files.
-                        sprintf(szSystemCmd, "umount %s >/dev/null 2>&1", szDiskName);
-
-                        ret = system(szSystemCmd);
-                        ret = WEXITSTATUS(ret);
-                        if(ret)
-                        {
-                            // Test and log if error
-                            printf("umount error after copy of log files: %d\n", ret);
-                        }
-
-                         // Mark as unmounted and not attached.
-                        bDiskDeviceMounted = false;
-                    }
-                }
-
-                bDiskDeviceAttached = true;
+                usbStageAttached(szWorkBuffer);
             }
-
         } // End if add action
         else if (strcmp(action, "remove") == 0)
         {
-            devpath = search_key("DEVPATH", &buf[keys], buflen);
-            devname = search_key("DEVNAME", &buf[keys], buflen);
-
-            if(bDiskDeviceAttached)
-            {
-                // See if this is the device that we attached earlier
-                strcpy(szWorkBuffer, "/dev/");
-                strcat(szWorkBuffer, devname);
-
-                if(strcmp(szWorkBuffer, szDiskName) == 0)
-                {
-#ifdef DEBUG
-printf("%s: unmounting %s\n", __func__, szDiskName);
-#endif
-                    // If we are mounted umount
-                    sprintf(szSystemCmd, "umount %s >/dev/null 2>&1", szDiskName);
-
-                    ret = system(szSystemCmd);
-
-                    ret = WEXITSTATUS(ret);
-                    if (ret)
-                    {
-                        printf("umount failed on remove of USB drive, may be normal\n");
-                        // Test and log if error
-                    }
-
-                    // Mark as unmounted and not attached.
-                    bDiskDeviceAttached = false;
-                    bDiskDeviceMounted = false;
-                }
-            }
+            usbStageRemoved(szWorkBuffer);
         }
     } // End subsystem is block
 }
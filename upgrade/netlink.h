@@ -41,5 +41,7 @@
 extern int init_netlink_uevent_socket( void );
 extern void process_netlink_uevent_message( int fd );
 extern int scanForConnectedPods(void);
+extern bool isSoftwareUpdatePackagePresent(void);
+extern bool isMountComplete(char *pDiskName, char *pMountPoint);
 
 #endif /* __NETLINK_H__ */
@@ -37,6 +37,7 @@
 #include <string.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
 
 #include <sys/mman.h>
 #include <sys/ioctl.h>
@@ -49,11 +50,19 @@
 #include "common.h"
 #include "zlib.h"
 
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/provider.h>
+#endif
+
 #include "xmlparser.h"
 #include "log.h"
 
 #include "upgradedatadefs.h"
 #include "swupdate.h"
+#include "abslot.h"
 
 #define logError(fmt,args...)       (logOutput(LOG_VERBOSITY_ERROR, __FILE__, __FUNCTION__, __LINE__, fmt, ##args))
 #define logWarning(fmt,args...)     (logOutput(LOG_VERBOSITY_WARNING, __FILE__, __FUNCTION__, __LINE__, fmt, ##args))
@@ -471,99 +480,729 @@ int versionCompare(const char *passedVersion1, const char *passedVersion2)
 
 
 /***********************************************************
- * NAME: decryptPackage()
- * DESCRIPTION: Decrypts the passed in file, places the file
- *              in the passed in location with the passed in
- *              file name.
- *
+ * NAME: decryptSecretKey()
+ * DESCRIPTION: Decrypts the secret key of the package with
+ *              the RSA private key.  The key is only kept in
+ *              memory, it used to be written to DECRYPT_KEY.
  *
- * IN:  Pointer to pathname of encrypted package file
- *      Pointer to path where decrypted package file will be
- *      placed.
+ * IN:  Pointer to buffer receiving the secret key
+ *      Pointer to its size, set on return to the length of
+ *      the password "openssl enc" would read from it
  *
  * OUT: 0 on success, error code otherwise
  ***********************************************************/
-int decryptPackage(const char *encryptedPackage,
-                   const char *decryptedPackagePath)
+static int decryptSecretKey(uint8_t *secret, size_t *secretLen)
 {
     int retval = SWUPDATE_SUCCESS;
-    char sysCmd[SWUPDATE_MAX_CMD];
-
-    struct stat info;
+    FILE *fp;
+    size_t len;
+    uint8_t encrypted[SWUPDATE_KEY_MAX];
+    EVP_PKEY *pkey = NULL;
+    EVP_PKEY_CTX *ctx = NULL;
 
     /*
     *   Verify that we have the private and encrypted secret keys
     *   present on the frame.  By definition in the design these
     *   keys are located in the /usr/scu/keys subdirectory.
     */
-
-    retval = stat(PRIV_KEY, &info);
-    if (retval)
+    fp = fopen(PRIV_KEY, "r");
+    if (fp == NULL)
     {
         printSwErrorMsg(ERR_SWUPDATE_PRIV_KEY, __func__, __LINE__);
         return ERR_SWUPDATE_PRIV_KEY;
     }
+    pkey = PEM_read_PrivateKey(fp, NULL, NULL, NULL);
+    fclose(fp);
+    if (pkey == NULL)
+    {
+        logInfo("%s-%d: Cannot read private key %s",__func__, __LINE__, PRIV_KEY);
+        return ERR_SWUPDATE_PRIV_KEY;
+    }
 
-    retval = stat(SECRET_KEY, &info);
-    if (retval)
+    fp = fopen(SECRET_KEY, "rb");
+    if (fp == NULL)
     {
-        printSwErrorMsg(ERR_SWUPDATE_PRIV_KEY, __func__, __LINE__);
-        return ERR_SWUPDATE_PRIV_KEY ;
+        printSwErrorMsg(ERR_SWUPDATE_SECRET_KEY, __func__, __LINE__);
+        retval = ERR_SWUPDATE_SECRET_KEY;
+        goto Error1;
+    }
+    len = fread(encrypted, 1, sizeof(encrypted), fp);
+    fclose(fp);
+
+    // Same as "openssl rsautl -decrypt", PKCS#1 v1.5 padding
+    ctx = EVP_PKEY_CTX_new(pkey, NULL);
+    if ((ctx == NULL) ||
+        (EVP_PKEY_decrypt_init(ctx) <= 0) ||
+        (EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_PADDING) <= 0) ||
+        (EVP_PKEY_decrypt(ctx, secret, secretLen, encrypted, len) <= 0))
+    {
+        logInfo("%s-%d: Failed to DECRYPT SECRET KEY",__func__, __LINE__);
+        retval = ERR_SWUPDATE_DECRYPTION;
+    }
+    else
+    {
+        // "openssl enc -pass file:" only uses the first line, without its newline, as a string
+        for (len = 0; (len < *secretLen) && (secret[len] != '\n') && (secret[len] != '\0'); len++)
+        {
+        }
+        *secretLen = len;
     }
 
-    /* Build command to decrypt the encrypted private key using the RSA private key */
-    sprintf(sysCmd, "openssl rsautl -decrypt -inkey %s -in %s -out %s", PRIV_KEY, SECRET_KEY, DECRYPT_KEY);
+Error1:
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(pkey);
 
-    retval = system(sysCmd);
-    if (retval)
+    return retval;
+}
+
+/*
+*   The package is processed in a single pass, each stage pushes
+*   its output to the next one:
+*
+*   read -> CRC32 -> blowfish decrypt -> gunzip -> untar (outer)
+*                                                   |
+*                    kioskupgrade.tgz entry  <------+
+*                           |
+*                           +-> gunzip -> untar (inner) -> needed entries
+*
+*   Only SWUPDATE_STREAM_BUFSZ sized buffers are used whatever the
+*   package size, and nothing but the extracted files is written.
+*/
+#define TAR_BLOCK_SIZE      512
+#define TAR_END_BLOCKS      2
+#define TAR_NAME_MAX        (155 + 1 + 100 + 1)     // ustar prefix, '/', name and NUL
+
+typedef struct gzStream gzStream_t;
+
+typedef struct
+{
+    uint8_t header[TAR_BLOCK_SIZE];
+    uint32_t headerLen;             // bytes of the current header received
+    uint64_t remaining;             // data bytes left in the current entry
+    uint32_t padding;               // bytes to skip up to the next header
+    int fd;                         // file of the current entry, -1 when not extracted
+    bool longName;                  // the current entry is the name of the next one (GNU tar)
+    char nextName[MAX_FILENAME_SIZE];
+    uint32_t nextNameLen;
+    int endBlocks;                  // zero blocks, TAR_END_BLOCKS end the archive
+    const char *destDir;
+    const char * const *only;       // entries to extract, NULL for all of them
+    const char *nestedName;         // entry also streamed to nested
+    gzStream_t *nested;
+    bool inNested;
+} tarStream_t;
+
+struct gzStream
+{
+    z_stream zs;
+    bool init;
+    bool done;                      // end of the gzip stream, anything after is ignored
+    tarStream_t *tar;
+    uint8_t out[SWUPDATE_STREAM_BUFSZ];
+};
+
+typedef struct
+{
+    EVP_CIPHER_CTX *ctx;
+    uint8_t secret[SWUPDATE_KEY_MAX];
+    size_t secretLen;
+    uint8_t salt[PKCS5_SALT_LEN * 2];   // "Salted__" and the salt written by "openssl enc"
+    uint32_t saltLen;
+    bool started;
+    gzStream_t *gz;
+    uint8_t out[SWUPDATE_STREAM_BUFSZ + EVP_MAX_BLOCK_LENGTH];
+} decryptStream_t;
+
+typedef struct
+{
+    uint8_t in[SWUPDATE_STREAM_BUFSZ];
+    decryptStream_t decrypt;
+    gzStream_t outerGz;
+    tarStream_t outerTar;
+    gzStream_t innerGz;
+    tarStream_t innerTar;
+} swStream_t;
+
+static int gzWrite(gzStream_t *gz, const uint8_t *data, size_t len);
+
+/***********************************************************
+ * NAME: makeParentDirs()
+ * DESCRIPTION: Creates the directories leading to path,
+ *              same as "mkdir -p $(dirname path)".
+ *
+ * IN:  Pointer to file pathname
+ *
+ * OUT: 0 on success, -1 otherwise
+ ***********************************************************/
+static int makeParentDirs(const char *path)
+{
+    char tmpPath[MAX_FILENAME_SIZE + SWUPDATE_MAX_PATH];
+    char *pos;
+
+    strncpy(tmpPath, path, sizeof(tmpPath) - 1);
+    tmpPath[sizeof(tmpPath) - 1] = '\0';
+
+    for (pos = strchr(tmpPath + 1, '/'); pos; pos = strchr(pos + 1, '/'))
     {
-        logInfo("%s-%d: Failed to DECRYPT SECRET KEY",__func__, __LINE__);
-        printSwErrorMsg(ERR_SWUPDATE_DECRYPTION, __func__, __LINE__);
-        return retval;
+        *pos = '\0';
+        if ((mkdir(tmpPath, 0755) < 0) && (errno != EEXIST))
+        {
+            logInfo("%s-%d: mkdir %s: %s", __func__, __LINE__, tmpPath, strerror(errno));
+            return -1;
+        }
+        *pos = '/';
     }
+    return 0;
+}
 
-    /*
-    *   Make sure that the key is only readable by the owner
-    *   May be overkill for embedded use, so can disuss
-    *   removing.
-    */
-    sprintf(sysCmd, "chmod 600 %s", DECRYPT_KEY);
-    retval = system(sysCmd);
-    if (retval)
+/***********************************************************
+ * NAME: tarOctal()
+ * DESCRIPTION: Converts a numeric field of a tar header,
+ *              octal or GNU base-256 for large values.
+ *
+ * IN:  Pointer to the field
+ *      Field length
+ *
+ * OUT: Field value
+ ***********************************************************/
+static uint64_t tarOctal(const uint8_t *field, int len)
+{
+    uint64_t value = 0;
+    int i = 0;
+
+    if (field[0] & 0x80)
     {
-        printf("chmod 600 of decrypt key returned %d\n", retval);
-        // Log and handle error.
+        // base-256, the first byte only flags it
+        value = field[0] & 0x3f;
+        for (i = 1; i < len; i++)
+        {
+            value = (value << 8) | field[i];
+        }
+        return value;
     }
 
-    // Need to make sure that the decrypted Package Path exists
-    sprintf(sysCmd, "mkdir -p %s", decryptedPackagePath);
-    retval = system(sysCmd);
+    while ((i < len) && (field[i] == ' '))
+    {
+        i++;
+    }
+    while ((i < len) && (field[i] >= '0') && (field[i] <= '7'))
+    {
+        value = (value << 3) | (field[i] - '0');
+        i++;
+    }
+    return value;
+}
 
-    /* Build command to decrypt the packge wrapper and extract the package file using the decrypted secret key */
-    sprintf(sysCmd, "dd if=%s|openssl enc -d -blowfish -pass file:%s|tar xzf - -C %s", encryptedPackage,
-            DECRYPT_KEY, decryptedPackagePath);
-    retval = system(sysCmd);
-    if (retval)
+/***********************************************************
+ * NAME: tarEntryName()
+ * DESCRIPTION: Removes the "./" and "/" prefixes of an entry
+ *              name, names going out of the destination
+ *              directory are refused.
+ *
+ * IN:  Pointer to entry name
+ *
+ * OUT: true if the name can be used
+ ***********************************************************/
+static bool tarEntryName(char *name)
+{
+    char *pos;
+
+    while ((strncmp(name, "./", 2) == 0) || (name[0] == '/'))
     {
-        logInfo("%s-%d: Failed to DECRYPT package file %s to %s",__func__, __LINE__, encryptedPackage, decryptedPackagePath);
-        retval = ERR_SWUPDATE_DECRYPTION;
-        printSwErrorMsg(retval, __func__, __LINE__);
-        goto Error1;
+        int skip = (name[0] == '/') ? 1 : 2;
+
+        memmove(name, name + skip, strlen(name + skip) + 1);
+    }
+    for (pos = name; pos; pos = strchr(pos, '/'))
+    {
+        if (*pos == '/')
+        {
+            pos++;
+        }
+        if ((strncmp(pos, "..", 2) == 0) && ((pos[2] == '/') || (pos[2] == '\0')))
+        {
+            logInfo("%s-%d: Entry %s ignored", __func__, __LINE__, name);
+            return false;
+        }
     }
+    return (name[0] != '\0');
+}
 
-    /*
-    *   The calling function will be attempting to extract the package contents, so if there was
-    *   some kind of failure that was not detected during decryption, e.g. a badly built package
-    *   the extraction process will return a failure code.  So we do not need to jump though the
-    *   hoops here to use tar -t to test the decrypted and extracted package file..
-    */
+/***********************************************************
+ * NAME: tarEntrySelected()
+ * DESCRIPTION: Tells if an entry has to be extracted.
+ *
+ * IN:  Pointer to tar stream
+ *      Pointer to entry name
+ *
+ * OUT: true if the entry is extracted
+ ***********************************************************/
+static bool tarEntrySelected(tarStream_t *tar, const char *name)
+{
+    int i;
 
-Error1:
-    unlink(DECRYPT_KEY);
+    if (tar->only == NULL)
+    {
+        return true;
+    }
+    for (i = 0; tar->only[i]; i++)
+    {
+        if (strcmp(name, tar->only[i]) == 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+/***********************************************************
+ * NAME: tarHeader()
+ * DESCRIPTION: Processes a complete tar header, creates the
+ *              file of the entry when it is extracted.
+ *
+ * IN:  Pointer to tar stream
+ *
+ * OUT: 0 on success, error code otherwise
+ ***********************************************************/
+static int tarHeader(tarStream_t *tar)
+{
+    int i;
+    uint32_t sum = 0;
+    uint64_t size;
+    mode_t mode;
+    char type;
+    char name[TAR_NAME_MAX];
+    char path[TAR_NAME_MAX + SWUPDATE_MAX_PATH];
+    char linkName[MAX_FILENAME_SIZE];
+    uint8_t *hdr = tar->header;
+
+    for (i = 0; i < TAR_BLOCK_SIZE; i++)
+    {
+        sum += hdr[i];
+    }
+    if (sum == 0)
+    {
+        tar->endBlocks++;
+        return SWUPDATE_SUCCESS;
+    }
+    if (tar->endBlocks >= TAR_END_BLOCKS)
+    {
+        // data after the end of the archive, padding to the record size
+        return SWUPDATE_SUCCESS;
+    }
+    tar->endBlocks = 0;
+
+    // the checksum is computed with its own field filled with spaces
+    for (i = 148; i < 156; i++)
+    {
+        sum = sum - hdr[i] + ' ';
+    }
+    if (sum != tarOctal(&hdr[148], 8))
+    {
+        logInfo("%s-%d: Bad tar header checksum", __func__, __LINE__);
+        return ERR_SWUPDATE_EXTRACTION;
+    }
+
+    size = tarOctal(&hdr[124], 12);
+    mode = tarOctal(&hdr[100], 8) & 07777;
+    type = hdr[156];
+
+    if (tar->nextNameLen)
+    {
+        // GNU long name given by the previous entry
+        snprintf(name, sizeof(name), "%s", tar->nextName);
+        tar->nextNameLen = 0;
+    }
+    else if ((memcmp(&hdr[257], "ustar", 5) == 0) && hdr[345])
+    {
+        snprintf(name, sizeof(name), "%.155s/%.100s", (char *)&hdr[345], (char *)&hdr[0]);
+    }
+    else
+    {
+        snprintf(name, sizeof(name), "%.100s", (char *)&hdr[0]);
+    }
+
+    tar->remaining = size;
+    tar->padding = (TAR_BLOCK_SIZE - (size % TAR_BLOCK_SIZE)) % TAR_BLOCK_SIZE;
+    tar->fd = -1;
+    tar->longName = false;
+    tar->inNested = false;
+
+    if (type == 'L')
+    {
+        if (size >= sizeof(tar->nextName))
+        {
+            logInfo("%s-%d: Entry name too long", __func__, __LINE__);
+            return ERR_SWUPDATE_EXTRACTION;
+        }
+        tar->longName = true;
+        return SWUPDATE_SUCCESS;
+    }
+
+    if (!tarEntryName(name))
+    {
+        return SWUPDATE_SUCCESS;
+    }
+    if (((type == '0') || (type == '\0') || (type == '7')) && tar->nestedName && (strcmp(name, tar->nestedName) == 0))
+    {
+        tar->inNested = true;
+    }
+    if (!tarEntrySelected(tar, name))
+    {
+        return SWUPDATE_SUCCESS;
+    }
+
+    if (snprintf(path, sizeof(path), "%s/%s", tar->destDir, name) >= (int)sizeof(path))
+    {
+        logInfo("%s-%d: Path too long for %s", __func__, __LINE__, name);
+        return ERR_SWUPDATE_EXTRACTION;
+    }
+    if (makeParentDirs(path) < 0)
+    {
+        return ERR_SWUPDATE_EXTRACTION;
+    }
+
+    switch (type)
+    {
+        case '0':
+        case '\0':
+        case '7':
+            unlink(path);
+            tar->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, mode ? mode : 0644);
+            if (tar->fd < 0)
+            {
+                logInfo("%s-%d: Cannot create %s: %s", __func__, __LINE__, path, strerror(errno));
+                return ERR_SWUPDATE_EXTRACTION;
+            }
+            break;
+
+        case '5':
+            if ((mkdir(path, mode ? mode : 0755) < 0) && (errno != EEXIST))
+            {
+                logInfo("%s-%d: mkdir %s: %s", __func__, __LINE__, path, strerror(errno));
+                return ERR_SWUPDATE_EXTRACTION;
+            }
+            break;
 
+        case '1':
+        case '2':
+            snprintf(linkName, sizeof(linkName), "%.100s", (char *)&hdr[157]);
+            unlink(path);
+            if (type == '2')
+            {
+                i = symlink(linkName, path);
+            }
+            else
+            {
+                char target[MAX_FILENAME_SIZE + SWUPDATE_MAX_PATH];
+
+                if (!tarEntryName(linkName))
+                {
+                    return ERR_SWUPDATE_EXTRACTION;
+                }
+                snprintf(target, sizeof(target), "%s/%s", tar->destDir, linkName);
+                i = link(target, path);
+            }
+            if (i < 0)
+            {
+                logInfo("%s-%d: Cannot link %s: %s", __func__, __LINE__, path, strerror(errno));
+                return ERR_SWUPDATE_EXTRACTION;
+            }
+            break;
+
+        default:
+            // devices, fifos, pax headers... are not part of a package
+            break;
+    }
+    return SWUPDATE_SUCCESS;
+}
+
+/***********************************************************
+ * NAME: tarWrite()
+ * DESCRIPTION: Untars the data, in pieces of any size.
+ *
+ * IN:  Pointer to tar stream
+ *      Pointer to data
+ *      Data length
+ *
+ * OUT: 0 on success, error code otherwise
+ ***********************************************************/
+static int tarWrite(tarStream_t *tar, const uint8_t *data, size_t len)
+{
+    int retval = SWUPDATE_SUCCESS;
+    size_t n;
+
+    while (len > 0)
+    {
+        if (tar->remaining > 0)
+        {
+            n = (len < tar->remaining) ? len : tar->remaining;
+            if ((tar->fd >= 0) && (write(tar->fd, data, n) != (ssize_t)n))
+            {
+                logInfo("%s-%d: write: %s", __func__, __LINE__, strerror(errno));
+                return ERR_SWUPDATE_NO_TMPSPACE;
+            }
+            if (tar->longName)
+            {
+                memcpy(&tar->nextName[tar->nextNameLen], data, n);
+                tar->nextNameLen += n;
+                tar->nextName[tar->nextNameLen] = '\0';
+            }
+            if (tar->inNested)
+            {
+                retval = gzWrite(tar->nested, data, n);
+                if (retval)
+                {
+                    return retval;
+                }
+            }
+            data += n;
+            len -= n;
+            tar->remaining -= n;
+            if ((tar->remaining == 0) && (tar->fd >= 0))
+            {
+                close(tar->fd);
+                tar->fd = -1;
+            }
+            continue;
+        }
+
+        if (tar->padding > 0)
+        {
+            n = (len < tar->padding) ? len : tar->padding;
+            data += n;
+            len -= n;
+            tar->padding -= n;
+            continue;
+        }
+
+        n = TAR_BLOCK_SIZE - tar->headerLen;
+        n = (len < n) ? len : n;
+        memcpy(&tar->header[tar->headerLen], data, n);
+        tar->headerLen += n;
+        data += n;
+        len -= n;
+        if (tar->headerLen == TAR_BLOCK_SIZE)
+        {
+            tar->headerLen = 0;
+            retval = tarHeader(tar);
+            if (retval)
+            {
+                return retval;
+            }
+        }
+    }
+    return retval;
+}
+
+/***********************************************************
+ * NAME: gzWrite()
+ * DESCRIPTION: Gunzips the data and passes it to the tar
+ *              stream.
+ *
+ * IN:  Pointer to gzip stream
+ *      Pointer to data
+ *      Data length
+ *
+ * OUT: 0 on success, error code otherwise
+ ***********************************************************/
+static int gzWrite(gzStream_t *gz, const uint8_t *data, size_t len)
+{
+    int retval = SWUPDATE_SUCCESS;
+    int ret;
+
+    if (!gz->init)
+    {
+        if (inflateInit2(&gz->zs, 16 + MAX_WBITS) != Z_OK)
+        {
+            return ERR_SWUPDATE_OUT_OF_MEMORY;
+        }
+        gz->init = true;
+    }
+
+    gz->zs.next_in = (Bytef *)data;
+    gz->zs.avail_in = len;
+    while (!gz->done)
+    {
+        gz->zs.next_out = gz->out;
+        gz->zs.avail_out = sizeof(gz->out);
+        ret = inflate(&gz->zs, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END)
+        {
+            gz->done = true;
+        }
+        else if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+        {
+            logInfo("%s-%d: inflate: %d", __func__, __LINE__, ret);
+            return ERR_SWUPDATE_EXTRACTION;
+        }
+
+        retval = tarWrite(gz->tar, gz->out, sizeof(gz->out) - gz->zs.avail_out);
+        if (retval)
+        {
+            return retval;
+        }
+        if ((gz->zs.avail_out != 0) && (gz->zs.avail_in == 0))
+        {
+            // all the input consumed and nothing pending
+            break;
+        }
+    }
+    return retval;
+}
+
+/***********************************************************
+ * NAME: decryptWrite()
+ * DESCRIPTION: Decrypts the data the same way as
+ *              "openssl enc -d -blowfish -pass file:" and
+ *              passes it to the gzip stream.
+ *
+ * IN:  Pointer to decrypt stream
+ *      Pointer to data
+ *      Data length
+ *
+ * OUT: 0 on success, error code otherwise
+ ***********************************************************/
+static int decryptWrite(decryptStream_t *dec, const uint8_t *data, size_t len)
+{
+    int retval = SWUPDATE_SUCCESS;
+    int outLen;
+    size_t n;
+    uint8_t key[EVP_MAX_KEY_LENGTH];
+    uint8_t iv[EVP_MAX_IV_LENGTH];
+    const uint8_t *salt = NULL;
+
+    if (!dec->started)
+    {
+        // the salt header comes first, unless the package was encrypted with -nosalt
+        n = sizeof(dec->salt) - dec->saltLen;
+        n = (len < n) ? len : n;
+        memcpy(&dec->salt[dec->saltLen], data, n);
+        dec->saltLen += n;
+        data += n;
+        len -= n;
+        if (dec->saltLen < sizeof(dec->salt))
+        {
+            return SWUPDATE_SUCCESS;
+        }
+
+        if (memcmp(dec->salt, "Salted__", PKCS5_SALT_LEN) == 0)
+        {
+            salt = &dec->salt[PKCS5_SALT_LEN];
+        }
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+        // blowfish is only provided by the legacy provider
+        OSSL_PROVIDER_load(NULL, "legacy");
+        OSSL_PROVIDER_load(NULL, "default");
+#endif
+        // "openssl enc" derived the key with MD5 up to OpenSSL 1.0.x
+        dec->ctx = EVP_CIPHER_CTX_new();
+        if ((dec->ctx == NULL) ||
+            (EVP_BytesToKey(EVP_bf_cbc(), EVP_md5(), salt, dec->secret, dec->secretLen, 1, key, iv) <= 0) ||
+            (EVP_DecryptInit_ex(dec->ctx, EVP_bf_cbc(), NULL, key, iv) != 1))
+        {
+            logInfo("%s-%d: Cannot initialize the decryption",__func__, __LINE__);
+            OPENSSL_cleanse(key, sizeof(key));
+            return ERR_SWUPDATE_DECRYPTION;
+        }
+        OPENSSL_cleanse(key, sizeof(key));
+        dec->started = true;
+
+        if (salt == NULL)
+        {
+            retval = decryptWrite(dec, dec->salt, sizeof(dec->salt));
+            if (retval)
+            {
+                return retval;
+            }
+        }
+    }
+
+    while (len > 0)
+    {
+        n = (len < SWUPDATE_STREAM_BUFSZ) ? len : SWUPDATE_STREAM_BUFSZ;
+        if (EVP_DecryptUpdate(dec->ctx, dec->out, &outLen, data, n) != 1)
+        {
+            return ERR_SWUPDATE_DECRYPTION;
+        }
+        retval = gzWrite(dec->gz, dec->out, outLen);
+        if (retval)
+        {
+            return retval;
+        }
+        data += n;
+        len -= n;
+    }
     return retval;
 }
 
+/***********************************************************
+ * NAME: decryptEnd()
+ * DESCRIPTION: Ends the decryption, checks the padding and
+ *              that both archives are complete.
+ *
+ * IN:  Pointer to stream
+ *
+ * OUT: 0 on success, error code otherwise
+ ***********************************************************/
+static int decryptEnd(swStream_t *s)
+{
+    int retval;
+    int outLen;
+
+    if (!s->decrypt.started || (EVP_DecryptFinal_ex(s->decrypt.ctx, s->decrypt.out, &outLen) != 1))
+    {
+        logInfo("%s-%d: Failed to DECRYPT package file",__func__, __LINE__);
+        return ERR_SWUPDATE_DECRYPTION;
+    }
+    retval = gzWrite(&s->outerGz, s->decrypt.out, outLen);
+    if (retval)
+    {
+        return retval;
+    }
+
+    if (!s->outerGz.done || !s->innerGz.done || (s->outerTar.remaining != 0) || (s->innerTar.remaining != 0))
+    {
+        logInfo("%s-%d: Package truncated",__func__, __LINE__);
+        return ERR_SWUPDATE_EXTRACTION;
+    }
+    return SWUPDATE_SUCCESS;
+}
+
+/***********************************************************
+ * NAME: streamFree()
+ * DESCRIPTION: Releases the stream, the secret key is wiped.
+ *
+ * IN:  Pointer to stream
+ *
+ * OUT: Nothing.
+ ***********************************************************/
+static void streamFree(swStream_t *s)
+{
+    if (s->decrypt.ctx)
+    {
+        EVP_CIPHER_CTX_free(s->decrypt.ctx);
+    }
+    OPENSSL_cleanse(s->decrypt.secret, sizeof(s->decrypt.secret));
+    if (s->outerGz.init)
+    {
+        inflateEnd(&s->outerGz.zs);
+    }
+    if (s->innerGz.init)
+    {
+        inflateEnd(&s->innerGz.zs);
+    }
+    if (s->outerTar.fd >= 0)
+    {
+        close(s->outerTar.fd);
+    }
+    if (s->innerTar.fd >= 0)
+    {
+        close(s->innerTar.fd);
+    }
+    free(s);
+}
+
 /***********************************************************
  * NAME: shouldUpdate()
  * DESCRIPTION: Test the current versions.xml and upgrade
@@ -760,174 +1399,172 @@ Exit1:
 
 
 /***********************************************************
- * NAME: performUpdate()
+ * NAME: performPackageUpdate()
  * DESCRIPTION: Test the current versions.xml and upgrade
  *              package versions.xml release verseion numbers
  *              If the same then no upgrade required.
  *              Otherwise return true (upgrade required).
  *
+ *              The package is checked, decrypted and the
+ *              needed files extracted in a single pass, see
+ *              swStream_t.
+ *
  * IN:  Pointer to upgrade package file pathname.
  *
  * OUT: 0 for success or error code on failure.
  ***********************************************************/
-int performUpdate(char *upgradePackageName)
+static int performPackageUpdate(char *upgradePackageName)
 {
-    uint32_t ret = 0;
+    int ret = SWUPDATE_SUCCESS;
+    int fd;
+    int i;
+    ssize_t n;
+    off_t left;
     struct stat info;
-    FILE *fp = NULL;
-    uint8_t *buffer = NULL;
-    ulong *pCRC;
+    ulong storedCRC;
     ulong calculatedCRC;
-    char *pEncFilename = NULL;
-    char sysCmd[512];
+    swStream_t *s;
     char szUpgradeVersionName[512];
     char szCurrentVersionName[512];
     char szReleaseVersion[10] = {0};
     char decryptedPackagePath[SWUPDATE_MAX_PATH] = UPDATE_TEMP_DIR;
     char decryptedPackageFile[SWUPDATE_MAX_PATH];
-
-    char extractedFilesDir[SWUPDATE_MAX_PATH] = UPDATE_TEMP_DIR;
+    char extractedFile[SWUPDATE_MAX_PATH + MAX_FILENAME_SIZE];
+    char slotDir[SWUPDATE_MAX_PATH] = {0};
+    const char *extractDir = TMPFILESDIR;
+    bool slotMode = abSlotEnabled();
+
+    // The package wraps kioskupgrade.tgz, only the files needed to start the upgrade are extracted from it
+    static const char * const packageEntries[] = { UPGRADE_PKG_BASENAME".tgz", NULL };
+    static const char * const upgradeEntries[] = { "usr/scu/default/versions.xml",
+                                                   "usr/scu/bin/dobackup",
+                                                   "usr/scu/bin/upgrade",
+                                                   NULL };
+    // With A/B slots the whole release is extracted to the inactive slot, kioskupgrade.tgz is not kept
+    static const char * const noEntries[] = { NULL };
 
 #ifdef DEBUG
     printf("%s: found %s...validating...\n", __func__, upgradePackageName);
 #endif /* DEBUG */
 
-    // Read the package file with CRC attached.
-    fp = fopen(upgradePackageName, "rb");
-    if (fp)
+    fd = open(upgradePackageName, O_RDONLY);
+    if (fd < 0)
     {
-        ret = stat(upgradePackageName, &info);
-        buffer = (uint8_t*)calloc(1, info.st_size);
-        ret = fread(buffer, 1, info.st_size, fp);
-        if (ret != info.st_size)
-        {
-            free(buffer);
-            fclose(fp);
-            return ERR_PKG_FILE_READ;
-        }
-        else
-        {
-            pCRC = (ulong *)(buffer + (info.st_size - sizeof(ulong)));
-            ret = info.st_size;
-            fclose(fp);
-        }
+        return ERR_PKG_FILE_NOT_FOUND;
     }
-    else
+    if ((fstat(fd, &info) < 0) || (info.st_size <= (off_t)sizeof(ulong)))
     {
-        return ERR_PKG_FILE_NOT_FOUND;
+        close(fd);
+        return ERR_PKG_FILE_READ;
     }
 
-    // Compute the CRC on the file proper, excluding the CRC at end.
-    calculatedCRC = crc32(0L, Z_NULL, 0);
-    calculatedCRC = crc32(calculatedCRC, buffer, info.st_size - sizeof(ulong));
-    // If different then error
-    if (*pCRC != calculatedCRC)
+    s = (swStream_t *)calloc(1, sizeof(swStream_t));
+    if (s == NULL)
     {
-        // CRC error corrupted file.
-        return ERR_PKG_FILE_CRC;
+        close(fd);
+        return ERR_SWUPDATE_OUT_OF_MEMORY;
     }
-
-#ifdef DEBUG
-    printf("%s: package %s valid...stripping CRC...\n", __func__, upgradePackageName);
-#endif /* DEBUG */
-
-    pEncFilename = calloc(1, strlen(upgradePackageName) + 1);
-    if (pEncFilename)
+    if (slotMode)
     {
-        char *pWork;
-        strcpy(pEncFilename, upgradePackageName);
-        pWork = strchr(pEncFilename , '.');
-        if (pWork)
+        ret = abSlotPrepare(slotDir, sizeof(slotDir));
+        if (ret)
         {
-            sprintf(pWork, ".enc");
+            free(s);
+            close(fd);
+            return ret;
         }
+        extractDir = slotDir;
+    }
+    s->decrypt.gz = &s->outerGz;
+    s->outerGz.tar = &s->outerTar;
+    s->outerTar.fd = -1;
+    s->outerTar.destDir = decryptedPackagePath;
+    s->outerTar.only = packageEntries;
+    s->outerTar.nestedName = packageEntries[0];
+    s->outerTar.nested = &s->innerGz;
+    s->innerGz.tar = &s->innerTar;
+    s->innerTar.fd = -1;
+    s->innerTar.destDir = extractDir;
+    s->innerTar.only = upgradeEntries;
+    if (slotMode)
+    {
+        s->outerTar.only = noEntries;
+        s->innerTar.only = NULL;
     }
 
-    // Write the .enc encrypted file without CRC
-    fp = fopen( pEncFilename, "wb");
-    if (fp)
+    s->decrypt.secretLen = sizeof(s->decrypt.secret);
+    ret = decryptSecretKey(s->decrypt.secret, &s->decrypt.secretLen);
+
+    // Compute the CRC on the file proper, excluding the CRC at end, while it is decrypted and extracted.
+    calculatedCRC = crc32(0L, Z_NULL, 0);
+    left = info.st_size - sizeof(ulong);
+    while (left > 0)
     {
-        // Write the bytes up to the CRC to a .enc file
-        ret = fwrite(buffer, 1, info.st_size - sizeof(ulong), fp);
-        if (ret != (info.st_size - sizeof(ulong)))
+        n = read(fd, s->in, (left < SWUPDATE_STREAM_BUFSZ) ? left : SWUPDATE_STREAM_BUFSZ);
+        if (n <= 0)
         {
-            // Error writing file.
-            fclose(fp);
-            free(buffer);
-            /* remove the stripped encrypted file if present */
-            unlink(pEncFilename);
-            free(pEncFilename);
-            return ERR_PKG_ENC_FILE_READ;
+            ret = ERR_PKG_FILE_READ;
+            break;
         }
-
-        fclose(fp);
-        // Need to sync to make sure that data is written to disk
-        ret = system("sync");
-        if (ret)
+        calculatedCRC = crc32(calculatedCRC, s->in, n);
+        if (ret == SWUPDATE_SUCCESS)
         {
-            printf("sync system call returned %d\n", ret);
-            // Log and handle error.
+            // after a failure only the CRC is computed, it tells if the package is corrupted
+            ret = decryptWrite(&s->decrypt, s->in, n);
         }
+        left -= n;
     }
-    else
+    if (left == 0)
     {
-        return ERR_PKG_ENC_FILE_OPEN;
+        if (read(fd, &storedCRC, sizeof(ulong)) != sizeof(ulong))
+        {
+            ret = ERR_PKG_FILE_READ;
+        }
+        else if (storedCRC != calculatedCRC)
+        {
+            // CRC error corrupted file.
+            ret = ERR_PKG_FILE_CRC;
+        }
+        else if (ret == SWUPDATE_SUCCESS)
+        {
+            ret = decryptEnd(s);
+        }
     }
+    close(fd);
+    streamFree(s);
 
-#ifdef DEBUG
-    printf("%s: package %s stripped...decrypting...\n", __func__, upgradePackageName);
-#endif /* DEBUG */
-
-    // Decrypt the .enc file to .tgz
-    strcat(extractedFilesDir, "/");
-    ret = decryptPackage(pEncFilename, decryptedPackagePath);
-
-    if (ret)
+    sprintf(decryptedPackageFile, "%s/%s.tgz", decryptedPackagePath, UPGRADE_PKG_BASENAME);
+    for (i = 0; (ret == SWUPDATE_SUCCESS) && upgradeEntries[i]; i++)
     {
-        // decryption operation failed.
-        printSwErrorMsg(ERR_SWUPDATE_DECRYPTION, __func__, __LINE__);
-        /* remove the stripped encrypted file */
-        unlink(pEncFilename);
-        if (buffer)
+        sprintf(extractedFile, "%s/%s", extractDir, upgradeEntries[i]);
+        if (stat(extractedFile, &info) < 0)
         {
-            free(buffer);
+            logInfo("%s-%d: %s missing from the package",__func__, __LINE__, upgradeEntries[i]);
+            ret = ERR_SWUPDATE_EXTRACTION;
         }
-
-        if (pEncFilename)
+    }
+    if (ret)
+    {
+        // remove what was extracted from a package that cannot be used
+        logInfo("%s-%d: Package %s rejected: %d",__func__, __LINE__, upgradePackageName, ret);
+        unlink(decryptedPackageFile);
+        for (i = 0; !slotMode && upgradeEntries[i]; i++)
         {
-            free(pEncFilename);
+            sprintf(extractedFile, "%s/%s", TMPFILESDIR, upgradeEntries[i]);
+            unlink(extractedFile);
         }
-        return ERR_SWUPDATE_DECRYPTION;
+        // an incomplete slot is emptied by the next upgrade
+        return ret;
     }
 
-    /* We've sucessfully decrypted...remove the stripped encrypted file */
-    unlink(pEncFilename);
-    sprintf(sysCmd, "%s", "sync");
-    ret = system(sysCmd); // Try to commit the change to the USB drive
-
 #ifdef DEBUG
     printf("%s: package %s decrypted...determining upgrade viability...\n", __func__, upgradePackageName);
 #endif /* DEBUG */
 
-    sprintf(decryptedPackageFile, "%s/%s.tgz", decryptedPackagePath, UPGRADE_PKG_BASENAME);
-
-    // Extract the upgrade package versions.xml file
-    sprintf(sysCmd, "tar -xz -f %s -C %s usr/scu/default/versions.xml",
-            decryptedPackageFile,
-            TMPFILESDIR);
-
-    ret = system(sysCmd);
-    if (ret)
-    {
-        // Log error, clean up
-        printSwErrorMsg(ERR_SWUPDATE_EXTRACTION, __func__, __LINE__);
-        return ERR_SWUPDATE_EXTRACTION ;
-    }
-
     // Upgrade versions.xml file is at /tmp/usr/scu/default/versions.xml
 
     // Compare the vers
-    sprintf(szUpgradeVersionName, "%s/usr/scu/default/%s", TMPFILESDIR, "versions.xml");
+    sprintf(szUpgradeVersionName, "%s/usr/scu/default/%s", extractDir, "versions.xml");
     sprintf(szCurrentVersionName, "%s", "/usr/scu/default/versions.xml");
 
     ret = shouldUpdate(szCurrentVersionName,
@@ -942,28 +1579,14 @@ int performUpdate(char *upgradePackageName)
     printf("%s: package %s needed...upgrading...\n", __func__, upgradePackageName);
 #endif /* DEBUG */
 
-        // extract the dobackup file to our temp directory.
-        sprintf(sysCmd, "tar -xz -f %s -C %s usr/scu/bin/dobackup", decryptedPackageFile,
-                TMPFILESDIR);
-        ret = system(sysCmd);
-        if (ret)
-        {
-            // Log error, clean up
-            printSwErrorMsg(ERR_SWUPDATE_EXTRACTION, __func__, __LINE__);
-            return ERR_SWUPDATE_EXTRACTION ;
-        }
-
-        // extract the upgrade file to our temp directory.
-        sprintf(sysCmd, "tar -xz -f %s -C %s usr/scu/bin/upgrade", decryptedPackageFile,
-                TMPFILESDIR);
-        ret = system(sysCmd);
-        if (ret)
+        if (slotMode)
         {
-            // Log error, clean up
-            printSwErrorMsg(ERR_SWUPDATE_EXTRACTION, __func__, __LINE__);
-            return ERR_SWUPDATE_EXTRACTION;
+            // The release was extracted and verified while the station was running,
+            // only the switch and the restart are left.
+            return abSlotActivate(slotDir);
         }
 
+        // dobackup and upgrade were extracted to our temp directory with versions.xml
         sprintf(szVupdate, "%susr/scu/bin/upgrade", TMPFILESDIR);
 
         // Versions are Do the following:
@@ -983,6 +1606,7 @@ int performUpdate(char *upgradePackageName)
         prog1_argv[2] = NULL;
 
         /* Fork our vupdate script processing, which will shut us down */
+        abSlotRecordActivation();
         pid = fork();
         switch (pid)
         {
@@ -1004,28 +1628,31 @@ int performUpdate(char *upgradePackageName)
     {
         // Log the fact that the versions are the same, no update will be done.
         // Return ERR_VERSION_IS_CURRENT
-        if (buffer)
-        {
-            free(buffer);
-        }
-
-        if (pEncFilename)
-        {
-            free(pEncFilename);
-        }
         return ERR_VERSION_IS_CURRENT;
     }
 
-    if (buffer)
-    {
-        free(buffer);
-    }
-
-    if (pEncFilename)
-    {
-        free(pEncFilename);
-    }
-
     return 0;
 }
 
+/***********************************************************
+ * NAME: performUpdate()
+ * DESCRIPTION: Upgrades from the package, one upgrade at a
+ *              time: the USB drive upgrades are run by the
+ *              staging worker and the OTA upgrades by the
+ *              main loop, they extract to the same files.
+ *
+ * IN:  Pointer to upgrade package file pathname.
+ *
+ * OUT: 0 for success or error code on failure.
+ ***********************************************************/
+int performUpdate(char *upgradePackageName)
+{
+    static pthread_mutex_t mutexUpdate = PTHREAD_MUTEX_INITIALIZER;
+    int ret;
+
+    pthread_mutex_lock(&mutexUpdate);
+    ret = performPackageUpdate(upgradePackageName);
+    pthread_mutex_unlock(&mutexUpdate);
+
+    return ret;
+}
@@ -51,7 +51,9 @@
 
 #define UPGRADE_PKG_BASENAME "kioskupgrade"
 
+#ifndef KEYDIR
 #define KEYDIR "/usr/scu/keys"
+#endif
 #define TEMPKEYDIR "/tmp/usr/scu/keys"
 #define UPDATE_TEMP_DIR "/tmp"
 // Where to extract the upgrade archive for interim processing.
@@ -84,6 +86,8 @@
 #define SWUPDATE_MAX_CMD    256
 #define SWUPDATE_WRK_BUFSZ  64
 #define SWUPDATE_TMP_ERRSZ  256
+#define SWUPDATE_STREAM_BUFSZ   (64*1024)   // read, decrypt and gunzip buffers, whatever the package size
+#define SWUPDATE_KEY_MAX        1024        // encrypted secret key, up to an 8192 bit RSA key
 
 #define SWUPDATE_VER_LT -1
 #define SWUPDATE_VER_GT 1
@@ -99,6 +103,7 @@
 char *getSoftwareUpdateErrorMsg(SwUpdateError_t swError);
 int printSwErrorMsg(SwUpdateError_t swError, const char *funcName, int lineNum);
 int getCurrentSoftwareVersion(char *currentSWVersion);
+int getFreeDiskSpace(char *pathToFile, unsigned long *swDiskFree);
 int performUpdate(char *upgradePackageName);
 
 #endif
@@ -40,6 +40,7 @@
 #include <stdint.h>
 #include <signal.h>
 #include <unistd.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -67,6 +68,8 @@
 #include "socketlist.h"
 #include "upgradedatadefs.h"
 #include "swupdate.h"
+#include "usbstage.h"
+#include "abslot.h"
 
 #ifndef SUCCESS
     #define SUCCESS 0
@@ -81,6 +84,9 @@
 /* Allow a maximum of 2 connection at a time to the TCP/IP socket. */
 #define MAXPENDING_CONNECTIONS 2
 
+/* Async connections notified at once, a notification is sent on copies of their handles */
+#define ASYNC_NOTIFY_MAX 16
+
 /* Socket handles */
 int uevent_fd = -1;
 
@@ -93,6 +99,9 @@ unsigned int ClientCmdLen;
 struct sockaddr_in ClientCmdAddress;
 struct socketlist socketConnectionList;
 
+/* Protects the socket list, the USB staging worker sends notifications on the Async sockets */
+static pthread_mutex_t mutexSocketList = PTHREAD_MUTEX_INITIALIZER;
+
 char szDiskName[256] = {0};
 bool bDiskDeviceAttached = false;
 bool bDiskDeviceMounted = false;
@@ -149,6 +158,7 @@ void CleanupOpenHandles(void)
         ServerSocket = -1;
     }
 
+    pthread_mutex_lock(&mutexSocketList);
     TAILQ_FOREACH(pSocketEntry, &socketConnectionList.head, next_entry)
     {
         closeSocketListHandle(pSocketEntry->socketHandle);
@@ -158,6 +168,7 @@ void CleanupOpenHandles(void)
     {
         del_socketlist_entry( &socketConnectionList, pSocketEntry );
     }
+    pthread_mutex_unlock(&mutexSocketList);
 }
 
 /*********************************************************
@@ -312,6 +323,69 @@ int sendTCPBuffer( int socketHandle, void *buffer, int bufferSize )
 
     return SUCCESS;
 }
+/*********************************************************
+*   NAME: sendAsyncUpgradeManagerResult
+*   DESCRIPTION: Sends the passed in buffer to all the
+*                Async connections.
+*
+*   IN: buffer - pointer to buffer to send.
+*       bufferSize - size of the buffer.
+*   OUT:    SUCCESS (0) or error code if it could not be
+*           sent to one of the connections.
+*
+*   The handles are duplicated under the list lock and the
+*   notification sent without it, a client that does not read
+*   its socket cannot hold up the main loop.
+*
+**********************************************************/
+int sendAsyncUpgradeManagerResult( void *buffer, int bufferSize )
+{
+    int nRetVal = SUCCESS;
+    int i, count = 0;
+    int handle[ASYNC_NOTIFY_MAX];
+    int copy[ASYNC_NOTIFY_MAX];
+    struct socketEntry *pSocketEntry;
+
+    pthread_mutex_lock(&mutexSocketList);
+    TAILQ_FOREACH(pSocketEntry, &socketConnectionList.head, next_entry)
+    {
+        if (((swu_connection_type_t)pSocketEntry->connType == swu_Async) && (pSocketEntry->socketHandle >= 0) &&
+            (count < ASYNC_NOTIFY_MAX))
+        {
+            copy[count] = dup(pSocketEntry->socketHandle);
+            if (copy[count] >= 0)
+            {
+                handle[count] = pSocketEntry->socketHandle;
+                count++;
+            }
+        }
+    }
+    pthread_mutex_unlock(&mutexSocketList);
+
+    for (i = 0; i < count; i++)
+    {
+        // sendTCPBuffer() closes the copy when it fails
+        if (sendTCPBuffer(copy[i], buffer, bufferSize) == SUCCESS)
+        {
+            close(copy[i]);
+            continue;
+        }
+
+        // the client went away, its entry is released unless the main loop did it meanwhile
+        nRetVal = -1;
+        pthread_mutex_lock(&mutexSocketList);
+        pSocketEntry = find_socketlist_entry_by_handle(&socketConnectionList, handle[i]);
+        if (pSocketEntry && ((swu_connection_type_t)pSocketEntry->connType == swu_Async))
+        {
+            close(pSocketEntry->socketHandle);
+            pSocketEntry->socketHandle = -1;
+        }
+        pthread_mutex_unlock(&mutexSocketList);
+    }
+
+    return nRetVal;
+}
+
 /*********************************************************
 *   NAME: recvTCPBuffer
 *   DESCRIPTION: Receives the command request from the Kiosk
@@ -448,6 +522,28 @@ int recvUpgradeManagerCommand(int cmdSocketHandle)
             }
             break;
 
+        case UPGRADE_MANAGER_STATION_UP:
+        {
+            swu_upgradeMgrResult_t swuResult;
+
+            // svsd finished its init, the station is up again after an upgrade
+            abSlotStationUp();
+
+            swuResult.protocolVersion = UPGRADE_PROTOCOL_VERSION;
+            swuResult.command = pUpgradeOTACmd->swu_command.command;
+            swuResult.error = false;
+            swuResult.status = SUCCESS;
+
+            nRetVal = sendTCPBuffer( cmdSocketHandle, &swuResult, sizeof(swu_upgradeMgrResult_t) );
+            if (nRetVal)
+            {
+#ifdef DEBUG
+                printf("[%s] Problem sending result\n", __func__);
+#endif
+            }
+            break;
+        }
+
         case UPGRADE_MANAGER_EXIT:
             // Clean up if needed, sets shutdown flag.
             CleanupOpenHandles();
@@ -501,6 +597,13 @@ int main( int argc, char** argv )
     }
 
 
+    /* Health check of a release activated by an A/B slot upgrade */
+    nRetVal = abSlotInit();
+    if (nRetVal)
+    {
+        printf("Error: A/B slot health check failed to start\n");
+    }
+
     uevent_fd = init_netlink_uevent_socket();
     if(uevent_fd < 0)
     {
@@ -521,6 +624,16 @@ int main( int argc, char** argv )
 
     /* Init the Socket Connection list */
     init_socketlist(&socketConnectionList);
+
+    /* USB drives are processed by a worker, the main loop only passes it the notifications */
+    if (uevent_fd >= 0)
+    {
+        nRetVal = usbStageInit();
+        if (nRetVal)
+        {
+            printf("Error: USB staging worker failed to start\n");
+        }
+    }
     while (1)
     {
         fd_set read_fds;
@@ -579,6 +692,7 @@ int main( int argc, char** argv )
                     uevent_fd = -1;
                 }
 
+                pthread_mutex_lock(&mutexSocketList);
                 TAILQ_FOREACH(pSocketEntry, &pSocketList->head, next_entry)
                 {
                     if(pSocketEntry->connType == swu_Command)
@@ -598,6 +712,7 @@ int main( int argc, char** argv )
                         }
                     }
                 }
+                pthread_mutex_unlock(&mutexSocketList);
 
             } /* End error EBADF */
 
@@ -613,7 +728,7 @@ int main( int argc, char** argv )
         if(FD_ISSET(uevent_fd, &read_fds))
         {
             // Process the notification to see if we have a USB drive attach
-            // Mounting, and processing will be completed when we return
+            // Mounting and processing are done by the USB staging worker
             process_netlink_uevent_message(uevent_fd);
         }
 
@@ -633,7 +748,9 @@ int main( int argc, char** argv )
                 swu_upgradeMgrCmd_t swuCommand;
                 int byteCount;
 
+                pthread_mutex_lock(&mutexSocketList);
                 pSocketEntry = add_socketlist_entry(&socketConnectionList, lclSocketHandle);
+                pthread_mutex_unlock(&mutexSocketList);
                 if(pSocketEntry)
                 {
                     // Add the socket handle to socketlist entry.
@@ -651,7 +768,10 @@ int main( int argc, char** argv )
                         }
                         else
                         {
+                            pthread_mutex_lock(&mutexSocketList);
                             pSocketEntry->connType = swuCommand.connType;
+                            pthread_mutex_unlock(&mutexSocketList);
+
                             /*
                             * Added the ID value to the socketlist entry.
                             * Now we are set to process, we are done with the socket
@@ -673,11 +793,13 @@ int main( int argc, char** argv )
                 {
                     if (recvUpgradeManagerCommand(pSocketEntry->socketHandle) < 0)
                     {
+                        pthread_mutex_lock(&mutexSocketList);
                         if (pSocketEntry->socketHandle > 0)
                         {
                             close(pSocketEntry->socketHandle);
                             pSocketEntry->socketHandle = -1;
                         }
+                        pthread_mutex_unlock(&mutexSocketList);
                         continue;
                     }
                 }
@@ -46,6 +46,8 @@ extern char szDiskName[256];
 extern bool bDiskDeviceAttached;
 extern bool bDiskDeviceMounted;
 
+extern int sendAsyncUpgradeManagerResult(void *buffer, int bufferSize);
+
 
 
 #endif // __UPDATE_MANAGER_H__
@@ -0,0 +1,763 @@
+/*
+ * Copyright (C) 2011, 2012 MapleLeaf Software, Inc
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * usbstage.c
+ *
+ * Description: Processing of the USB drives attached to the kiosk, run by a
+ *              worker thread so that the netlink processing never waits on
+ *              mount or on the copy.  The upgrade package is copied to local
+ *              flash, its CRC is checked while it is copied, and the upgrade
+ *              is started from the copy.  The progress is reported to the
+ *              Async connections.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <zlib.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "netlink.h"
+#include "upgrademanager.h"
+#include "swupdate.h"
+#include "usbstage.h"
+
+// Copied to the USB drive when it holds no upgrade package.
+#define LOGFILES_PATHNAME "/usr/scu/logs"
+
+// Time for the partition to settle after it was added before mounting it.
+#define USB_STAGE_SETTLE_SECS 2
+
+// Attach and remove notifications waiting for the worker.
+#define USB_STAGE_EVENT_MAX 8
+
+// Number of progress notifications sent while the package is copied.
+#define USB_STAGE_PROGRESS_STEPS 20
+
+typedef enum
+{
+    usbStageAttach,
+    usbStageRemove
+} usbStageAction_t;
+
+typedef struct
+{
+    usbStageAction_t action;
+    char diskName[256];
+} usbStageEvent_t;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    usbStageEvent_t event[USB_STAGE_EVENT_MAX];
+    int head;
+    int count;
+    char stagingDisk[256];      // drive being processed by the worker
+    volatile bool cancel;       // that drive was removed
+} usbStage_t;
+
+/*
+ * Double buffering of the copy: the reader thread fills one buffer from the
+ * USB drive while the worker writes the other one to flash and computes its CRC.
+ */
+typedef struct
+{
+    uint8_t data[SWUPDATE_STREAM_BUFSZ];
+    ssize_t len;                // 0 at end of file, -1 on read error
+    bool full;
+} usbStageBuffer_t;
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int fd;
+    off_t left;                 // bytes the reader still has to read
+    bool stop;                  // the writer failed, the reader exits
+    usbStageBuffer_t buf[2];
+} usbStageCopy_t;
+
+static usbStage_t usbStage = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+/*********************************************************
+ * NAME: usbStagePublish
+ * DESCRIPTION: Sends a progress notification to the Async
+ *              connections.
+ *
+ * IN:  stage current step of the USB upgrade.
+ *      status SWUPDATE_IN_PROGRESS, or the result once
+ *             finished.
+ *      bytesDone, bytesTotal progress of the copy.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+static void usbStagePublish(swu_usb_stage_t stage, int status, off_t bytesDone, off_t bytesTotal)
+{
+    swu_upgradeUsbProgress_t progress;
+
+    memset(&progress, 0, sizeof(progress));
+    progress.swuResult.command = UPGRADE_MANAGER_USB_PROGRESS;
+    progress.swuResult.protocolVersion = UPGRADE_PROTOCOL_VERSION;
+    progress.swuResult.error = ((status != SWUPDATE_SUCCESS) && (status != SWUPDATE_IN_PROGRESS));
+    progress.swuResult.status = status;
+    progress.stage = stage;
+    progress.bytesDone = (unsigned int)bytesDone;
+    progress.bytesTotal = (unsigned int)bytesTotal;
+
+    sendAsyncUpgradeManagerResult(&progress, sizeof(progress));
+}
+
+/*********************************************************
+ * NAME: usbStageSystem
+ * DESCRIPTION: Runs a mount, umount or cp command on the
+ *              USB drive.
+ *
+ * IN:  szSystemCmd command to run.
+ * OUT: Exit status of the command.
+ *
+ **********************************************************/
+static int usbStageSystem(const char *szSystemCmd)
+{
+    int ret;
+
+#ifdef DEBUG
+    printf("%s: running %s\n", __func__, szSystemCmd);
+#endif
+    ret = system(szSystemCmd);
+
+    return WEXITSTATUS(ret);
+}
+
+/*********************************************************
+ * NAME: usbStageMount
+ * DESCRIPTION: Mounts the USB drive partition on the
+ *              upgrade mount point.
+ *
+ * IN:  pDiskName pointer to the partition device name.
+ * OUT: true if the partition is mounted, false if not.
+ *
+ **********************************************************/
+static bool usbStageMount(const char *pDiskName)
+{
+    char szSystemCmd[256];
+    int ret;
+
+    sprintf(szSystemCmd, "mount %s %s >/dev/null 2>&1", pDiskName, SWUPDATE_MOUNT_POINT);
+    ret = usbStageSystem(szSystemCmd);
+
+    // Expand test later, e.g. 32 is mount failed, but any non-zero
+    // means the mount didn't succeed so try unmounting and remount.
+    if (ret != 0)
+    {
+#ifdef DEBUG
+        printf("%s: mount error in USB upgrade: %d...retrying.\n", __func__, ret);
+#endif
+        sprintf(szSystemCmd, "umount %s >/dev/null 2>&1", pDiskName);
+        ret = usbStageSystem(szSystemCmd);
+        if (ret)
+        {
+#ifdef DEBUG
+            printf("%s: umount error in USB upgrade: %d\n", __func__, ret);
+#endif
+        }
+
+        // Now try to mount again, if still and error then
+        // log it and move on.
+        sprintf(szSystemCmd, "mount %s %s >/dev/null 2>&1", pDiskName, SWUPDATE_MOUNT_POINT);
+        ret = usbStageSystem(szSystemCmd);
+        if (ret)
+        {
+#ifdef DEBUG
+            printf("%s: mount error on retry of mount in USB upgrade: %d\n", __func__, ret);
+#endif
+        }
+    }
+
+    return isMountComplete((char *)pDiskName, SWUPDATE_MOUNT_POINT);
+}
+
+/*********************************************************
+ * NAME: usbStageUnmount
+ * DESCRIPTION: Unmounts the USB drive, commits the files
+ *              written to it.
+ *
+ * IN:  pDiskName pointer to the partition device name.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+static void usbStageUnmount(const char *pDiskName)
+{
+    char szSystemCmd[256];
+    int ret;
+
+    sprintf(szSystemCmd, "umount %s >/dev/null 2>&1", pDiskName);
+    ret = usbStageSystem(szSystemCmd);
+    if (ret)
+    {
+        // May be normal when the drive was removed.
+        printf("umount error on USB drive %s: %d\n", pDiskName, ret);
+    }
+
+    // Mark as unmounted.
+    bDiskDeviceMounted = false;
+}
+
+/*********************************************************
+ * NAME: usbStageReader
+ * DESCRIPTION: Thread function reading the package from
+ *              the USB drive in the two copy buffers in
+ *              turn.
+ *
+ * IN:  arg pointer to the copy.
+ * OUT: NULL.
+ *
+ **********************************************************/
+static void *usbStageReader(void *arg)
+{
+    usbStageCopy_t *copy = arg;
+    usbStageBuffer_t *pBuffer;
+    ssize_t n;
+    bool stop;
+    int i = 0;
+
+    do
+    {
+        pBuffer = &copy->buf[i];
+
+        pthread_mutex_lock(&copy->mutex);
+        while (pBuffer->full && !copy->stop)
+        {
+            pthread_cond_wait(&copy->cond, &copy->mutex);
+        }
+        stop = copy->stop;
+        pthread_mutex_unlock(&copy->mutex);
+        if (stop)
+        {
+            break;
+        }
+
+        n = 0;
+        if (copy->left > 0)
+        {
+            n = read(copy->fd, pBuffer->data,
+                     (copy->left < SWUPDATE_STREAM_BUFSZ) ? copy->left : SWUPDATE_STREAM_BUFSZ);
+            if ((n <= 0) || usbStage.cancel)
+            {
+                // truncated package, or the drive was removed
+                n = -1;
+            }
+            else
+            {
+                copy->left -= n;
+            }
+        }
+
+        pthread_mutex_lock(&copy->mutex);
+        pBuffer->len = n;
+        pBuffer->full = true;
+        pthread_cond_signal(&copy->cond);
+        pthread_mutex_unlock(&copy->mutex);
+
+        i ^= 1;
+    } while (n > 0);
+
+    return NULL;
+}
+
+/*********************************************************
+ * NAME: usbStageWrite
+ * DESCRIPTION: Writes a copy buffer to the staged package.
+ *
+ * IN:  fd staged package file descriptor.
+ *      data, len buffer to write.
+ * OUT: SWUPDATE_SUCCESS or ERR_SWUPDATE_NO_DISK_SPACE.
+ *
+ **********************************************************/
+static int usbStageWrite(int fd, const uint8_t *data, ssize_t len)
+{
+    ssize_t n;
+
+    while (len > 0)
+    {
+        n = write(fd, data, len);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            printf("[%s] Failed to write the staged package: %s\n", __func__, strerror(errno));
+            return ERR_SWUPDATE_NO_DISK_SPACE;
+        }
+        data += n;
+        len -= n;
+    }
+
+    return SWUPDATE_SUCCESS;
+}
+
+/*********************************************************
+ * NAME: usbStageCopyPackage
+ * DESCRIPTION: Copies the upgrade package to local flash
+ *              and checks its CRC while it is copied.  The
+ *              reader thread reads the USB drive while the
+ *              previous buffer is written.
+ *
+ * IN:  pSrcName pointer to the package on the USB drive.
+ *      pDstName pointer to the staged package pathname,
+ *               only created when the CRC is good.
+ * OUT: 0 for success or error code on failure.
+ *
+ **********************************************************/
+static int usbStageCopyPackage(const char *pSrcName, const char *pDstName)
+{
+    int ret = SWUPDATE_SUCCESS;
+    int outFd;
+    int i = 0;
+    int step = 0;
+    ssize_t j;
+    ssize_t crcLen;
+    off_t done = 0;
+    off_t payload;
+    ulong storedCRC = 0;
+    ulong calculatedCRC;
+    unsigned long diskFree = 0;
+    struct stat info;
+    usbStageCopy_t *copy;
+    usbStageBuffer_t *pBuffer;
+    pthread_t reader;
+    char szTempName[SWUPDATE_MAX_PATH];
+
+    copy = (usbStageCopy_t *)calloc(1, sizeof(usbStageCopy_t));
+    if (copy == NULL)
+    {
+        return ERR_SWUPDATE_OUT_OF_MEMORY;
+    }
+
+    copy->fd = open(pSrcName, O_RDONLY);
+    if (copy->fd < 0)
+    {
+        free(copy);
+        return ERR_PKG_FILE_NOT_FOUND;
+    }
+    if ((fstat(copy->fd, &info) < 0) || (info.st_size <= (off_t)sizeof(ulong)))
+    {
+        ret = ERR_PKG_FILE_READ;
+        goto Exit1;
+    }
+
+    mkdir(USB_STAGE_DIR, 0700);
+    ret = getFreeDiskSpace(USB_STAGE_DIR, &diskFree);
+    if (ret != SWUPDATE_SUCCESS)
+    {
+        goto Exit1;
+    }
+    if (diskFree < (unsigned long)info.st_size)
+    {
+        printf("[%s] %lu bytes free for a %ld bytes package\n", __func__, diskFree, (long)info.st_size);
+        ret = ERR_SWUPDATE_NO_DISK_SPACE;
+        goto Exit1;
+    }
+
+    sprintf(szTempName, "%s.tmp", pDstName);
+    outFd = open(szTempName, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (outFd < 0)
+    {
+        printf("[%s] Failed to create %s: %s\n", __func__, szTempName, strerror(errno));
+        ret = ERR_SWUPDATE_NO_DISK_SPACE;
+        goto Exit1;
+    }
+
+    posix_fadvise(copy->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    pthread_mutex_init(&copy->mutex, NULL);
+    pthread_cond_init(&copy->cond, NULL);
+    copy->left = info.st_size;
+    if (pthread_create(&reader, NULL, usbStageReader, copy) != 0)
+    {
+        ret = ERR_SWUPDATE_OUT_OF_MEMORY;
+        goto Error1;
+    }
+
+    // The CRC covers the package proper, the CRC is stored in the last bytes.
+    payload = info.st_size - sizeof(ulong);
+    calculatedCRC = crc32(0L, Z_NULL, 0);
+    for (;;)
+    {
+        pBuffer = &copy->buf[i];
+
+        pthread_mutex_lock(&copy->mutex);
+        while (!pBuffer->full)
+        {
+            pthread_cond_wait(&copy->cond, &copy->mutex);
+        }
+        pthread_mutex_unlock(&copy->mutex);
+
+        if (pBuffer->len <= 0)
+        {
+            if (pBuffer->len < 0)
+            {
+                ret = ERR_PKG_FILE_READ;
+            }
+            break;
+        }
+
+        crcLen = 0;
+        if (done < payload)
+        {
+            crcLen = ((payload - done) < pBuffer->len) ? (payload - done) : pBuffer->len;
+            calculatedCRC = crc32(calculatedCRC, pBuffer->data, crcLen);
+        }
+        for (j = crcLen; j < pBuffer->len; j++)
+        {
+            ((uint8_t *)&storedCRC)[done + j - payload] = pBuffer->data[j];
+        }
+        ret = usbStageWrite(outFd, pBuffer->data, pBuffer->len);
+        done += pBuffer->len;
+
+        pthread_mutex_lock(&copy->mutex);
+        pBuffer->full = false;
+        pthread_cond_signal(&copy->cond);
+        pthread_mutex_unlock(&copy->mutex);
+
+        if (ret != SWUPDATE_SUCCESS)
+        {
+            break;
+        }
+        i ^= 1;
+
+        if ((done * USB_STAGE_PROGRESS_STEPS) / info.st_size > step)
+        {
+            step = (done * USB_STAGE_PROGRESS_STEPS) / info.st_size;
+            usbStagePublish(swu_usbCopy, SWUPDATE_IN_PROGRESS, done, info.st_size);
+        }
+    }
+
+    pthread_mutex_lock(&copy->mutex);
+    copy->stop = true;
+    pthread_cond_signal(&copy->cond);
+    pthread_mutex_unlock(&copy->mutex);
+    pthread_join(reader, NULL);
+
+    if ((ret == SWUPDATE_SUCCESS) && (storedCRC != calculatedCRC))
+    {
+        // CRC error corrupted file.
+        ret = ERR_PKG_FILE_CRC;
+    }
+    if ((ret == SWUPDATE_SUCCESS) && (fsync(outFd) < 0))
+    {
+        ret = ERR_SWUPDATE_NO_DISK_SPACE;
+    }
+
+Error1:
+    close(outFd);
+    pthread_mutex_destroy(&copy->mutex);
+    pthread_cond_destroy(&copy->cond);
+    if ((ret == SWUPDATE_SUCCESS) && (rename(szTempName, pDstName) < 0))
+    {
+        ret = ERR_SWUPDATE_NO_DISK_SPACE;
+    }
+    if (ret != SWUPDATE_SUCCESS)
+    {
+        unlink(szTempName);
+    }
+
+Exit1:
+    close(copy->fd);
+    free(copy);
+
+    return ret;
+}
+
+/*********************************************************
+ * NAME: usbStageUpgrade
+ * DESCRIPTION: Stages the upgrade package of the USB
+ *              drive, unmounts the drive and starts the
+ *              upgrade from the staged copy.
+ *
+ * IN:  pDiskName pointer to the partition device name.
+ * OUT: 0 for success or error code on failure.
+ *
+ **********************************************************/
+static int usbStageUpgrade(const char *pDiskName)
+{
+    int ret;
+    char szUpgradePackageName[256];
+
+    sprintf(szUpgradePackageName, "%s%s", SWUPDATE_MOUNT_POINT, SWUPDATE_PACKAGE_FILENAME);
+
+#ifdef DEBUG
+    printf("%s: package found...staging %s\n", __func__, szUpgradePackageName);
+#endif
+    usbStagePublish(swu_usbCopy, SWUPDATE_IN_PROGRESS, 0, 0);
+    ret = usbStageCopyPackage(szUpgradePackageName, USB_STAGE_PACKAGE);
+
+    // The package is on local flash or rejected, the drive can be removed.
+    usbStageUnmount(pDiskName);
+    if (ret != SWUPDATE_SUCCESS)
+    {
+        printf("[%s] Package %s rejected: %d\n", __func__, szUpgradePackageName, ret);
+        return ret;
+    }
+    usbStagePublish(swu_usbVerify, SWUPDATE_IN_PROGRESS, 0, 0);
+
+    // Kick off the software update process, this will check versions, and
+    // do the upgrade if appropriate.
+    usbStagePublish(swu_usbInstall, SWUPDATE_IN_PROGRESS, 0, 0);
+    ret = performUpdate(USB_STAGE_PACKAGE);
+    unlink(USB_STAGE_PACKAGE);
+
+    return ret;
+}
+
+/*********************************************************
+ * NAME: usbStageProcessAttach
+ * DESCRIPTION: Mounts the USB drive partition, upgrades
+ *              from its upgrade package if it has one, or
+ *              copies the log files to it.
+ *
+ * IN:  pDiskName pointer to the partition device name.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+static void usbStageProcessAttach(const char *pDiskName)
+{
+    char szSystemCmd[256];
+    int ret;
+
+    strcpy(szDiskName, pDiskName);
+
+    sleep(USB_STAGE_SETTLE_SECS);
+    if (usbStage.cancel)
+    {
+        return;
+    }
+
+    usbStagePublish(swu_usbMount, SWUPDATE_IN_PROGRESS, 0, 0);
+    bDiskDeviceMounted = usbStageMount(szDiskName);
+
+#ifdef DEBUG
+    printf("%s: mount status %s\n", __func__, bDiskDeviceMounted ? "true":"false");
+#endif
+    if (!bDiskDeviceAttached && bDiskDeviceMounted)
+    {
+        // Check for the upgrade package file.
+        if (isSoftwareUpdatePackagePresent())
+        {
+            ret = usbStageUpgrade(szDiskName);
+            usbStagePublish(swu_usbDone, ret, 0, 0);
+        }
+        else
+        {
+            // Did not find an upgrade package.
+            // Copy log files from the system to the USB drive.
+            sprintf(szSystemCmd, "cp -r %s %s", LOGFILES_PATHNAME, SWUPDATE_MOUNT_POINT);
+            ret = usbStageSystem(szSystemCmd);
+            if (ret)
+            {
+                // Error copying log files
+                printf("cp error copying of log files: %d\n", ret);
+            }
+
+            // Unmount the USB drive, commit the files.
+            usbStageUnmount(szDiskName);
+        }
+    }
+
+    bDiskDeviceAttached = true;
+}
+
+/*********************************************************
+ * NAME: usbStageProcessRemove
+ * DESCRIPTION: Unmounts the USB drive partition if it is
+ *              the one that was attached.
+ *
+ * IN:  pDiskName pointer to the partition device name.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+static void usbStageProcessRemove(const char *pDiskName)
+{
+    if (bDiskDeviceAttached && (strcmp(pDiskName, szDiskName) == 0))
+    {
+#ifdef DEBUG
+        printf("%s: unmounting %s\n", __func__, szDiskName);
+#endif
+        usbStageUnmount(szDiskName);
+
+        // Mark as not attached.
+        bDiskDeviceAttached = false;
+    }
+}
+
+/*********************************************************
+ * NAME: usbStageThread
+ * DESCRIPTION: Worker thread processing the USB drive
+ *              notifications in the order they were
+ *              received.
+ *
+ * IN:  arg not used.
+ * OUT: NULL.
+ *
+ **********************************************************/
+static void *usbStageThread(void *arg)
+{
+    usbStageEvent_t event;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&usbStage.mutex);
+        while (usbStage.count == 0)
+        {
+            pthread_cond_wait(&usbStage.cond, &usbStage.mutex);
+        }
+        event = usbStage.event[usbStage.head];
+        usbStage.head = (usbStage.head + 1) % USB_STAGE_EVENT_MAX;
+        usbStage.count--;
+        if (event.action == usbStageAttach)
+        {
+            strcpy(usbStage.stagingDisk, event.diskName);
+            usbStage.cancel = false;
+        }
+        pthread_mutex_unlock(&usbStage.mutex);
+
+        if (event.action == usbStageAttach)
+        {
+            usbStageProcessAttach(event.diskName);
+
+            pthread_mutex_lock(&usbStage.mutex);
+            usbStage.stagingDisk[0] = '\0';
+            pthread_mutex_unlock(&usbStage.mutex);
+        }
+        else
+        {
+            usbStageProcessRemove(event.diskName);
+        }
+    }
+
+    return arg;
+}
+
+/*********************************************************
+ * NAME: usbStagePost
+ * DESCRIPTION: Queues a notification for the worker, never
+ *              waits on it.
+ *
+ * IN:  action attach or remove.
+ *      pDiskName pointer to the partition device name.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+static void usbStagePost(usbStageAction_t action, const char *pDiskName)
+{
+    usbStageEvent_t *pEvent;
+
+    pthread_mutex_lock(&usbStage.mutex);
+    if (usbStage.count == USB_STAGE_EVENT_MAX)
+    {
+        printf("[%s] USB notification for %s dropped, queue full\n", __func__, pDiskName);
+    }
+    else
+    {
+        pEvent = &usbStage.event[(usbStage.head + usbStage.count) % USB_STAGE_EVENT_MAX];
+        pEvent->action = action;
+        strncpy(pEvent->diskName, pDiskName, sizeof(pEvent->diskName) - 1);
+        pEvent->diskName[sizeof(pEvent->diskName) - 1] = '\0';
+        usbStage.count++;
+        pthread_cond_signal(&usbStage.cond);
+    }
+    pthread_mutex_unlock(&usbStage.mutex);
+}
+
+/*********************************************************
+ * NAME: usbStageAttached
+ * DESCRIPTION: Called by the netlink processing when a USB
+ *              drive partition was added.
+ *
+ * IN:  pDiskName pointer to the partition device name.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+void usbStageAttached(const char *pDiskName)
+{
+    usbStagePost(usbStageAttach, pDiskName);
+}
+
+/*********************************************************
+ * NAME: usbStageRemoved
+ * DESCRIPTION: Called by the netlink processing when a USB
+ *              drive partition was removed, aborts the copy
+ *              of its package.
+ *
+ * IN:  pDiskName pointer to the partition device name.
+ * OUT: Nothing.
+ *
+ **********************************************************/
+void usbStageRemoved(const char *pDiskName)
+{
+    pthread_mutex_lock(&usbStage.mutex);
+    if (strcmp(usbStage.stagingDisk, pDiskName) == 0)
+    {
+        usbStage.cancel = true;
+    }
+    pthread_mutex_unlock(&usbStage.mutex);
+
+    usbStagePost(usbStageRemove, pDiskName);
+}
+
+/*********************************************************
+ * NAME: usbStageInit
+ * DESCRIPTION: Starts the USB drive worker thread.
+ *
+ * IN:  Nothing.
+ * OUT: SUCCESS (0) or error.
+ *
+ **********************************************************/
+int usbStageInit(void)
+{
+    pthread_t thread;
+    pthread_attr_t attr;
+    int ret;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    ret = pthread_create(&thread, &attr, usbStageThread, NULL);
+    pthread_attr_destroy(&attr);
+
+    return ret;
+}
@@ -0,0 +1,47 @@
+/*
+ * Copyright (C) 2011, 2012 MapleLeaf Software, Inc
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * usbstage.h
+ *
+ * Description: Header file for the USB drive upgrade staging worker.
+ */
+
+#ifndef __USBSTAGE_H__
+#define __USBSTAGE_H__
+
+#include "swupdate.h"
+
+// The package is copied to local flash before it is decrypted, the USB drive can be removed once it is verified.
+#define USB_STAGE_DIR "/usr/scu/staging"
+#define USB_STAGE_PACKAGE USB_STAGE_DIR"/"UPGRADE_PKG_BASENAME".pkg"
+
+extern int usbStageInit(void);
+extern void usbStageAttached(const char *pDiskName);
+extern void usbStageRemoved(const char *pDiskName);
+
+#endif /* __USBSTAGE_H__ */